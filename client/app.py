@@ -1,63 +1,112 @@
 from flask import Flask, render_template
 import requests
-from plotter import plot_temperature  # Импортируем функцию для построения графиков
+import array
+import struct
+import sys
+import time
+from datetime import datetime
 
 app = Flask(__name__)
 
 # Адрес сервера
 SERVER_URL = "http://127.0.0.1:8080"
 
-def fetch_data(endpoint):
+# Размер графиков в пикселях. Графики строит сервер (/chart.png), прореживая данные
+# до ширины картинки, сколько бы их ни было в истории; браузер загружает их напрямую
+CHART_WIDTH = 1000
+CHART_HEIGHT = 600
+
+# Окно истории на страницах и графиках таблиц (по сроку хранения таблицы) и предел точек на датчик:
+# без from сервер отдал бы всю историю вместе с архивом, и страница росла бы с его возрастом,
+# а графики сырых значений каждый раз распаковывали бы весь архив мимо кэша горячих данных
+TABLE_WINDOW_SECONDS = {
+    "temperatures": 24 * 3600,
+    "avg_temp_hour": 30 * 24 * 3600,
+    "avg_temp_day": 365 * 24 * 3600,
+}
+TABLE_MAX_POINTS = 1000
+
+# Столбцовый двоичный формат ответа сервера (см. server/wire_format.hpp): метки, значения и датчики
+# читаются массивами целиком, без разбора JSON по строке
+COLUMNS_FORMAT = "application/vnd.temperature.columns"
+
+def decode_columns(body):
+    """Разбор ответа в столбцовом формате в {"data": [{"sensor_id", "timestamp", "value"}, ...]}."""
+    if body[:4] != b"TCOL" or body[4] != 2:
+        raise ValueError("Unexpected response format")
+    value_type = "f" if body[5] == 32 else "d"
+    timestamps = array.array("q")
+    values = array.array(value_type)
+    sensors = array.array("i")
+    pos = 8
+    while True:
+        count, extra = struct.unpack_from("<II", body, pos)
+        pos += 8
+        if count == 0:
+            break
+        timestamps.frombytes(body[pos:pos + 8 * count])
+        pos += 8 * count
+        values.frombytes(body[pos:pos + values.itemsize * count])
+        pos += (values.itemsize * count + 7) // 8 * 8
+        sensors.frombytes(body[pos:pos + 4 * count])
+        pos += (4 * count + 7) // 8 * 8
+    if sys.byteorder == "big":
+        timestamps.byteswap()
+        values.byteswap()
+        sensors.byteswap()
+    data = [{"sensor_id": sensor_id, "timestamp": datetime.fromtimestamp(ts / 1000).strftime("%Y-%m-%d %H:%M:%S"), "value": value}
+            for ts, value, sensor_id in zip(timestamps, values, sensors)]
+    return {"data": data}
+
+def fetch_data(endpoint, params=None):
     """Функция для получения данных с сервера."""
     try:
-        response = requests.get(f"{SERVER_URL}/{endpoint}")
+        response = requests.get(f"{SERVER_URL}/{endpoint}", params=params, headers={"Accept": COLUMNS_FORMAT})
         if response.status_code == 200:
-            data = response.json()
-            for entry in data["data"]:
-                entry["value"] = float(entry["value"])  # Преобразуем строку в число
-            return data  # Парсим JSON
+            return decode_columns(response.content)
         else:
             return None
     except requests.exceptions.RequestException as e:
         print(f"Error fetching data from server: {e}")
         return None
 
-@app.route('/')
-def index():
-    """Главная страница с данными из всех таблиц."""
-    # Получаем данные из всех таблиц
-    temperatures = fetch_data("temperatures")
-    avg_temp_hour = fetch_data("avg_temp_hour")
-    avg_temp_day = fetch_data("avg_temp_day")
+def window_start(table):
+    """Начало окна TABLE_WINDOW_SECONDS таблицы, мс от эпохи. Округляется вверх до минуты:
+    в течение минуты адрес графика не меняется и отдаётся из кэша ответов сервера, а начало
+    не выходит за окно кэша горячих данных."""
+    return -(-int(time.time() - TABLE_WINDOW_SECONDS[table]) // 60) * 60 * 1000
 
-    # Строим графики
-    temp_plot = plot_temperature(temperatures, "Raw Temperatures") if temperatures else None
-    avg_hour_plot = plot_temperature(avg_temp_hour, "Average Temperature per Hour") if avg_temp_hour else None
-    avg_day_plot = plot_temperature(avg_temp_day, "Average Temperature per Day") if avg_temp_day else None
+def fetch_recent(table):
+    """Последние строки таблицы за окно TABLE_WINDOW_SECONDS, прореженные до TABLE_MAX_POINTS."""
+    return fetch_data(table, {"from": window_start(table), "max_points": TABLE_MAX_POINTS})
 
+@app.route('/')
+def index():
+    """Главная страница с графиками всех таблиц."""
     return render_template(
         'index.html',
-        temp_plot=temp_plot,
-        avg_hour_plot=avg_hour_plot,
-        avg_day_plot=avg_day_plot
+        server_url=SERVER_URL,
+        chart_width=CHART_WIDTH,
+        chart_height=CHART_HEIGHT,
+        chart_from={table: window_start(table) for table in TABLE_WINDOW_SECONDS}
     )
 
 @app.route('/temperatures')
 def show_temperatures():
     """Страница с данными из таблицы temperatures."""
-    temperatures = fetch_data("temperatures")
+    temperatures = fetch_recent("temperatures")
     return render_template('temperatures.html', data=temperatures["data"] if temperatures else None)
 
 @app.route('/avg_temp_hour')
 def show_avg_temp_hour():
     """Страница с данными из таблицы avg_temp_hour."""
-    avg_temp_hour = fetch_data("avg_temp_hour")
+    avg_temp_hour = fetch_recent("avg_temp_hour")
     return render_template('avg_temp_hour.html', data=avg_temp_hour["data"] if avg_temp_hour else None)
 
 @app.route('/avg_temp_day')
 def show_avg_temp_day():
     """Страница с данными из таблицы avg_temp_day."""
-    avg_temp_day = fetch_data("avg_temp_day")
+    avg_temp_day = fetch_recent("avg_temp_day")
     return render_template('avg_temp_day.html', data=avg_temp_day["data"] if avg_temp_day else None)
 
 if __name__ == '__main__':
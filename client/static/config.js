@@ -1,2 +1,40 @@
-// Время перезагрузки страницы в миллисекундах
-const RELOAD_INTERVAL = 60000; 
\ No newline at end of file
+// Время перезагрузки страницы в миллисекундах (если браузер не поддерживает EventSource)
+const RELOAD_INTERVAL = 60000;
+
+// Поток новых данных сервера (Server-Sent Events)
+const STREAM_URL = "http://127.0.0.1:8080/stream";
+
+// Задержка перезагрузки после события: строки одной синхронизации приходят пачкой
+const RELOAD_DELAY = 1000;
+
+// Перезагрузка страницы при появлении новых строк в таблицах tables.
+// Скрытая вкладка перезагружается, когда её снова покажут
+function reloadOnEvents(tables) {
+    let pending = false;
+    function refreshPage() {
+        if (document.hidden) {
+            pending = true;
+        } else {
+            location.reload();
+        }
+    }
+    document.addEventListener("visibilitychange", function () {
+        if (pending && !document.hidden) {
+            location.reload();
+        }
+    });
+
+    if (!window.EventSource) {
+        setInterval(refreshPage, RELOAD_INTERVAL);
+        return;
+    }
+    let timer = null;
+    const source = new EventSource(STREAM_URL);
+    tables.forEach(function (table) {
+        source.addEventListener(table, function () {
+            if (timer === null) {
+                timer = setTimeout(refreshPage, RELOAD_DELAY);
+            }
+        });
+    });
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+
+#include "storage.hpp"
+
+// Статистика одного интервала: число, сумма, минимум, максимум,
+// среднее и сумма квадратов отклонений (алгоритм Уэлфорда - без потери точности на больших суммах)
+struct Bucket {
+    int64_t start = 0;      // Начало интервала, мс от эпохи
+    int64_t end = 0;        // Конец интервала (не включая)
+    int64_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void add(double value) {
+        count++;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        double delta = value - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (value - mean);
+    }
+
+    // Объединение с другой статистикой (формула Чана для дисперсии)
+    void merge(const Bucket& other) {
+        if (other.count == 0)
+            return;
+        if (count == 0) {
+            int64_t s = start, e = end;
+            *this = other;
+            start = s;
+            end = e;
+            return;
+        }
+        double n1 = static_cast<double>(count), n2 = static_cast<double>(other.count);
+        double delta = other.mean - mean;
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        mean += delta * n2 / (n1 + n2);
+        m2 += other.m2 + delta * delta * n1 * n2 / (n1 + n2);
+    }
+
+    double average() const { return count ? mean : 0.0; }
+    // Выборочное стандартное отклонение
+    double stddev() const { return count > 1 ? std::sqrt(m2 / static_cast<double>(count - 1)) : 0.0; }
+};
+
+// Длительность интервала агрегации
+enum AggregatePeriod {
+    PERIOD_HOUR,
+    PERIOD_DAY,
+    PERIOD_COUNT
+};
+
+// Границы часа и суток считаются по локальному времени
+inline struct tm localTime(int64_t millis) {
+    time_t t = static_cast<time_t>(millis / 1000);
+    struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    return tm;
+}
+
+// Начало интервала, содержащего момент ts. Начало суток - локальная полночь той же даты через mktime:
+// вычитание часов по циферблату в день перехода на летнее/зимнее время ошиблось бы на час.
+// Если полночи в этот день нет (переход в 00:00), mktime даёт первый момент суток
+inline int64_t periodStart(AggregatePeriod period, int64_t ts) {
+    struct tm tm = localTime(ts);
+    int64_t seconds = tm.tm_min * 60 + tm.tm_sec;
+    int64_t start = ts - seconds * 1000 - ts % 1000;
+    if (period == PERIOD_DAY) {
+        int64_t hours = tm.tm_hour;
+        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        time_t midnight = mktime(&tm);
+        start = midnight != static_cast<time_t>(-1) ? static_cast<int64_t>(midnight) * 1000 : start - hours * 3600000;
+    }
+    return start;
+}
+
+// Конец интервала, начинающегося в start. Сутки при переходе на летнее/зимнее время
+// длятся 23-25 часов, поэтому конец суток - начало суток, в которые попадает start + 36 часов
+inline int64_t periodEnd(AggregatePeriod period, int64_t start) {
+    if (period == PERIOD_HOUR)
+        return start + 60 * 60 * 1000LL;
+    return periodStart(PERIOD_DAY, start + 36 * 60 * 60 * 1000LL);
+}
+
+// Инкрементальные агрегаты за час и за сутки по каждому датчику.
+// Каждое измерение учитывается сразу при поступлении за O(1), без сканирования таблицы;
+// закрытый интервал передаётся в sink для записи в базу
+class RollingAggregator {
+public:
+    using Sink = std::function<void(AggregatePeriod period, int32_t sensor_id, const Bucket& bucket)>;
+
+    explicit RollingAggregator(Sink sink) : sink_(std::move(sink)) {}
+
+    // Учесть измерение. Измерение после конца текущего интервала закрывает его;
+    // запоздавшее измерение (до начала интервала) учитывается в текущем
+    void add(const Reading& reading) {
+        Bucket* buckets = sensors_[reading.sensor_id].buckets;
+        for (int p = 0; p < PERIOD_COUNT; ++p) {
+            Bucket& bucket = buckets[p];
+            if (reading.ts >= bucket.end) {
+                close(static_cast<AggregatePeriod>(p), reading.sensor_id, bucket);
+                open(static_cast<AggregatePeriod>(p), bucket, reading.ts);
+            }
+            bucket.add(reading.value);
+        }
+    }
+
+    // Закрыть интервалы, закончившиеся к моменту now, даже если новых измерений не было
+    void advance(int64_t now) {
+        for (auto& sensor : sensors_) {
+            for (int p = 0; p < PERIOD_COUNT; ++p) {
+                Bucket& bucket = sensor.second.buckets[p];
+                if (bucket.end != 0 && now >= bucket.end) {
+                    close(static_cast<AggregatePeriod>(p), sensor.first, bucket);
+                    open(static_cast<AggregatePeriod>(p), bucket, now);
+                }
+            }
+        }
+    }
+
+    // Добавить к текущему интервалу статистику, накопленную до перезапуска
+    void restore(AggregatePeriod period, int32_t sensor_id, int64_t now, const Bucket& saved) {
+        Bucket& bucket = sensors_[sensor_id].buckets[period];
+        if (bucket.end == 0)
+            open(period, bucket, now);
+        bucket.merge(saved);
+    }
+
+    // Текущий (открытый) интервал датчика; nullptr, если измерений не было
+    const Bucket* current(AggregatePeriod period, int32_t sensor_id) const {
+        auto it = sensors_.find(sensor_id);
+        return it == sensors_.end() ? nullptr : &it->second.buckets[period];
+    }
+
+private:
+    struct SensorBuckets {
+        Bucket buckets[PERIOD_COUNT];
+    };
+
+    void open(AggregatePeriod period, Bucket& bucket, int64_t ts) {
+        bucket = Bucket();
+        bucket.start = periodStart(period, ts);
+        bucket.end = periodEnd(period, bucket.start);
+    }
+
+    void close(AggregatePeriod period, int32_t sensor_id, const Bucket& bucket) {
+        if (bucket.count > 0)
+            sink_(period, sensor_id, bucket);
+    }
+
+    Sink sink_;
+    std::unordered_map<int32_t, SensorBuckets> sensors_;
+};
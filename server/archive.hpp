@@ -0,0 +1,260 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "crc32.hpp"
+#include "gorilla.hpp"
+#include "storage.hpp"
+#include "logger.hpp"
+
+// Архив сырых значений старше окна горячих данных.
+// Значения одного датчика за сутки (UTC) сжимаются в неизменяемый файл-чанк
+// ARCHIVE_DIR/<sensor_id>/<YYYY-MM-DD>.gor (см. gorilla.hpp). Индекс чанков -
+// таблица archive_chunks в базе: строки индекса всех датчиков за сутки добавляются одной
+// транзакцией, и с неё сутки заархивированы целиком: сырые строки с метками раньше
+// archivedUntil() не читаются, поэтому каждое измерение видно читателю либо в таблице, либо
+// в архиве. Сами строки удаляются из temperatures после этого, порциями
+#define ARCHIVE_DIR "archive"
+
+const int64_t ARCHIVE_DAY = 24 * 60 * 60 * 1000LL;
+
+// Начало суток UTC, в которые попадает метка
+inline int64_t archiveDay(int64_t ts) {
+    return (ts >= 0 ? ts : ts - ARCHIVE_DAY + 1) / ARCHIVE_DAY * ARCHIVE_DAY;
+}
+
+// Строка индекса: чанк датчика за сутки
+struct ArchiveChunk {
+    int64_t day = 0;        // Начало суток, мс от эпохи
+    int32_t sensor_id = 0;
+    int64_t count = 0;
+    int64_t min_ts = 0;
+    int64_t max_ts = 0;
+    double min = 0;
+    double max = 0;
+    int64_t bytes = 0;      // Размер файла
+};
+
+// Дата суток UTC "YYYY-MM-DD"
+inline std::string archiveDayName(int64_t day) {
+    time_t t = static_cast<time_t>(day / 1000);
+    struct tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char name[16];
+    strftime(name, sizeof(name), "%Y-%m-%d", &tm);
+    return name;
+}
+
+inline std::string chunkPath(const std::string& dir, int32_t sensor_id, int64_t day) {
+    return dir + "/" + std::to_string(sensor_id) + "/" + archiveDayName(day) + ".gor";
+}
+
+// Заголовок файла чанка; копия строки индекса, чтобы индекс можно было восстановить по файлам
+struct ChunkHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t sensor_id;
+    uint32_t checksum;      // crc32 сжатых данных
+    int64_t day;
+    int64_t count;
+    int64_t min_ts;
+    int64_t max_ts;
+    double min;
+    double max;
+    uint64_t payload;       // Байт сжатых данных после заголовка
+};
+
+const uint32_t CHUNK_MAGIC = 0x524F4754;    // "TGOR"
+const uint32_t CHUNK_VERSION = 1;
+
+// Запись чанка из строк одного датчика за одни сутки (по возрастанию времени).
+// Файл пишется рядом и переименовывается: читатель видит либо старый чанк, либо новый целиком
+template <class Rows>
+bool writeChunk(const std::string& dir, const Rows& rows, ArchiveChunk& chunk) {
+    std::string payload;
+    GorillaEncoder encoder(payload);
+    ChunkHeader header{CHUNK_MAGIC, CHUNK_VERSION, rows.front().sensor_id, 0, archiveDay(rows.front().ts),
+                       static_cast<int64_t>(rows.size()), rows.front().ts, rows.back().ts, rows.front().value,
+                       rows.front().value, 0};
+    for (const Reading& row : rows) {
+        encoder.add(row.ts, row.value);
+        header.min = std::min(header.min, row.value);
+        header.max = std::max(header.max, row.value);
+    }
+    header.checksum = crc32(payload.data(), payload.size());
+    header.payload = payload.size();
+
+    std::string path = chunkPath(dir, header.sensor_id, header.day);
+    std::string tmp = path + ".tmp";
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    FILE* file = std::fopen(tmp.c_str(), "wb");
+    bool ok = file && std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(payload.data(), 1, payload.size(), file) == payload.size() && std::fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    if (file)
+        std::fclose(file);
+    if (ok)
+        std::filesystem::rename(tmp, path, ec);
+    if (!ok || ec) {
+        LOG_ERROR("Failed to write archive chunk '" << path << "'");
+        std::remove(tmp.c_str());
+        return false;
+    }
+    chunk = ArchiveChunk{header.day, header.sensor_id, header.count, header.min_ts, header.max_ts,
+                         header.min, header.max, static_cast<int64_t>(sizeof(header) + payload.size())};
+    return true;
+}
+
+// Результат чтения чанка
+enum ChunkRead {
+    CHUNK_READ,             // Строки дописаны
+    CHUNK_MISSING,          // Файла нет: сутки датчика не заархивированы
+    CHUNK_FAILED            // Ошибка чтения или чанк повреждён; в rows может остаться часть строк
+};
+
+// Чтение чанка датчика за сутки; строки дописываются в rows
+template <class Rows>
+ChunkRead readChunk(const std::string& dir, int32_t sensor_id, int64_t day, Rows& rows) {
+    std::string path = chunkPath(dir, sensor_id, day);
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec) && !ec)
+            return CHUNK_MISSING;
+        LOG_ERROR("Failed to open archive chunk '" << path << "'");
+        return CHUNK_FAILED;
+    }
+    ChunkHeader header;
+    std::string payload;
+    bool ok = static_cast<bool>(file.read(reinterpret_cast<char*>(&header), sizeof(header))) &&
+              header.magic == CHUNK_MAGIC && header.version == CHUNK_VERSION && header.payload < (uint64_t(1) << 32);
+    if (ok) {
+        payload.resize(static_cast<std::size_t>(header.payload));
+        ok = static_cast<bool>(file.read(&payload[0], static_cast<std::streamsize>(payload.size()))) &&
+             crc32(payload.data(), payload.size()) == header.checksum &&
+             gorillaDecode(payload.data(), payload.size(), static_cast<std::size_t>(header.count), header.sensor_id, rows);
+    }
+    if (!ok) {
+        LOG_ERROR("Archive chunk '" << path << "' is unreadable or corrupted");
+        return CHUNK_FAILED;
+    }
+    return CHUNK_READ;
+}
+
+// Конец заархивированного периода (начало первых незаархивированных суток);
+// минимальное значение, если архив пуст
+inline int64_t archivedUntil(sqlite3* db) {
+    if (queryInt(db, "SELECT COUNT(*) FROM archive_chunks;") == 0)
+        return INT64_MIN;
+    return queryInt(db, "SELECT MAX(day) FROM archive_chunks;") + ARCHIVE_DAY;
+}
+
+// Чанки с данными в [from, to) (и датчика sensor_id, если он >= 0) по возрастанию суток и датчика
+inline bool listChunks(sqlite3* db, int64_t from, int64_t to, int64_t sensor_id, std::vector<ArchiveChunk>& chunks) {
+    std::string sql = "SELECT day, sensor_id, count, min_ts, max_ts, min, max, bytes FROM archive_chunks"
+                      " WHERE day > ?1 AND day < ?2 AND max_ts >= ?3 AND min_ts < ?2";
+    if (sensor_id >= 0)
+        sql += " AND sensor_id = ?4";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, (sql + " ORDER BY day, sensor_id;").c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: " << sqlite3_errmsg(db));
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, from == INT64_MIN ? from : from - ARCHIVE_DAY);
+    sqlite3_bind_int64(stmt, 2, to);
+    sqlite3_bind_int64(stmt, 3, from);
+    if (sensor_id >= 0)
+        sqlite3_bind_int64(stmt, 4, sensor_id);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        chunks.push_back(ArchiveChunk{sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int64(stmt, 2),
+                                      sqlite3_column_int64(stmt, 3), sqlite3_column_int64(stmt, 4), sqlite3_column_double(stmt, 5),
+                                      sqlite3_column_double(stmt, 6), sqlite3_column_int64(stmt, 7)});
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// Последовательное чтение архивных строк в [from, to) по возрастанию (ts, sensor_id).
+// В памяти одновременно только одни сутки: чанки всех датчиков за сутки распаковываются
+// и сливаются при переходе к ним. Если задан курсор, отдаются строки после него
+class ArchiveCursor {
+public:
+    ArchiveCursor(std::string dir, std::vector<ArchiveChunk> chunks, int64_t from, int64_t to)
+        : dir_(std::move(dir)), chunks_(std::move(chunks)), from_(from), to_(to) {}
+
+    void after(int64_t ts, int64_t sensor_id) {
+        has_cursor_ = true;
+        cursor_ts_ = ts;
+        cursor_sensor_ = sensor_id;
+    }
+
+    // Следующая строка; false - строки кончились
+    bool next(Reading& reading) {
+        while (pos_ == rows_.size()) {
+            if (next_chunk_ == chunks_.size())
+                return false;
+            loadDay();
+        }
+        reading = rows_[pos_++];
+        return true;
+    }
+
+private:
+    void loadDay() {
+        rows_.clear();
+        pos_ = 0;
+        int64_t day = chunks_[next_chunk_].day;
+        std::vector<Reading> decoded;
+        for (; next_chunk_ < chunks_.size() && chunks_[next_chunk_].day == day; ++next_chunk_) {
+            decoded.clear();
+            if (readChunk(dir_, chunks_[next_chunk_].sensor_id, day, decoded) != CHUNK_READ)
+                continue;
+            for (const Reading& row : decoded) {
+                if (row.ts < from_ || row.ts >= to_)
+                    continue;
+                if (has_cursor_ && (row.ts < cursor_ts_ || (row.ts == cursor_ts_ && row.sensor_id <= cursor_sensor_)))
+                    continue;
+                rows_.push_back(row);
+            }
+        }
+        std::sort(rows_.begin(), rows_.end(), [](const Reading& a, const Reading& b) {
+            return a.ts != b.ts ? a.ts < b.ts : a.sensor_id < b.sensor_id;
+        });
+    }
+
+    std::string dir_;
+    std::vector<ArchiveChunk> chunks_;
+    int64_t from_;
+    int64_t to_;
+    bool has_cursor_ = false;
+    int64_t cursor_ts_ = 0;
+    int64_t cursor_sensor_ = 0;
+    std::size_t next_chunk_ = 0;
+    std::vector<Reading> rows_;     // Строки текущих суток
+    std::size_t pos_ = 0;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/utsname.h>
+
+#include "json_writer.hpp"      // JsonWriter::appendString
+
+// Общая часть замеров производительности (bench_micro, bench_ingest).
+// Результат - набор именованных чисел с единицей и направлением ("lower" - меньше лучше,
+// "higher" - больше лучше), который пишется в JSON:
+//   {"suite":"micro","host":"...","compiler":"...","started":"2025-11-03T14:05:09Z",
+//    "results":[{"name":"json/row_epoch","value":12.3,"unit":"ns","better":"lower"},...]}
+// bench/compare.py сравнивает такой файл с сохранённым эталоном и отмечает ухудшения.
+// Замеры идут на одной машине без сети; числа сравнимы только между запусками на ней же
+
+// Значение считается используемым: компилятор не выбросит вычисление
+template <class T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+    std::string name;
+    double value;
+    std::string unit;
+    bool higher_is_better;
+};
+
+class BenchReport {
+public:
+    explicit BenchReport(std::string suite) : suite_(std::move(suite)) {
+        std::time_t now = std::time(nullptr);
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        started_ = buf;
+    }
+
+    // Результат сразу выводится строкой таблицы; note - пояснение только для вывода
+    void add(const std::string& name, double value, const std::string& unit, bool higher_is_better,
+             const std::string& note = std::string()) {
+        results_.push_back(BenchResult{name, value, unit, higher_is_better});
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-40s %14.3f %-6s", name.c_str(), value, unit.c_str());
+        std::cout << line << (note.empty() ? "" : "  ") << note << std::endl;
+    }
+
+    const std::vector<BenchResult>& results() const { return results_; }
+
+    bool write(const std::string& path) const {
+        std::string out = "{\"suite\":";
+        JsonWriter::appendString(out, suite_);
+        out += ",\"host\":";
+        JsonWriter::appendString(out, host());
+        out += ",\"compiler\":";
+        JsonWriter::appendString(out, compiler());
+        out += ",\"started\":";
+        JsonWriter::appendString(out, started_);
+        out += ",\"results\":[";
+        for (std::size_t i = 0; i < results_.size(); ++i) {
+            const BenchResult& result = results_[i];
+            out += i ? ",\n" : "\n";
+            out += "{\"name\":";
+            JsonWriter::appendString(out, result.name);
+            out += ",\"value\":";
+            JsonWriter::appendDouble(out, result.value);
+            out += ",\"unit\":";
+            JsonWriter::appendString(out, result.unit);
+            out += result.higher_is_better ? ",\"better\":\"higher\"}" : ",\"better\":\"lower\"}";
+        }
+        out += "\n]}\n";
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << out;
+        return static_cast<bool>(file);
+    }
+
+private:
+    static std::string host() {
+        struct utsname name;
+        if (uname(&name) != 0)
+            return "unknown";
+        return std::string(name.nodename) + " " + name.sysname + " " + name.release + " " + name.machine;
+    }
+
+    static std::string compiler() {
+#if defined(__clang__)
+        return "clang " __clang_version__;
+#elif defined(__GNUC__)
+        return "gcc " __VERSION__;
+#else
+        return "unknown";
+#endif
+    }
+
+    std::string suite_;
+    std::string started_;
+    std::vector<BenchResult> results_;
+};
+
+// Перцентиль p (0..1) по ближайшему рангу; values переупорядочивается
+inline double benchPercentile(std::vector<double>& values, double p) {
+    if (values.empty())
+        return 0;
+    std::size_t i = std::min(values.size() - 1, static_cast<std::size_t>(p * static_cast<double>(values.size())));
+    std::nth_element(values.begin(), values.begin() + i, values.end());
+    return values[i];
+}
+
+// Время одной операции, нс. body(n) выполняет n операций.
+// Число операций подбирается удвоением, пока прогон не займёт min_seconds; затем repeat прогонов,
+// результат - самый быстрый: помехи (планировщик, соседние процессы) только добавляют время
+template <class Body>
+double measureNs(Body&& body, double min_seconds, int repeat) {
+    using clock = std::chrono::steady_clock;
+    auto run = [&](uint64_t n) {
+        clock::time_point start = clock::now();
+        body(n);
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+    uint64_t n = 1;
+    for (double seconds = run(n); seconds < min_seconds; seconds = run(n)) {
+        // Сразу к нужному числу, если прогон уже измерим, иначе удвоение
+        double scale = seconds > min_seconds / 100 ? min_seconds / seconds * 1.2 : 2.0;
+        n = static_cast<uint64_t>(std::ceil(static_cast<double>(n) * std::min(scale, 100.0)));
+    }
+    double best = run(n);
+    for (int i = 1; i < repeat; ++i)
+        best = std::min(best, run(n));
+    return best * 1e9 / static_cast<double>(n);
+}
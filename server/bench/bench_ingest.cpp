@@ -0,0 +1,1066 @@
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aggregator.hpp"
+#include "bench.hpp"
+#include "db_writer.hpp"
+#include "storage.hpp"
+#include "waveform.hpp"
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = asio::ip::tcp;
+
+// Сквозной сценарий на одной машине: simulator пишет N датчиков с частотой R в свои pty,
+// temperature_monitor их читает и пишет в базу, server отдаёт данные K клиентам, которые
+// без пауз шлют запросы по keep-alive соединениям. Все процессы - собранные рядом бинарники,
+// в отдельном временном каталоге с базой, заранее заполненной историей за --history часов.
+// Измеряется:
+//  - приём: сколько измерений не дошло до сборщика (из итогов симулятора и счётчика
+//    ingest_readings_total в temperature_monitor.prom), отставание симулятора от расписания,
+//    загрузка процессора сборщиком;
+//  - чтение: запросов в секунду, задержка p50/p99 всего и по каждому запросу, ошибки,
+//    загрузка процессора сервером.
+// Задержка появления в базе здесь не меряется: сборщик пишет в базу раз в SYNC_PERIOD,
+// это дольше сценария (см. simulator --markers --lag-db).
+// --load N1,N2,...: после основного замера - нагрузка на сервер N одновременными keep-alive
+// соединениями (асинхронный клиент, запросы без пауз): запросов в секунду, p50/p99 и ошибки на каждом уровне.
+// --fanout N1,N2,...: N подписчиков /stream; в базу по одной пишутся FANOUT_EVENTS строк отдельного датчика,
+// задержка - от фиксации строки до получения события каждым подписчиком (включает ожидание обновления
+// кэша сервера, до секунды), разброс - от первого до последнего получившего одно событие (сама рассылка).
+// --scale N1,N2,...: отдельные сеансы simulator + temperature_monitor на N портах (по датчику на порт)
+// с записью в базу раз в секунду: загрузка процессора сборщиком на порт, потери и задержка от отправки
+// измерения до появления в базе (метки симулятора, simulator --markers --lag-db)
+// --contention HZ: задержка чтения (клиенты, как в основном замере) без записи в базу и при записи:
+// сначала сборщик остановлен, затем simulator пишет --sensors датчиков с частотой HZ, а temperature_monitor
+// записывает их в ту же базу раз в CONTENTION_SYNC_PERIOD
+// --cache N: запросов в секунду и задержка на N keep-alive соединениях для одного часа сырых значений
+// из кэша горячих данных сервера (час внутри его окна) и из SQLite (такой же час старше окна,
+// дописывается в базу перед замером); сборщик остановлен, поэтому готовое тело кэша не устаревает
+#ifndef BENCH_BIN_DIR
+#define BENCH_BIN_DIR "."
+#endif
+
+const std::chrono::seconds START_TIMEOUT(10);
+const std::chrono::seconds METRICS_TIMEOUT(12);     // Два периода выгрузки метрик сборщика и запас
+const int64_t HISTORY_STEP_MS = 10000;              // Шаг истории: измерение раз в 10 с
+const int FANOUT_EVENTS = 10;                       // Событий на уровень --fanout
+const std::chrono::milliseconds FANOUT_EVENT_PERIOD(300);
+const std::chrono::seconds FANOUT_CONNECT_TIMEOUT(60);
+const std::chrono::seconds FANOUT_DRAIN(3);          // Ожидание событий после последней строки
+const int32_t FANOUT_SENSOR = 1000000;              // Датчик событий: не пересекается с датчиками симулятора
+const char* const SCALE_SYNC_PERIOD = "1";          // Запись в базу в сеансах --scale, с
+const char* const SCALE_MARKER_PERIOD = "0.5";      // Метки задержки каждого датчика, с
+const char* const CONTENTION_SYNC_PERIOD = "1";     // Запись в базу в фазе --contention со сборщиком, с
+const int64_t CACHE_HOT_AGO_MS = 2 * 3600000LL;      // Начало часа --cache из кэша: внутри окна кэша и истории
+const int64_t CACHE_COLD_AGO_MS = 26 * 3600000LL;    // Начало часа --cache из SQLite: старше окна кэша (24 ч)
+const std::chrono::seconds CACHE_SETTLE(2);         // Обновление кэша сервера после записи старого часа
+
+struct IngestOptions {
+    int sensors = 4;
+    double rate = 100;
+    int binary = 0;
+    int clients = 4;
+    int threads = 2;
+    double duration = 10;
+    double warmup = 2;
+    int history_hours = 6;
+    unsigned short port = 18080;
+    std::string bin_dir = BENCH_BIN_DIR;
+    std::string dir;
+    std::string out;
+    bool keep = false;
+    std::vector<std::pair<std::string, std::string>> paths;    // Метка -> запрос
+    std::vector<int> load;                              // Уровни --load, соединений
+    std::string load_path = "/temperatures?limit=100&time=epoch";
+    int load_threads = 1;
+    std::vector<int> fanout;                            // Уровни --fanout, подписчиков
+    std::vector<int> scale;                             // Уровни --scale, портов
+    double contention = 0;                              // --contention: частота записи на датчик, 0 - без замера
+    int cache = 0;                                      // --cache: соединений, 0 - без замера
+};
+
+// Запросы по умолчанию: сырые строки порцией, прореженный ряд, часовые агрегаты, статистика, график
+const std::pair<const char*, const char*> DEFAULT_PATHS[] = {
+    {"raw", "/temperatures?limit=1000&time=epoch"},
+    {"downsampled", "/temperatures?points=500&time=epoch"},
+    {"hourly", "/avg_temp_hour?time=epoch"},
+    {"stats", "/stats?bucket=3600"},
+    {"chart", "/chart.png?width=800&height=400"},
+};
+
+// Задержки и ошибки одного клиента; сводятся после остановки
+struct ClientStats {
+    std::vector<std::vector<double>> latencies;         // мс, по запросам
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+};
+
+// Дочерний процесс в каталоге dir, вывод в log
+pid_t spawn(const std::string& dir, const std::string& log, const std::vector<std::string>& args) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    if (chdir(dir.c_str()) != 0)
+        _exit(127);
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    std::vector<char*> argv;
+    for (const std::string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+}
+
+// Ожидание завершения не дольше timeout; false - процесс ещё работает
+bool waitExit(pid_t pid, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid)
+            return true;
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+void stopProcess(pid_t pid) {
+    if (pid <= 0)
+        return;
+    kill(pid, SIGTERM);
+    if (!waitExit(pid, std::chrono::seconds(3))) {
+        kill(pid, SIGKILL);
+        waitExit(pid, std::chrono::seconds(3));
+    }
+}
+
+// Процессорное время процесса (user + system), с
+double cpuSeconds(pid_t pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // Имя процесса в скобках может содержать пробелы: поля считаются после ')'
+    std::size_t pos = stat.rfind(')');
+    if (pos == std::string::npos)
+        return 0;
+    std::istringstream fields(stat.substr(pos + 2));
+    std::string field;
+    double utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; ++i) {
+        if (i == 14)
+            utime = std::atof(field.c_str());
+        else if (i == 15)
+            stime = std::atof(field.c_str());
+    }
+    return (utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Число из плоского JSON итогов симулятора: "key":value
+bool jsonNumber(const std::string& json, const std::string& key, double& value) {
+    std::size_t pos = json.find("\"" + key + "\":");
+    if (pos == std::string::npos)
+        return false;
+    value = std::strtod(json.c_str() + pos + key.size() + 3, nullptr);
+    return true;
+}
+
+// Значение метрики без меток из текстового формата Prometheus
+bool promValue(const std::string& text, const std::string& name, double& value) {
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size() + 1, name + " ") == 0) {
+            value = std::strtod(line.c_str() + name.size() + 1, nullptr);
+            return true;
+        }
+    }
+    return false;
+}
+
+// История за hours часов до текущего момента: сырые значения и часовые агрегаты каждого датчика
+bool seedHistory(const std::string& path, int sensors, int hours) {
+    sqlite3* db = openDatabase(path.c_str(), false);
+    if (!db || !initializeSchema(db)) {
+        sqlite3_close(db);
+        return false;
+    }
+    {
+        DbWriter writer(db);
+        int64_t end = nowMillis() / HISTORY_STEP_MS * HISTORY_STEP_MS;
+        int64_t start = end - int64_t(hours) * 3600000;
+        std::vector<Reading> rows;
+        for (int sensor = 0; sensor < sensors; ++sensor) {
+            Waveform waveform(WaveformParams(), 1, static_cast<uint32_t>(sensor));
+            Bucket hour;
+            for (int64_t ts = start; ts < end; ts += HISTORY_STEP_MS) {
+                double value;
+                if (!waveform.sample(static_cast<double>(ts - start) / 1000, value))
+                    continue;
+                rows.push_back(Reading{ts, value, sensor});
+                int64_t hour_start = periodStart(PERIOD_HOUR, ts);
+                if (hour.count > 0 && hour.start != hour_start) {
+                    writer.insertAggregate("avg_temp_hour", sensor, hour);
+                    hour = Bucket();
+                }
+                hour.start = hour_start;
+                hour.end = periodEnd(PERIOD_HOUR, hour_start);
+                hour.add(value);
+            }
+            if (hour.count > 0)
+                writer.insertAggregate("avg_temp_hour", sensor, hour);
+        }
+        std::sort(rows.begin(), rows.end(), [](const Reading& a, const Reading& b) {
+            return a.ts != b.ts ? a.ts < b.ts : a.sensor_id < b.sensor_id;
+        });
+        writer.insertBatch("temperatures", rows);
+    }
+    sqlite3_close(db);
+    return true;
+}
+
+bool waitForFile(const std::string& path) {
+    auto deadline = std::chrono::steady_clock::now() + START_TIMEOUT;
+    std::error_code ec;
+    while (!std::filesystem::exists(path, ec)) {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return true;
+}
+
+bool waitForServer(unsigned short port) {
+    auto deadline = std::chrono::steady_clock::now() + START_TIMEOUT;
+    for (;;) {
+        asio::io_context io_context;
+        tcp::socket socket(io_context);
+        beast::error_code ec;
+        socket.connect(tcp::endpoint(asio::ip::make_address("127.0.0.1"), port), ec);
+        if (!ec)
+            return true;
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+// Клиент: запросы по кругу (каждый клиент начинает со своего) по одному keep-alive соединению,
+// после ошибки - новое соединение
+void runClient(const IngestOptions& options, int index, const std::atomic<bool>& stop, ClientStats& stats) {
+    using clock = std::chrono::steady_clock;
+    asio::io_context io_context;
+    tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), options.port);
+    std::unique_ptr<beast::tcp_stream> stream;
+    beast::flat_buffer buffer;
+    stats.latencies.resize(options.paths.size());
+    for (std::size_t i = static_cast<std::size_t>(index); !stop; ++i) {
+        std::size_t path = i % options.paths.size();
+        http::request<http::empty_body> req(http::verb::get, options.paths[path].second, 11);
+        req.set(http::field::host, "127.0.0.1");
+        req.set(http::field::accept_encoding, "gzip");
+        clock::time_point start = clock::now();
+        try {
+            if (!stream) {
+                stream = std::make_unique<beast::tcp_stream>(io_context);
+                stream->connect(endpoint);
+                buffer.clear();
+            }
+            http::write(*stream, req);
+            http::response_parser<http::string_body> parser;
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+            http::read(*stream, buffer, parser);
+            stats.latencies[path].push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+            stats.bytes += parser.get().body().size();
+            if (parser.get().result() != http::status::ok)
+                stats.errors++;
+            if (!parser.get().keep_alive())
+                stream.reset();
+        } catch (const std::exception&) {
+            stats.errors++;
+            stream.reset();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+// Клиенты без пауз в течение options.duration: задержки всех запросов, мс
+std::vector<double> runClients(const IngestOptions& options, uint64_t& errors) {
+    std::atomic<bool> stop{false};
+    std::vector<ClientStats> stats(static_cast<std::size_t>(options.clients));
+    std::vector<std::thread> clients;
+    for (int i = 0; i < options.clients; ++i)
+        clients.emplace_back(runClient, std::cref(options), i, std::cref(stop), std::ref(stats[static_cast<std::size_t>(i)]));
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    stop = true;
+    for (std::thread& client : clients)
+        client.join();
+    std::vector<double> all;
+    errors = 0;
+    for (const ClientStats& client : stats) {
+        for (const std::vector<double>& latencies : client.latencies)
+            all.insert(all.end(), latencies.begin(), latencies.end());
+        errors += client.errors;
+    }
+    return all;
+}
+
+// Список чисел через запятую ("1,64,1024")
+bool parseList(const std::string& text, std::vector<int>& values) {
+    std::istringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        int value = std::atoi(item.c_str());
+        if (value <= 0)
+            return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+// Предел открытых файлов - до жёсткого: тысячи соединений клиента и сервера (сервер наследует предел)
+void raiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Задержки и ошибки соединений одного потока клиента нагрузки
+struct LoadStats {
+    std::vector<double> latencies;      // мс
+    uint64_t errors = 0;
+};
+
+// Соединение клиента нагрузки: запросы target по кругу без пауз, ответ - следующий запрос.
+// После ошибки - переподключение. Все соединения потока работают на одном io_context
+class LoadConnection : public std::enable_shared_from_this<LoadConnection> {
+public:
+    LoadConnection(asio::io_context& io_context, const tcp::endpoint& endpoint, const std::string& target,
+                   const std::atomic<bool>& stop, LoadStats& stats)
+        : stream_(io_context), retry_(io_context), endpoint_(endpoint), stop_(stop), stats_(stats),
+          req_(http::verb::get, target, 11) {
+        req_.set(http::field::host, "127.0.0.1");
+        req_.set(http::field::accept_encoding, "gzip");
+    }
+
+    void start() {
+        stream_.async_connect(endpoint_, beast::bind_front_handler(&LoadConnection::on_connect, shared_from_this()));
+    }
+
+private:
+    void on_connect(beast::error_code ec) {
+        if (ec)
+            return fail();
+        send();
+    }
+
+    void send() {
+        if (stop_)
+            return close();
+        start_ = std::chrono::steady_clock::now();
+        http::async_write(stream_, req_, beast::bind_front_handler(&LoadConnection::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t) {
+        if (ec)
+            return fail();
+        parser_.emplace();
+        parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+        http::async_read(stream_, buffer_, *parser_, beast::bind_front_handler(&LoadConnection::on_read, shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t) {
+        if (ec)
+            return fail();
+        if (!stop_)
+            stats_.latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count());
+        if (parser_->get().result() != http::status::ok)
+            stats_.errors++;
+        if (!parser_->get().keep_alive()) {
+            close();
+            return start();
+        }
+        send();
+    }
+
+    void fail() {
+        if (stop_)
+            return close();
+        stats_.errors++;
+        close();
+        buffer_.clear();
+        retry_.expires_after(std::chrono::milliseconds(10));
+        retry_.async_wait([self = shared_from_this()](beast::error_code) { self->start(); });
+    }
+
+    void close() {
+        beast::error_code ec;
+        stream_.socket().close(ec);
+    }
+
+    beast::tcp_stream stream_;
+    asio::steady_timer retry_;
+    tcp::endpoint endpoint_;
+    const std::atomic<bool>& stop_;
+    LoadStats& stats_;
+    http::request<http::empty_body> req_;
+    beast::flat_buffer buffer_;
+    std::optional<http::response_parser<http::string_body>> parser_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Нагрузка: connections соединений на load_threads потоках клиента шлют target в течение duration.
+// Задержки ответов, мс
+std::vector<double> runConnections(const IngestOptions& options, int connections, const std::string& target, uint64_t& errors) {
+    const std::size_t threads = static_cast<std::size_t>(std::min(options.load_threads, connections));
+    tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), options.port);
+    std::atomic<bool> stop{false};
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    std::vector<LoadStats> stats(threads);
+    for (std::size_t t = 0; t < threads; ++t)
+        contexts.push_back(std::make_unique<asio::io_context>());
+    for (int i = 0; i < connections; ++i) {
+        std::size_t t = static_cast<std::size_t>(i) % threads;
+        std::make_shared<LoadConnection>(*contexts[t], endpoint, target, stop, stats[t])->start();
+    }
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t)
+        pool.emplace_back([&contexts, t] { contexts[t]->run(); });
+    // Установка соединений и первые ответы - вне замера
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    for (std::size_t t = 0; t < threads; ++t)
+        asio::post(*contexts[t], [&stats, t] { stats[t] = LoadStats(); });
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    stop = true;
+    std::vector<double> all;
+    errors = 0;
+    for (std::size_t t = 0; t < threads; ++t) {
+        // Итоги забираются в потоке соединений, затем ожидающие ответа соединения закрываются
+        std::promise<void> done;
+        asio::post(*contexts[t], [&] {
+            all.insert(all.end(), stats[t].latencies.begin(), stats[t].latencies.end());
+            errors += stats[t].errors;
+            done.set_value();
+        });
+        done.get_future().wait();
+        contexts[t]->stop();
+    }
+    for (std::thread& thread : pool)
+        thread.join();
+    return all;
+}
+
+// Уровень нагрузки --load
+void runLoad(const IngestOptions& options, int connections, BenchReport& report) {
+    uint64_t errors = 0;
+    std::vector<double> all = runConnections(options, connections, options.load_path, errors);
+    std::string prefix = "http/load/c" + std::to_string(connections);
+    report.add(prefix + "/requests_per_second", static_cast<double>(all.size()) / options.duration, "1/s", true);
+    report.add(prefix + "/p50", benchPercentile(all, 0.5), "ms", false);
+    report.add(prefix + "/p99", benchPercentile(all, 0.99), "ms", false);
+    report.add(prefix + "/errors", static_cast<double>(errors), "count", false);
+}
+
+// Получение событий подписчиками одного уровня --fanout; только в потоке подписчиков
+struct FanoutStats {
+    std::atomic<int> ready{0};          // Получили заголовки ответа - подписаны
+    std::atomic<int> failed{0};
+    std::vector<std::vector<std::chrono::steady_clock::time_point>> received;   // По событиям
+};
+
+// Подписчик /stream: номер события - значение value в data события temperatures
+class StreamConnection : public std::enable_shared_from_this<StreamConnection> {
+public:
+    StreamConnection(asio::io_context& io_context, const tcp::endpoint& endpoint, FanoutStats& stats)
+        : socket_(io_context), endpoint_(endpoint), stats_(stats),
+          request_("GET /stream?sensor=" + std::to_string(FANOUT_SENSOR) + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n") {}
+
+    void start() {
+        socket_.async_connect(endpoint_, [self = shared_from_this()](beast::error_code ec) {
+            if (ec)
+                return self->fail();
+            asio::async_write(self->socket_, asio::buffer(self->request_), [self](beast::error_code ec, std::size_t) {
+                if (ec)
+                    return self->fail();
+                self->read();
+            });
+        });
+    }
+
+private:
+    void read() {
+        socket_.async_read_some(asio::buffer(buffer_), [self = shared_from_this()](beast::error_code ec, std::size_t size) {
+            if (ec)
+                return self->fail();
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!self->ready_) {
+                self->ready_ = true;
+                self->stats_.ready++;
+            }
+            self->parse(now, size);
+            self->read();
+        });
+    }
+
+    // События разделены пустой строкой; заголовки ответа уходят вместе с первым
+    void parse(std::chrono::steady_clock::time_point now, std::size_t size) {
+        pending_.append(buffer_, size);
+        std::size_t end;
+        while ((end = pending_.find("\n\n")) != std::string::npos) {
+            std::size_t value = pending_.find("\"value\":");
+            if (value < end && pending_.find("event: temperatures") < end) {
+                int index = std::atoi(pending_.c_str() + value + 8);
+                if (index >= 1 && index <= static_cast<int>(stats_.received.size()))
+                    stats_.received[static_cast<std::size_t>(index - 1)].push_back(now);
+            }
+            pending_.erase(0, end + 2);
+        }
+    }
+
+    void fail() {
+        if (!ready_)
+            stats_.failed++;
+    }
+
+    tcp::socket socket_;
+    tcp::endpoint endpoint_;
+    FanoutStats& stats_;
+    std::string request_;
+    char buffer_[4096];
+    std::string pending_;
+    bool ready_ = false;
+};
+
+// Уровень рассылки: subscribers подписчиков, FANOUT_EVENTS строк в базу
+void runFanout(const IngestOptions& options, const std::string& db_path, int subscribers, BenchReport& report) {
+    using clock = std::chrono::steady_clock;
+    tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), options.port);
+    asio::io_context io_context;
+    FanoutStats stats;
+    stats.received.resize(FANOUT_EVENTS);
+    for (int i = 0; i < subscribers; ++i)
+        std::make_shared<StreamConnection>(io_context, endpoint, stats)->start();
+    std::thread thread([&io_context] { io_context.run(); });
+
+    std::string prefix = "fanout/s" + std::to_string(subscribers);
+    clock::time_point deadline = clock::now() + FANOUT_CONNECT_TIMEOUT;
+    while (stats.ready + stats.failed < subscribers && clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int ready = stats.ready;
+
+    std::vector<clock::time_point> inserted(FANOUT_EVENTS);
+    sqlite3* db = openDatabase(db_path.c_str(), false);
+    if (db) {
+        DbWriter writer(db);
+        for (int i = 0; i < FANOUT_EVENTS; ++i) {
+            writer.insert("temperatures", Reading{nowMillis(), static_cast<double>(i + 1), FANOUT_SENSOR});
+            inserted[static_cast<std::size_t>(i)] = clock::now();
+            std::this_thread::sleep_for(FANOUT_EVENT_PERIOD);
+        }
+    }
+    sqlite3_close(db);
+    std::this_thread::sleep_for(FANOUT_DRAIN);
+    io_context.stop();
+    thread.join();
+
+    std::vector<double> latencies;
+    std::vector<double> spreads;
+    for (std::size_t i = 0; i < stats.received.size(); ++i) {
+        const std::vector<clock::time_point>& times = stats.received[i];
+        for (clock::time_point time : times)
+            latencies.push_back(std::chrono::duration<double, std::milli>(time - inserted[i]).count());
+        if (!times.empty()) {
+            auto range = std::minmax_element(times.begin(), times.end());
+            spreads.push_back(std::chrono::duration<double, std::milli>(*range.second - *range.first).count());
+        }
+    }
+    double missed = static_cast<double>(FANOUT_EVENTS) * ready - static_cast<double>(latencies.size());
+    report.add(prefix + "/subscribed", ready, "count", true);
+    report.add(prefix + "/p50", benchPercentile(latencies, 0.5), "ms", false);
+    report.add(prefix + "/p99", benchPercentile(latencies, 0.99), "ms", false);
+    report.add(prefix + "/spread_p99", benchPercentile(spreads, 0.99), "ms", false);
+    report.add(prefix + "/missed", std::max(0.0, missed), "count", false);
+}
+
+// Сеанс уровня --scale в подкаталоге dir: ports портов с частотой options.rate, без сервера
+bool runScale(const IngestOptions& options, const std::string& dir, int ports, BenchReport& report) {
+    std::filesystem::create_directories(dir + "/ptys");
+    std::vector<std::string> sim_args = {options.bin_dir + "/simulator", "--ptys", dir + "/ptys",
+                                         "--sensors", std::to_string(ports),
+                                         "--rate", std::to_string(options.rate),
+                                         "--write-config", dir + "/sensors.conf",
+                                         "--duration", std::to_string(options.warmup + options.duration),
+                                         "--report", "0", "--seed", "1",
+                                         "--markers", SCALE_MARKER_PERIOD, "--lag-db", dir + "/" STORAGE_DB_PATH,
+                                         "--summary", dir + "/simulator.json"};
+    if (options.binary > 0) {
+        sim_args.push_back("--binary");
+        sim_args.push_back(std::to_string(options.binary));
+    }
+    pid_t simulator = spawn(dir, dir + "/simulator.log", sim_args);
+    if (!waitForFile(dir + "/sensors.conf")) {
+        std::cout << "Simulator did not start, see " << dir << "/simulator.log" << std::endl;
+        stopProcess(simulator);
+        return false;
+    }
+    pid_t monitor = spawn(dir, dir + "/temperature_monitor.log",
+                          {options.bin_dir + "/temperature_monitor", "--config", dir + "/sensors.conf",
+                           "--sync-period", SCALE_SYNC_PERIOD});
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    double monitor_cpu = cpuSeconds(monitor);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    monitor_cpu = cpuSeconds(monitor) - monitor_cpu;
+    if (!waitExit(simulator, std::chrono::seconds(10)))
+        stopProcess(simulator);
+
+    std::string summary = readFile(dir + "/simulator.json");
+    double sent = 0, dropped = 0, received = 0, lag_p50 = 0, lag_p99 = 0, seen = 0;
+    bool ok = jsonNumber(summary, "sent", sent);
+    jsonNumber(summary, "dropped", dropped);
+    jsonNumber(summary, "visible_lag_p50_ms", lag_p50);
+    jsonNumber(summary, "visible_lag_p99_ms", lag_p99);
+    jsonNumber(summary, "markers_seen", seen);
+    for (auto deadline = std::chrono::steady_clock::now() + METRICS_TIMEOUT; ok && std::chrono::steady_clock::now() < deadline;) {
+        if (promValue(readFile(dir + "/temperature_monitor.prom"), "ingest_readings_total", received) && received >= sent)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    stopProcess(monitor);
+    if (!ok) {
+        std::cout << "No simulator summary, see " << dir << "/simulator.log" << std::endl;
+        return false;
+    }
+
+    std::string prefix = "scale/p" + std::to_string(ports);
+    report.add(prefix + "/monitor_cpu_per_port", monitor_cpu / options.duration * 100 / ports, "%", false,
+               "total " + std::to_string(static_cast<int>(monitor_cpu / options.duration * 100)) + " %");
+    report.add(prefix + "/lost", std::max(0.0, sent - received) + dropped, "count", false);
+    report.add(prefix + "/db_lag_p50", lag_p50, "ms", false, std::to_string(static_cast<int>(seen)) + " markers");
+    report.add(prefix + "/db_lag_p99", lag_p99, "ms", false);
+    return true;
+}
+
+// Чтение без записи и при записи в базу (--contention). Сервер уже работает на базе каталога dir,
+// основной сборщик остановлен; сборщик этой фазы запускается в dir, чтобы писать в ту же базу
+bool runContention(const IngestOptions& options, const std::string& dir, BenchReport& report) {
+    auto add = [&](const std::string& phase, std::vector<double>& latencies, uint64_t errors) {
+        std::string prefix = "contention/writer_" + phase;
+        report.add(prefix + "/p50", benchPercentile(latencies, 0.5), "ms", false,
+                   std::to_string(latencies.size()) + " requests, " + std::to_string(errors) + " errors");
+        report.add(prefix + "/p99", benchPercentile(latencies, 0.99), "ms", false);
+    };
+    uint64_t errors = 0;
+    std::vector<double> idle = runClients(options, errors);
+    add("off", idle, errors);
+
+    std::string sub = dir + "/contention";
+    std::filesystem::create_directories(sub + "/ptys");
+    std::vector<std::string> sim_args = {options.bin_dir + "/simulator", "--ptys", sub + "/ptys",
+                                         "--sensors", std::to_string(options.sensors),
+                                         "--rate", std::to_string(options.contention),
+                                         "--write-config", sub + "/sensors.conf",
+                                         "--duration", std::to_string(options.warmup + options.duration),
+                                         "--report", "0", "--seed", "2",
+                                         "--summary", sub + "/simulator.json"};
+    if (options.binary > 0) {
+        sim_args.push_back("--binary");
+        sim_args.push_back(std::to_string(options.binary));
+    }
+    pid_t simulator = spawn(sub, sub + "/simulator.log", sim_args);
+    if (!waitForFile(sub + "/sensors.conf")) {
+        std::cout << "Simulator did not start, see " << sub << "/simulator.log" << std::endl;
+        stopProcess(simulator);
+        return false;
+    }
+    pid_t monitor = spawn(dir, sub + "/temperature_monitor.log",
+                          {options.bin_dir + "/temperature_monitor", "--config", sub + "/sensors.conf",
+                           "--sync-period", CONTENTION_SYNC_PERIOD});
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    std::vector<double> busy = runClients(options, errors);
+    if (!waitExit(simulator, std::chrono::seconds(10)))
+        stopProcess(simulator);
+    stopProcess(monitor);
+
+    std::string summary = readFile(sub + "/simulator.json");
+    double sent = 0, seconds = 0;
+    if (!jsonNumber(summary, "sent", sent) || !jsonNumber(summary, "seconds", seconds) || seconds <= 0) {
+        std::cout << "No simulator summary, see " << sub << "/simulator.log" << std::endl;
+        return false;
+    }
+    add("on", busy, errors);
+    report.add("contention/writer_on/rows_per_second", sent / seconds, "1/s", true);
+    return true;
+}
+
+// Ответ на один запрос: тело, пусто при ошибке
+std::string fetch(const IngestOptions& options, const std::string& target) {
+    try {
+        asio::io_context io_context;
+        beast::tcp_stream stream(io_context);
+        stream.connect(tcp::endpoint(asio::ip::make_address("127.0.0.1"), options.port));
+        http::request<http::empty_body> req(http::verb::get, target, 11);
+        req.set(http::field::host, "127.0.0.1");
+        http::write(stream, req);
+        beast::flat_buffer buffer;
+        http::response_parser<http::string_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        http::read(stream, buffer, parser);
+        return parser.get().result() == http::status::ok ? parser.get().body() : std::string();
+    } catch (const std::exception&) {
+        return std::string();
+    }
+}
+
+std::size_t countRows(const std::string& json) {
+    std::size_t rows = 0;
+    for (std::size_t pos = json.find("\"value\""); pos != std::string::npos; pos = json.find("\"value\"", pos + 1))
+        rows++;
+    return rows;
+}
+
+// Час сырых значений из кэша горячих данных и из SQLite (--cache). Сервер работает на базе db_path,
+// сборщик остановлен. Час старше окна кэша дописывается в базу значениями тех же датчиков
+bool runCache(const IngestOptions& options, const std::string& db_path, BenchReport& report) {
+    int64_t now = nowMillis() / HISTORY_STEP_MS * HISTORY_STEP_MS;
+    int64_t cold_from = now - CACHE_COLD_AGO_MS;
+    sqlite3* db = openDatabase(db_path.c_str(), false);
+    if (!db)
+        return false;
+    {
+        DbWriter writer(db);
+        std::vector<Reading> rows;
+        for (int sensor = 0; sensor < options.sensors; ++sensor) {
+            Waveform waveform(WaveformParams(), 1, static_cast<uint32_t>(sensor));
+            for (int64_t ts = cold_from; ts < cold_from + 3600000; ts += HISTORY_STEP_MS) {
+                double value;
+                if (waveform.sample(static_cast<double>(ts - cold_from) / 1000, value))
+                    rows.push_back(Reading{ts, value, sensor});
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Reading& a, const Reading& b) {
+            return a.ts != b.ts ? a.ts < b.ts : a.sensor_id < b.sensor_id;
+        });
+        writer.insertBatch("temperatures", rows, true);
+    }
+    sqlite3_close(db);
+    std::this_thread::sleep_for(CACHE_SETTLE);
+
+    int64_t hot_from = now - CACHE_HOT_AGO_MS;
+    const std::pair<const char*, int64_t> paths[] = {{"hit", hot_from}, {"sqlite", cold_from}};
+    double rates[2] = {0, 0};
+    for (int i = 0; i < 2; ++i) {
+        std::string target = "/temperatures?from=" + std::to_string(paths[i].second) + "&to=" +
+                             std::to_string(paths[i].second + 3600000) + "&time=epoch";
+        std::size_t rows = countRows(fetch(options, target));
+        if (rows == 0) {
+            std::cout << "No rows for " << target << std::endl;
+            return false;
+        }
+        uint64_t errors = 0;
+        std::vector<double> latencies = runConnections(options, options.cache, target, errors);
+        std::string prefix = std::string("cache/") + paths[i].first;
+        rates[i] = static_cast<double>(latencies.size()) / options.duration;
+        report.add(prefix + "/requests_per_second", rates[i], "1/s", true,
+                   std::to_string(rows) + " rows per response, " + std::to_string(errors) + " errors");
+        report.add(prefix + "/p50", benchPercentile(latencies, 0.5), "ms", false);
+        report.add(prefix + "/p99", benchPercentile(latencies, 0.99), "ms", false);
+    }
+    report.add("cache/speedup", rates[1] > 0 ? rates[0] / rates[1] : 0, "x", true, "cache hits / SQLite requests per second");
+    return true;
+}
+
+void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options]" << std::endl;
+    std::cout << "  --sensors N         simulated sensors (default 4)" << std::endl;
+    std::cout << "  --rate HZ           readings per second per sensor (default 100)" << std::endl;
+    std::cout << "  --binary N          binary frames of N readings instead of text lines" << std::endl;
+    std::cout << "  --clients K         concurrent HTTP clients (default 4)" << std::endl;
+    std::cout << "  --threads N         server worker threads (default 2)" << std::endl;
+    std::cout << "  --duration S        measured time (default 10)" << std::endl;
+    std::cout << "  --warmup S          time before measuring (default 2)" << std::endl;
+    std::cout << "  --history H         hours of history in the database (default 6)" << std::endl;
+    std::cout << "  --port P            server port (default 18080)" << std::endl;
+    std::cout << "  --path LABEL=TARGET request for the clients, repeatable (default: raw, downsampled, hourly, stats, chart)" << std::endl;
+    std::cout << "  --load N1,N2,...    then load the server with N concurrent keep-alive connections at each level" << std::endl;
+    std::cout << "  --load-path TARGET  request of the load levels (default " << IngestOptions().load_path << ")" << std::endl;
+    std::cout << "  --load-threads N    client threads of the load levels (default 1)" << std::endl;
+    std::cout << "  --fanout N1,N2,...  then measure /stream delivery to N subscribers at each level" << std::endl;
+    std::cout << "  --scale N1,N2,...   then run the monitor alone on N ports at each level: CPU per port, loss, lag to the database" << std::endl;
+    std::cout << "  --contention HZ     then read latency with the monitor stopped and while it writes N sensors at HZ each" << std::endl;
+    std::cout << "  --cache N           then requests/s for one hour of readings from the hot cache and from SQLite, N connections" << std::endl;
+    std::cout << "  --bin-dir DIR       where server, temperature_monitor and simulator are (default: build directory)" << std::endl;
+    std::cout << "  --dir DIR           parent of the working directory (default $TMPDIR or /tmp)" << std::endl;
+    std::cout << "  --out FILE          write results as JSON (see bench/compare.py)" << std::endl;
+    std::cout << "  --keep              keep the working directory with the database and logs" << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, IngestOptions& options) {
+    const char* tmp = std::getenv("TMPDIR");
+    options.dir = tmp && *tmp ? tmp : "/tmp";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep") {
+            options.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        if (arg == "--sensors")
+            options.sensors = std::atoi(value.c_str());
+        else if (arg == "--rate")
+            options.rate = std::atof(value.c_str());
+        else if (arg == "--binary")
+            options.binary = std::atoi(value.c_str());
+        else if (arg == "--clients")
+            options.clients = std::atoi(value.c_str());
+        else if (arg == "--threads")
+            options.threads = std::atoi(value.c_str());
+        else if (arg == "--duration")
+            options.duration = std::atof(value.c_str());
+        else if (arg == "--warmup")
+            options.warmup = std::atof(value.c_str());
+        else if (arg == "--history")
+            options.history_hours = std::atoi(value.c_str());
+        else if (arg == "--port")
+            options.port = static_cast<unsigned short>(std::atoi(value.c_str()));
+        else if (arg == "--bin-dir")
+            options.bin_dir = value;
+        else if (arg == "--dir")
+            options.dir = value;
+        else if (arg == "--out")
+            options.out = value;
+        else if (arg == "--load" && parseList(value, options.load))
+            continue;
+        else if (arg == "--fanout" && parseList(value, options.fanout))
+            continue;
+        else if (arg == "--scale" && parseList(value, options.scale))
+            continue;
+        else if (arg == "--contention")
+            options.contention = std::atof(value.c_str());
+        else if (arg == "--cache")
+            options.cache = std::atoi(value.c_str());
+        else if (arg == "--load-path")
+            options.load_path = value;
+        else if (arg == "--load-threads")
+            options.load_threads = std::atoi(value.c_str());
+        else if (arg == "--path" && value.find('=') != std::string::npos)
+            options.paths.emplace_back(value.substr(0, value.find('=')), value.substr(value.find('=') + 1));
+        else
+            return false;
+    }
+    if (options.paths.empty())
+        for (const auto& path : DEFAULT_PATHS)
+            options.paths.emplace_back(path.first, path.second);
+    return options.sensors >= 1 && options.rate > 0 && options.binary >= 0 && options.clients >= 0 && options.threads >= 1 &&
+           options.load_threads >= 1 && options.duration > 0 && options.warmup >= 0 && options.history_hours >= 0 && options.port > 0 &&
+           options.contention >= 0 && (options.contention == 0 || options.clients > 0) && options.cache >= 0 &&
+           (options.cache == 0 || options.history_hours * 3600000LL > CACHE_HOT_AGO_MS);
+}
+
+int main(int argc, char** argv) {
+    IngestOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    raiseFileLimit();
+
+    std::string pattern = options.dir + "/bench_ingest.XXXXXX";
+    if (!mkdtemp(pattern.data())) {
+        std::cout << "Failed to create a directory in '" << options.dir << "'" << std::endl;
+        return 1;
+    }
+    const std::string dir = pattern;
+    std::filesystem::create_directories(dir + "/ptys");
+    std::cout << "Working directory " << dir << std::endl;
+
+    std::cout << "Seeding " << options.history_hours << " h of history for " << options.sensors << " sensors" << std::endl;
+    if (!seedHistory(dir + "/" STORAGE_DB_PATH, options.sensors, options.history_hours)) {
+        std::cout << "Failed to seed the database" << std::endl;
+        return 1;
+    }
+
+    // Симулятор работает с прогревом и отправляет всё до выхода; сборщик и сервер - до конца замера
+    std::vector<std::string> sim_args = {options.bin_dir + "/simulator", "--ptys", dir + "/ptys",
+                                         "--sensors", std::to_string(options.sensors),
+                                         "--rate", std::to_string(options.rate),
+                                         "--write-config", dir + "/sensors.conf",
+                                         "--duration", std::to_string(options.warmup + options.duration),
+                                         "--report", "0", "--seed", "1",
+                                         "--summary", dir + "/simulator.json"};
+    if (options.binary > 0) {
+        sim_args.push_back("--binary");
+        sim_args.push_back(std::to_string(options.binary));
+    }
+    pid_t simulator = spawn(dir, dir + "/simulator.log", sim_args);
+    pid_t monitor = -1, server = -1;
+    int status = 0;
+    if (!waitForFile(dir + "/sensors.conf")) {
+        std::cout << "Simulator did not start, see " << dir << "/simulator.log" << std::endl;
+        status = 1;
+    } else {
+        monitor = spawn(dir, dir + "/temperature_monitor.log",
+                        {options.bin_dir + "/temperature_monitor", "--config", dir + "/sensors.conf"});
+        server = spawn(dir, dir + "/server.log",
+                       {options.bin_dir + "/server", std::to_string(options.port), std::to_string(options.threads)});
+        if (!waitForServer(options.port)) {
+            std::cout << "Server did not start, see " << dir << "/server.log" << std::endl;
+            status = 1;
+        }
+    }
+
+    BenchReport report("ingest");
+    if (status == 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+        std::cout << "Measuring " << options.duration << " s: " << options.sensors << " sensors at " << options.rate
+                  << " Hz, " << options.clients << " HTTP clients" << std::endl;
+
+        double monitor_cpu = cpuSeconds(monitor), server_cpu = cpuSeconds(server);
+        std::atomic<bool> stop{false};
+        std::vector<ClientStats> stats(static_cast<std::size_t>(options.clients));
+        std::vector<std::thread> clients;
+        for (int i = 0; i < options.clients; ++i)
+            clients.emplace_back(runClient, std::cref(options), i, std::cref(stop), std::ref(stats[static_cast<std::size_t>(i)]));
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+        stop = true;
+        for (std::thread& client : clients)
+            client.join();
+        monitor_cpu = cpuSeconds(monitor) - monitor_cpu;
+        server_cpu = cpuSeconds(server) - server_cpu;
+
+        // Приём: итоги симулятора и счётчик сборщика, когда он догонит отправленное
+        waitExit(simulator, std::chrono::seconds(10));
+        simulator = -1;
+        std::string summary = readFile(dir + "/simulator.json");
+        double sent = 0, seconds = 0, dropped = 0, max_late = 0, received = 0;
+        if (!jsonNumber(summary, "sent", sent) || !jsonNumber(summary, "seconds", seconds)) {
+            std::cout << "No simulator summary, see " << dir << "/simulator.log" << std::endl;
+            status = 1;
+        }
+        jsonNumber(summary, "dropped", dropped);
+        jsonNumber(summary, "max_late_ms", max_late);
+        for (auto deadline = std::chrono::steady_clock::now() + METRICS_TIMEOUT; std::chrono::steady_clock::now() < deadline;) {
+            if (promValue(readFile(dir + "/temperature_monitor.prom"), "ingest_readings_total", received) && received >= sent)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+
+        report.add("ingest/sent_per_second", seconds > 0 ? sent / seconds : 0, "1/s", true);
+        report.add("ingest/lost", std::max(0.0, sent - received) + dropped, "count", false,
+                   "dropped by the simulator " + std::to_string(static_cast<uint64_t>(dropped)));
+        report.add("ingest/max_late", max_late, "ms", false);
+        report.add("ingest/monitor_cpu", monitor_cpu / options.duration * 100, "%", false);
+
+        if (options.clients > 0) {
+            std::vector<double> all;
+            uint64_t errors = 0, bytes = 0;
+            for (std::size_t path = 0; path < options.paths.size(); ++path) {
+                std::vector<double> latencies;
+                for (ClientStats& client : stats)
+                    latencies.insert(latencies.end(), client.latencies[path].begin(), client.latencies[path].end());
+                all.insert(all.end(), latencies.begin(), latencies.end());
+                const std::string& label = options.paths[path].first;
+                report.add("http/" + label + "/p50", benchPercentile(latencies, 0.5), "ms", false);
+                report.add("http/" + label + "/p99", benchPercentile(latencies, 0.99), "ms", false);
+            }
+            for (const ClientStats& client : stats) {
+                errors += client.errors;
+                bytes += client.bytes;
+            }
+            report.add("http/requests_per_second", static_cast<double>(all.size()) / options.duration, "1/s", true,
+                       std::to_string(bytes / 1024 / 1024) + " MB received");
+            report.add("http/p50", benchPercentile(all, 0.5), "ms", false);
+            report.add("http/p99", benchPercentile(all, 0.99), "ms", false);
+            report.add("http/errors", static_cast<double>(errors), "count", false);
+        }
+        report.add("http/server_cpu", server_cpu / options.duration * 100, "%", false);
+
+        for (int connections : options.load) {
+            std::cout << "Load: " << connections << " connections, " << options.duration << " s" << std::endl;
+            runLoad(options, connections, report);
+        }
+        for (int subscribers : options.fanout) {
+            std::cout << "Fan-out: " << subscribers << " subscribers, " << FANOUT_EVENTS << " events" << std::endl;
+            runFanout(options, dir + "/" STORAGE_DB_PATH, subscribers, report);
+        }
+        if (options.contention > 0) {
+            std::cout << "Contention: " << options.duration << " s without writes, " << options.duration << " s with "
+                      << options.sensors << " sensors at " << options.contention << " Hz" << std::endl;
+            stopProcess(monitor);
+            monitor = -1;
+            if (!runContention(options, dir, report))
+                status = 1;
+        }
+        if (status == 0 && options.cache > 0) {
+            std::cout << "Cache: " << options.cache << " connections, " << options.duration
+                      << " s from the hot cache, " << options.duration << " s from SQLite" << std::endl;
+            stopProcess(monitor);
+            monitor = -1;
+            if (!runCache(options, dir + "/" STORAGE_DB_PATH, report))
+                status = 1;
+        }
+    }
+
+    if (simulator > 0)
+        stopProcess(simulator);
+    stopProcess(server);
+    stopProcess(monitor);
+
+    // Масштабирование по числу портов - отдельные сеансы без сервера
+    for (std::size_t i = 0; status == 0 && i < options.scale.size(); ++i) {
+        int ports = options.scale[i];
+        std::cout << "Scale: " << ports << " ports at " << options.rate << " Hz, " << options.duration << " s" << std::endl;
+        if (!runScale(options, dir + "/scale" + std::to_string(ports), ports, report))
+            status = 1;
+    }
+
+    if (options.keep) {
+        std::cout << "Kept " << dir << std::endl;
+    } else {
+        std::error_code ec;
+        std::filesystem::remove_all(dir, ec);
+    }
+
+    if (status == 0 && !options.out.empty() && !report.write(options.out)) {
+        std::cout << "Failed to write '" << options.out << "'" << std::endl;
+        return 1;
+    }
+    return status;
+}
@@ -0,0 +1,1255 @@
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "archive.hpp"
+#include "bench.hpp"
+#include "chart.hpp"
+#include "compression.hpp"
+#include "db_writer.hpp"
+#include "downsample.hpp"
+#include "gorilla.hpp"
+#include "json_writer.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "reading_queue.hpp"
+#include "sensor_protocol.hpp"
+#include "serial_reader.hpp"        // LineFramer
+#include "stats.hpp"
+#include "storage.hpp"
+#include "waveform.hpp"
+#include "wire_format.hpp"
+
+// Микрозамеры горячих путей сервера и сборщика на коде из server/: сериализация ответа,
+// форматирование времени, разбор строк и кадров порта, очередь измерений, вставка и выборка SQLite,
+// сжатие, архив, схема базы, статистика, графики, метрики и журнал.
+// Каждый замер - время на один элемент (строку, измерение, кадр, запрос), лучшее из повторов.
+// Данные - модель Waveform с постоянным зерном, поэтому от запуска к запуску одинаковы.
+// Сравнение схем базы запускает собранную рядом утилиту migrate_db
+#ifndef BENCH_BIN_DIR
+#define BENCH_BIN_DIR "."
+#endif
+
+const std::size_t SERIES_SIZE = 4096;           // Измерений в порции (как ROW_BLOCK)
+const std::size_t LARGE_SERIES_SIZE = 65536;    // Для статистики, прореживания и графиков
+const std::size_t WIRE_ROWS = 100000;           // Строк ответа для сравнения форматов
+const int WIRE_SENSORS = 4;
+const int64_t SERIES_START = 1735689600000;     // 2025-01-01 00:00:00 UTC
+const int SQLITE_SENSORS = 4;
+const int SQLITE_HOURS = 6;                     // История в базе для выборок, 1 Гц на датчик
+const std::size_t INSERT_BATCH = 1000;          // Строк в транзакции вставки
+const std::size_t SYNC_ROWS[] = {1, 100, 10000}; // Накопленных измерений за синхронизацию
+const std::size_t STATS_SQL_SIZES[] = {10000, 1000000, 100000000};  // Статистика в памяти и AVG/MIN/MAX SQLite
+const std::size_t DEFAULT_STATS_SQL_MAX = 1000000;  // 10^8 - около 3 ГБ базы и минут заполнения, по --stats-sql-max
+const std::size_t STATS_SQL_FILL = 65536;       // Строк в транзакции заполнения
+const int SCHEMA_DAYS = 7;                      // История датчика 1 Гц для сравнения схем базы
+
+// Чанки датчика за сутки при разной частоте измерений
+struct ArchiveDayRate {
+    const char* label;
+    int64_t step_ms;
+};
+const ArchiveDayRate ARCHIVE_DAY_RATES[] = {{"10s", 10000}, {"1hz", 1000}, {"10hz", 100}};
+
+// Выборки по году архива с шагом ARCHIVE_YEAR_STEP_MS: окно и число запросов
+struct ArchiveQuery {
+    const char* label;
+    int64_t window_ms;
+    int repeat;
+};
+const ArchiveQuery ARCHIVE_QUERIES[] = {
+    {"1h", ARCHIVE_DAY / 24, 200}, {"1d", ARCHIVE_DAY, 100}, {"30d", 30 * ARCHIVE_DAY, 20}, {"365d", 365 * ARCHIVE_DAY, 5}};
+const int64_t ARCHIVE_YEAR_STEP_MS = 10000;
+const std::size_t ARCHIVE_YEAR_DAYS = 365;
+const std::size_t QUEUE_BENCH_CAPACITY = 4096;  // Очередь замера при остановившемся писателе
+const std::size_t QUEUE_BENCH_PUSHES = 65536;
+const std::chrono::milliseconds QUEUE_STALL(20); // Писатель забирает очередь не чаще
+
+struct MicroOptions {
+    std::string out;
+    std::string filter;
+    std::string dir;
+    double min_time = 0.2;
+    int repeat = 5;
+    std::size_t stats_sql_max = DEFAULT_STATS_SQL_MAX;
+    bool list = false;
+};
+
+// Ряд измерений одного датчика с шагом step_ms
+struct Series {
+    std::vector<int64_t> ts;
+    std::vector<double> values;
+
+    Series(std::size_t n, int64_t step_ms) {
+        WaveformParams params;
+        params.period = 3600;      // Заметный ход за время ряда
+        Waveform waveform(params, 1, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+            double value = params.base;
+            waveform.sample(static_cast<double>(i) * static_cast<double>(step_ms) / 1000, value);
+            ts.push_back(SERIES_START + static_cast<int64_t>(i) * step_ms);
+            values.push_back(value);
+        }
+    }
+
+    std::size_t size() const { return ts.size(); }
+};
+
+class Micro {
+public:
+    Micro(const MicroOptions& options, BenchReport& report) : options_(options), report_(report) {}
+
+    bool selected(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    // Есть ли выбранные замеры с префиксом: подготовка данных для группы пропускается
+    bool any(const std::vector<std::string>& names) const {
+        for (const std::string& name : names)
+            if (selected(name))
+                return true;
+        return false;
+    }
+
+    // body(n) выполняет n операций по items элементов; в отчёт - нс на элемент.
+    // bytes - входных байт на операцию, для пропускной способности в выводе
+    template <class Body>
+    void run(const std::string& name, Body&& body, std::size_t items = 1, std::size_t bytes = 0) {
+        if (!selected(name))
+            return;
+        if (options_.list) {
+            std::cout << name << std::endl;
+            return;
+        }
+        double ns = measureNs(body, options_.min_time, options_.repeat);
+        std::string note;
+        if (bytes > 0) {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.1f MB/s", static_cast<double>(bytes) / ns * 1e3);
+            note = buf;
+        }
+        report_.add(name, ns / static_cast<double>(items), "ns", false, note);
+    }
+
+    // Готовое значение (например, перцентиль распределения), если замер выбран
+    void report(const std::string& name, double value, const std::string& unit, const std::string& note = std::string(),
+                bool higher_is_better = false) {
+        if (!selected(name))
+            return;
+        if (options_.list) {
+            std::cout << name << std::endl;
+            return;
+        }
+        report_.add(name, value, unit, higher_is_better, note);
+    }
+
+    const MicroOptions& options() const { return options_; }
+
+private:
+    const MicroOptions& options_;
+    BenchReport& report_;
+};
+
+// Строки ответа: JSON с метками числом и строкой локального времени, столбцовый формат, MessagePack
+void benchSerialization(Micro& m, const Series& series) {
+    struct Variant {
+        const char* name;
+        ResponseFormat format;
+        bool epoch_time;
+    };
+    const Variant variants[] = {
+        {"json/row_epoch", {FORMAT_JSON, false}, true},
+        {"json/row_local_time", {FORMAT_JSON, false}, false},
+        {"formats/columns_row", {FORMAT_COLUMNS, false}, true},
+        {"formats/msgpack_row", {FORMAT_MSGPACK, false}, true},
+    };
+    for (const Variant& variant : variants) {
+        std::string out;
+        m.run(variant.name, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                RowWriter writer(variant.format, variant.epoch_time);
+                out.clear();
+                writer.begin(out);
+                for (std::size_t i = 0; i < series.size(); ++i)
+                    writer.row(out, series.ts[i], 0, series.values[i]);
+                writer.end(out);
+                doNotOptimize(out.data());
+            }
+        }, series.size());
+    }
+}
+
+// Разбор ответа клиентом: строки в rows, false - ответ не разобран.
+// JSON - объекты строк с ключами в любом порядке (null - NaN)
+bool decodeJson(std::string_view body, std::vector<Reading>& rows) {
+    const char* p = body.data();
+    const char* end = p + body.size();
+    auto skip = [&](char ch) {
+        if (p == end || *p != ch)
+            return false;
+        ++p;
+        return true;
+    };
+    if (body.compare(0, 9, "{\"data\":[") != 0)
+        return false;
+    p += 9;
+    while (skip('{')) {
+        Reading row{0, 0, 0};
+        do {
+            const char* key = p + 1;
+            const char* key_end = skip('"') ? static_cast<const char*>(std::memchr(p, '"', end - p)) : nullptr;
+            if (!key_end)
+                return false;
+            std::string_view name(key, key_end - key);
+            p = key_end + 1;
+            if (!skip(':'))
+                return false;
+            std::from_chars_result result{p, std::errc()};
+            if (name == "value" && end - p >= 4 && std::memcmp(p, "null", 4) == 0) {
+                row.value = std::nan("");
+                result.ptr = p + 4;
+            } else if (name == "value") {
+                result = std::from_chars(p, end, row.value);
+            } else if (name == "timestamp") {
+                result = std::from_chars(p, end, row.ts);
+            } else if (name == "sensor_id") {
+                result = std::from_chars(p, end, row.sensor_id);
+            } else {
+                return false;
+            }
+            if (result.ec != std::errc())
+                return false;
+            p = result.ptr;
+        } while (skip(','));
+        if (!skip('}'))
+            return false;
+        rows.push_back(row);
+        if (!skip(','))
+            break;
+    }
+    return skip(']');
+}
+
+template <class T>
+T loadLE(const char* p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));      // Замеры - на little-endian
+    return value;
+}
+
+// Столбцовый формат (wire_format.hpp): блоки до пустого
+bool decodeColumns(std::string_view body, std::vector<Reading>& rows) {
+    if (body.size() < 8 || body.compare(0, 4, "TCOL") != 0 || body[4] != 2)
+        return false;
+    bool float32 = body[5] == 32;
+    const char* p = body.data() + 8;
+    const char* end = body.data() + body.size();
+    while (end - p >= 8) {
+        std::size_t n = loadLE<uint32_t>(p);
+        p += 8;
+        if (n == 0)
+            return true;
+        std::size_t value_bytes = float32 ? (n * 4 + 7) / 8 * 8 : n * 8;
+        std::size_t sensor_bytes = (n * 4 + 7) / 8 * 8;
+        if (static_cast<std::size_t>(end - p) < n * 8 + value_bytes + sensor_bytes)
+            return false;
+        std::size_t first = rows.size();
+        rows.resize(first + n);
+        for (std::size_t i = 0; i < n; ++i)
+            rows[first + i].ts = loadLE<int64_t>(p + i * 8);
+        p += n * 8;
+        for (std::size_t i = 0; i < n; ++i)
+            rows[first + i].value = float32 ? loadLE<float>(p + i * 4) : loadLE<double>(p + i * 8);
+        p += value_bytes;
+        for (std::size_t i = 0; i < n; ++i)
+            rows[first + i].sensor_id = loadLE<int32_t>(p + i * 4);
+        p += sensor_bytes;
+    }
+    return false;
+}
+
+// MessagePack (wire_format.hpp): словари блоков со столбцами
+bool decodeMsgpack(std::string_view body, std::vector<Reading>& rows) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(body.data());
+    const unsigned char* end = p + body.size();
+    auto big = [&](int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i)
+            value = value << 8 | *p++;
+        return value;
+    };
+    while (p < end) {
+        if ((*p & 0xf0) != 0x80)
+            return false;
+        int keys = *p++ & 0x0f;
+        std::size_t first = rows.size();
+        for (int k = 0; k < keys; ++k) {
+            if (p == end || (*p & 0xe0) != 0xa0)
+                return false;
+            std::size_t len = *p++ & 0x1f;
+            if (end - p < static_cast<std::ptrdiff_t>(len) + 1)
+                return false;
+            std::string_view key(reinterpret_cast<const char*>(p), len);
+            p += len;
+            if (key == "next_cursor") {
+                if (end - p < 2 || *p++ != 0xd9 || end - p < *p + 1)
+                    return false;
+                p += *p + 1;
+                continue;
+            }
+            std::size_t n;
+            if ((*p & 0xf0) == 0x90)
+                n = *p++ & 0x0f;
+            else if (end - p >= 3 && *p++ == 0xdc)
+                n = static_cast<std::size_t>(big(2));
+            else
+                return false;
+            if (rows.size() < first + n)
+                rows.resize(first + n, Reading{0, 0, 0});
+            for (std::size_t i = 0; i < n; ++i) {
+                unsigned char type = *p;
+                if (end - p < (type == 0xca || type == 0xd2 ? 5 : 9))
+                    return false;
+                ++p;
+                Reading& row = rows[first + i];
+                if (key == "ts" && type == 0xd3) {
+                    row.ts = static_cast<int64_t>(big(8));
+                } else if (key == "value" && type == 0xcb) {
+                    uint64_t bits = big(8);
+                    std::memcpy(&row.value, &bits, sizeof(bits));
+                } else if (key == "value" && type == 0xca) {
+                    uint32_t bits = static_cast<uint32_t>(big(4));
+                    float value;
+                    std::memcpy(&value, &bits, sizeof(bits));
+                    row.value = value;
+                } else if (key == "sensor_id" && type == 0xd2) {
+                    row.sensor_id = static_cast<int32_t>(big(4));
+                } else {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Ответ на WIRE_ROWS строк (WIRE_SENSORS датчиков) в каждом формате: размер тела, кодирование
+// и разбор клиентом, время - на строку. Разобранное сверяется с записанным один раз до замеров
+void benchWireFormats(Micro& m) {
+    struct Variant {
+        const char* name;
+        ResponseFormat format;
+        bool (*decode)(std::string_view, std::vector<Reading>&);
+        double tolerance;           // float32 теряет разряды
+    };
+    const Variant variants[] = {
+        {"json", {FORMAT_JSON, false}, decodeJson, 0},
+        {"columns", {FORMAT_COLUMNS, false}, decodeColumns, 0},
+        {"columns_f32", {FORMAT_COLUMNS, true}, decodeColumns, 1e-4},
+        {"msgpack", {FORMAT_MSGPACK, false}, decodeMsgpack, 0},
+        {"msgpack_f32", {FORMAT_MSGPACK, true}, decodeMsgpack, 1e-4},
+    };
+    std::vector<std::string> names;
+    for (const Variant& variant : variants)
+        for (const char* what : {"/bytes", "/encode", "/decode"})
+            names.push_back(std::string("formats/") + variant.name + "_1e5" + what);
+    if (!m.options().list && !m.any(names))
+        return;
+
+    Series series(WIRE_ROWS / WIRE_SENSORS, 1000);
+    auto encode = [&](const Variant& variant, std::string& out) {
+        RowWriter writer(variant.format, true);
+        out.clear();
+        writer.begin(out);
+        for (std::size_t i = 0; i < series.size(); ++i)
+            for (int sensor = 0; sensor < WIRE_SENSORS; ++sensor)
+                writer.row(out, series.ts[i], sensor, series.values[i] + sensor);
+        writer.end(out);
+    };
+    for (const Variant& variant : variants) {
+        std::string prefix = std::string("formats/") + variant.name + "_1e5";
+        std::string body;
+        std::vector<Reading> rows;
+        if (!m.options().list) {
+            encode(variant, body);
+            bool same = variant.decode(body, rows) && rows.size() == WIRE_ROWS;
+            for (std::size_t i = 0; same && i < rows.size(); ++i) {
+                std::size_t k = i / WIRE_SENSORS;
+                int sensor = static_cast<int>(i % WIRE_SENSORS);
+                same = rows[i].ts == series.ts[k] && rows[i].sensor_id == sensor &&
+                       std::fabs(rows[i].value - (series.values[k] + sensor)) <= variant.tolerance;
+            }
+            if (!same) {
+                std::cerr << prefix << ": decoded rows differ from the encoded ones" << std::endl;
+                continue;
+            }
+        }
+        m.report(prefix + "/bytes", static_cast<double>(body.size()) / WIRE_ROWS, "B",
+                 std::to_string(body.size()) + " bytes per response");
+        std::string out;
+        m.run(prefix + "/encode", [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                encode(variant, out);
+                doNotOptimize(out.data());
+            }
+        }, WIRE_ROWS);
+        m.run(prefix + "/decode", [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                rows.clear();
+                variant.decode(body, rows);
+                doNotOptimize(rows.data());
+            }
+        }, WIRE_ROWS, body.size());
+    }
+}
+
+// Метки локального времени: подряд в одной минуте (префикс из кэша) и каждая в новой минуте
+void benchTimestamps(Micro& m) {
+    for (int64_t step : {int64_t(1000), int64_t(61000)}) {
+        LocalTimeFormatter formatter;
+        std::string out;
+        m.run(step == 1000 ? "time/local_time_same_minute" : "time/local_time_new_minute", [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                out.clear();
+                for (std::size_t i = 0; i < SERIES_SIZE; ++i)
+                    formatter.append(out, SERIES_START + static_cast<int64_t>(k * SERIES_SIZE + i) * step);
+                doNotOptimize(out.data());
+            }
+        }, SERIES_SIZE);
+    }
+}
+
+// Текстовый протокол порта: разбор числа и весь путь от принятых байт до значений через LineFramer
+void benchTextProtocol(Micro& m, const Series& series) {
+    std::vector<std::string> lines;
+    std::string stream;
+    for (double value : series.values) {
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, 2);
+        lines.emplace_back(buf, result.ptr);
+        stream.append(buf, result.ptr);
+        stream += "\r\n";
+    }
+
+    m.run("parse/text_reading", [&](uint64_t n) {
+        double sum = 0;
+        for (uint64_t k = 0; k < n; ++k) {
+            for (const std::string& line : lines) {
+                double value;
+                if (parseTextReading(line, value))
+                    sum += value;
+            }
+        }
+        doNotOptimize(sum);
+    }, lines.size());
+
+    LineFramer framer;
+    m.run("parse/text_stream", [&](uint64_t n) {
+        double sum = 0;
+        for (uint64_t k = 0; k < n; ++k) {
+            // Порциями по 256 байт, как read() с порта на высокой частоте
+            for (std::size_t pos = 0; pos < stream.size();) {
+                boost::asio::mutable_buffer buffer = framer.prepare();
+                std::size_t len = std::min({buffer.size(), stream.size() - pos, std::size_t(256)});
+                std::memcpy(buffer.data(), stream.data() + pos, len);
+                pos += len;
+                framer.commit(len, [&](std::string_view line) {
+                    double value;
+                    if (parseTextReading(line, value))
+                        sum += value;
+                });
+            }
+        }
+        doNotOptimize(sum);
+    }, lines.size(), stream.size());
+}
+
+// Двоичный протокол: кодирование кадров по 32 измерения и поиск кадров в потоке
+void benchBinaryProtocol(Micro& m, const Series& series) {
+    const std::size_t frame_samples = 32;
+    std::vector<std::vector<double>> frames;
+    for (std::size_t i = 0; i + frame_samples <= series.size(); i += frame_samples)
+        frames.emplace_back(series.values.begin() + i, series.values.begin() + i + frame_samples);
+    std::string stream;
+    for (std::size_t i = 0; i < frames.size(); ++i)
+        encodeFrame(stream, 1, 10000, series.ts[i * frame_samples], frames[i]);
+
+    std::string out;
+    m.run("parse/frame_encode", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            out.clear();
+            for (std::size_t i = 0; i < frames.size(); ++i)
+                encodeFrame(out, 1, 10000, series.ts[i * frame_samples], frames[i]);
+            doNotOptimize(out.data());
+        }
+    }, frames.size(), stream.size());
+
+    FrameDecoder decoder;
+    m.run("parse/frame_decode", [&](uint64_t n) {
+        double sum = 0;
+        for (uint64_t k = 0; k < n; ++k) {
+            for (std::size_t pos = 0; pos < stream.size();) {
+                std::pair<char*, std::size_t> buffer = decoder.prepare();
+                std::size_t len = std::min({buffer.second, stream.size() - pos, std::size_t(256)});
+                std::memcpy(buffer.first, stream.data() + pos, len);
+                pos += len;
+                decoder.commit(len, [&](const SensorFrame& frame) {
+                    for (std::size_t i = 0; i < frame.count; ++i)
+                        sum += frame.value(i);
+                });
+            }
+        }
+        doNotOptimize(sum);
+    }, frames.size(), stream.size());
+}
+
+// Сжатие ответа gzip и deflate на уровне потоковых ответов (1), кэшированных тел (6) и наибольшем (9):
+// время на строку (сжатие в одном потоке, то есть процессорное время) и степень сжатия
+// тела JSON и столбцового
+void benchCompression(Micro& m, const Series& series) {
+    struct Body {
+        const char* suffix;
+        ResponseFormat format;
+    };
+    const Body bodies[] = {{"", {FORMAT_JSON, false}}, {"_columns", {FORMAT_COLUMNS, false}}};
+    for (const Body& kind : bodies) {
+        std::string body;
+        RowWriter writer(kind.format, true);
+        writer.begin(body);
+        for (std::size_t i = 0; i < series.size(); ++i)
+            writer.row(body, series.ts[i], 0, series.values[i]);
+        writer.end(body);
+
+        for (ContentEncoding encoding : {ENCODING_GZIP, ENCODING_DEFLATE}) {
+            for (int level : {STREAM_COMPRESSION_LEVEL, CACHED_COMPRESSION_LEVEL, Z_BEST_COMPRESSION}) {
+                std::string name = std::string("compression/") + encodingName(encoding) + "_level" + std::to_string(level) + kind.suffix;
+                std::string out;
+                if (!m.options().list)
+                    compressBody(body, encoding, level, out);
+                double ratio = out.empty() ? 0 : static_cast<double>(body.size()) / static_cast<double>(out.size());
+                m.report(name + "_ratio", ratio, "x", std::to_string(body.size()) + " -> " + std::to_string(out.size()) + " bytes",
+                         true);
+                m.run(name, [&](uint64_t n) {
+                    for (uint64_t k = 0; k < n; ++k) {
+                        compressBody(body, encoding, level, out);
+                        doNotOptimize(out.data());
+                    }
+                }, series.size(), body.size());
+            }
+        }
+    }
+}
+
+// Архив: сжатие и распаковка ряда Gorilla
+void benchGorilla(Micro& m, const Series& series) {
+    std::string chunk;
+    GorillaEncoder encoder(chunk);
+    for (std::size_t i = 0; i < series.size(); ++i)
+        encoder.add(series.ts[i], series.values[i]);
+
+    std::string out;
+    m.run("gorilla/encode", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            out.clear();
+            GorillaEncoder encoder(out);
+            for (std::size_t i = 0; i < series.size(); ++i)
+                encoder.add(series.ts[i], series.values[i]);
+            doNotOptimize(out.data());
+        }
+    }, series.size());
+
+    std::vector<Reading> rows;
+    rows.reserve(series.size());
+    m.run("gorilla/decode", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            rows.clear();
+            gorillaDecode(chunk.data(), chunk.size(), series.size(), 0, rows);
+            doNotOptimize(rows.data());
+        }
+    }, series.size());
+}
+
+// Статистика /stats каждым доступным вариантом ядер; прореживание и графики /chart
+void benchAnalytics(Micro& m, const Series& series) {
+    for (const StatsKernels& kernels : availableStatsKernels()) {
+        std::string name = kernels.name;
+        m.run("stats/summarize_" + name, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k)
+                doNotOptimize(summarize(series.values.data(), series.size(), kernels));
+        }, series.size());
+        m.run("stats/histogram_" + name, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k)
+                doNotOptimize(histogram(series.values.data(), series.size(), 15, 35, 50, kernels));
+        }, series.size());
+    }
+
+    std::vector<Point> points;
+    for (std::size_t i = 0; i < series.size(); ++i)
+        points.push_back(Point{series.ts[i], series.values[i]});
+    m.run("downsample/lttb_1000", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            doNotOptimize(downsampleLttb(points, 1000));
+    }, points.size());
+    m.run("downsample/minmax_1000", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            doNotOptimize(downsampleMinMax(points, 1000));
+    }, points.size());
+
+    std::vector<Point> shown = downsampleLttb(points, 800);
+    m.run("chart/png_800x400", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            doNotOptimize(renderPng(shown, 800, 400));
+    });
+    m.run("chart/svg_800x400", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            doNotOptimize(renderSvg(shown, "bench", 800, 400));
+    });
+}
+
+// Учёт метрик и журнал на горячем пути
+void benchInstrumentation(Micro& m) {
+    Counter& counter = metrics().counter("bench_counter_total", "Benchmark counter");
+    Histogram& histogram = metrics().histogram("bench_duration_seconds", "Benchmark histogram");
+    m.run("metrics/counter_inc", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            counter.inc();
+    });
+    m.run("metrics/histogram_observe", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            histogram.observe(k * 977);
+    });
+    m.run("metrics/scoped_timer", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            ScopedTimer timer(histogram);
+    });
+
+    m.run("log/disabled_debug", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            LOG_DEBUG("bench " << k);
+    });
+    // Подавленное сообщение: одно в секунду выводится (в stderr), остальные только считаются
+    m.run("log/limited_suppressed", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k)
+            LOG_LIMITED(LEVEL_WARN, 1, "bench_micro: rate-limited message " << k);
+    });
+
+    WaveformParams params;
+    params.spike_probability = 0.001;
+    params.dropouts_per_hour = 1;
+    Waveform waveform(params, 1, 0);
+    double t = 0;
+    m.run("waveform/sample", [&](uint64_t n) {
+        double value = 0;
+        for (uint64_t k = 0; k < n; ++k) {
+            t += 0.001;
+            waveform.sample(t, value);
+        }
+        doNotOptimize(value);
+    });
+}
+
+// Очередь измерений: push() без переполнения и задержка каждого push() при остановившемся писателе.
+// Писатель забирает всю очередь раз в QUEUE_STALL (база не успевает), производитель шлёт без пауз:
+// block ждёт места, drop_oldest выбрасывает старые, spill дописывает в файл. p50/p99/max по политикам
+void benchQueue(Micro& m) {
+    {
+        ReadingQueue queue(QUEUE_BENCH_CAPACITY, OVERFLOW_BLOCK, std::string());
+        std::vector<Reading> rows;
+        rows.reserve(QUEUE_BENCH_CAPACITY);
+        m.run("queue/push", [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                queue.push(Reading{static_cast<int64_t>(k), 20.0, 0});
+                if (queue.depth() == QUEUE_BENCH_CAPACITY) {
+                    rows.clear();
+                    queue.drain(rows, QUEUE_BENCH_CAPACITY);
+                }
+            }
+        });
+    }
+
+    const std::pair<const char*, OverflowPolicy> policies[] = {
+        {"block", OVERFLOW_BLOCK}, {"drop_oldest", OVERFLOW_DROP_OLDEST}, {"spill", OVERFLOW_SPILL}};
+    for (const auto& policy : policies) {
+        std::string prefix = std::string("queue/stalled_") + policy.first;
+        if (!m.any({prefix + "/p50", prefix + "/p99", prefix + "/max"}))
+            continue;
+        std::string spill_path = m.options().dir + "/bench_micro_" + std::to_string(getpid()) + ".spill";
+        ReadingQueue queue(QUEUE_BENCH_CAPACITY, policy.second, spill_path);
+        std::atomic<bool> stop{false};
+        std::thread writer([&] {
+            std::vector<Reading> rows;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(QUEUE_STALL);
+                rows.clear();
+                queue.drain(rows, QUEUE_BENCH_CAPACITY);
+                queue.drainSpill(rows);
+            }
+        });
+        std::vector<double> ns;
+        ns.reserve(QUEUE_BENCH_PUSHES);
+        for (std::size_t k = 0; k < QUEUE_BENCH_PUSHES; ++k) {
+            auto start = std::chrono::steady_clock::now();
+            queue.push(Reading{static_cast<int64_t>(k), 20.0, 0});
+            ns.push_back(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count()));
+        }
+        stop = true;
+        writer.join();
+        std::remove(spill_path.c_str());
+
+        std::string note = "blocked " + std::to_string(queue.blocked()) + " ms, dropped " + std::to_string(queue.dropped()) +
+                           ", spilled " + std::to_string(queue.spilled());
+        m.report(prefix + "/p50", benchPercentile(ns, 0.5), "ns", note);
+        m.report(prefix + "/p99", benchPercentile(ns, 0.99), "ns");
+        m.report(prefix + "/max", benchPercentile(ns, 1), "ns");
+    }
+}
+
+// Файл базы для замеров; существующий удаляется вместе с WAL
+std::string benchDatabase(const MicroOptions& options, const char* name) {
+    std::string path = options.dir + "/bench_micro." + std::to_string(getpid()) + "." + name + ".db";
+    for (const char* suffix : {"", "-wal", "-shm"})
+        std::remove((path + suffix).c_str());
+    return path;
+}
+
+void removeDatabase(const std::string& path) {
+    for (const char* suffix : {"", "-wal", "-shm"})
+        std::remove((path + suffix).c_str());
+}
+
+// Строки ответа /temperatures из базы: подготовка запроса как в server.cpp, проход по строкам, JSON
+std::size_t selectRows(sqlite3* db, const std::string& sql, int64_t from, int64_t to, int sensor, std::string& out) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return 0;
+    sqlite3_bind_int64(stmt, 1, from);
+    sqlite3_bind_int64(stmt, 2, to);
+    if (sensor >= 0)
+        sqlite3_bind_int(stmt, 3, sensor);
+    JsonWriter writer(true);
+    out.clear();
+    writer.begin(out);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        writer.row(out, sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 2), sqlite3_column_double(stmt, 1));
+    writer.end(out);
+    sqlite3_finalize(stmt);
+    return writer.rows();
+}
+
+// Вставка порциями в одной транзакции (синхронизация сборщика), прежняя вставка по строке и выборки сервера
+void benchSqlite(Micro& m) {
+    if (m.options().list || m.any({"sqlite/insert_batch"})) {
+        std::string path = benchDatabase(m.options(), "insert");
+        sqlite3* db = openDatabase(path.c_str(), false);
+        if (!db || !initializeSchema(db))
+            return;
+        {
+            DbWriter writer(db);
+            std::vector<Reading> rows(INSERT_BATCH);
+            int64_t ts = SERIES_START;
+            m.run("sqlite/insert_batch", [&](uint64_t n) {
+                for (uint64_t k = 0; k < n; ++k) {
+                    for (Reading& row : rows)
+                        row = Reading{ts++, 20.0 + static_cast<double>(ts % 1000) / 100, 0};
+                    writer.insertBatch("temperatures", rows);
+                }
+            }, INSERT_BATCH);
+        }
+        sqlite3_close(db);
+        removeDatabase(path);
+    }
+
+    // Синхронизация накопленных измерений: прежний путь (SQL склеивается из значений, sqlite3_exec
+    // на каждую строку, каждая строка - своя транзакция) и DbWriter (подготовленное выражение,
+    // одна транзакция на синхронизацию)
+    for (std::size_t count : SYNC_ROWS) {
+        for (bool batched : {false, true}) {
+            std::string name = std::string(batched ? "sqlite/sync_batched_" : "sqlite/sync_per_row_") + std::to_string(count);
+            if (!m.options().list && !m.any({name}))
+                continue;
+            std::string path = benchDatabase(m.options(), "sync");
+            sqlite3* db = openDatabase(path.c_str(), false);
+            if (!db || !initializeSchema(db))
+                return;
+            {
+                DbWriter writer(db);
+                std::vector<Reading> rows(count);
+                int64_t ts = SERIES_START;
+                m.run(name, [&](uint64_t n) {
+                    for (uint64_t k = 0; k < n; ++k) {
+                        for (Reading& row : rows)
+                            row = Reading{ts++, 20.0 + static_cast<double>(ts % 1000) / 100, 0};
+                        if (batched) {
+                            writer.insertBatch("temperatures", rows);
+                            continue;
+                        }
+                        for (const Reading& row : rows) {
+                            std::string sql = "INSERT INTO temperatures (ts, sensor_id, value) VALUES (" + std::to_string(row.ts) +
+                                              ", " + std::to_string(row.sensor_id) + ", " + std::to_string(row.value) + ");";
+                            sqlite3_exec(db, sql.c_str(), 0, 0, 0);
+                        }
+                    }
+                }, count);
+            }
+            sqlite3_close(db);
+            removeDatabase(path);
+        }
+    }
+
+    if (!m.options().list && !m.any({"sqlite/select_range_1h", "sqlite/select_sensor_1h", "sqlite/count_range_1h"}))
+        return;
+    std::string path = benchDatabase(m.options(), "select");
+    sqlite3* db = openDatabase(path.c_str(), false);
+    if (!db || !initializeSchema(db))
+        return;
+    if (!m.options().list) {
+        DbWriter writer(db);
+        Series series(static_cast<std::size_t>(SQLITE_HOURS) * 3600, 1000);
+        std::vector<Reading> rows;
+        for (std::size_t i = 0; i < series.size(); ++i)
+            for (int sensor = 0; sensor < SQLITE_SENSORS; ++sensor)
+                rows.push_back(Reading{series.ts[i], series.values[i] + sensor, sensor});
+        writer.insertBatch("temperatures", rows);
+        sqlite3_exec(db, "ANALYZE;", 0, 0, 0);
+    }
+
+    // Случайный час истории; окна одинаковы от запуска к запуску
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<int64_t> hour(0, (SQLITE_HOURS - 1) * 3600 - 1);
+    std::string out;
+    const std::string range_sql = "SELECT ts, value, sensor_id FROM temperatures WHERE ts >= ?1 AND ts < ?2 ORDER BY ts, sensor_id;";
+    const std::string sensor_sql = "SELECT ts, value, sensor_id FROM temperatures WHERE ts >= ?1 AND ts < ?2 AND sensor_id = ?3 ORDER BY ts, sensor_id;";
+    m.run("sqlite/select_range_1h", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            int64_t from = SERIES_START + hour(rng) * 1000;
+            selectRows(db, range_sql, from, from + 3600000, -1, out);
+        }
+    }, 3600 * SQLITE_SENSORS);
+    m.run("sqlite/select_sensor_1h", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            int64_t from = SERIES_START + hour(rng) * 1000;
+            selectRows(db, sensor_sql, from, from + 3600000, static_cast<int>(k % SQLITE_SENSORS), out);
+        }
+    }, 3600);
+    // Оценка объёма перед прореживанием (?points=)
+    m.run("sqlite/count_range_1h", [&](uint64_t n) {
+        for (uint64_t k = 0; k < n; ++k) {
+            int64_t from = SERIES_START + hour(rng) * 1000;
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db, "SELECT COUNT(*), MIN(ts), MAX(ts) FROM temperatures WHERE ts >= ?1 AND ts < ?2;", -1, &stmt, nullptr);
+            sqlite3_bind_int64(stmt, 1, from);
+            sqlite3_bind_int64(stmt, 2, from + 3600000);
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+                doNotOptimize(sqlite3_column_int64(stmt, 0));
+            sqlite3_finalize(stmt);
+        }
+    });
+    sqlite3_close(db);
+    removeDatabase(path);
+}
+
+// Значения датчика с шагом step_ms от SERIES_START: суточный ход модели с точностью 0,01,
+// как их присылает датчик (сжатие Gorilla зависит от числа значащих разрядов)
+std::vector<Reading> sensorReadings(std::size_t n, int64_t step_ms) {
+    WaveformParams params;
+    Waveform waveform(params, 1, 0);
+    std::vector<Reading> rows;
+    rows.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        double value = params.base;
+        waveform.sample(static_cast<double>(i) * static_cast<double>(step_ms) / 1000, value);
+        rows.push_back(Reading{SERIES_START + static_cast<int64_t>(i) * step_ms, std::round(value * 100) / 100, 0});
+    }
+    return rows;
+}
+
+// Архив: размер чанка датчика за сутки против строк SQLite, распаковка чанков реальных размеров
+// и выборки по году архива через ArchiveCursor (индекс в базе, чанки в файлах, кэш страниц прогрет)
+void benchArchive(Micro& m) {
+    std::vector<std::string> names;
+    for (const ArchiveDayRate& rate : ARCHIVE_DAY_RATES)
+        for (const char* what : {"_bytes", "_ratio", ""})
+            names.push_back(std::string(what[0] ? "gorilla/day_" : "gorilla/decode_day_") + rate.label + what);
+    std::vector<std::string> query_names;
+    for (const ArchiveQuery& query : ARCHIVE_QUERIES)
+        for (const char* what : {"/p50", "/p99"})
+            query_names.push_back(std::string("gorilla/archive_query_") + query.label + what);
+    if (!m.options().list && !m.any(names) && !m.any(query_names))
+        return;
+
+    // Байт на строку в таблице temperatures: прирост страниц базы после вставки суток 1 Гц
+    double sqlite_row_bytes = 0;
+    if (!m.options().list) {
+        std::string path = benchDatabase(m.options(), "archive_rows");
+        sqlite3* db = openDatabase(path.c_str(), false);
+        if (!db || !initializeSchema(db))
+            return;
+        int64_t pages = queryInt(db, "PRAGMA page_count;");
+        std::vector<Reading> rows = sensorReadings(ARCHIVE_DAY / 1000, 1000);
+        {
+            DbWriter writer(db);
+            writer.insertBatch("temperatures", rows);
+        }
+        sqlite_row_bytes = static_cast<double>((queryInt(db, "PRAGMA page_count;") - pages) * queryInt(db, "PRAGMA page_size;")) /
+                           static_cast<double>(rows.size());
+        sqlite3_close(db);
+        removeDatabase(path);
+    }
+
+    for (const ArchiveDayRate& rate : ARCHIVE_DAY_RATES) {
+        std::string label = rate.label;
+        std::size_t count = static_cast<std::size_t>(ARCHIVE_DAY / rate.step_ms);
+        std::vector<Reading> rows;
+        std::string chunk;
+        if (!m.options().list) {
+            rows = sensorReadings(count, rate.step_ms);
+            GorillaEncoder encoder(chunk);
+            for (const Reading& row : rows)
+                encoder.add(row.ts, row.value);
+        }
+        double bytes = rows.empty() ? 0 : static_cast<double>(chunk.size()) / static_cast<double>(count);
+        m.report("gorilla/day_" + label + "_bytes", bytes, "B", std::to_string(chunk.size()) + " bytes per chunk");
+        char note[64];
+        std::snprintf(note, sizeof(note), "vs %.1f B per SQLite row", sqlite_row_bytes);
+        m.report("gorilla/day_" + label + "_ratio", bytes > 0 ? sqlite_row_bytes / bytes : 0, "x", note, true);
+        m.run("gorilla/decode_day_" + label, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                rows.clear();
+                gorillaDecode(chunk.data(), chunk.size(), count, 0, rows);
+                doNotOptimize(rows.data());
+            }
+        }, count, chunk.size());
+    }
+
+    if (!m.options().list && !m.any(query_names))
+        return;
+    // Год значений с шагом 10 с: чанк на сутки и строка индекса
+    std::string path = benchDatabase(m.options(), "archive");
+    std::string dir = path + ".chunks";
+    sqlite3* db = openDatabase(path.c_str(), false);
+    if (!db || !initializeSchema(db))
+        return;
+    if (!m.options().list) {
+        DbWriter writer(db);
+        std::size_t per_day = static_cast<std::size_t>(ARCHIVE_DAY / ARCHIVE_YEAR_STEP_MS);
+        std::vector<Reading> year = sensorReadings(per_day * ARCHIVE_YEAR_DAYS, ARCHIVE_YEAR_STEP_MS);
+        for (std::size_t day = 0; day < ARCHIVE_YEAR_DAYS; ++day) {
+            std::vector<Reading> rows(year.begin() + day * per_day, year.begin() + (day + 1) * per_day);
+            ArchiveChunk chunk;
+            if (!writeChunk(dir, rows, chunk) || !writer.insertChunk(chunk)) {
+                std::cerr << "Failed to build the archive in " << dir << std::endl;
+                return;
+            }
+        }
+    }
+    std::mt19937_64 rng(1);
+    const int64_t year_end = SERIES_START + static_cast<int64_t>(ARCHIVE_YEAR_DAYS) * ARCHIVE_DAY;
+    for (const ArchiveQuery& query : ARCHIVE_QUERIES) {
+        std::string prefix = std::string("gorilla/archive_query_") + query.label;
+        if (!m.options().list && !m.any({prefix + "/p50", prefix + "/p99"}))
+            continue;
+        std::vector<double> ms;
+        std::size_t rows = 0;
+        for (int k = 0; !m.options().list && k < query.repeat; ++k) {
+            int64_t span = year_end - SERIES_START - query.window_ms;
+            int64_t from = SERIES_START + (span > 0 ? static_cast<int64_t>(rng() % static_cast<uint64_t>(span)) : 0);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<ArchiveChunk> chunks;
+            listChunks(db, from, from + query.window_ms, 0, chunks);
+            ArchiveCursor cursor(dir, std::move(chunks), from, from + query.window_ms);
+            Reading reading;
+            rows = 0;
+            while (cursor.next(reading))
+                ++rows;
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        m.report(prefix + "/p50", benchPercentile(ms, 0.5), "ms", std::to_string(rows) + " rows");
+        m.report(prefix + "/p99", benchPercentile(ms, 0.99), "ms");
+    }
+    sqlite3_close(db);
+    removeDatabase(path);
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+}
+
+// Перенос базы утилитой migrate_db, собранной рядом (вывод отбрасывается); true - перенос завершён
+bool runMigrate(const std::string& path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execl(BENCH_BIN_DIR "/migrate_db", "migrate_db", path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Байт на строку: занятые страницы базы (без свободных после переноса) на число строк
+double bytesPerRow(sqlite3* db, int64_t rows) {
+    int64_t pages = queryInt(db, "PRAGMA page_count;") - queryInt(db, "PRAGMA freelist_count;");
+    return rows > 0 ? static_cast<double>(pages * queryInt(db, "PRAGMA page_size;")) / static_cast<double>(rows) : 0;
+}
+
+// Исходная схема (timestamp TEXT PRIMARY KEY в локальном времени) против текущей (ts INTEGER в мс,
+// sensor_id, WITHOUT ROWID): база исходной схемы с SCHEMA_DAYS сутками датчика 1 Гц переносится
+// migrate_db, сравниваются байт на строку и выборка за час (проход по строкам с чтением столбцов)
+void benchSchema(Micro& m) {
+    const char* names[] = {"schema/legacy_text_bytes", "schema/epoch_ms_bytes", "schema/size_ratio", "schema/migrate",
+                           "schema/legacy_text_select_1h", "schema/epoch_ms_select_1h"};
+    if (!m.options().list && !m.any(std::vector<std::string>(std::begin(names), std::end(names))))
+        return;
+
+    std::string path = benchDatabase(m.options(), "schema");
+    sqlite3* db = openDatabase(path.c_str(), false);
+    if (!db)
+        return;
+    const int64_t count = static_cast<int64_t>(SCHEMA_DAYS) * 86400;
+    int64_t rows = 0;
+    double legacy_bytes = 0;
+    if (!m.options().list) {
+        // Таблица и вставка как у сборщика до переноса
+        sqlite3_exec(db, "CREATE TABLE temperatures (timestamp TEXT PRIMARY KEY, value REAL);", 0, 0, 0);
+        std::vector<Reading> readings = sensorReadings(static_cast<std::size_t>(count), 1000);
+        LocalTimeFormatter formatter;
+        std::string timestamp;
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_exec(db, "BEGIN;", 0, 0, 0);
+        // OR IGNORE: при переводе часов назад локальные метки повторяются
+        sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO temperatures (timestamp, value) VALUES (?1, ?2);", -1, &stmt, nullptr);
+        for (const Reading& reading : readings) {
+            timestamp.clear();
+            formatter.append(timestamp, reading.ts);
+            sqlite3_bind_text(stmt, 1, timestamp.data(), static_cast<int>(timestamp.size()), SQLITE_STATIC);
+            sqlite3_bind_double(stmt, 2, reading.value);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_exec(db, "COMMIT;", 0, 0, 0);
+        sqlite3_exec(db, "ANALYZE;", 0, 0, 0);
+        rows = queryInt(db, "SELECT COUNT(*) FROM temperatures;");
+        legacy_bytes = bytesPerRow(db, rows);
+    }
+
+    // Случайный час истории; окна одинаковы от запуска к запуску и для обеих схем
+    std::uniform_int_distribution<int64_t> hour(0, (SCHEMA_DAYS * 24 - 1) * 3600 - 1);
+    LocalTimeFormatter formatter;
+    std::string from_text, to_text;
+    auto select = [&](const char* sql, bool text, uint64_t n) {
+        std::mt19937_64 rng(1);
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+        for (uint64_t k = 0; k < n; ++k) {
+            int64_t from = SERIES_START + hour(rng) * 1000;
+            if (text) {
+                from_text.clear();
+                to_text.clear();
+                formatter.append(from_text, from);
+                formatter.append(to_text, from + 3600000);
+                sqlite3_bind_text(stmt, 1, from_text.data(), static_cast<int>(from_text.size()), SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 2, to_text.data(), static_cast<int>(to_text.size()), SQLITE_STATIC);
+            } else {
+                sqlite3_bind_int64(stmt, 1, from);
+                sqlite3_bind_int64(stmt, 2, from + 3600000);
+            }
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                if (text)
+                    doNotOptimize(sqlite3_column_text(stmt, 0));
+                else
+                    doNotOptimize(sqlite3_column_int64(stmt, 0));
+                doNotOptimize(sqlite3_column_double(stmt, 1));
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    };
+    m.run("schema/legacy_text_select_1h", [&](uint64_t n) {
+        select("SELECT timestamp, value FROM temperatures WHERE timestamp >= ?1 AND timestamp < ?2 ORDER BY timestamp;", true, n);
+    }, 3600);
+    sqlite3_close(db);
+
+    double seconds = 0;
+    if (!m.options().list) {
+        auto start = std::chrono::steady_clock::now();
+        if (!runMigrate(path)) {
+            std::cerr << "migrate_db failed on " << path << std::endl;
+            removeDatabase(path);
+            return;
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    db = openDatabase(path.c_str(), false);
+    if (!db)
+        return;
+    double bytes = 0;
+    if (!m.options().list) {
+        sqlite3_exec(db, "ANALYZE;", 0, 0, 0);
+        int64_t migrated = queryInt(db, "SELECT COUNT(*) FROM temperatures;");
+        if (migrated != rows)
+            std::cerr << "migrate_db copied " << migrated << " of " << rows << " rows" << std::endl;
+        bytes = bytesPerRow(db, migrated);
+    }
+    std::string note = std::to_string(rows) + " rows";
+    m.report("schema/legacy_text_bytes", legacy_bytes, "B", note);
+    m.report("schema/epoch_ms_bytes", bytes, "B", note);
+    m.report("schema/size_ratio", bytes > 0 ? legacy_bytes / bytes : 0, "x", "legacy size / current size", true);
+    m.report("schema/migrate", rows > 0 ? seconds * 1e9 / static_cast<double>(rows) : 0, "ns",
+             "per row, including pauses between batches");
+    m.run("schema/epoch_ms_select_1h", [&](uint64_t n) {
+        select("SELECT ts, value FROM temperatures WHERE ts >= ?1 AND ts < ?2 ORDER BY ts, sensor_id;", false, n);
+    }, 3600);
+    sqlite3_close(db);
+    removeDatabase(path);
+}
+
+// Сводка /stats по диапазону: ядра статистики над значениями в памяти против AVG/MIN/MAX SQLite
+// по тем же строкам в базе (после первого прохода - из кэша страниц). Размеры больше
+// --stats-sql-max пропускаются: база на 10^8 строк занимает несколько гигабайт
+void benchStatsVsSql(Micro& m) {
+    for (std::size_t size : STATS_SQL_SIZES) {
+        std::string label = "1e" + std::to_string(static_cast<int>(std::lround(std::log10(static_cast<double>(size)))));
+        std::vector<std::string> names;
+        for (const StatsKernels& kernels : availableStatsKernels())
+            names.push_back("stats_sql/summarize_" + std::string(kernels.name) + "_" + label);
+        names.push_back("stats_sql/sqlite_avg_min_max_" + label);
+        if (size > m.options().stats_sql_max || (!m.options().list && !m.any(names)))
+            continue;
+
+        std::string path = benchDatabase(m.options(), "stats");
+        sqlite3* db = openDatabase(path.c_str(), false);
+        if (!db || !initializeSchema(db))
+            return;
+        std::vector<double> values;
+        if (!m.options().list) {
+            WaveformParams params;
+            params.period = 3600;
+            Waveform waveform(params, 1, 0);
+            values.reserve(size);
+            DbWriter writer(db);
+            std::vector<Reading> rows;
+            for (std::size_t i = 0; i < size; ++i) {
+                double value = params.base;
+                waveform.sample(static_cast<double>(i), value);
+                values.push_back(value);
+                rows.push_back(Reading{SERIES_START + static_cast<int64_t>(i) * 1000, value, 0});
+                if (rows.size() == STATS_SQL_FILL || i + 1 == size) {
+                    writer.insertBatch("temperatures", rows);
+                    rows.clear();
+                }
+            }
+        }
+
+        for (const StatsKernels& kernels : availableStatsKernels()) {
+            m.run("stats_sql/summarize_" + std::string(kernels.name) + "_" + label, [&](uint64_t n) {
+                for (uint64_t k = 0; k < n; ++k)
+                    doNotOptimize(summarize(values.data(), values.size(), kernels));
+            }, size);
+        }
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT AVG(value), MIN(value), MAX(value) FROM temperatures WHERE ts >= ?1 AND ts < ?2;", -1, &stmt,
+                           nullptr);
+        m.run("stats_sql/sqlite_avg_min_max_" + label, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                sqlite3_bind_int64(stmt, 1, SERIES_START);
+                sqlite3_bind_int64(stmt, 2, SERIES_START + static_cast<int64_t>(size) * 1000);
+                if (sqlite3_step(stmt) == SQLITE_ROW)
+                    doNotOptimize(sqlite3_column_double(stmt, 0));
+                sqlite3_reset(stmt);
+            }
+        }, size);
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        removeDatabase(path);
+    }
+}
+
+void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options]" << std::endl;
+    std::cout << "  --out FILE        write results as JSON (see bench/compare.py)" << std::endl;
+    std::cout << "  --filter TEXT     run only benchmarks whose name contains TEXT" << std::endl;
+    std::cout << "  --min-time S      minimum duration of one measurement (default 0.2)" << std::endl;
+    std::cout << "  --repeat N        measurements per benchmark, the fastest is reported (default 5)" << std::endl;
+    std::cout << "  --dir DIR         directory for temporary databases (default $TMPDIR or /tmp)" << std::endl;
+    std::cout << "  --stats-sql-max N largest stats_sql/* size, up to 1e8 (default " << DEFAULT_STATS_SQL_MAX << ")" << std::endl;
+    std::cout << "  --list            list benchmark names" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    MicroOptions options;
+    const char* tmp = std::getenv("TMPDIR");
+    options.dir = tmp && *tmp ? tmp : "/tmp";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--out" && has_value) {
+            options.out = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--dir" && has_value) {
+            options.dir = argv[++i];
+        } else if (arg == "--min-time" && has_value) {
+            options.min_time = std::atof(argv[++i]);
+        } else if (arg == "--repeat" && has_value) {
+            options.repeat = std::atoi(argv[++i]);
+        } else if (arg == "--stats-sql-max" && has_value) {
+            options.stats_sql_max = static_cast<std::size_t>(std::atof(argv[++i]));
+        } else if (arg == "--list") {
+            options.list = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.min_time <= 0 || options.repeat < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    BenchReport report("micro");
+    Micro m(options, report);
+    Series series(SERIES_SIZE, 1000);
+    Series large(LARGE_SERIES_SIZE, 1000);
+    benchSerialization(m, series);
+    benchWireFormats(m);
+    benchTimestamps(m);
+    benchTextProtocol(m, series);
+    benchBinaryProtocol(m, series);
+    benchCompression(m, series);
+    benchGorilla(m, series);
+    benchAnalytics(m, large);
+    benchInstrumentation(m);
+    benchQueue(m);
+    benchSqlite(m);
+    benchArchive(m);
+    benchStatsVsSql(m);
+    benchSchema(m);
+
+    if (!options.out.empty() && !options.list && !report.write(options.out)) {
+        std::cout << "Failed to write '" << options.out << "'" << std::endl;
+        return 1;
+    }
+    return 0;
+}
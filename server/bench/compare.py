@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""Сравнение результатов замеров (bench_micro --out, bench_ingest --out) с эталоном.
+
+    compare.py [--threshold 0.10] [--ignore TEXT]... BASELINE CURRENT
+
+BASELINE и CURRENT - файлы JSON или каталоги с ними (сравниваются файлы с одинаковыми именами).
+Ухудшение - изменение в худшую сторону ("better" в результате) больше threshold от эталона;
+для нулевого эталона (ошибки, потери) - любое ненулевое значение.
+Код возврата 1, если есть ухудшения, 2 - если сравнивать нечего.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    return report, {r["name"]: r for r in report["results"]}
+
+
+def pairs(baseline, current):
+    """Пары файлов (эталон, текущий) по именам, если заданы каталоги."""
+    if os.path.isdir(current):
+        if not os.path.isdir(baseline):
+            sys.exit("%s is a directory, %s is not" % (current, baseline))
+        for name in sorted(os.listdir(current)):
+            if name.endswith(".json"):
+                base = os.path.join(baseline, name)
+                if os.path.exists(base):
+                    yield base, os.path.join(current, name)
+                else:
+                    print("%s: no baseline, skipped" % name)
+    else:
+        yield baseline, current
+
+
+def compare(baseline_path, current_path, threshold, ignore):
+    """Печать таблицы сравнения; возвращает (сравнено, ухудшений)."""
+    base_report, base = load(baseline_path)
+    cur_report, cur = load(current_path)
+    print("== %s: %s (%s) vs %s (%s)" % (cur_report.get("suite", current_path), baseline_path,
+                                         base_report.get("started", "?"), current_path, cur_report.get("started", "?")))
+    if base_report.get("host") != cur_report.get("host"):
+        print("   note: different hosts, '%s' vs '%s'" % (base_report.get("host"), cur_report.get("host")))
+    compared = regressions = 0
+    for name, result in cur.items():
+        if any(text in name for text in ignore):
+            continue
+        if name not in base:
+            print("   %-40s %14.3f %-6s  new" % (name, result["value"], result["unit"]))
+            continue
+        old, new = base[name]["value"], result["value"]
+        higher = result.get("better") == "higher"
+        if old == 0:
+            change = 0.0 if new == 0 else float("inf")
+            worse = new != 0 and not higher
+        else:
+            change = (new - old) / abs(old)
+            worse = (-change if higher else change) > threshold
+        better = (change if higher else -change) > threshold
+        mark = "REGRESSION" if worse else ("improved" if better else "")
+        print("   %-40s %14.3f -> %14.3f %-6s %+7.1f%%  %s" % (name, old, new, result["unit"], change * 100, mark))
+        compared += 1
+        regressions += worse
+    for name in base:
+        if name not in cur and not any(text in name for text in ignore):
+            print("   %-40s missing in current results" % name)
+    return compared, regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10, help="relative change treated as a regression (default 0.10)")
+    parser.add_argument("--ignore", action="append", default=[], help="skip results whose name contains TEXT")
+    args = parser.parse_args()
+
+    compared = regressions = 0
+    for baseline, current in pairs(args.baseline, args.current):
+        c, r = compare(baseline, current, args.threshold, args.ignore)
+        compared += c
+        regressions += r
+    if compared == 0:
+        print("Nothing to compare")
+        return 2
+    print("%d results compared, %d regressions (threshold %.0f%%)" % (compared, regressions, args.threshold * 100))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Получатель рассылки. deliver() вызывается из потока, публикующего событие,
+// и не должен блокироваться: получатель только ставит сообщение в свою очередь
+// (или пропускает его, если не подписан на события датчика sensor_id)
+class Subscriber {
+public:
+    virtual ~Subscriber() = default;
+    virtual void deliver(const std::shared_ptr<const std::string>& message, int32_t sensor_id) = 0;
+};
+
+// Рассылка событий подписчикам. Сообщение сериализуется один раз и передаётся
+// всем получателям общим указателем. Подписчики хранятся слабыми ссылками:
+// закрытые соединения выпадают из списка при следующей публикации
+class Broadcaster {
+public:
+    void subscribe(const std::shared_ptr<Subscriber>& subscriber) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers_.push_back(subscriber);
+    }
+
+    void publish(const std::shared_ptr<const std::string>& message, int32_t sensor_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::size_t alive = 0;
+        for (std::size_t i = 0; i < subscribers_.size(); ++i) {
+            std::shared_ptr<Subscriber> subscriber = subscribers_[i].lock();
+            if (!subscriber)
+                continue;
+            subscriber->deliver(message, sensor_id);
+            if (alive != i)
+                subscribers_[alive] = std::move(subscribers_[i]);
+            alive++;
+        }
+        subscribers_.resize(alive);
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return subscribers_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::weak_ptr<Subscriber>> subscribers_;
+};
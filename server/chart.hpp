@@ -0,0 +1,399 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "aggregator.hpp"
+#include "crc32.hpp"
+#include "downsample.hpp"
+
+// Построение графика температуры на сервере: SVG или PNG.
+// Точки уже прорежены до ширины картинки, поэтому время построения не зависит от длины истории.
+// Оформление повторяет прежние графики клиента (matplotlib): ось температуры 0..35 с шагом 5
+// (расширяется, если значения выходят за неё), сетка, синяя линия с маркерами.
+// У каждого датчика своя линия: соседние по времени точки разных датчиков не соединяются
+
+// Разметка графика: область построения, диапазоны осей и деления
+class ChartLayout {
+public:
+    struct Tick {
+        double pos;         // Координата в пикселях
+        std::string label;
+    };
+
+    ChartLayout(const std::vector<Point>& points, int width, int height)
+        : width_(width), height_(height), left_(64), right_(width - 20), top_(40), bottom_(height - 50) {
+        y_min_ = 0;
+        y_max_ = 35;
+        if (points.empty()) {
+            t_min_ = 0;
+            t_max_ = 1;
+        } else {
+            t_min_ = points.front().ts;
+            t_max_ = points.back().ts;
+            for (const Point& point : points) {
+                y_min_ = std::min(y_min_, std::floor(point.value / 5) * 5);
+                y_max_ = std::max(y_max_, std::ceil(point.value / 5) * 5);
+            }
+            // Одна точка - полчаса в обе стороны
+            if (t_max_ == t_min_) {
+                t_min_ -= 30 * 60 * 1000;
+                t_max_ += 30 * 60 * 1000;
+            }
+        }
+        double y_step = 5;
+        while ((y_max_ - y_min_) / y_step > 10)
+            y_step *= 2;
+        for (double v = y_min_; v <= y_max_ + 1e-9; v += y_step)
+            y_ticks_.push_back(Tick{y(v), formatValue(v)});
+        if (!points.empty())
+            timeTicks();
+    }
+
+    double x(int64_t ts) const { return left_ + static_cast<double>(ts - t_min_) / static_cast<double>(t_max_ - t_min_) * (right_ - left_); }
+    double y(double value) const { return bottom_ - (value - y_min_) / (y_max_ - y_min_) * (bottom_ - top_); }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int left() const { return left_; }
+    int right() const { return right_; }
+    int top() const { return top_; }
+    int bottom() const { return bottom_; }
+    const std::vector<Tick>& xTicks() const { return x_ticks_; }
+    const std::vector<Tick>& yTicks() const { return y_ticks_; }
+
+private:
+    static std::string formatValue(double v) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%g", v);
+        return buf;
+    }
+
+    // Деления времени по круглым значениям местного времени; не больше ~8 делений
+    void timeTicks() {
+        static const int64_t MINUTE = 60 * 1000LL, HOUR = 60 * MINUTE, DAY = 24 * HOUR;
+        static const int64_t STEPS[] = {MINUTE, 5 * MINUTE, 15 * MINUTE, 30 * MINUTE, HOUR, 3 * HOUR, 6 * HOUR,
+                                        12 * HOUR, DAY, 2 * DAY, 7 * DAY, 14 * DAY, 30 * DAY, 91 * DAY, 365 * DAY};
+        int64_t span = t_max_ - t_min_;
+        int64_t step = STEPS[sizeof(STEPS) / sizeof(STEPS[0]) - 1];
+        for (int64_t s : STEPS) {
+            if (span / s <= 8) {
+                step = s;
+                break;
+            }
+        }
+        // Смещение местного времени от UTC в начале диапазона
+        struct tm tm = localTime(t_min_);
+        int64_t local = (tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec) * 1000LL;
+        int64_t offset = local - ((t_min_ % DAY) + DAY) % DAY;
+        if (offset > 14 * HOUR)
+            offset -= DAY;
+        else if (offset < -12 * HOUR)
+            offset += DAY;
+
+        const char* format = step < DAY ? "%H:%M" : step < 30 * DAY ? "%m-%d" : "%Y-%m";
+        int64_t first = t_min_ + offset;
+        first = (first / step + (first % step > 0 ? 1 : 0)) * step - offset;
+        for (int64_t ts = first; ts <= t_max_; ts += step) {
+            struct tm t = localTime(ts);
+            char buf[32];
+            strftime(buf, sizeof(buf), format, &t);
+            x_ticks_.push_back(Tick{x(ts), buf});
+        }
+    }
+
+    int width_, height_;
+    int left_, right_, top_, bottom_;
+    int64_t t_min_, t_max_;
+    double y_min_, y_max_;
+    std::vector<Tick> x_ticks_, y_ticks_;
+};
+
+// Маркеры рисуются, только если точки не сливаются
+inline bool chartMarkers(const ChartLayout& layout, std::size_t points) {
+    return points * 4 <= static_cast<std::size_t>(layout.right() - layout.left());
+}
+
+// Точки, сгруппированные по датчикам с сохранением порядка времени: линия строится между
+// соседними точками одного датчика
+inline std::vector<Point> chartSeries(const std::vector<Point>& points) {
+    std::vector<Point> series = points;
+    std::stable_sort(series.begin(), series.end(), [](const Point& a, const Point& b) { return a.sensor_id < b.sensor_id; });
+    return series;
+}
+
+// Экранирование текста для XML
+inline void appendXml(std::string& out, const std::string& text) {
+    for (char ch : text) {
+        switch (ch) {
+        case '<': out.append("&lt;"); break;
+        case '>': out.append("&gt;"); break;
+        case '&': out.append("&amp;"); break;
+        case '"': out.append("&quot;"); break;
+        default: out.push_back(ch);
+        }
+    }
+}
+
+// График в формате SVG
+inline std::string renderSvg(const std::vector<Point>& points, const std::string& title, int width, int height) {
+    ChartLayout layout(points, width, height);
+    std::string out;
+    out.reserve(4096 + points.size() * 16);
+    char buf[128];
+    snprintf(buf, sizeof(buf), "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" ", width,
+             height, width, height);
+    out.append(buf).append("font-family=\"sans-serif\" font-size=\"12\">");
+    out.append("<rect width=\"100%\" height=\"100%\" fill=\"white\"/>");
+
+    // Сетка и подписи
+    out.append("<g stroke=\"#b0b0b0\" stroke-width=\"0.8\">");
+    for (const ChartLayout::Tick& tick : layout.yTicks()) {
+        snprintf(buf, sizeof(buf), "<line x1=\"%d\" y1=\"%.1f\" x2=\"%d\" y2=\"%.1f\"/>", layout.left(), tick.pos, layout.right(), tick.pos);
+        out.append(buf);
+    }
+    for (const ChartLayout::Tick& tick : layout.xTicks()) {
+        snprintf(buf, sizeof(buf), "<line x1=\"%.1f\" y1=\"%d\" x2=\"%.1f\" y2=\"%d\"/>", tick.pos, layout.top(), tick.pos, layout.bottom());
+        out.append(buf);
+    }
+    out.append("</g><g text-anchor=\"end\">");
+    for (const ChartLayout::Tick& tick : layout.yTicks()) {
+        snprintf(buf, sizeof(buf), "<text x=\"%d\" y=\"%.1f\">", layout.left() - 6, tick.pos + 4);
+        out.append(buf).append(tick.label).append("</text>");
+    }
+    out.append("</g><g text-anchor=\"middle\">");
+    for (const ChartLayout::Tick& tick : layout.xTicks()) {
+        snprintf(buf, sizeof(buf), "<text x=\"%.1f\" y=\"%d\">", tick.pos, layout.bottom() + 16);
+        out.append(buf).append(tick.label).append("</text>");
+    }
+    snprintf(buf, sizeof(buf), "<text x=\"%d\" y=\"%d\" font-size=\"16\">", width / 2, layout.top() - 14);
+    out.append(buf);
+    appendXml(out, title);
+    snprintf(buf, sizeof(buf), "</text><text x=\"%d\" y=\"%d\">Time</text>", (layout.left() + layout.right()) / 2, height - 12);
+    out.append(buf);
+    snprintf(buf, sizeof(buf), "<text transform=\"translate(16 %d) rotate(-90)\">Temperature (&#176;C)</text>",
+             (layout.top() + layout.bottom()) / 2);
+    out.append(buf).append("</g>");
+    snprintf(buf, sizeof(buf), "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"black\"/>", layout.left(),
+             layout.top(), layout.right() - layout.left(), layout.bottom() - layout.top());
+    out.append(buf);
+
+    if (points.empty()) {
+        snprintf(buf, sizeof(buf), "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">No data</text>", (layout.left() + layout.right()) / 2,
+                 (layout.top() + layout.bottom()) / 2);
+        out.append(buf).append("</svg>");
+        return out;
+    }
+
+    std::vector<Point> series = chartSeries(points);
+    out.append("<path fill=\"none\" stroke=\"blue\" stroke-width=\"1.5\" d=\"");
+    for (std::size_t i = 0; i < series.size(); ++i) {
+        bool start = i == 0 || series[i].sensor_id != series[i - 1].sensor_id;
+        snprintf(buf, sizeof(buf), "%c%.1f %.1f", start ? 'M' : 'L', layout.x(series[i].ts), layout.y(series[i].value));
+        out.append(buf);
+    }
+    out.append("\"/>");
+    if (chartMarkers(layout, points.size())) {
+        out.append("<g fill=\"blue\">");
+        for (const Point& point : points) {
+            snprintf(buf, sizeof(buf), "<circle cx=\"%.1f\" cy=\"%.1f\" r=\"3\"/>", layout.x(point.ts), layout.y(point.value));
+            out.append(buf);
+        }
+        out.append("</g>");
+    }
+    out.append("</svg>");
+    return out;
+}
+
+// Растровое изображение RGB с простыми примитивами
+class Canvas {
+public:
+    struct Color {
+        unsigned char r, g, b;
+    };
+
+    Canvas(int width, int height, Color background)
+        : width_(width), height_(height), pixels_(static_cast<std::size_t>(width) * height * 3) {
+        for (std::size_t i = 0; i < pixels_.size(); i += 3) {
+            pixels_[i] = background.r;
+            pixels_[i + 1] = background.g;
+            pixels_[i + 2] = background.b;
+        }
+    }
+
+    // Смешение пикселя с цветом; alpha 0..1
+    void blend(int x, int y, Color color, double alpha = 1.0) {
+        if (x < 0 || y < 0 || x >= width_ || y >= height_ || alpha <= 0)
+            return;
+        unsigned char* p = &pixels_[(static_cast<std::size_t>(y) * width_ + x) * 3];
+        alpha = std::min(alpha, 1.0);
+        p[0] = static_cast<unsigned char>(p[0] + (color.r - p[0]) * alpha + 0.5);
+        p[1] = static_cast<unsigned char>(p[1] + (color.g - p[1]) * alpha + 0.5);
+        p[2] = static_cast<unsigned char>(p[2] + (color.b - p[2]) * alpha + 0.5);
+    }
+
+    void hline(int x0, int x1, int y, Color color) {
+        for (int x = x0; x <= x1; ++x)
+            blend(x, y, color);
+    }
+
+    void vline(int x, int y0, int y1, Color color) {
+        for (int y = y0; y <= y1; ++y)
+            blend(x, y, color);
+    }
+
+    // Сглаженная линия толщиной около 1.5 пикселя: покрытие пикселя считается по расстоянию до отрезка
+    void line(double x0, double y0, double x1, double y1, Color color) {
+        const double half = 0.75;
+        int xa = static_cast<int>(std::floor(std::min(x0, x1) - 1)), xb = static_cast<int>(std::ceil(std::max(x0, x1) + 1));
+        int ya = static_cast<int>(std::floor(std::min(y0, y1) - 1)), yb = static_cast<int>(std::ceil(std::max(y0, y1) + 1));
+        double dx = x1 - x0, dy = y1 - y0, len2 = dx * dx + dy * dy;
+        for (int y = std::max(ya, 0); y <= std::min(yb, height_ - 1); ++y) {
+            for (int x = std::max(xa, 0); x <= std::min(xb, width_ - 1); ++x) {
+                double px = x + 0.5 - x0, py = y + 0.5 - y0;
+                double t = len2 > 0 ? std::clamp((px * dx + py * dy) / len2, 0.0, 1.0) : 0.0;
+                double ex = px - t * dx, ey = py - t * dy;
+                double distance = std::sqrt(ex * ex + ey * ey);
+                double coverage = half + 0.5 - distance;
+                if (coverage > 0)
+                    blend(x, y, color, coverage);
+            }
+        }
+    }
+
+    // Закрашенный круг со сглаженным краем
+    void disc(double cx, double cy, double r, Color color) {
+        for (int y = static_cast<int>(cy - r - 1); y <= static_cast<int>(cy + r + 1); ++y)
+            for (int x = static_cast<int>(cx - r - 1); x <= static_cast<int>(cx + r + 1); ++x) {
+                double dx = x + 0.5 - cx, dy = y + 0.5 - cy;
+                blend(x, y, color, r + 0.5 - std::sqrt(dx * dx + dy * dy));
+            }
+    }
+
+    // Текст шрифтом 5x7 (цифры, '-', ':', '.', пробел) с увеличением scale.
+    // align: 0 - от x, 1 - по центру, 2 - до x
+    void text(int x, int y, const std::string& str, int scale, int align, Color color) {
+        int advance = 6 * scale;
+        int w = static_cast<int>(str.size()) * advance - scale;
+        if (align == 1)
+            x -= w / 2;
+        else if (align == 2)
+            x -= w;
+        for (char ch : str) {
+            const unsigned char* glyph = fontGlyph(ch);
+            for (int row = 0; row < 7; ++row)
+                for (int col = 0; col < 5; ++col)
+                    if (glyph && (glyph[row] >> (4 - col) & 1))
+                        for (int sy = 0; sy < scale; ++sy)
+                            for (int sx = 0; sx < scale; ++sx)
+                                blend(x + col * scale + sx, y + row * scale + sy, color);
+            x += advance;
+        }
+    }
+
+    // Изображение в формате PNG (RGB, 8 бит); пустая строка при ошибке сжатия
+    std::string png() const {
+        // Строки с фильтром Sub: соседние пиксели фона и сетки одинаковы и сжимаются лучше
+        std::string raw;
+        raw.reserve(static_cast<std::size_t>(height_) * (width_ * 3 + 1));
+        for (int y = 0; y < height_; ++y) {
+            const unsigned char* row = &pixels_[static_cast<std::size_t>(y) * width_ * 3];
+            raw.push_back(1);
+            for (int i = 0; i < width_ * 3; ++i)
+                raw.push_back(static_cast<char>(row[i] - (i >= 3 ? row[i - 3] : 0)));
+        }
+        uLongf size = compressBound(static_cast<uLong>(raw.size()));
+        std::string compressed(size, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &size, reinterpret_cast<const Bytef*>(raw.data()),
+                      static_cast<uLong>(raw.size()), 6) != Z_OK)
+            return std::string();
+        compressed.resize(size);
+
+        std::string out("\x89PNG\r\n\x1a\n", 8);
+        std::string header;
+        appendU32(header, static_cast<uint32_t>(width_));
+        appendU32(header, static_cast<uint32_t>(height_));
+        header.append("\x08\x02\x00\x00\x00", 5);     // 8 бит, RGB, deflate, без чересстрочности
+        chunk(out, "IHDR", header);
+        chunk(out, "IDAT", compressed);
+        chunk(out, "IEND", std::string());
+        return out;
+    }
+
+private:
+    static const unsigned char* fontGlyph(char ch) {
+        static const unsigned char DIGITS[10][7] = {
+            {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+            {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+            {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+            {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+            {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}};
+        static const unsigned char MINUS[7] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00};
+        static const unsigned char COLON[7] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00};
+        static const unsigned char DOT[7] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C};
+        if (ch >= '0' && ch <= '9')
+            return DIGITS[ch - '0'];
+        if (ch == '-')
+            return MINUS;
+        if (ch == ':')
+            return COLON;
+        if (ch == '.')
+            return DOT;
+        return nullptr;
+    }
+
+    static void appendU32(std::string& out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+
+    // Блок PNG: длина, тип, данные и CRC типа с данными
+    static void chunk(std::string& out, const char* type, const std::string& data) {
+        appendU32(out, static_cast<uint32_t>(data.size()));
+        std::size_t start = out.size();
+        out.append(type, 4).append(data);
+        appendU32(out, crc32(out.data() + start, out.size() - start));
+    }
+
+    int width_, height_;
+    std::vector<unsigned char> pixels_;
+};
+
+// График в формате PNG. Растровый шрифт содержит только цифры, поэтому заголовок и подписи осей
+// не рисуются - их показывает страница клиента
+inline std::string renderPng(const std::vector<Point>& points, int width, int height) {
+    const Canvas::Color WHITE{255, 255, 255}, GRID{176, 176, 176}, BLACK{0, 0, 0}, BLUE{0, 0, 255};
+    ChartLayout layout(points, width, height);
+    Canvas canvas(width, height, WHITE);
+    int scale = height >= 400 ? 2 : 1;
+
+    for (const ChartLayout::Tick& tick : layout.yTicks()) {
+        int y = static_cast<int>(std::lround(tick.pos));
+        canvas.hline(layout.left(), layout.right(), y, GRID);
+        canvas.text(layout.left() - 6, y - 7 * scale / 2, tick.label, scale, 2, BLACK);
+    }
+    for (const ChartLayout::Tick& tick : layout.xTicks()) {
+        int x = static_cast<int>(std::lround(tick.pos));
+        canvas.vline(x, layout.top(), layout.bottom(), GRID);
+        canvas.text(x, layout.bottom() + 6, tick.label, scale, 1, BLACK);
+    }
+    canvas.hline(layout.left(), layout.right(), layout.top(), BLACK);
+    canvas.hline(layout.left(), layout.right(), layout.bottom(), BLACK);
+    canvas.vline(layout.left(), layout.top(), layout.bottom(), BLACK);
+    canvas.vline(layout.right(), layout.top(), layout.bottom(), BLACK);
+
+    std::vector<Point> series = chartSeries(points);
+    for (std::size_t i = 1; i < series.size(); ++i)
+        if (series[i].sensor_id == series[i - 1].sensor_id)
+            canvas.line(layout.x(series[i - 1].ts), layout.y(series[i - 1].value), layout.x(series[i].ts), layout.y(series[i].value), BLUE);
+    if (chartMarkers(layout, points.size()) || points.size() == 1)
+        for (const Point& point : points)
+            canvas.disc(layout.x(point.ts), layout.y(point.value), 3, BLUE);
+    return canvas.png();
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+// Сжатие тел HTTP-ответов (Content-Encoding: gzip или deflate) через zlib.
+// deflate в HTTP - поток zlib (RFC 1950), gzip - с заголовком gzip (RFC 1952)
+enum ContentEncoding {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE
+};
+
+// Тела меньше этого размера не сжимаются: выигрыш меньше заголовков
+const std::size_t MIN_COMPRESS_SIZE = 1024;
+
+// Уровни сжатия ответов: готовые тела из кэша сжимаются один раз на версию данных,
+// потоковые и разовые ответы - на каждый запрос, поэтому быстрее
+const int CACHED_COMPRESSION_LEVEL = 6;
+const int STREAM_COMPRESSION_LEVEL = 1;
+
+inline const char* encodingName(ContentEncoding encoding) {
+    switch (encoding) {
+    case ENCODING_GZIP:
+        return "gzip";
+    case ENCODING_DEFLATE:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+// Выбор кодировки по заголовку Accept-Encoding: с наибольшим q, при равных gzip.
+// Без заголовка или без поддерживаемых кодировок - без сжатия
+inline ContentEncoding negotiateEncoding(std::string_view accept) {
+    ContentEncoding best = ENCODING_IDENTITY;
+    double best_q = 0;
+    while (!accept.empty()) {
+        std::size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        std::size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon);
+        while (!name.empty() && name.front() == ' ')
+            name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ')
+            name.remove_suffix(1);
+        ContentEncoding encoding;
+        if (name == "gzip" || name == "x-gzip" || name == "*")
+            encoding = ENCODING_GZIP;
+        else if (name == "deflate")
+            encoding = ENCODING_DEFLATE;
+        else
+            continue;
+
+        double q = 1;
+        std::size_t pos = semicolon == std::string_view::npos ? std::string_view::npos : item.find("q=", semicolon);
+        if (pos != std::string_view::npos)
+            q = std::strtod(std::string(item.substr(pos + 2)).c_str(), nullptr);
+        if (q > best_q || (q == best_q && encoding == ENCODING_GZIP)) {
+            best = encoding;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+// Потоковое сжатие: тело подаётся порциями, сжатые данные дописываются в out.
+// Между порциями zlib копит данные у себя, поэтому выход порции может быть пустым
+class StreamCompressor {
+public:
+    StreamCompressor(ContentEncoding encoding, int level) {
+        ok_ = deflateInit2(&stream_, level, Z_DEFLATED, encoding == ENCODING_GZIP ? 15 + 16 : 15, 8,
+                           Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~StreamCompressor() {
+        if (ok_)
+            deflateEnd(&stream_);
+    }
+
+    // finish - последняя порция: поток завершается
+    bool compress(std::string_view in, std::string& out, bool finish) {
+        if (!ok_)
+            return false;
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        stream_.avail_in = static_cast<uInt>(in.size());
+        int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+        int rc;
+        do {
+            std::size_t pos = out.size();
+            std::size_t room = deflateBound(&stream_, stream_.avail_in) + 64;
+            out.resize(pos + room);
+            stream_.next_out = reinterpret_cast<Bytef*>(&out[pos]);
+            stream_.avail_out = static_cast<uInt>(room);
+            rc = deflate(&stream_, flush);
+            out.resize(pos + room - stream_.avail_out);
+        } while (rc == Z_OK && (finish || stream_.avail_in > 0));
+        return finish ? rc == Z_STREAM_END : rc == Z_OK || rc == Z_BUF_ERROR;
+    }
+
+private:
+    z_stream stream_{};
+    bool ok_ = false;
+
+    StreamCompressor(const StreamCompressor&) = delete;
+    StreamCompressor& operator=(const StreamCompressor&) = delete;
+};
+
+// Сжатие тела целиком
+inline bool compressBody(std::string_view in, ContentEncoding encoding, int level, std::string& out) {
+    StreamCompressor compressor(encoding, level);
+    out.clear();
+    return compressor.compress(in, out, true);
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include "storage.hpp"
+#include "aggregator.hpp"
+#include "archive.hpp"
+#include "logger.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Запись в базу через подготовленные выражения.
+// Выражения готовятся при первом использовании и живут всё время соединения,
+// поэтому SQL разбирается один раз, а значения передаются через bind.
+// Имена таблиц подставляются в текст запроса, поэтому допускаются только
+// константы из кода, а не внешние данные.
+// Класс не потокобезопасен: вызывающий код сериализует доступ к соединению.
+class DbWriter {
+public:
+    explicit DbWriter(sqlite3* db) : db_(db) {}
+    ~DbWriter() {
+        for (auto& entry : statements_)
+            sqlite3_finalize(entry.second);
+    }
+
+    // Вставка одной строки в таблицу
+    bool insert(const std::string& table, const Reading& reading) {
+        sqlite3_stmt* stmt = statement("INSERT INTO " + table + " (ts, sensor_id, value) VALUES (?, ?, ?);");
+        return stmt && insertRow(stmt, reading);
+    }
+
+    // Вставка набора строк одной транзакцией: одна фиксация на диск вместо фиксации на каждую строку.
+    // Ошибка отдельной строки (например, повтор ключа) откатывает только эту строку,
+    // как и раньше при вставке по одной; такие строки не входят в inserted() и в журнал
+    // попадает одна запись на порцию. false - если транзакцию зафиксировать не удалось.
+    // ignore_existing - строки, уже записанные в таблицу, молча пропускаются (повтор журнала после сбоя)
+    template<class Rows>
+    bool insertBatch(const std::string& table, const Rows& rows, bool ignore_existing = false) {
+        inserted_ = 0;
+        sqlite3_stmt* stmt = statement(std::string(ignore_existing ? "INSERT OR IGNORE" : "INSERT") + " INTO " + table +
+                                       " (ts, sensor_id, value) VALUES (?, ?, ?);");
+        if (!stmt || !begin())
+            return false;
+        std::size_t rejected = 0;
+        std::string error;
+        for (const Reading& row : rows) {
+            sqlite3_bind_int64(stmt, 1, row.ts);
+            sqlite3_bind_int(stmt, 2, row.sensor_id);
+            sqlite3_bind_double(stmt, 3, row.value);
+            if (sqlite3_step(stmt) == SQLITE_DONE) {
+                inserted_ += static_cast<std::size_t>(sqlite3_changes(db_));
+            } else if (rejected++ == 0) {
+                error = sqlite3_errmsg(db_);
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_clear_bindings(stmt);
+        if (rejected > 0)
+            LOG_ERROR("SQL error: " << rejected << " of " << rows.size() << " rows not inserted into " << table << ": " << error);
+        if (commit())
+            return true;
+        inserted_ = 0;
+        return false;
+    }
+
+    // Строк, вставленных последним insertBatch
+    std::size_t inserted() const { return inserted_; }
+
+    // Удаление не больше limit самых старых записей старше cutoff (мс от эпохи); deleted - сколько удалено.
+    // Порция ограничена, чтобы удаление большого хвоста не держало базу долго
+    bool deleteOldest(const std::string& table, int64_t cutoff, std::size_t limit, std::size_t& deleted) {
+        sqlite3_stmt* stmt = statement("DELETE FROM " + table + " WHERE (ts, sensor_id) IN (SELECT ts, sensor_id FROM " + table +
+                                       " WHERE ts < ? ORDER BY ts LIMIT ?);");
+        deleted = 0;
+        if (!stmt)
+            return false;
+        sqlite3_bind_int64(stmt, 1, cutoff);
+        sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(limit));
+        if (!execute(stmt))
+            return false;
+        deleted = static_cast<std::size_t>(sqlite3_changes(db_));
+        return true;
+    }
+
+    // Число записей старше cutoff
+    int64_t countOlderThan(const std::string& table, int64_t cutoff) {
+        sqlite3_stmt* stmt = statement("SELECT COUNT(*) FROM " + table + " WHERE ts < ?;");
+        if (!stmt)
+            return 0;
+        sqlite3_bind_int64(stmt, 1, cutoff);
+        int64_t count = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return count;
+    }
+
+    // Страниц в списке свободных: освобождены удалением, но файл не уменьшился
+    int64_t freePages() {
+        sqlite3_stmt* stmt = statement("PRAGMA freelist_count;");
+        if (!stmt)
+            return 0;
+        int64_t pages = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+        sqlite3_reset(stmt);
+        return pages;
+    }
+
+    // Режим PRAGMA auto_vacuum (AUTO_VACUUM_INCREMENTAL - освобождённое место можно вернуть файлу)
+    int64_t autoVacuum() { return queryInt(db_, "PRAGMA auto_vacuum;"); }
+
+    // Возврат файлу до pages свободных страниц (только при auto_vacuum = INCREMENTAL)
+    bool incrementalVacuum(int64_t pages) {
+        std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ");";
+        char* errMsg = 0;
+        if (sqlite3_exec(db_, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+            LOG_ERROR("SQL error: " << errMsg);
+            sqlite3_free(errMsg);
+            return false;
+        }
+        return true;
+    }
+
+    // Самая ранняя метка в таблице; false, если таблица пуста
+    bool oldest(const std::string& table, int64_t& ts) {
+        sqlite3_stmt* stmt = statement("SELECT MIN(ts) FROM " + table + ";");
+        if (!stmt)
+            return false;
+        bool found = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+        if (found)
+            ts = sqlite3_column_int64(stmt, 0);
+        sqlite3_reset(stmt);
+        return found;
+    }
+
+    // Датчики, у которых есть строки таблицы за [from, to)
+    bool sensors(const std::string& table, int64_t from, int64_t to, std::vector<int32_t>& sensors) {
+        sqlite3_stmt* stmt = statement("SELECT DISTINCT sensor_id FROM " + table + " WHERE ts >= ? AND ts < ? ORDER BY sensor_id;");
+        if (!stmt)
+            return false;
+        sqlite3_bind_int64(stmt, 1, from);
+        sqlite3_bind_int64(stmt, 2, to);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            sensors.push_back(sqlite3_column_int(stmt, 0));
+        return finishQuery(stmt, rc);
+    }
+
+    // Строки датчика за [from, to) по возрастанию времени
+    template<class Rows>
+    bool rows(const std::string& table, int32_t sensor_id, int64_t from, int64_t to, Rows& rows) {
+        sqlite3_stmt* stmt = statement("SELECT ts, value FROM " + table + " WHERE sensor_id = ? AND ts >= ? AND ts < ? ORDER BY ts;");
+        if (!stmt)
+            return false;
+        sqlite3_bind_int(stmt, 1, sensor_id);
+        sqlite3_bind_int64(stmt, 2, from);
+        sqlite3_bind_int64(stmt, 3, to);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            rows.push_back(Reading{sqlite3_column_int64(stmt, 0), sqlite3_column_double(stmt, 1), sensor_id});
+        return finishQuery(stmt, rc);
+    }
+
+    // Удаление строк rows[first, first + count) по ключу (ts, sensor_id) одной транзакцией.
+    // Строки таблицы с другими ключами (например, пришедшие позже в тот же диапазон) не затрагиваются
+    template<class Rows>
+    bool deleteRows(const std::string& table, const Rows& rows, std::size_t first, std::size_t count) {
+        sqlite3_stmt* stmt = statement("DELETE FROM " + table + " WHERE ts = ? AND sensor_id = ?;");
+        if (!stmt || !begin())
+            return false;
+        bool ok = true;
+        for (std::size_t i = first; i < first + count && ok; ++i) {
+            sqlite3_bind_int64(stmt, 1, rows[i].ts);
+            sqlite3_bind_int(stmt, 2, rows[i].sensor_id);
+            ok = execute(stmt);
+        }
+        if (ok)
+            return commit();
+        rollback();
+        return false;
+    }
+
+    // Строка индекса архива (новый чанк или замена чанка тех же суток)
+    bool insertChunk(const ArchiveChunk& chunk) {
+        sqlite3_stmt* stmt = statement("INSERT OR REPLACE INTO archive_chunks (day, sensor_id, count, min_ts, max_ts, min, max, bytes)"
+                                       " VALUES (?, ?, ?, ?, ?, ?, ?, ?);");
+        if (!stmt)
+            return false;
+        sqlite3_bind_int64(stmt, 1, chunk.day);
+        sqlite3_bind_int(stmt, 2, chunk.sensor_id);
+        sqlite3_bind_int64(stmt, 3, chunk.count);
+        sqlite3_bind_int64(stmt, 4, chunk.min_ts);
+        sqlite3_bind_int64(stmt, 5, chunk.max_ts);
+        sqlite3_bind_double(stmt, 6, chunk.min);
+        sqlite3_bind_double(stmt, 7, chunk.max);
+        sqlite3_bind_int64(stmt, 8, chunk.bytes);
+        return execute(stmt);
+    }
+
+    // Запись закрытого интервала в таблицу агрегатов; ключ - начало интервала
+    bool insertAggregate(const std::string& table, int32_t sensor_id, const Bucket& bucket) {
+        sqlite3_stmt* stmt = statement("INSERT OR REPLACE INTO " + table +
+                                       " (ts, sensor_id, value, count, min, max, stddev) VALUES (?, ?, ?, ?, ?, ?, ?);");
+        if (!stmt)
+            return false;
+        sqlite3_bind_int64(stmt, 1, bucket.start);
+        sqlite3_bind_int(stmt, 2, sensor_id);
+        sqlite3_bind_double(stmt, 3, bucket.average());
+        sqlite3_bind_int64(stmt, 4, bucket.count);
+        sqlite3_bind_double(stmt, 5, bucket.min);
+        sqlite3_bind_double(stmt, 6, bucket.max);
+        sqlite3_bind_double(stmt, 7, bucket.stddev());
+        return execute(stmt);
+    }
+
+    // Статистика значений датчика в таблице за [from, to)
+    Bucket statistics(const std::string& table, int32_t sensor_id, int64_t from, int64_t to) {
+        Bucket bucket;
+        sqlite3_stmt* stmt = statement("SELECT COUNT(*), TOTAL(value), MIN(value), MAX(value), TOTAL(value * value) FROM " + table +
+                                       " WHERE ts >= ? AND ts < ? AND sensor_id = ?;");
+        if (!stmt)
+            return bucket;
+        sqlite3_bind_int64(stmt, 1, from);
+        sqlite3_bind_int64(stmt, 2, to);
+        sqlite3_bind_int(stmt, 3, sensor_id);
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) > 0) {
+            bucket.count = sqlite3_column_int64(stmt, 0);
+            bucket.sum = sqlite3_column_double(stmt, 1);
+            bucket.min = sqlite3_column_double(stmt, 2);
+            bucket.max = sqlite3_column_double(stmt, 3);
+            bucket.mean = bucket.sum / static_cast<double>(bucket.count);
+            bucket.m2 = std::max(0.0, sqlite3_column_double(stmt, 4) - bucket.sum * bucket.mean);
+        }
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return bucket;
+    }
+
+    // Управление транзакцией
+    bool begin() { return execute(statement("BEGIN IMMEDIATE;")); }
+    bool commit() {
+        if (execute(statement("COMMIT;")))
+            return true;
+        rollback();
+        return false;
+    }
+    void rollback() { execute(statement("ROLLBACK;")); }
+
+private:
+    // Подготовленное выражение из кэша
+    sqlite3_stmt* statement(const std::string& sql) {
+        auto it = statements_.find(sql);
+        if (it != statements_.end())
+            return it->second;
+        sqlite3_stmt* stmt = nullptr;
+        int rc = sqlite3_prepare_v3(db_, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+        if (rc != SQLITE_OK) {
+            LOG_ERROR("Failed to prepare statement: " << sqlite3_errmsg(db_));
+            return nullptr;
+        }
+        statements_.emplace(sql, stmt);
+        return stmt;
+    }
+
+    bool insertRow(sqlite3_stmt* stmt, const Reading& reading) {
+        sqlite3_bind_int64(stmt, 1, reading.ts);
+        sqlite3_bind_int(stmt, 2, reading.sensor_id);
+        sqlite3_bind_double(stmt, 3, reading.value);
+        return execute(stmt);
+    }
+
+    // Конец выборки строк: ошибка в журнал, выражение сбрасывается для повторного использования
+    bool finishQuery(sqlite3_stmt* stmt, int rc) {
+        if (rc != SQLITE_DONE)
+            LOG_ERROR("SQL error: " << sqlite3_errmsg(db_));
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return rc == SQLITE_DONE;
+    }
+
+    // Выполнение выражения без результата и сброс для повторного использования
+    bool execute(sqlite3_stmt* stmt) {
+        if (!stmt)
+            return false;
+        int rc = sqlite3_step(stmt);
+        bool ok = rc == SQLITE_DONE || rc == SQLITE_ROW;
+        if (!ok)
+            LOG_ERROR("SQL error: " << sqlite3_errmsg(db_));
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return ok;
+    }
+
+    sqlite3* db_;
+    std::map<std::string, sqlite3_stmt*> statements_;
+    std::size_t inserted_ = 0;
+
+    DbWriter(const DbWriter&) = delete;
+    DbWriter& operator=(const DbWriter&) = delete;
+};
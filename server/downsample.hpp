@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Точка ряда: время (мс от эпохи), значение и датчик
+struct Point {
+    int64_t ts;
+    double value;
+    int32_t sensor_id = 0;
+};
+
+// Прореживание Largest-Triangle-Three-Buckets (Steinarsson, 2013).
+// Первая и последняя точки сохраняются, остальные делятся на threshold - 2 корзины;
+// из каждой берётся точка, образующая наибольший треугольник с выбранной точкой
+// предыдущей корзины и средним следующей. Форма графика при этом сохраняется.
+// При threshold == 2 (наименьшее max_points) остаются только первая и последняя точки
+inline std::vector<Point> downsampleLttb(const std::vector<Point>& data, std::size_t threshold) {
+    if (threshold >= data.size() || threshold < 2)
+        return data;
+    if (threshold == 2)
+        return {data.front(), data.back()};
+
+    std::vector<Point> sampled;
+    sampled.reserve(threshold);
+    sampled.push_back(data.front());
+
+    double every = static_cast<double>(data.size() - 2) / static_cast<double>(threshold - 2);
+    std::size_t a = 0;
+    for (std::size_t i = 0; i < threshold - 2; ++i) {
+        // Среднее следующей корзины
+        std::size_t avg_start = static_cast<std::size_t>(std::floor((i + 1) * every)) + 1;
+        std::size_t avg_end = std::min(static_cast<std::size_t>(std::floor((i + 2) * every)) + 1, data.size());
+        double avg_x = 0.0, avg_y = 0.0;
+        for (std::size_t j = avg_start; j < avg_end; ++j) {
+            avg_x += static_cast<double>(data[j].ts);
+            avg_y += data[j].value;
+        }
+        double avg_len = static_cast<double>(avg_end - avg_start);
+        avg_x /= avg_len;
+        avg_y /= avg_len;
+
+        // Точка текущей корзины с наибольшей площадью треугольника
+        std::size_t range_start = static_cast<std::size_t>(std::floor(i * every)) + 1;
+        std::size_t range_end = static_cast<std::size_t>(std::floor((i + 1) * every)) + 1;
+        double ax = static_cast<double>(data[a].ts), ay = data[a].value;
+        double max_area = -1.0;
+        std::size_t next_a = range_start;
+        for (std::size_t j = range_start; j < range_end; ++j) {
+            double area = std::fabs((ax - avg_x) * (data[j].value - ay) -
+                                    (ax - static_cast<double>(data[j].ts)) * (avg_y - ay));
+            if (area > max_area) {
+                max_area = area;
+                next_a = j;
+            }
+        }
+        sampled.push_back(data[next_a]);
+        a = next_a;
+    }
+
+    sampled.push_back(data.back());
+    return sampled;
+}
+
+// Прореживание минимумом и максимумом: диапазон времени делится на max_points / 2 равных
+// интервалов, из каждого берутся точки минимума и максимума в порядке времени.
+// Выбросы, которые LTTB мог бы сгладить, сохраняются
+inline std::vector<Point> downsampleMinMax(const std::vector<Point>& data, std::size_t max_points) {
+    std::size_t buckets = max_points / 2;
+    if (data.size() <= max_points || buckets == 0)
+        return data;
+
+    int64_t first = data.front().ts;
+    double width = static_cast<double>(data.back().ts - first + 1) / static_cast<double>(buckets);
+
+    std::vector<Point> sampled;
+    sampled.reserve(buckets * 2);
+    std::size_t i = 0;
+    while (i < data.size()) {
+        std::size_t bucket = static_cast<std::size_t>(static_cast<double>(data[i].ts - first) / width);
+        std::size_t lo = i, hi = i;
+        for (++i; i < data.size() && static_cast<std::size_t>(static_cast<double>(data[i].ts - first) / width) == bucket; ++i) {
+            if (data[i].value < data[lo].value)
+                lo = i;
+            if (data[i].value > data[hi].value)
+                hi = i;
+        }
+        if (lo == hi) {
+            sampled.push_back(data[lo]);
+        } else {
+            sampled.push_back(data[std::min(lo, hi)]);
+            sampled.push_back(data[std::max(lo, hi)]);
+        }
+    }
+    return sampled;
+}
+
+// Прореживание по датчикам: ряд каждого датчика прореживается отдельно до target точек
+// (ряды разных датчиков не смешиваются в одну кривую). data упорядочен по времени;
+// результат - тоже, при равном времени - по датчику
+template <class Downsample>
+std::vector<Point> downsampleBySensor(const std::vector<Point>& data, std::size_t target, Downsample downsample) {
+    std::map<int32_t, std::vector<Point>> series;
+    for (const Point& point : data)
+        series[point.sensor_id].push_back(point);
+    if (series.size() <= 1)
+        return downsample(data, target);
+
+    std::vector<Point> sampled;
+    for (const auto& item : series) {
+        std::vector<Point> part = downsample(item.second, target);
+        sampled.insert(sampled.end(), part.begin(), part.end());
+    }
+    std::sort(sampled.begin(), sampled.end(),
+              [](const Point& a, const Point& b) { return a.ts != b.ts ? a.ts < b.ts : a.sensor_id < b.sensor_id; });
+    return sampled;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "storage.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Сжатие ряда измерений одного датчика по схеме Gorilla (Facebook, 2015):
+//  - метки времени - разность разностей (delta-of-delta) соседних меток кодом переменной длины;
+//    при постоянном периоде опроса метка занимает 1 бит;
+//  - значения - XOR с предыдущим значением; у повторяющегося значения 1 бит, у близких
+//    значимые биты XOR пишутся в окне предыдущего значения без повторения его границ.
+// Строки подаются по возрастанию времени, метки - мс от эпохи
+
+// Число ведущих и завершающих нулевых бит; x != 0
+inline int leadingZeros(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+inline int trailingZeros(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// Запись битового потока (старшие биты первыми)
+class BitWriter {
+public:
+    explicit BitWriter(std::string& out) : out_(out) {}
+
+    void write(uint64_t bits, int count) {
+        while (count > 0) {
+            if (free_ == 0) {
+                out_.push_back('\0');
+                free_ = 8;
+            }
+            int n = count < free_ ? count : free_;
+            uint64_t chunk = (bits >> (count - n)) & ((uint64_t(1) << n) - 1);
+            out_.back() = static_cast<char>(static_cast<unsigned char>(out_.back()) | (chunk << (free_ - n)));
+            free_ -= n;
+            count -= n;
+        }
+    }
+
+private:
+    std::string& out_;
+    int free_ = 0;      // Свободных бит в последнем байте
+};
+
+// Чтение битового потока; за концом данных читаются нули, ошибку показывает overrun()
+class BitReader {
+public:
+    BitReader(const char* data, std::size_t size) : data_(reinterpret_cast<const unsigned char*>(data)), size_(size) {}
+
+    uint64_t read(int count) {
+        uint64_t bits = 0;
+        while (count > 0) {
+            std::size_t byte = pos_ >> 3;
+            int used = static_cast<int>(pos_ & 7);
+            int n = count < 8 - used ? count : 8 - used;
+            unsigned value = byte < size_ ? data_[byte] : 0;
+            if (byte >= size_)
+                overrun_ = true;
+            bits = (bits << n) | ((value >> (8 - used - n)) & ((1u << n) - 1));
+            pos_ += static_cast<std::size_t>(n);
+            count -= n;
+        }
+        return bits;
+    }
+
+    bool bit() { return read(1) != 0; }
+    bool overrun() const { return overrun_; }
+
+private:
+    const unsigned char* data_;
+    std::size_t size_;
+    std::size_t pos_ = 0;
+    bool overrun_ = false;
+};
+
+// Кодирование ряда values[i] с метками ts[i] (в порядке возрастания); результат дописывается в out
+class GorillaEncoder {
+public:
+    explicit GorillaEncoder(std::string& out) : bits_(out) {}
+
+    void add(int64_t ts, double value) {
+        uint64_t raw;
+        std::memcpy(&raw, &value, sizeof(raw));
+        if (count_++ == 0) {
+            bits_.write(static_cast<uint64_t>(ts), 64);
+            bits_.write(raw, 64);
+        } else {
+            writeTimestamp(ts - prev_ts_ - prev_delta_);
+            prev_delta_ = ts - prev_ts_;
+            writeValue(raw ^ prev_value_);
+        }
+        prev_ts_ = ts;
+        prev_value_ = raw;
+    }
+
+private:
+    // Разность разностей: '0' | '10'+7 бит | '110'+9 бит | '1110'+12 бит | '1111'+64 бита
+    void writeTimestamp(int64_t dod) {
+        if (dod == 0)
+            bits_.write(0, 1);
+        else if (dod >= -63 && dod <= 64)
+            bits_.write((uint64_t(0x2) << 7) | (static_cast<uint64_t>(dod + 63) & 0x7F), 9);
+        else if (dod >= -255 && dod <= 256)
+            bits_.write((uint64_t(0x6) << 9) | (static_cast<uint64_t>(dod + 255) & 0x1FF), 12);
+        else if (dod >= -2047 && dod <= 2048)
+            bits_.write((uint64_t(0xE) << 12) | (static_cast<uint64_t>(dod + 2047) & 0xFFF), 16);
+        else {
+            bits_.write(0xF, 4);
+            bits_.write(static_cast<uint64_t>(dod), 64);
+        }
+    }
+
+    // XOR значений: '0' - повтор; '10' - значимые биты в окне предыдущего;
+    // '11' + 5 бит ведущих нулей + 6 бит длины (64 пишется как 0) + значимые биты
+    void writeValue(uint64_t x) {
+        if (x == 0) {
+            bits_.write(0, 1);
+            return;
+        }
+        int leading = leadingZeros(x);
+        int trailing = trailingZeros(x);
+        if (leading > 31)
+            leading = 31;
+        if (window_ && leading >= leading_ && trailing >= trailing_) {
+            int length = 64 - leading_ - trailing_;
+            bits_.write(0x2, 2);
+            bits_.write(x >> trailing_, length);
+            return;
+        }
+        int length = 64 - leading - trailing;
+        bits_.write(0x3, 2);
+        bits_.write(static_cast<uint64_t>(leading), 5);
+        bits_.write(static_cast<uint64_t>(length & 63), 6);
+        bits_.write(x >> trailing, length);
+        window_ = true;
+        leading_ = leading;
+        trailing_ = trailing;
+    }
+
+    BitWriter bits_;
+    std::size_t count_ = 0;
+    int64_t prev_ts_ = 0;
+    int64_t prev_delta_ = 0;
+    uint64_t prev_value_ = 0;
+    bool window_ = false;
+    int leading_ = 0;
+    int trailing_ = 0;
+};
+
+// Декодирование count измерений датчика sensor_id; false - данные повреждены
+template <class Rows>
+bool gorillaDecode(const char* data, std::size_t size, std::size_t count, int32_t sensor_id, Rows& rows) {
+    BitReader bits(data, size);
+    int64_t ts = 0, delta = 0;
+    uint64_t value = 0;
+    int leading = 0, trailing = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (i == 0) {
+            ts = static_cast<int64_t>(bits.read(64));
+            value = bits.read(64);
+        } else {
+            int64_t dod;
+            if (!bits.bit())
+                dod = 0;
+            else if (!bits.bit())
+                dod = static_cast<int64_t>(bits.read(7)) - 63;
+            else if (!bits.bit())
+                dod = static_cast<int64_t>(bits.read(9)) - 255;
+            else if (!bits.bit())
+                dod = static_cast<int64_t>(bits.read(12)) - 2047;
+            else
+                dod = static_cast<int64_t>(bits.read(64));
+            delta += dod;
+            ts += delta;
+
+            if (bits.bit()) {
+                if (bits.bit()) {
+                    leading = static_cast<int>(bits.read(5));
+                    int length = static_cast<int>(bits.read(6));
+                    if (length == 0)
+                        length = 64;
+                    trailing = 64 - leading - length;
+                    if (trailing < 0)
+                        return false;
+                }
+                value ^= bits.read(64 - leading - trailing) << trailing;
+            }
+        }
+        if (bits.overrun())
+            return false;
+        double v;
+        std::memcpy(&v, &value, sizeof(v));
+        rows.push_back(Reading{ts, v, sensor_id});
+    }
+    return true;
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "archive.hpp"
+#include "storage.hpp"
+#include "logger.hpp"
+
+// Кольцевой буфер измерений, упорядоченных по (ts, sensor_id), в виде структуры массивов:
+// поиск по времени и проход по диапазону читают только массив меток и массив значений подряд.
+// Ёмкость - степень двойки, растёт удвоением
+class ReadingRing {
+public:
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    int64_t ts(std::size_t i) const { return ts_[slot(i)]; }
+    double value(std::size_t i) const { return values_[slot(i)]; }
+    int32_t sensor(std::size_t i) const { return sensors_[slot(i)]; }
+
+    void push_back(int64_t ts, int32_t sensor_id, double value) {
+        if (size_ == ts_.size())
+            grow();
+        std::size_t s = slot(size_);
+        ts_[s] = ts;
+        sensors_[s] = sensor_id;
+        values_[s] = value;
+        size_++;
+    }
+    void pop_front() {
+        head_ = (head_ + 1) & mask();
+        size_--;
+    }
+    void pop_back() { size_--; }
+    void clear() { head_ = size_ = 0; }
+
+    // Первая позиция с ts >= t
+    std::size_t lowerBound(int64_t t) const {
+        std::size_t lo = 0, hi = size_;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (ts(mid) < t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Первая позиция с ключом (ts, sensor_id) больше заданного
+    std::size_t upperBound(int64_t t, int64_t sensor_id) const {
+        std::size_t i = lowerBound(t);
+        while (i < size_ && ts(i) == t && sensor(i) <= sensor_id)
+            ++i;
+        return i;
+    }
+
+private:
+    std::size_t mask() const { return ts_.size() - 1; }
+    std::size_t slot(std::size_t i) const { return (head_ + i) & mask(); }
+
+    void grow() {
+        std::size_t capacity = ts_.empty() ? 1024 : ts_.size() * 2;
+        std::vector<int64_t> ts(capacity);
+        std::vector<double> values(capacity);
+        std::vector<int32_t> sensors(capacity);
+        for (std::size_t i = 0; i < size_; ++i) {
+            ts[i] = this->ts(i);
+            values[i] = value(i);
+            sensors[i] = sensor(i);
+        }
+        ts_.swap(ts);
+        values_.swap(values);
+        sensors_.swap(sensors);
+        head_ = 0;
+    }
+
+    std::vector<int64_t> ts_;
+    std::vector<double> values_;
+    std::vector<int32_t> sensors_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+};
+
+// Готовый ответ: тело и таблица-источник (заголовок X-Source-Table; пустая - без заголовка)
+struct CachedResponse {
+    std::shared_ptr<const std::string> body;
+    std::string source_table;
+};
+
+// Кэш горячих данных сервера: сырые значения за последние window мс и все строки таблиц агрегатов,
+// плюс уже сериализованные ответы на запросы к ним.
+//
+// Обновление инкрементальное: если PRAGMA data_version не изменился, база не трогается вовсе;
+// иначе дочитываются сырые строки после отметки high-water mark (с перекрытием на случай
+// строк, записанных с опозданием) и перечитываются небольшие таблицы агрегатов.
+// Каждое изменение увеличивает версию данных; версия входит в ETag ответов.
+//
+// Чтение - под разделяемой блокировкой (lock_shared), обновление - под исключительной
+class HotCache {
+public:
+    // Таблицы в порядке STORAGE_TABLES
+    static const int TABLES = 3;
+
+    HotCache(const char* path, int64_t window) : window_(window), started_(nowMillis()) {
+        db_ = openDatabase(path, true);
+    }
+    ~HotCache() { sqlite3_close(db_); }
+
+    // Обновление из базы; true, если данные изменились
+    bool refresh() {
+        if (!db_)
+            return false;
+        int64_t data_version = queryInt(db_, "PRAGMA data_version;");
+        if (initialized_ && data_version == data_version_)
+            return false;
+
+        // Чтение из базы - без блокировки кэша, чтобы не задерживать запросы
+        int64_t now = nowMillis();
+        int64_t from = now - window_;
+        if (initialized_ && hwm_ != std::numeric_limits<int64_t>::min())
+            from = std::max(hwm_ - REFRESH_OVERLAP, from);
+        std::vector<Row> raw;
+        bool ok = load("SELECT ts, sensor_id, value FROM temperatures WHERE ts >= ?1 ORDER BY ts, sensor_id;", from, raw);
+        std::vector<Row> aggregates[TABLES];
+        for (int t = 1; t < TABLES && ok; ++t)
+            ok = load(std::string("SELECT ts, sensor_id, value FROM ") + STORAGE_TABLES[t] + " ORDER BY ts, sensor_id;",
+                      std::numeric_limits<int64_t>::min(), aggregates[t]);
+        if (!ok)
+            return false;
+        // Сырые строки раньше archivedUntil() читаются из архива, а в таблице их может уже не быть
+        // (срок хранения temperatures короче окна). Граница читается после строк: архивация между
+        // ними только сдвигает её вперёд
+        int64_t covered_from = std::max(now - window_, archivedUntil(db_));
+
+        // Ключи последних строк до обновления: строки после них - новые.
+        // Таблицы меняет только refresh(), поэтому читать их здесь можно без блокировки
+        std::pair<int64_t, int32_t> last[TABLES];
+        for (int t = 0; t < TABLES; ++t) {
+            const ReadingRing& ring = tables_[t];
+            last[t] = ring.empty() ? std::make_pair(std::numeric_limits<int64_t>::min(), 0)
+                                   : std::make_pair(ring.ts(ring.size() - 1), ring.sensor(ring.size() - 1));
+        }
+        bool notify = initialized_ && listener_;
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        ReadingRing& ring = tables_[0];
+        while (!ring.empty() && ring.ts(ring.size() - 1) >= from)
+            ring.pop_back();
+        for (const Row& row : raw)
+            ring.push_back(row.ts, row.sensor_id, row.value);
+        while (!ring.empty() && ring.ts(0) < now - window_)
+            ring.pop_front();
+        if (!ring.empty())
+            hwm_ = std::max(hwm_, ring.ts(ring.size() - 1));
+
+        for (int t = 1; t < TABLES; ++t) {
+            tables_[t].clear();
+            for (const Row& row : aggregates[t])
+                tables_[t].push_back(row.ts, row.sensor_id, row.value);
+        }
+
+        covered_from_ = covered_from;
+        data_version_ = data_version;
+        initialized_ = true;
+        version_++;
+        {
+            std::lock_guard<std::mutex> responses_lock(responses_mutex_);
+            responses_.clear();
+        }
+        lock.unlock();
+
+        if (notify) {
+            aggregates[0].swap(raw);
+            for (int t = 0; t < TABLES; ++t)
+                for (const Row& row : aggregates[t])
+                    if (std::make_pair(row.ts, row.sensor_id) > last[t])
+                        listener_(t, row.ts, row.sensor_id, row.value);
+        }
+        return true;
+    }
+
+    // Обработчик строк, появившихся в базе после предыдущего обновления (первая загрузка не в счёт).
+    // Вызывается из refresh() после снятия блокировки
+    using RowListener = std::function<void(int table, int64_t ts, int32_t sensor_id, double value)>;
+    void onNewRow(RowListener listener) { listener_ = std::move(listener); }
+
+    // Блокировка для чтения таблиц и версии
+    std::shared_lock<std::shared_mutex> lock_shared() const { return std::shared_lock<std::shared_mutex>(mutex_); }
+
+    bool initialized() const { return initialized_; }
+    const ReadingRing& table(int t) const { return tables_[t]; }
+    uint64_t version() const { return version_; }
+
+    // Начало периода, полностью представленного в кэше: для сырых значений - начало окна или конец
+    // архива, если он позже; таблицы агрегатов хранятся целиком
+    int64_t coveredFrom(int t) const { return t == 0 ? covered_from_ : std::numeric_limits<int64_t>::min(); }
+
+    // ETag ответа текущей версии; время запуска отличает версии разных запусков сервера
+    std::string etag() const { return "\"" + std::to_string(started_) + "-" + std::to_string(version_) + "\""; }
+
+    // Готовый ответ на запрос key, построенный по версии version; false, если его нет
+    bool response(const std::string& key, uint64_t version, CachedResponse& response) const {
+        std::lock_guard<std::mutex> lock(responses_mutex_);
+        auto it = responses_.find(key);
+        if (it == responses_.end() || it->second.first != version)
+            return false;
+        response = it->second.second;
+        return true;
+    }
+
+    void storeResponse(const std::string& key, uint64_t version, CachedResponse response) {
+        std::lock_guard<std::mutex> lock(responses_mutex_);
+        if (responses_.size() >= MAX_RESPONSES)
+            responses_.clear();
+        responses_[key] = std::make_pair(version, std::move(response));
+    }
+
+private:
+    // Перекрытие при дочитывании: строки, записанные с опозданием до этого срока, попадут в кэш
+    static const int64_t REFRESH_OVERLAP = 2 * 60 * 1000;
+    // Число хранимых готовых ответов
+    static const std::size_t MAX_RESPONSES = 256;
+
+    struct Row {
+        int64_t ts;
+        int32_t sensor_id;
+        double value;
+    };
+
+    bool load(const std::string& sql, int64_t from, std::vector<Row>& rows) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            LOG_ERROR("Failed to prepare statement: " << sqlite3_errmsg(db_));
+            return false;
+        }
+        if (sqlite3_bind_parameter_count(stmt) > 0)
+            sqlite3_bind_int64(stmt, 1, from);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            rows.push_back(Row{sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_double(stmt, 2)});
+        sqlite3_finalize(stmt);
+        return rc == SQLITE_DONE;
+    }
+
+    sqlite3* db_;
+    int64_t window_;
+    int64_t started_;
+
+    mutable std::shared_mutex mutex_;
+    ReadingRing tables_[TABLES];
+    int64_t hwm_ = std::numeric_limits<int64_t>::min();
+    int64_t covered_from_ = std::numeric_limits<int64_t>::max();
+    int64_t data_version_ = 0;
+    bool initialized_ = false;
+    uint64_t version_ = 0;
+
+    RowListener listener_;
+
+    mutable std::mutex responses_mutex_;
+    std::map<std::string, std::pair<uint64_t, CachedResponse>> responses_;
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crc32.hpp"
+#include "storage.hpp"
+#include "logger.hpp"
+
+// Место, где тест сбоев (tests/journal_crash_test.cpp) может остановить процесс; в программах пустое
+#ifndef JOURNAL_CRASH_POINT
+#define JOURNAL_CRASH_POINT(name)
+#endif
+
+// Журнал измерений, ещё не записанных в базу: файл фиксированного размера, отображённый в память.
+// Измерение дописывается в журнал как только поток записи забрал его из очереди; на диск журнал
+// сбрасывается группой (msync) - по числу записей или по времени с первой несброшенной записи.
+// После того как первые n измерений зафиксированы в SQLite, они освобождаются (release): записи,
+// принятые во время записи в базу, остаются в журнале и не переписываются заново.
+// При запуске оставшиеся в журнале записи (процесс упал до записи в базу) читаются заново.
+//
+// Формат: заголовок на первой странице (поколение и индекс первой неосвобождённой записи в одном слове),
+// затем записи по 24 байта. Контрольная сумма записи включает номер поколения, поэтому записи
+// прежних поколений при чтении отбрасываются. Освобождение всех записей только увеличивает номер
+// поколения. Если неосвобождённый хвост помещается перед ним, он копируется в начало файла под
+// следующим поколением, и только затем заголовок переключается на это поколение: при сбое
+// в любой момент верна либо старая, либо новая картина. Повреждённая или недописанная запись
+// (обрыв питания посреди сброса) пропускается, записи после неё читаются.
+// Только POSIX (mmap)
+class Journal {
+public:
+    Journal(std::string path, std::size_t capacity, std::size_t commit_records, std::chrono::milliseconds commit_interval)
+        : path_(std::move(path)), capacity_(capacity), commit_records_(commit_records), commit_interval_(commit_interval) {}
+
+    ~Journal() {
+        if (map_) {
+            commit();
+            munmap(map_, size_);
+        }
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    // Открытие (создание) файла журнала
+    bool open() {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            LOG_ERROR("Failed to open journal '" << path_ << "': " << strerror(errno));
+            return false;
+        }
+        size_ = HEADER_SIZE + capacity_ * sizeof(Record);
+        // Место выделяется сразу: запись в отображение не должна упасть (SIGBUS) из-за нехватки места
+        int rc = posix_fallocate(fd_, 0, static_cast<off_t>(size_));
+        if (rc != 0) {
+            LOG_ERROR("Failed to allocate journal '" << path_ << "': " << strerror(rc));
+            return false;
+        }
+        void* map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            LOG_ERROR("Failed to map journal '" << path_ << "': " << strerror(errno));
+            return false;
+        }
+        map_ = static_cast<char*>(map);
+        Header* header = this->header();
+        if (header->magic != MAGIC || (header->version != VERSION && header->version != 1)) {
+            header->magic = MAGIC;
+            header->version = VERSION;
+            switchTo(1, 0);
+        } else if (header->version == 1) {
+            // В версии 1 на этом месте только поколение; записи частично не освобождались
+            header->version = VERSION;
+            switchTo(header->state, 0);
+        } else if (start() > capacity_) {
+            switchTo(generation(), 0);
+        }
+        start_ = start();
+        count_ = committed_ = start_;
+        // Перенос хвоста, прерванный сбоем, оставил перед start_ записи следующего поколения:
+        // при следующем переносе или освобождении всех записей они стали бы верными
+        Record* records = this->records();
+        bool stale = false;
+        for (std::size_t i = 0; i < start_; ++i) {
+            if (records[i].checksum == checksum(records[i], generation() + 1)) {
+                records[i].checksum = ~records[i].checksum;
+                stale = true;
+            }
+        }
+        if (stale)
+            msync(map_, HEADER_SIZE + start_ * sizeof(Record), MS_SYNC);
+        return true;
+    }
+
+    // Неосвобождённые записи текущего поколения, оставшиеся от прошлого запуска, по порядку.
+    // Повреждённые записи пропускаются; новые записи дописываются после последней верной,
+    // поэтому вызывающий держит прочитанные вместе с новыми и освобождает их вместе
+    template <class Rows>
+    std::size_t replay(Rows& rows) {
+        Record* records = this->records();
+        std::vector<std::size_t> invalid;
+        damaged_.clear();
+        count_ = start_;
+        for (std::size_t i = start_; i < capacity_; ++i) {
+            if (records[i].checksum != checksum(records[i])) {
+                invalid.push_back(i);
+                continue;
+            }
+            rows.push_back(Reading{records[i].ts, records[i].value, records[i].sensor_id});
+            // Неверные записи перед верной - повреждённые, после последней верной - свободное место
+            damaged_.insert(damaged_.end(), invalid.begin(), invalid.end());
+            invalid.clear();
+            count_ = i + 1;
+        }
+        committed_ = count_;
+        if (!damaged_.empty())
+            LOG_WARN("Journal: " << damaged_.size() << " damaged records skipped");
+        return count_ - start_ - damaged_.size();
+    }
+
+    // Дописать измерение; false - журнал заполнен (измерение не защищено от сбоя)
+    bool append(const Reading& reading) {
+        if (count_ >= capacity_) {
+            overflows_++;
+            return false;
+        }
+        Record& record = records()[count_];
+        record.ts = reading.ts;
+        record.value = reading.value;
+        record.sensor_id = reading.sensor_id;
+        record.checksum = checksum(record);
+        if (count_ == committed_)
+            first_pending_ = std::chrono::steady_clock::now();
+        count_++;
+        return true;
+    }
+
+    // Групповая фиксация: сброс на диск, если накопилось commit_records записей или прошло commit_interval
+    void maybeCommit() {
+        if (count_ == committed_)
+            return;
+        if (count_ - committed_ >= commit_records_ || std::chrono::steady_clock::now() - first_pending_ >= commit_interval_)
+            commit();
+    }
+
+    // Сброс несброшенных записей на диск
+    void commit() {
+        if (count_ == committed_)
+            return;
+        std::size_t from = HEADER_SIZE + committed_ * sizeof(Record);
+        std::size_t to = HEADER_SIZE + count_ * sizeof(Record);
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::size_t start = from / page * page;
+        if (msync(map_ + start, to - start, MS_SYNC) != 0)
+            LOG_ERROR("Failed to sync journal: " << strerror(errno));
+        committed_ = count_;
+        commits_++;
+    }
+
+    // Первые n неосвобождённых измерений (в порядке добавления) зафиксированы в базе.
+    // Сбой до конца вызова - при запуске они повторятся (в базе такие строки пропускаются)
+    void release(std::size_t n) {
+        std::size_t end = start_;
+        std::size_t skipped = 0;
+        for (; n > 0 && end < count_; ++end) {
+            if (skipped < damaged_.size() && damaged_[skipped] == end)
+                skipped++;
+            else
+                n--;
+        }
+        while (skipped < damaged_.size() && damaged_[skipped] == end) {
+            skipped++;
+            end++;
+        }
+        damaged_.erase(damaged_.begin(), damaged_.begin() + static_cast<std::ptrdiff_t>(skipped));
+        start_ = end;
+
+        JOURNAL_CRASH_POINT("release");
+        if (start_ == count_) {
+            // Освобождено всё: новое поколение, журнал пуст
+            switchTo(generation() + 1, 0);
+            start_ = count_ = committed_ = 0;
+        } else if (count_ - start_ <= start_) {
+            // Сначала освобождение в заголовке: копии ложатся на освобождённые записи, и после
+            // сбоя посреди переноса open() отбросит их как записи следующего поколения
+            switchTo(generation(), start_);
+            compact();
+        } else {
+            switchTo(generation(), start_);
+        }
+    }
+
+    // Неосвобождённых записей
+    std::size_t size() const { return count_ - start_ - damaged_.size(); }
+    std::size_t damaged() const { return damaged_.size(); }
+    std::size_t commits() const { return commits_; }
+    std::size_t overflows() const { return overflows_; }
+
+private:
+    static const uint32_t MAGIC = 0x4A524E4C;   // "JRNL"
+    static const uint32_t VERSION = 2;
+    static const std::size_t HEADER_SIZE = 4096;
+
+    // Поколение и первая неосвобождённая запись - одно 64-битное слово: заголовок переключается
+    // одной записью, и при сбое не бывает нового поколения со старым началом (или наоборот)
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t state;             // Поколение << 32 | первая неосвобождённая запись (в версии 1 - поколение)
+    };
+
+    struct Record {
+        int64_t ts;
+        double value;
+        int32_t sensor_id;
+        uint32_t checksum;
+    };
+    static_assert(sizeof(Record) == 24, "journal record layout");
+
+    // Перенос неосвобождённых записей в начало файла под следующим поколением. Хвост не пересекается
+    // с местом назначения (не длиннее start_), поэтому до смены поколения в заголовке старые записи
+    // целы
+    void compact() {
+        uint64_t generation = this->generation() + 1;
+        Record* records = this->records();
+        std::size_t n = 0, damaged = 0;
+        for (std::size_t i = start_; i < count_; ++i) {
+            if (damaged < damaged_.size() && damaged_[damaged] == i) {
+                damaged++;
+                continue;
+            }
+            records[n] = records[i];
+            records[n].checksum = checksum(records[n], generation);
+            n++;
+        }
+        if (msync(map_, HEADER_SIZE + n * sizeof(Record), MS_SYNC) != 0)
+            LOG_ERROR("Failed to sync journal: " << strerror(errno));
+        JOURNAL_CRASH_POINT("compact");
+        switchTo(generation, 0);
+        damaged_.clear();
+        start_ = 0;
+        count_ = committed_ = n;
+    }
+
+    Header* header() const { return reinterpret_cast<Header*>(map_); }
+    Record* records() const { return reinterpret_cast<Record*>(map_ + HEADER_SIZE); }
+
+    uint64_t generation() const { return header()->state >> 32; }
+    std::size_t start() const { return static_cast<std::size_t>(header()->state & 0xFFFFFFFF); }
+
+    // Переключение заголовка одной записью слова (volatile - компилятор не делит и не переносит её)
+    // и сброс страницы заголовка на диск
+    void switchTo(uint64_t generation, std::size_t start) {
+        *static_cast<volatile uint64_t*>(&header()->state) = generation << 32 | start;
+        if (msync(map_, HEADER_SIZE, MS_SYNC) != 0)
+            LOG_ERROR("Failed to sync journal: " << strerror(errno));
+    }
+
+    uint32_t checksum(const Record& record) const { return checksum(record, generation()); }
+
+    static uint32_t checksum(const Record& record, uint64_t generation) {
+        uint32_t crc = crc32(&generation, sizeof(generation));
+        return crc32(&record, offsetof(Record, checksum), crc);
+    }
+
+    std::string path_;
+    std::size_t capacity_;
+    std::size_t commit_records_;
+    std::chrono::milliseconds commit_interval_;
+
+    int fd_ = -1;
+    char* map_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t start_ = 0;         // Первая неосвобождённая запись
+    std::size_t count_ = 0;         // Конец записей в журнале
+    std::vector<std::size_t> damaged_;  // Повреждённые записи между start_ и count_ (после повтора), по возрастанию
+    std::size_t committed_ = 0;     // Из них сброшено на диск
+    std::chrono::steady_clock::time_point first_pending_;
+    std::size_t commits_ = 0;
+    std::size_t overflows_ = 0;
+};
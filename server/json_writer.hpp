@@ -0,0 +1,126 @@
+#pragma once
+
+#include <charconv>     // std::to_chars
+#include <cmath>        // std::isfinite
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// Перевод времени в мс от эпохи в строку "YYYY-MM-DD HH:MM:SS" локального времени -
+// формат, в котором API отдавал временные метки при текстовых ключах в базе.
+// localtime дорогой, поэтому префикс до минут кэшируется: подряд идущие
+// измерения одной минуты форматируются дописыванием секунд
+class LocalTimeFormatter {
+public:
+    void append(std::string& out, int64_t millis) {
+        int64_t seconds = millis >= 0 ? millis / 1000 : (millis - 999) / 1000;
+        int64_t minute = seconds >= 0 ? seconds / 60 : (seconds - 59) / 60;
+        if (minute != cached_minute_) {
+            time_t t = static_cast<time_t>(minute * 60);
+            struct tm tm;
+#ifdef _WIN32
+            localtime_s(&tm, &t);
+#else
+            localtime_r(&t, &tm);
+#endif
+            prefix_len_ = strftime(prefix_, sizeof(prefix_), "%Y-%m-%d %H:%M:", &tm);
+            cached_minute_ = minute;
+        }
+        int sec = static_cast<int>(seconds - minute * 60);
+        out.append(prefix_, prefix_len_);
+        out.push_back(static_cast<char>('0' + sec / 10));
+        out.push_back(static_cast<char>('0' + sec % 10));
+    }
+
+private:
+    int64_t cached_minute_ = INT64_MIN;
+    char prefix_[32];
+    std::size_t prefix_len_ = 0;
+};
+
+// Потоковая запись строк результата в JSON вида
+// {"data":[{"sensor_id":...,"timestamp":...,"value":...},...][,"next_cursor":...]}
+// без промежуточного дерева. Всё дописывается в переданный буфер: вызывающий код
+// переиспользует его между порциями (clear() не освобождает память), поэтому
+// в установившемся режиме запись строки не выделяет память.
+class JsonWriter {
+public:
+    // epoch_time - метки числом мс от эпохи вместо строки локального времени
+    explicit JsonWriter(bool epoch_time = false) : epoch_time_(epoch_time) {}
+
+    // Начало документа
+    void begin(std::string& out) {
+        rows_ = 0;
+        out.append("{\"data\":[");
+    }
+
+    // Конец документа; next_cursor - курсор следующей страницы, если она есть
+    void end(std::string& out, std::string_view next_cursor = {}) {
+        out.push_back(']');
+        if (!next_cursor.empty()) {
+            out.append(",\"next_cursor\":");
+            appendString(out, next_cursor);
+        }
+        out.push_back('}');
+    }
+
+    // Одна строка: временная метка (мс от эпохи), датчик и значение
+    void row(std::string& out, int64_t timestamp, int32_t sensor_id, double value) {
+        char buf[24];
+        if (rows_++ != 0)
+            out.push_back(',');
+        out.append("{\"sensor_id\":");
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), sensor_id).ptr);
+        out.append(",\"timestamp\":");
+        if (epoch_time_) {
+            auto result = std::to_chars(buf, buf + sizeof(buf), timestamp);
+            out.append(buf, result.ptr);
+        } else {
+            out.push_back('"');
+            time_.append(out, timestamp);
+            out.push_back('"');
+        }
+        out.append(",\"value\":");
+        appendDouble(out, value);
+        out.push_back('}');
+    }
+
+    // Число записанных строк
+    std::size_t rows() const { return rows_; }
+
+    // Строка JSON с экранированием
+    static void appendString(std::string& out, std::string_view str) {
+        static const char hex[] = "0123456789abcdef";
+        out.push_back('"');
+        for (char ch : str) {
+            unsigned char c = static_cast<unsigned char>(ch);
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(ch);
+            } else if (c < 0x20) {
+                char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                out.append(esc, sizeof(esc));
+            } else {
+                out.push_back(ch);
+            }
+        }
+        out.push_back('"');
+    }
+
+    // Число с плавающей точкой в кратчайшем точном представлении; NaN и inf - null
+    static void appendDouble(std::string& out, double value) {
+        if (!std::isfinite(value)) {
+            out.append("null");
+            return;
+        }
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, result.ptr);
+    }
+
+private:
+    bool epoch_time_;
+    std::size_t rows_ = 0;
+    LocalTimeFormatter time_;
+};
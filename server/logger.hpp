@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "json_writer.hpp"      // LocalTimeFormatter
+
+// Асинхронный журнал сообщений сервера и сборщика.
+// Поток, пишущий сообщение, только копирует запись в свой кольцевой буфер (один писатель -
+// один читатель, без блокировок) и не ждёт вывода. Фоновый поток раз в LOG_FLUSH_PERIOD
+// забирает записи из буферов всех потоков, упорядочивает по времени и выводит пачкой:
+// DEBUG и INFO - в stdout, WARN и ERROR - в stderr, с одним fflush на пачку.
+// Если буфер потока полон, запись отбрасывается; число отброшенных выводится отдельной строкой.
+// Текст записи ограничен LOG_TEXT_SIZE байтами, длиннее - обрезается.
+// Уровень задаётся переменной окружения LOG_LEVEL (debug, info, warn, error), по умолчанию info.
+// Повторяющиеся сообщения ограничиваются по частоте в месте вызова: LOG_LIMITED
+enum LogLevel {
+    LEVEL_DEBUG,
+    LEVEL_INFO,
+    LEVEL_WARN,
+    LEVEL_ERROR
+};
+
+const std::size_t LOG_TEXT_SIZE = 232;
+const std::size_t LOG_BUFFER_RECORDS = 1024;                    // Записей в буфере потока (степень двойки)
+const std::chrono::milliseconds LOG_FLUSH_PERIOD(50);
+
+struct LogRecord {
+    int64_t micros;             // Время записи, мкс от эпохи
+    LogLevel level;
+    uint32_t size;
+    char text[LOG_TEXT_SIZE];
+};
+
+inline const char* logLevelName(LogLevel level) {
+    switch (level) {
+    case LEVEL_DEBUG:
+        return "DEBUG";
+    case LEVEL_INFO:
+        return "INFO ";
+    case LEVEL_WARN:
+        return "WARN ";
+    default:
+        return "ERROR";
+    }
+}
+
+inline bool parseLogLevel(std::string_view name, LogLevel& level) {
+    if (name == "debug")
+        level = LEVEL_DEBUG;
+    else if (name == "info")
+        level = LEVEL_INFO;
+    else if (name == "warn")
+        level = LEVEL_WARN;
+    else if (name == "error")
+        level = LEVEL_ERROR;
+    else
+        return false;
+    return true;
+}
+
+// Буфер записей одного потока. head_ двигает только поток-владелец, tail_ - только поток вывода
+class LogBuffer {
+public:
+    bool push(const LogRecord& record) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == LOG_BUFFER_RECORDS) {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        std::memcpy(&records_[head & (LOG_BUFFER_RECORDS - 1)], &record, offsetof(LogRecord, text) + record.size);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void drain(std::vector<LogRecord>& out) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+            out.push_back(records_[tail & (LOG_BUFFER_RECORDS - 1)]);
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    uint64_t reported = 0;      // Отброшенных, о которых уже выведено сообщение (только поток вывода)
+
+private:
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) std::atomic<uint64_t> dropped_{0};
+    LogRecord records_[LOG_BUFFER_RECORDS];
+};
+
+class Logger {
+public:
+    Logger() {
+        LogLevel level = LEVEL_INFO;
+        if (const char* name = std::getenv("LOG_LEVEL"))
+            parseLogLevel(name, level);
+        level_.store(level, std::memory_order_relaxed);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    // Выводит всё, что осталось в буферах: в том числе при exit()
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    bool enabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+
+    // Ошибки будят поток вывода сразу, не дожидаясь периода: процесс может вскоре завершиться
+    void write(const LogRecord& record) {
+        buffer().push(record);
+        if (record.level == LEVEL_ERROR)
+            wake_.notify_one();
+    }
+
+    // Всего отброшенных записей
+    uint64_t dropped() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t sum = 0;
+        for (const auto& buffer : buffers_)
+            sum += buffer->dropped();
+        return sum;
+    }
+
+    static int64_t micros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    // Буфер текущего потока. Буферы живут до конца процесса: потоки обоих процессов
+    // создаются при запуске и живут до конца работы
+    LogBuffer& buffer() {
+        thread_local LogBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::make_unique<LogBuffer>());
+            buffer = buffers_.back().get();
+        }
+        return *buffer;
+    }
+
+    void run() {
+        std::vector<LogRecord> batch;
+        std::string out, err;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (bool stopping = false; !stopping;) {
+            stopping = wake_.wait_for(lock, LOG_FLUSH_PERIOD, [this] { return stop_; });
+            int64_t now = micros();
+            uint64_t dropped = 0;
+            for (const auto& buffer : buffers_) {
+                buffer->drain(batch);
+                uint64_t total = buffer->dropped();
+                dropped += total - buffer->reported;
+                buffer->reported = total;
+            }
+            lock.unlock();
+
+            // Записи одного потока уже упорядочены, между потоками - по времени
+            std::stable_sort(batch.begin(), batch.end(),
+                             [](const LogRecord& a, const LogRecord& b) { return a.micros < b.micros; });
+            for (const LogRecord& record : batch)
+                format(record.level <= LEVEL_INFO ? out : err, record.micros, record.level,
+                       std::string_view(record.text, record.size));
+            if (dropped > 0) {
+                char text[64];
+                auto result = std::to_chars(text, text + sizeof(text), dropped);
+                std::string_view suffix = " log records dropped: buffer full";
+                std::memcpy(result.ptr, suffix.data(), suffix.size());
+                format(err, now, LEVEL_WARN, std::string_view(text, result.ptr - text + suffix.size()));
+            }
+            flush(stdout, out);
+            flush(stderr, err);
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+    // "2025-11-03 14:05:09.123 INFO  текст"
+    void format(std::string& out, int64_t micros, LogLevel level, std::string_view text) {
+        int64_t millis = micros / 1000;
+        time_.append(out, millis);
+        int ms = static_cast<int>(millis % 1000);
+        char frac[5] = {'.', static_cast<char>('0' + ms / 100), static_cast<char>('0' + ms / 10 % 10),
+                        static_cast<char>('0' + ms % 10), ' '};
+        out.append(frac, sizeof(frac));
+        out.append(logLevelName(level));
+        out.push_back(' ');
+        out.append(text);
+        out.push_back('\n');
+    }
+
+    static void flush(FILE* file, std::string& text) {
+        if (text.empty())
+            return;
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fflush(file);
+        text.clear();
+    }
+
+    std::atomic<LogLevel> level_{LEVEL_INFO};
+    mutable std::mutex mutex_;                      // Список буферов и остановка
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::vector<std::unique_ptr<LogBuffer>> buffers_;
+    LocalTimeFormatter time_;                       // Только поток вывода
+    std::thread thread_;
+};
+
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+// Одна запись: текст собирается прямо в запись без выделения памяти и уходит в буфер потока
+// в деструкторе
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) {
+        record_.micros = Logger::micros();
+        record_.level = level;
+        record_.size = 0;
+    }
+    ~LogLine() { logger().write(record_); }
+
+    LogLine& operator<<(std::string_view text) {
+        std::size_t n = std::min(text.size(), LOG_TEXT_SIZE - record_.size);
+        std::memcpy(record_.text + record_.size, text.data(), n);
+        record_.size += static_cast<uint32_t>(n);
+        return *this;
+    }
+    LogLine& operator<<(const char* text) { return *this << std::string_view(text); }
+    LogLine& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    LogLine& operator<<(char ch) { return *this << std::string_view(&ch, 1); }
+
+    template <class T, class = std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>>
+    LogLine& operator<<(T value) {
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        return *this << std::string_view(buf, result.ptr - buf);
+    }
+
+private:
+    LogRecord record_;
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+};
+
+// Ограничение частоты сообщения в месте вызова: не больше per_second в секунду,
+// о пропущенных сообщается в следующем выведенном. Счётчики приблизительные - гонка
+// потоков на границе секунды может пропустить лишнее сообщение
+class LogRateLimit {
+public:
+    explicit LogRateLimit(uint32_t per_second) : per_second_(per_second) {}
+
+    // suppressed - сколько сообщений пропущено с прошлого выведенного
+    bool allow(uint64_t& suppressed) {
+        int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+                             std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t window = window_.load(std::memory_order_relaxed);
+        if (window != second && window_.compare_exchange_strong(window, second, std::memory_order_relaxed))
+            count_.store(0, std::memory_order_relaxed);
+        if (count_.fetch_add(1, std::memory_order_relaxed) < per_second_) {
+            suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    const uint32_t per_second_;
+    std::atomic<int64_t> window_{INT64_MIN};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+// Текст собирается, только если уровень включён: LOG_INFO("Got " << n << " rows")
+#define LOG_AT(level, message)                  \
+    do {                                        \
+        if (logger().enabled(level)) {          \
+            LogLine log_line_(level);           \
+            log_line_ << message;               \
+        }                                       \
+    } while (0)
+
+#define LOG_DEBUG(message) LOG_AT(LEVEL_DEBUG, message)
+#define LOG_INFO(message) LOG_AT(LEVEL_INFO, message)
+#define LOG_WARN(message) LOG_AT(LEVEL_WARN, message)
+#define LOG_ERROR(message) LOG_AT(LEVEL_ERROR, message)
+
+// Не больше per_second сообщений в секунду из этого места вызова
+#define LOG_LIMITED(level, per_second, message)                                         \
+    do {                                                                                \
+        if (logger().enabled(level)) {                                                  \
+            static LogRateLimit log_limit_(per_second);                                 \
+            uint64_t log_suppressed_;                                                   \
+            if (log_limit_.allow(log_suppressed_)) {                                    \
+                LogLine log_line_(level);                                               \
+                log_line_ << message;                                                   \
+                if (log_suppressed_ > 0)                                                \
+                    log_line_ << " (" << log_suppressed_ << " similar messages suppressed)"; \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
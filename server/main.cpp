@@ -11,32 +11,110 @@
 #include <string>
 #include <vector>
 #include <iomanip>
+#include <algorithm>
 #include <ctime>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
 #include <boost/asio.hpp>
 
-#include "my_serial.hpp"
+#include "serial_reader.hpp"
+#include "sensor_config.hpp"
+#include "sensor_protocol.hpp"
+#include "reading_queue.hpp"
+#include "journal.hpp"
+#include "db_writer.hpp"
+#include "storage.hpp"
+#include "aggregator.hpp"
+#include "archive.hpp"
+#include "retention.hpp"
+#include "scheduler.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
 
 #include <sqlite3.h>
 
 using namespace std;
 
 sqlite3* db;
+DbWriter* db_writer;    // Подготовленные выражения соединения db
 std::mutex db_mutex;
 
+// Соединение только для чтения: сутки для архива читаются без db_mutex (только задача retention)
+sqlite3* archive_db;
+DbWriter* archive_reader;
+
+// Измерения от потока чтения портов к потоку записи
+ReadingQueue* reading_queue;
+
+// Данные потока записи; задачи планировщика забирают их под log_mutex
+std::deque<Reading> log_temp_memory; // Основной лог температур: измерения, ещё не записанные в базу
+RollingAggregator* aggregator;      // Агрегаты за час и за день, обновляются при каждом измерении
+Journal* journal;                   // Копия log_temp_memory на диске на случай падения процесса
 std::mutex log_mutex;
-std::deque<std::pair<std::string, double>> log_temp_memory; // Основной лог температур
+
+// Закрытые интервалы агрегации, ещё не записанные в базу (под log_mutex)
+struct ClosedBucket {
+    AggregatePeriod period;
+    int32_t sensor_id;
+    Bucket bucket;
+};
+std::vector<ClosedBucket> closed_buckets;
+
+// Периодическая работа: синхронизация, агрегаты, сроки хранения, метрики
+Scheduler* scheduler;
+RetentionWorker* retention;         // Срок хранения и возврат места файлу, соединение db под db_mutex
+
+// Метрики
+Counter& readings_total = metrics().counter("ingest_readings_total", "Readings accepted from sensor ports");
+Counter& invalid_readings_total = metrics().counter("ingest_invalid_readings_total", "Lines and frames from sensor ports that are not accepted as readings");
+Histogram& sync_seconds = metrics().histogram("ingest_sync_duration_seconds", "Time to write pending readings to the database and archive");
+Counter& synced_rows_total = metrics().counter("ingest_synced_rows_total", "Readings written to the database");
+Counter& sync_failures_total = metrics().counter("ingest_sync_failures_total", "Syncs whose transaction failed");
+Histogram& insert_batch_seconds = metrics().histogram("ingest_sql_duration_seconds", "SQLite statement time", "statement=\"insert_batch\"");
+Histogram& insert_aggregate_seconds = metrics().histogram("ingest_sql_duration_seconds", "SQLite statement time", "statement=\"insert_aggregate\"");
+Histogram& delete_old_seconds = metrics().histogram("ingest_sql_duration_seconds", "SQLite statement time", "statement=\"delete_old\"");
+Histogram& statistics_seconds = metrics().histogram("ingest_sql_duration_seconds", "SQLite statement time", "statement=\"statistics\"");
+Histogram& archive_seconds = metrics().histogram("ingest_archive_duration_seconds", "Time to move expired days to the archive");
+Counter& archived_rows_total = metrics().counter("ingest_archived_rows_total", "Readings moved to the archive");
 
 // Константы
-const double TIME_DELAY = 10.0;             // Таймаут для чтения данных
-const int MAX_TIME_DEFAULT = 24 * 60 * 60; // Максимальное время хранения записей в основном логе (24 часа)
-const int MAX_TIME_HOUR = 30 * 24 * 60 * 60; // Максимальное время хранения записей в логе за час (30 дней)
-const int MAX_TIME_DAY = 365 * 24 * 60 * 60; // Максимальное время хранения записей в логе за день (1 год)
-const int HOUR = 60 * 60 / TIME_DELAY;                   // Интервал записи 
-const int DAY = 24 * 60 * 60 / TIME_DELAY;               // Интервал записи
-const int SYNC_INTERVAL = 60 / TIME_DELAY;               // Интервал синхронизации с бд 
+const std::chrono::seconds SYNC_PERIOD(60);             // Синхронизация с бд в начале каждой минуты (--sync-period).
+                                                        // Только после неё измерения видны серверу и подписчикам /stream
+const std::chrono::seconds EARLY_SYNC_PERIOD(1);        // Досрочная синхронизация не чаще
+const std::chrono::seconds AGGREGATE_GRACE(1);          // Интервалы закрываются через столько после границы часа:
+                                                        // измерения до границы успевают пройти очередь
+const std::chrono::seconds RETENTION_OFFSET(30);        // Сроки хранения - в середине минуты, между синхронизациями
+const std::size_t SCHEDULER_THREADS = 2;                // Долгий проход сроков хранения не задерживает синхронизацию
+
+// Очередь измерений и поток записи
+const std::size_t QUEUE_CAPACITY = 65536;               // Измерений в очереди (степень двойки)
+const std::size_t DRAIN_BATCH = 4096;                   // Измерений, забираемых из очереди за раз
+const std::chrono::milliseconds WRITER_POLL(10);        // Опрос пустой очереди (не больше окна фиксации журнала)
+const std::size_t MAX_PENDING_ROWS = 100000;            // Столько незаписанных измерений - синхронизация досрочно
+#define SPILL_PATH "temperature.spill"                  // Файл измерений, не поместившихся в очередь
+
+// Журнал незаписанных измерений
+#define JOURNAL_PATH "temperature.journal"
+const std::size_t JOURNAL_CAPACITY = 1 << 20;           // Записей в журнале (24 МБ)
+const std::size_t JOURNAL_COMMIT_RECORDS = 1024;        // Сброс на диск после стольких записей...
+const int JOURNAL_COMMIT_MS = 20;                       // ...или через столько мс после первой несброшенной
+
+// Метрики выгружаются в файл рядом с базой, сервер добавляет его к своим на /metrics
+#define METRICS_PATH "temperature_monitor.prom"
+const std::chrono::seconds METRICS_PERIOD(5);
+
+// Строк о каждом измерении в журнале не больше стольких в секунду, остальные только считаются
+const uint32_t LOG_SAMPLES_PER_SECOND = 10;
+
+// Таблицы агрегатов по длительности интервала
+const char* const AGGREGATE_TABLE[PERIOD_COUNT] = {"avg_temp_hour", "avg_temp_day"};
+
+// Сроки хранения по умолчанию (меняются --retention): сырые значения сутки в таблице, затем в архиве;
+// часовые агрегаты 30 дней, суточные год
+const char* const DEFAULT_RETENTION[] = {"temperatures=24h", "avg_temp_hour=30d", "avg_temp_day=365d"};
 
 // Функция для преобразования любого типа в строку
 template<class T>
@@ -46,199 +124,468 @@ std::string to_string(const T& v) {
     return ss.str();
 }
 
-// Получение текущего времени в формате "YYYY-MM-DD HH:MM:SS"
-std::string getCurrentTime() {
-    time_t now = time(nullptr);
-    struct tm tm;
-    #ifdef _WIN32
-    localtime_s(&tm, &now);
-    #else
-    localtime_r(&now, &tm);
-    #endif
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
-    return string(buffer);
-}
-
 // Инициализация базы данных и создание таблиц
 void initializeDatabase() {
-    int rc = sqlite3_open("temperature.db", &db);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
+    // WAL: чтение сервером не блокирует запись
+    db = openDatabase(STORAGE_DB_PATH, false);
+    if (!db)
         exit(1);
-    }
 
-    const char* sql = R"(
-        CREATE TABLE IF NOT EXISTS temperatures (
-            timestamp TEXT PRIMARY KEY,
-            value REAL
-        );
-        CREATE TABLE IF NOT EXISTS avg_temp_hour (
-            timestamp TEXT PRIMARY KEY,
-            value REAL
-        );
-        CREATE TABLE IF NOT EXISTS avg_temp_day (
-            timestamp TEXT PRIMARY KEY,
-            value REAL
-        );
-    )";
-
-    char* errMsg = 0;
-    rc = sqlite3_exec(db, sql, 0, 0, &errMsg);
-    if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
-    }
+    if (!initializeSchema(db))
+        exit(1);
+
+    db_writer = new DbWriter(db);
+
+    archive_db = openDatabase(STORAGE_DB_PATH, true);
+    if (!archive_db)
+        exit(1);
+    archive_reader = new DbWriter(archive_db);
 }
 
-void insertIntoTable(const std::string& table, const std::string& timestamp, double value) {
+void insertIntoTable(const std::string& table, int32_t sensor_id, const Bucket& bucket) {
     std::lock_guard<std::mutex> lock(db_mutex);
-    std::string sql = "INSERT INTO " + table + " (timestamp, value) VALUES ('" + timestamp + "', " + to_string(value) + ");";
-    char* errMsg = 0;
-    int rc = sqlite3_exec(db, sql.c_str(), 0, 0, &errMsg);
-    if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
-    }
+    ScopedTimer timer(insert_aggregate_seconds);
+    db_writer->insertAggregate(table, sensor_id, bucket);
 }
 
-void deleteOldEntries(const std::string& table, int max_age_seconds) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+// Перенос в архив самых ранних суток сырых значений, если они целиком раньше cutoff
+// (шаг обслуживания RetentionWorker). Сутки читаются отдельным соединением и сжимаются в чанки
+// по датчикам без db_mutex; под ним одной транзакцией добавляются только строки индекса.
+// С этого момента читатели берут сутки из архива, а строки таблицы (в archived) удаляет
+// RetentionWorker порциями по ключу. Строки, пришедшие с опозданием за уже заархивированные сутки
+// или оставшиеся после прерванного удаления, сливаются с существующим чанком; если его не удалось
+// прочитать, проход прерывается, не трогая чанк. В archived строки попадают только после
+// фиксации индекса: их удаляет RetentionWorker.
+// false - таких суток нет или перенос не удался
+bool archiveOneDay(int64_t cutoff, std::vector<Reading>& archived) {
+    ScopedTimer timer(archive_seconds);
+    int64_t oldest;
+    if (!archive_reader->oldest("temperatures", oldest) || archiveDay(oldest) + ARCHIVE_DAY > cutoff)
+        return false;
+    int64_t day = archiveDay(oldest);
+    std::vector<int32_t> sensors;
+    if (!archive_reader->sensors("temperatures", day, day + ARCHIVE_DAY, sensors))
+        return false;
+
+    std::vector<ArchiveChunk> chunks;
+    int64_t bytes = 0;
+    std::vector<Reading> day_rows;
+    std::vector<Reading> rows;
+    for (int32_t sensor_id : sensors) {
+        rows.clear();
+        if (!archive_reader->rows("temperatures", sensor_id, day, day + ARCHIVE_DAY, rows))
+            return false;
+        day_rows.insert(day_rows.end(), rows.begin(), rows.end());
+        // Чанк, который не удалось прочитать, заменился бы чанком только из новых строк
+        if (readChunk(ARCHIVE_DIR, sensor_id, day, rows) == CHUNK_FAILED)
+            return false;
+        std::stable_sort(rows.begin(), rows.end(), [](const Reading& a, const Reading& b) { return a.ts < b.ts; });
+        rows.erase(std::unique(rows.begin(), rows.end(), [](const Reading& a, const Reading& b) { return a.ts == b.ts; }),
+                   rows.end());
+        ArchiveChunk chunk;
+        if (!writeChunk(ARCHIVE_DIR, rows, chunk))
+            return false;
+        chunks.push_back(chunk);
+        bytes += chunk.bytes;
+    }
 
-    time_t now = time(nullptr);
-    struct tm tm;
-	#ifdef _WIN32
-    localtime_s(&tm, &now);
-    #else
-    localtime_r(&now, &tm);
-    #endif
-    char buffer[80];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
-    std::string current_time(buffer);
-
-    std::string sql = "DELETE FROM " + table + " WHERE timestamp < datetime('" + current_time + "', '-" + to_string(max_age_seconds) + " seconds');";
-    char* errMsg = 0;
-    int rc = sqlite3_exec(db, sql.c_str(), 0, 0, &errMsg);
-    if (rc != SQLITE_OK) {
-        std::cerr << "SQL error: " << errMsg << std::endl;
-        sqlite3_free(errMsg);
-    } else {
-        std::cout << "Deleted old entries from " << table << " older than " << max_age_seconds << " seconds" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(db_mutex);
+        if (!db_writer->begin())
+            return false;
+        // Без строки индекса хотя бы одного датчика сутки не фиксируются: archivedUntil() скрыл бы
+        // его сырые строки
+        for (const ArchiveChunk& chunk : chunks) {
+            if (!db_writer->insertChunk(chunk)) {
+                db_writer->rollback();
+                return false;
+            }
+        }
+        if (!db_writer->commit())
+            return false;
     }
+    archived.insert(archived.end(), day_rows.begin(), day_rows.end());
+    archived_rows_total.inc(day_rows.size());
+    LOG_INFO("Archived " << day_rows.size() << " rows of " << archiveDayName(day)
+             << " into " << chunks.size() << " chunks, " << bytes << " bytes");
+    return true;
 }
 
-// Синхронизация логов из памяти в базу данных
+// Синхронизация логов из памяти в базу данных одной транзакцией (задача планировщика).
+// Поток записи продолжает принимать измерения, пока идёт запись в базу.
+// Если зафиксировать транзакцию не удалось, записи возвращаются в лог до следующей синхронизации
 void syncLogsToDatabase() {
+    ScopedTimer timer(sync_seconds);
+    std::deque<Reading> rows;
+    std::size_t journaled;      // Из них в журнале (при переполнении журнала - не все)
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        rows.swap(log_temp_memory);
+        journaled = journal->size();
+    }
+    bool synced;
+    std::size_t inserted;       // Без отвергнутых базой строк
+    {
+        std::lock_guard<std::mutex> db_lock(db_mutex);
+        ScopedTimer insert_timer(insert_batch_seconds);
+        synced = db_writer->insertBatch("temperatures", rows);
+        inserted = db_writer->inserted();
+    }
     std::lock_guard<std::mutex> lock(log_mutex);
-    for (const auto& entry : log_temp_memory) {
-        insertIntoTable("temperatures", entry.first, entry.second);
+    if (!synced) {
+        sync_failures_total.inc();
+        log_temp_memory.insert(log_temp_memory.begin(), rows.begin(), rows.end());
+        return;
     }
-    deleteOldEntries("temperatures", MAX_TIME_DEFAULT); 
-    log_temp_memory.clear();
+    synced_rows_total.inc(inserted);
+    // Освобождаются только записанные измерения; принятые во время записи остаются в журнале
+    journal->release(journaled);
+    LOG_INFO("data updated: " << inserted << " of " << rows.size() << " rows, queue " << reading_queue->depth() << "/" << reading_queue->capacity()
+             << " (max " << reading_queue->maxDepth() << "), dropped " << reading_queue->dropped()
+             << ", spilled " << reading_queue->spilled() << ", journal commits " << journal->commits()
+             << ", journal overflows " << journal->overflows());
 }
 
-
-// Вычисление средней температуры
-double calculateAverageTemperature(std::string type) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    std::string hour_command = "SELECT AVG(value) FROM temperatures WHERE timestamp >= datetime('now', '-1 hour');";
-    std::string day_command = "SELECT AVG(value) FROM temperatures WHERE timestamp >= datetime('now', '-1 day');";
-    std::string sql = type == "hour" ? hour_command : day_command;
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        return 0.0;
+// Повтор журнала: измерения, принятые до падения процесса, но не записанные в базу.
+// Часть из них могла быть уже записана (падение между фиксацией транзакции и очисткой журнала) -
+// такие строки пропускаются. Если записать не удалось, измерения остаются в логе до синхронизации
+void replayJournal() {
+    std::size_t rows = journal->replay(log_temp_memory);
+    if (rows == 0)
+        return;
+    bool synced;
+    {
+        std::lock_guard<std::mutex> db_lock(db_mutex);
+        synced = db_writer->insertBatch("temperatures", log_temp_memory, true);
     }
-
-    double avg = 0.0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        avg = sqlite3_column_double(stmt, 0);
+    LOG_INFO("Journal replayed: " << rows << " rows" << (synced ? "" : ", kept in memory"));
+    if (synced) {
+        log_temp_memory.clear();
+        journal->release(rows);
     }
+}
+
 
-    sqlite3_finalize(stmt);
-    return avg;
+// Статистика текущего часа или суток по уже записанным в базу значениям.
+// Нужна только при запуске: восстанавливает агрегаты, накопленные до перезапуска
+Bucket calculateAverageTemperature(AggregatePeriod period, int32_t sensor_id) {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    ScopedTimer timer(statistics_seconds);
+    int64_t now = nowMillis();
+    return db_writer->statistics("temperatures", sensor_id, periodStart(period, now), now);
 }
-// Проверка на наличие нулевых байтов в строке
-bool containsNullBytes(const std::string& str) {
-    return str.find('\x00') != std::string::npos;
+
+// Закрытый интервал агрегации запоминается (вызывается под log_mutex), в базу его пишет writeClosedBuckets
+void onBucketClosed(AggregatePeriod period, int32_t sensor_id, const Bucket& bucket) {
+    closed_buckets.push_back(ClosedBucket{period, sensor_id, bucket});
 }
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <port>" << std::endl;
-        return -1;
+// Закрытие часа и суток по времени, даже если измерений не было, и запись закрытых интервалов
+// (задача планировщика: после каждой границы часа и по запросу потока записи)
+void writeClosedBuckets() {
+    std::vector<ClosedBucket> closed;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        aggregator->advance(nowMillis());
+        closed.swap(closed_buckets);
     }
+    for (const ClosedBucket& entry : closed)
+        insertIntoTable(AGGREGATE_TABLE[entry.period], entry.sensor_id, entry.bucket); // Запись в базу данных
+}
+
+// Срок ближайшего закрытия часа (локальное время) с запасом AGGREGATE_GRACE
+int64_t nextAggregation(int64_t now) {
+    int64_t grace = std::chrono::duration_cast<std::chrono::milliseconds>(AGGREGATE_GRACE).count();
+    int64_t start = periodStart(PERIOD_HOUR, now);
+    return start + grace > now ? start + grace : periodEnd(PERIOD_HOUR, start) + grace;
+}
 
-    cplib::SerialPort smport(std::string(argv[1]), cplib::SerialPort::BAUDRATE_115200);
-    if (!smport.IsOpen()) {
-        std::cout << "Failed to open port '" << argv[1] << "'! Terminating..." << std::endl;
-        return -2;
+// Обработка строки или кадра, полученных из порта датчика sensor_id (поток чтения портов).
+// Измерения только ставятся в очередь: запись в базу и агрегаты - в потоке записи.
+// Порт - один датчик: кадр с ненулевым номером датчика на устройстве отбрасывается,
+// иначе его измерения смешались бы с датчиком другого порта
+void onSample(int32_t sensor_id, const SerialReader::Sample& sample) {
+    if (const SensorFrame* frame = sample.frame) {
+        if (frame->sensor_id != 0) {
+            LOG_LIMITED(LEVEL_WARN, LOG_SAMPLES_PER_SECOND,
+                        "Frame of device sensor " << frame->sensor_id << " on port of sensor " << sensor_id << " ignored");
+            invalid_readings_total.inc();
+            return;
+        }
+        LOG_LIMITED(LEVEL_INFO, LOG_SAMPLES_PER_SECOND,
+                    "Got [" << sensor_id << "]: " << frame->count << " readings from " << frame->value(0));
+        for (std::size_t i = 0; i < frame->count; ++i)
+            reading_queue->push(Reading{sample.frame_ts[i], frame->value(i), sensor_id});
+        readings_total.inc(frame->count);
+        return;
     }
+    double temp;
+    if (!parseTextReading(sample.line, temp)) {
+        LOG_LIMITED(LEVEL_WARN, LOG_SAMPLES_PER_SECOND, "Invalid data [" << sensor_id << "]: " << sample.line);
+        invalid_readings_total.inc();
+        return;
+    }
+    LOG_LIMITED(LEVEL_INFO, LOG_SAMPLES_PER_SECOND, "Got [" << sensor_id << "]: " << sample.line);
+    reading_queue->push(Reading{sample.ts, temp, sensor_id});
+    readings_total.inc();
+}
 
-    initializeDatabase();
+// Поток записи: забирает измерения из очереди порциями, дописывает их в журнал и учитывает в агрегатах.
+// Журнал сбрасывается на диск группами: при падении теряется не больше окна фиксации.
+// Запись в базу, закрытие интервалов по времени и выгрузка метрик - задачи планировщика; отсюда
+// они только запускаются досрочно: синхронизация, если незаписанных измерений слишком много,
+// и запись интервала, закрытого поступившим измерением
+void runWriter() {
+    using clock = std::chrono::steady_clock;
+    clock::time_point last_early_sync = clock::time_point();
+    std::vector<Reading> batch;
+    batch.reserve(DRAIN_BATCH);
+
+    for (;;) {
+        batch.clear();
+        std::size_t drained = reading_queue->drain(batch, DRAIN_BATCH);
+        drained += reading_queue->drainSpill(batch);
+        if (drained == 0) {
+            // Окно фиксации журнала истекает и без новых измерений
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                journal->maybeCommit();
+            }
+            std::this_thread::sleep_for(WRITER_POLL);
+            continue;
+        }
 
-    std::string mystr;
-    smport.SetTimeout(TIME_DELAY);
+        std::size_t pending;
+        bool closed;
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            // Агрегаты учитывают измерение сразу, не дожидаясь записи в базу
+            for (const Reading& reading : batch) {
+                if (!journal->append(reading) && journal->overflows() == 1)
+                    LOG_WARN("Journal is full, new readings are not protected until the next sync");
+                aggregator->add(reading);
+                log_temp_memory.push_back(reading);
+            }
+            journal->maybeCommit();
+            pending = log_temp_memory.size();
+            closed = !closed_buckets.empty();
+        }
+        if (closed)
+            scheduler->trigger("aggregate");
+
+        // При большом объёме - досрочная синхронизация, но не чаще раза в EARLY_SYNC_PERIOD
+        clock::time_point now = clock::now();
+        if (pending >= MAX_PENDING_ROWS && now - last_early_sync >= EARLY_SYNC_PERIOD) {
+            scheduler->trigger("sync");
+            last_early_sync = now;
+        }
+    }
+}
 
-    int counter_avg_hour = 0;
-    int counter_avg_day = 0;
-    int sync_counter = 0;
+void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options] <port>" << std::endl;
+    std::cout << "       " << name << " [options] --config <sensors.conf>" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --protocol text|binary               sensor protocol for ports without one in the config (default: text)" << std::endl;
+    std::cout << "  --overflow block|drop_oldest|spill   what to do when the write queue is full (default: block)" << std::endl;
+    std::cout << "  --journal-commit-ms N                sync the journal to disk at most N ms after a reading (default: "
+              << JOURNAL_COMMIT_MS << ")" << std::endl;
+    std::cout << "  --journal-commit-records N           or after N journaled readings (default: " << JOURNAL_COMMIT_RECORDS << ")" << std::endl;
+    std::cout << "  --retention TABLE=AGE                keep rows of TABLE for AGE (s, m, h or d suffix, 0 - forever);" << std::endl;
+    std::cout << "                                       raw readings then go to the archive (default:";
+    for (const char* policy : DEFAULT_RETENTION)
+        std::cout << " " << policy;
+    std::cout << ")" << std::endl;
+    std::cout << "  --retention-budget-ms N              target duration of one retention delete batch (default: "
+              << RETENTION_BATCH_BUDGET.count() << ")" << std::endl;
+    std::cout << "  --sync-period N                      write readings to the database every N s (default: "
+              << SYNC_PERIOD.count() << "); readers and /stream see them only then" << std::endl;
+}
 
-    for (;;) {
-        smport >> mystr;
-        if (!mystr.empty() && !containsNullBytes(mystr)) {
-            // Валидация данных
-            bool is_valid = true;
-            for (char ch : mystr) {
-                if (!isdigit(ch) && ch != '.' && ch != '-') {
-                    is_valid = false;
-                    break;
-                }
+int main(int argc, char** argv) {
+    // Один порт (датчик 0) либо список датчиков из файла
+    std::vector<SensorConfig> sensors;
+    OverflowPolicy policy = OVERFLOW_BLOCK;
+    SensorProtocol protocol = PROTOCOL_TEXT;
+    std::string port;
+    std::string config;
+    int journal_commit_ms = JOURNAL_COMMIT_MS;
+    long journal_commit_records = static_cast<long>(JOURNAL_COMMIT_RECORDS);
+    std::vector<RetentionPolicy> retention_policies;
+    for (const char* table : STORAGE_TABLES)
+        retention_policies.push_back(RetentionPolicy{table, 0});
+    for (const char* text : DEFAULT_RETENTION)
+        parseRetentionPolicy(text, retention_policies);
+    std::chrono::milliseconds retention_budget = RETENTION_BATCH_BUDGET;
+    std::chrono::seconds sync_period = SYNC_PERIOD;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            config = argv[++i];
+        } else if (arg == "--protocol" && i + 1 < argc) {
+            if (!parseSensorProtocol(argv[++i], protocol)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+        } else if (arg == "--overflow" && i + 1 < argc) {
+            if (!parseOverflowPolicy(argv[++i], policy)) {
+                printUsage(argv[0]);
+                return -1;
             }
-            if (is_valid) {
-                std::cout << "Got: " << mystr << std::endl;
-                double temp = stod(mystr);
-                std::string timestamp = getCurrentTime();
-                {
-                    std::lock_guard<std::mutex> lock(log_mutex);
-                    log_temp_memory.emplace_back(timestamp, temp);
-                }
+        } else if ((arg == "--journal-commit-ms" || arg == "--journal-commit-records") && i + 1 < argc) {
+            long value = -1;
+            try {
+                value = std::stol(argv[++i]);
+            } catch (const std::exception&) {
             }
+            if (value < (arg == "--journal-commit-ms" ? 0 : 1) || value > 1000000) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            if (arg == "--journal-commit-ms")
+                journal_commit_ms = static_cast<int>(value);
+            else
+                journal_commit_records = value;
+        } else if (arg == "--retention" && i + 1 < argc) {
+            if (!parseRetentionPolicy(argv[++i], retention_policies)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+        } else if (arg == "--retention-budget-ms" && i + 1 < argc) {
+            long value = -1;
+            try {
+                value = std::stol(argv[++i]);
+            } catch (const std::exception&) {
+            }
+            if (value < 1 || value > 60000) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            retention_budget = std::chrono::milliseconds(value);
+        } else if (arg == "--sync-period" && i + 1 < argc) {
+            long value = -1;
+            try {
+                value = std::stol(argv[++i]);
+            } catch (const std::exception&) {
+            }
+            if (value < 1 || value > 3600) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            sync_period = std::chrono::seconds(value);
+        } else if (port.empty() && arg.compare(0, 2, "--") != 0) {
+            port = arg;
         } else {
-            std::cout << "Got nothing" << std::endl;
+            printUsage(argv[0]);
+            return -1;
         }
+    }
+    if (!config.empty() && port.empty()) {
+        if (!loadSensorConfig(config, sensors, protocol))
+            return -1;
+    } else if (config.empty() && !port.empty()) {
+        sensors.push_back(SensorConfig{0, port, DEFAULT_BAUD_RATE, protocol});
+    } else {
+        printUsage(argv[0]);
+        return -1;
+    }
 
-        counter_avg_hour++;
-        counter_avg_day++;
-        sync_counter++;
-
-        // Каждый час вычисляем среднее значение температуры за последний час
-        if (counter_avg_hour >= HOUR) {
-            double avg_hour = calculateAverageTemperature("hour");
-            std::string timestamp = getCurrentTime();
-            insertIntoTable("avg_temp_hour", timestamp, avg_hour); // Запись в базу данных
-            deleteOldEntries("avg_temp_hour", MAX_TIME_HOUR);
-            counter_avg_hour = 0;
-        }
+    initializeDatabase();
 
-        // Каждые 24 часа вычисляем среднее значение температуры за последний день
-        if (counter_avg_day >= DAY) {
-            double avg_day = calculateAverageTemperature("day");
-            std::string timestamp = getCurrentTime();
-            insertIntoTable("avg_temp_day", timestamp, avg_day); // Запись в базу данных
-            deleteOldEntries("avg_temp_day", MAX_TIME_DAY); 
-            counter_avg_day = 0;
-        }
+    // Журнал повторяется до восстановления агрегатов, чтобы они учли и повторённые измерения
+    journal = new Journal(JOURNAL_PATH, JOURNAL_CAPACITY, static_cast<std::size_t>(journal_commit_records),
+                          std::chrono::milliseconds(journal_commit_ms));
+    if (!journal->open())
+        return -1;
+    replayJournal();
 
-        // Синхронизация логов с бд
-        if (sync_counter >= SYNC_INTERVAL) {
-            syncLogsToDatabase();
-            cout << "data updated" << endl;
-            sync_counter = 0;
+    aggregator = new RollingAggregator(onBucketClosed);
+    for (const SensorConfig& sensor : sensors) {
+        for (int p = 0; p < PERIOD_COUNT; ++p) {
+            AggregatePeriod period = static_cast<AggregatePeriod>(p);
+            aggregator->restore(period, sensor.sensor_id, nowMillis(), calculateAverageTemperature(period, sensor.sensor_id));
         }
     }
 
+    reading_queue = new ReadingQueue(QUEUE_CAPACITY, policy, SPILL_PATH);
+
+    // Величины, которые уже считают очередь и журнал; читаются при выгрузке в потоке записи
+    metrics().gaugeFunction("ingest_queue_depth", "Readings waiting in the write queue", [] { return double(reading_queue->depth()); });
+    metrics().gaugeFunction("ingest_queue_max_depth", "Highest write queue depth seen", [] { return double(reading_queue->maxDepth()); });
+    metrics().counterFunction("ingest_queue_dropped_total", "Readings dropped on queue overflow", [] { return double(reading_queue->dropped()); });
+    metrics().counterFunction("ingest_queue_spilled_total", "Readings spilled to file on queue overflow", [] { return double(reading_queue->spilled()); });
+    metrics().gaugeFunction("ingest_pending_rows", "Readings not yet written to the database", [] {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return double(log_temp_memory.size());
+    });
+    metrics().counterFunction("ingest_journal_commits_total", "Journal group commits", [] {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return double(journal->commits());
+    });
+    metrics().counterFunction("ingest_journal_overflows_total", "Readings not journaled because the journal was full", [] {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return double(journal->overflows());
+    });
+    metrics().counterFunction("log_dropped_total", "Log records dropped because a thread's log buffer was full", [] { return double(logger().dropped()); });
+
+    // Все порты читаются одним потоком-реактором по готовности данных и только ставят измерения в очередь.
+    // Пропавший порт переоткрывается автоматически
+    boost::asio::io_context io_context;
+    std::vector<std::unique_ptr<SerialReader>> readers;
+    for (const SensorConfig& sensor : sensors) {
+        int32_t sensor_id = sensor.sensor_id;
+        readers.push_back(std::make_unique<SerialReader>(
+            io_context, sensor.device, sensor.baud_rate, sensor.protocol,
+            [sensor_id](const SerialReader::Sample& sample) { onSample(sensor_id, sample); }));
+        if (!readers.back()->start())
+            LOG_WARN("Port '" << sensor.device << "' is not available yet, waiting for it...");
+    }
+    auto decoders = [&readers](uint64_t (FrameDecoder::*counter)() const) {
+        return [&readers, counter] {
+            uint64_t sum = 0;
+            for (const auto& reader : readers)
+                sum += (reader->decoder().*counter)();
+            return double(sum);
+        };
+    };
+    metrics().counterFunction("ingest_frames_total", "Binary frames received", decoders(&FrameDecoder::frames));
+    metrics().counterFunction("ingest_frame_errors_total", "Binary frames rejected for a bad length or CRC", decoders(&FrameDecoder::errors));
+    metrics().counterFunction("ingest_frame_skipped_bytes_total", "Bytes skipped while searching for a frame", decoders(&FrameDecoder::skippedBytes));
+    metrics().counterFunction("ingest_port_reconnects_total", "Serial ports reopened after a read error or hangup", [&readers] {
+        std::size_t sum = 0;
+        for (const auto& reader : readers)
+            sum += reader->reconnects();
+        return double(sum);
+    });
+    std::thread reader_thread([&io_context] { io_context.run(); });
+
+    // Периодическая работа - по часам, независимо от того, как часто приходят измерения
+    retention = new RetentionWorker(*db_writer, db_mutex, retention_policies, retention_budget, archiveOneDay, delete_old_seconds);
+    scheduler = new Scheduler(SCHEDULER_THREADS);
+    scheduler->add("sync", Scheduler::every(sync_period), syncLogsToDatabase);
+    scheduler->add("aggregate", nextAggregation, writeClosedBuckets);
+    scheduler->add("retention", Scheduler::every(RETENTION_PERIOD, RETENTION_OFFSET), [] { retention->pass(); });
+    scheduler->add("metrics", Scheduler::every(METRICS_PERIOD), [] {
+        if (!metrics().writeFile(METRICS_PATH))
+            LOG_ERROR("Failed to write metrics to '" << METRICS_PATH << "'");
+    });
+    scheduler->start();
+
+    // Основной поток - поток записи
+    runWriter();
+
+    for (auto& reader : readers)
+        reader->stop();
+    reader_thread.join();
+    retention->stop();
+    delete scheduler;
+    delete retention;
+    delete reading_queue;
+    delete journal;
+    delete aggregator;
+    delete db_writer;
+    delete archive_reader;
     sqlite3_close(db);
+    sqlite3_close(archive_db);
     return 0;
 }
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gorilla.hpp"      // leadingZeros
+
+// Метрики процесса в текстовом формате Prometheus.
+// Счётчики и гистограммы разнесены по METRIC_SHARDS ячейкам в отдельных кэш-линиях: поток
+// пишет в свою ячейку одним атомарным сложением без упорядочивания, без блокировок и без
+// борьбы за кэш-линию с другими потоками; ячейки суммируются только при выгрузке.
+// Гистограммы задержек - логарифмически-линейные, как HDR Histogram: каждая степень двойки
+// наносекунд делится на HISTOGRAM_SUB_BUCKETS частей, относительная погрешность до 12,5%.
+// Метрики регистрируются при запуске; регистрация и выгрузка - под мьютексом реестра,
+// запись значений блокировок не берёт
+
+const std::size_t METRIC_SHARDS = 16;
+
+// Ячейка текущего потока; потоки раздаются по ячейкам по кругу
+inline std::size_t metricShard() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) { shards_[metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t value() const {
+        uint64_t sum = 0;
+        for (const Shard& shard : shards_)
+            sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    Shard shards_[METRIC_SHARDS];
+};
+
+// Мгновенное значение; пишется редко, поэтому одна ячейка
+class Gauge {
+public:
+    void set(double value) { value_.store(value, std::memory_order_relaxed); }
+    double value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value_{0};
+};
+
+const int HISTOGRAM_SUB_BITS = 3;
+const int HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+const int HISTOGRAM_MAX_BITS = 40;      // До 2^40 нс (~18 минут), дольше - в последнюю корзину
+const int HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+// Гистограмма длительностей в наносекундах. В Prometheus выгружается в секундах
+// с границами-степенями двойки от 256 нс: они совпадают с границами корзин, поэтому точны
+class Histogram {
+public:
+    void observe(uint64_t ns) {
+        Shard& shard = shards_[metricShard()];
+        shard.buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    void observe(std::chrono::steady_clock::duration duration) {
+        observe(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+    }
+
+    // Корзина: значения меньше HISTOGRAM_SUB_BUCKETS - сами по себе, остальные - по старшему
+    // биту и следующим за ним HISTOGRAM_SUB_BITS битам
+    static int bucket(uint64_t ns) {
+        if (ns < HISTOGRAM_SUB_BUCKETS)
+            return static_cast<int>(ns);
+        int exponent = 63 - leadingZeros(ns);
+        if (exponent >= HISTOGRAM_MAX_BITS)
+            return HISTOGRAM_BUCKETS - 1;
+        int sub = static_cast<int>(ns >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+        return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+    }
+
+    // Суммы по всем потокам: число значений в корзинах и сумма в нс
+    void snapshot(std::vector<uint64_t>& buckets, uint64_t& sum) const {
+        buckets.assign(HISTOGRAM_BUCKETS, 0);
+        sum = 0;
+        for (const Shard& shard : shards_) {
+            for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+                buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            sum += shard.sum.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS] = {};
+        std::atomic<uint64_t> sum{0};
+    };
+    Shard shards_[METRIC_SHARDS];
+};
+
+// Замер длительности блока
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Реестр метрик. Метрики живут до конца процесса, ссылки на них можно хранить.
+// labels - готовая строка меток вида path="/stats"; метрики с одним именем и разными
+// метками выгружаются одним семейством
+class MetricsRegistry {
+public:
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = std::string()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counters_.emplace_back(std::make_unique<Counter>());
+        add(name, help, "counter", labels, Metric{counters_.back().get(), nullptr, nullptr, nullptr});
+        return *counters_.back();
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = std::string()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        gauges_.emplace_back(std::make_unique<Gauge>());
+        add(name, help, "gauge", labels, Metric{nullptr, gauges_.back().get(), nullptr, nullptr});
+        return *gauges_.back();
+    }
+
+    // Значение вычисляется при выгрузке (в потоке, который её вызвал) - для величин,
+    // которые уже считает сам код: глубина очереди, число сбросов журнала
+    void gaugeFunction(const std::string& name, const std::string& help, std::function<double()> callback,
+                       const std::string& labels = std::string()) {
+        addFunction(name, help, "gauge", labels, std::move(callback));
+    }
+
+    void counterFunction(const std::string& name, const std::string& help, std::function<double()> callback,
+                         const std::string& labels = std::string()) {
+        addFunction(name, help, "counter", labels, std::move(callback));
+    }
+
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = std::string()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        histograms_.emplace_back(std::make_unique<Histogram>());
+        add(name, help, "histogram", labels, Metric{nullptr, nullptr, histograms_.back().get(), nullptr});
+        return *histograms_.back();
+    }
+
+    // Все метрики в текстовом формате Prometheus
+    std::string render() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        std::vector<uint64_t> buckets;
+        for (const std::string& name : order_) {
+            const Family& family = families_.at(name);
+            out << "# HELP " << name << " " << family.help << "\n# TYPE " << name << " " << family.type << "\n";
+            for (const auto& entry : family.metrics) {
+                const std::string& labels = entry.first;
+                const Metric& metric = entry.second;
+                std::string braces = labels.empty() ? std::string() : "{" + labels + "}";
+                if (metric.counter) {
+                    out << name << braces << " " << metric.counter->value() << "\n";
+                } else if (metric.gauge) {
+                    out << name << braces << " " << formatNumber(metric.gauge->value()) << "\n";
+                } else if (metric.callback) {
+                    out << name << braces << " " << formatNumber((*metric.callback)()) << "\n";
+                } else {
+                    uint64_t sum;
+                    metric.histogram->snapshot(buckets, sum);
+                    std::string prefix = labels.empty() ? std::string() : labels + ",";
+                    uint64_t count = 0;
+                    int next = 0;
+                    // Границы 2^8 ... 2^(HISTOGRAM_MAX_BITS-1) нс: корзины до начала следующей степени двойки
+                    for (int bits = 8; bits < HISTOGRAM_MAX_BITS; ++bits) {
+                        int end = Histogram::bucket(uint64_t(1) << bits);
+                        for (; next < end; ++next)
+                            count += buckets[next];
+                        out << name << "_bucket{" << prefix << "le=\"" << formatNumber(static_cast<double>(uint64_t(1) << bits) / 1e9)
+                            << "\"} " << count << "\n";
+                    }
+                    for (; next < HISTOGRAM_BUCKETS; ++next)
+                        count += buckets[next];
+                    out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << count << "\n";
+                    out << name << "_sum" << braces << " " << formatNumber(static_cast<double>(sum) / 1e9) << "\n";
+                    out << name << "_count" << braces << " " << count << "\n";
+                }
+            }
+        }
+        return out.str();
+    }
+
+    // Выгрузка в файл для сбора другим процессом (формат textfile collector):
+    // пишется рядом и переименовывается, читатель не видит файл наполовину
+    bool writeFile(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::trunc);
+            file << render();
+            if (!file)
+                return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    }
+
+private:
+    // Кратчайшее точное представление числа
+    static std::string formatNumber(double value) {
+        if (std::isnan(value))
+            return "NaN";
+        if (std::isinf(value))
+            return value > 0 ? "+Inf" : "-Inf";
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        return std::string(buf, result.ptr);
+    }
+
+    struct Metric {
+        Counter* counter;
+        Gauge* gauge;
+        Histogram* histogram;
+        std::function<double()>* callback;
+    };
+    struct Family {
+        std::string help;
+        std::string type;
+        std::vector<std::pair<std::string, Metric>> metrics;
+    };
+
+    void addFunction(const std::string& name, const std::string& help, const char* type, const std::string& labels,
+                     std::function<double()> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callbacks_.emplace_back(std::make_unique<std::function<double()>>(std::move(callback)));
+        add(name, help, type, labels, Metric{nullptr, nullptr, nullptr, callbacks_.back().get()});
+    }
+
+    void add(const std::string& name, const std::string& help, const char* type, const std::string& labels, Metric metric) {
+        auto it = families_.find(name);
+        if (it == families_.end()) {
+            order_.push_back(name);
+            it = families_.emplace(name, Family{help, type, {}}).first;
+        }
+        it->second.metrics.emplace_back(labels, metric);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Counter>> counters_;
+    std::vector<std::unique_ptr<Gauge>> gauges_;
+    std::vector<std::unique_ptr<Histogram>> histograms_;
+    std::vector<std::unique_ptr<std::function<double()>>> callbacks_;
+    std::map<std::string, Family> families_;
+    std::vector<std::string> order_;        // Порядок регистрации семейств
+};
+
+inline MetricsRegistry& metrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
@@ -0,0 +1,170 @@
+// Перенос базы из исходной схемы (timestamp TEXT в локальном времени)
+// в схему с целочисленными ключами (ts INTEGER - мс от эпохи UTC, sensor_id, WITHOUT ROWID).
+//
+// Перенос выполняется "на ходу": строки копируются во временную таблицу <table>_v2
+// порциями, каждая порция - отдельная короткая транзакция, поэтому запущенные
+// temperature_monitor и server старой версии продолжают писать и читать.
+// В конце одной транзакцией докопируется всё, что успело появиться, и таблицы подменяются.
+// Прерванный перенос можно просто запустить заново.
+//
+// --auto-vacuum дополнительно переводит базу в режим auto_vacuum = INCREMENTAL, в котором
+// temperature_monitor возвращает файлу место после удаления устаревших строк (retention.hpp).
+// Режим существующей базы меняется только полной перезаписью (VACUUM): она требует места
+// на диске с размер базы и монопольного доступа, поэтому запускается при остановленных
+// temperature_monitor и server.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "storage.hpp"
+
+const int BATCH_ROWS = 5000;                                  // Строк в одной порции
+const std::chrono::milliseconds BATCH_PAUSE(10);              // Пауза между порциями для других писателей
+
+// Перевод текстовой метки в мс от эпохи: метки хранились в локальном времени
+#define LEGACY_TS_TO_MILLIS "CAST(strftime('%s', timestamp, 'utc') AS INTEGER) * 1000"
+
+bool exec(sqlite3* db, const std::string& sql) {
+    char* errMsg = 0;
+    if (sqlite3_exec(db, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+        std::cerr << "SQL error: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+// Копирование строк с ключом в (after, upto] в новую таблицу
+bool copyRange(sqlite3* db, const std::string& table, const std::string& after, const std::string* upto) {
+    std::string sql = "INSERT OR IGNORE INTO " + table + "_v2 (ts, sensor_id, value) "
+                      "SELECT " LEGACY_TS_TO_MILLIS ", 0, value FROM " + table +
+                      " WHERE timestamp > ?1" + (upto ? " AND timestamp <= ?2" : "") +
+                      " AND value IS NOT NULL AND strftime('%s', timestamp) IS NOT NULL;";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, after.c_str(), -1, SQLITE_TRANSIENT);
+    if (upto)
+        sqlite3_bind_text(stmt, 2, upto->c_str(), -1, SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!ok)
+        std::cerr << "SQL error: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+// Верхняя граница следующей порции: последний ключ среди BATCH_ROWS ключей после after.
+// false - если строк после after больше нет
+bool nextBatchEnd(sqlite3* db, const std::string& table, const std::string& after, std::string& upto) {
+    std::string sql = "SELECT MAX(timestamp) FROM (SELECT timestamp FROM " + table +
+                      " WHERE timestamp > ? ORDER BY timestamp LIMIT ?);";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+    sqlite3_bind_text(stmt, 1, after.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, BATCH_ROWS);
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        upto = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        found = true;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Перенос одной таблицы
+bool migrateTable(sqlite3* db, const std::string& table) {
+    if (!isLegacyTable(db, table)) {
+        std::cout << table << ": already up to date" << std::endl;
+        return true;
+    }
+    if (!exec(db, tableSchema(table + "_v2")))
+        return false;
+
+    std::string last;
+    std::string upto;
+    long long batches = 0;
+    while (nextBatchEnd(db, table, last, upto)) {
+        if (!exec(db, "BEGIN IMMEDIATE;"))
+            return false;
+        if (!copyRange(db, table, last, &upto)) {
+            exec(db, "ROLLBACK;");
+            return false;
+        }
+        if (!exec(db, "COMMIT;"))
+            return false;
+        last = upto;
+        if (++batches % 20 == 0)
+            std::cout << table << ": copied up to " << last << std::endl;
+        std::this_thread::sleep_for(BATCH_PAUSE);
+    }
+
+    // Хвост, записанный во время переноса, и подмена таблиц - одной транзакцией
+    bool ok = exec(db, "BEGIN IMMEDIATE;") &&
+              copyRange(db, table, last, nullptr) &&
+              exec(db, "DROP TABLE " + table + ";") &&
+              exec(db, "ALTER TABLE " + table + "_v2 RENAME TO " + table + ";") &&
+              exec(db, "COMMIT;");
+    if (!ok) {
+        exec(db, "ROLLBACK;");
+        return false;
+    }
+    std::cout << table << ": migrated, " << queryInt(db, "SELECT COUNT(*) FROM " + table + ";") << " rows" << std::endl;
+    return true;
+}
+
+// Перевод базы в режим auto_vacuum = INCREMENTAL
+bool enableIncrementalVacuum(sqlite3* db) {
+    if (incrementalVacuumEnabled(db)) {
+        std::cout << "auto_vacuum: already incremental" << std::endl;
+        return true;
+    }
+    std::cout << "auto_vacuum: rewriting the database..." << std::endl;
+    if (!exec(db, "PRAGMA auto_vacuum = INCREMENTAL;") || !exec(db, "VACUUM;"))
+        return false;
+    std::cout << "auto_vacuum: incremental" << std::endl;
+    return incrementalVacuumEnabled(db);
+}
+
+int main(int argc, char** argv) {
+    const char* path = STORAGE_DB_PATH;
+    bool auto_vacuum = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--auto-vacuum") {
+            auto_vacuum = true;
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--auto-vacuum] [database]" << std::endl;
+            return 1;
+        }
+    }
+
+    sqlite3* db = openDatabase(path, false);
+    if (!db)
+        return 1;
+
+    int rc = 0;
+    for (const char* table : STORAGE_TABLES) {
+        if (queryInt(db, std::string("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = '") + table + "';") == 0)
+            continue;
+        if (!migrateTable(db, table)) {
+            std::cerr << table << ": migration failed" << std::endl;
+            rc = 2;
+        }
+    }
+    // Недостающие таблицы и номер версии схемы
+    if (rc == 0 && !initializeSchema(db))
+        rc = 2;
+    if (rc == 0 && auto_vacuum && !enableIncrementalVacuum(db)) {
+        std::cerr << "auto_vacuum: conversion failed (are temperature_monitor and server stopped?)" << std::endl;
+        rc = 2;
+    }
+
+    sqlite3_close(db);
+    return rc;
+}
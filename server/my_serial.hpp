@@ -369,7 +369,7 @@ namespace cplib
 			// Сконвертируем параметры класса в системные параметры COM-порта
 			MY_PORT_SETTINGS setts;
 			int ret = ParamsToSystem(inp_params, setts);
-			if (!ret)
+			if (ret != RE_OK)
 				return ret;
 #if defined(WIN32)
 			// Системный вызов установки параметров
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "wire_format.hpp"
+
+// Разобранная цель запроса: путь и параметры строки запроса
+struct Target {
+    std::string path;
+    std::map<std::string, std::string> params;
+
+    const std::string* param(const std::string& name) const {
+        auto it = params.find(name);
+        return it == params.end() ? nullptr : &it->second;
+    }
+};
+
+// Декодирование %XX и '+' в строке запроса
+inline std::string urlDecode(std::string_view str) {
+    std::string out;
+    out.reserve(str.size());
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        char ch = str[i];
+        if (ch == '+') {
+            out.push_back(' ');
+        } else if (ch == '%' && i + 2 < str.size()) {
+            unsigned value = 0;
+            auto result = std::from_chars(str.data() + i + 1, str.data() + i + 3, value, 16);
+            if (result.ec == std::errc() && result.ptr == str.data() + i + 3) {
+                out.push_back(static_cast<char>(value));
+                i += 2;
+            } else {
+                out.push_back(ch);
+            }
+        } else {
+            out.push_back(ch);
+        }
+    }
+    return out;
+}
+
+// Разбор "/path?name=value&..."; повторный параметр заменяет предыдущий
+inline Target parseTarget(std::string_view target) {
+    Target result;
+    std::size_t question = target.find('?');
+    result.path = urlDecode(target.substr(0, question));
+    if (question == std::string_view::npos)
+        return result;
+    std::string_view query = target.substr(question + 1);
+    while (!query.empty()) {
+        std::size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        if (!pair.empty()) {
+            std::size_t eq = pair.find('=');
+            std::string name = urlDecode(pair.substr(0, eq));
+            std::string value = eq == std::string_view::npos ? std::string() : urlDecode(pair.substr(eq + 1));
+            result.params[name] = value;
+        }
+        if (amp == std::string_view::npos)
+            break;
+        query.remove_prefix(amp + 1);
+    }
+    return result;
+}
+
+// Целое число целиком, без лишних символов
+inline bool parseInt(const std::string& str, int64_t& value) {
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    return !str.empty() && result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+// Момент времени: мс от эпохи либо локальное время "YYYY-MM-DD[ HH:MM[:SS]]" (вместо пробела допускается 'T')
+inline bool parseTime(const std::string& str, int64_t& millis) {
+    if (parseInt(str, millis))
+        return true;
+    struct tm tm = {};
+    int consumed = 0;
+    int fields = std::sscanf(str.c_str(), "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &consumed);
+    if (fields != 3)
+        return false;
+    if (static_cast<std::size_t>(consumed) < str.size()) {
+        char sep = str[consumed];
+        if (sep != ' ' && sep != 'T')
+            return false;
+        int rest = 0;
+        fields = std::sscanf(str.c_str() + consumed + 1, "%2d:%2d%n:%2d%n", &tm.tm_hour, &tm.tm_min, &rest, &tm.tm_sec, &rest);
+        if (fields < 2 || static_cast<std::size_t>(consumed + 1 + rest) != str.size())
+            return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == static_cast<time_t>(-1))
+        return false;
+    millis = static_cast<int64_t>(t) * 1000;
+    return true;
+}
+
+// Способ прореживания
+enum DownsampleMethod {
+    DOWNSAMPLE_LTTB,     // Largest-Triangle-Three-Buckets: сохраняет форму графика
+    DOWNSAMPLE_MINMAX    // Минимум и максимум в каждом интервале: сохраняет выбросы
+};
+
+// Параметры выборки из таблицы:
+//  from, to     - диапазон времени [from, to);
+//  sensor       - только строки датчика sensor;
+//  limit        - не больше limit строк, продолжение - по cursor из ответа;
+//  max_points   - прорядить до max_points точек (не больше MAX_POINTS);
+//  resolution   - шаг точек в секундах, не больше MAX_RESOLUTION_SECONDS
+//                 (число точек - длина диапазона данных, делённая на шаг);
+//  method       - lttb (по умолчанию) или minmax;
+//  time         - local (по умолчанию, строка локального времени) или epoch (мс от эпохи);
+//  format       - формат ответа, выбирается по заголовку Accept (см. wire_format.hpp)
+struct RangeQuery {
+    int64_t from = std::numeric_limits<int64_t>::min();
+    int64_t to = std::numeric_limits<int64_t>::max();
+    int64_t sensor = -1;            // -1 - все датчики
+    int64_t limit = 0;              // 0 - без ограничения
+    bool has_cursor = false;
+    int64_t cursor_ts = 0;          // Последняя отданная строка: (ts, sensor_id)
+    int64_t cursor_sensor = 0;
+    int64_t max_points = 0;         // 0 - без прореживания
+    int64_t resolution = 0;         // мс
+    DownsampleMethod method = DOWNSAMPLE_LTTB;
+    bool epoch_time = false;
+    ResponseFormat format;
+};
+
+// Пределы параметров: больше точек прореживание уже не экономит, шаг больше года не нужен
+// ни одной таблице (и в мс не переполняется)
+const int64_t MAX_POINTS = 100000;
+const int64_t MAX_RESOLUTION_SECONDS = 366LL * 24 * 3600;
+
+// Курсор продолжения - ключ последней отданной строки
+inline std::string formatCursor(int64_t ts, int64_t sensor_id) {
+    return std::to_string(ts) + "_" + std::to_string(sensor_id);
+}
+
+// Разбор параметров выборки; при ошибке возвращает false и описание в error
+inline bool parseRangeQuery(const Target& target, RangeQuery& query, std::string& error) {
+    const std::string* value;
+    if ((value = target.param("from")) && !parseTime(*value, query.from)) {
+        error = "Invalid 'from'";
+        return false;
+    }
+    if ((value = target.param("to")) && !parseTime(*value, query.to)) {
+        error = "Invalid 'to'";
+        return false;
+    }
+    if (query.from >= query.to) {
+        error = "'from' must be earlier than 'to'";
+        return false;
+    }
+    if ((value = target.param("sensor")) &&
+        (!parseInt(*value, query.sensor) || query.sensor < 0 || query.sensor > std::numeric_limits<int32_t>::max())) {
+        error = "Invalid 'sensor'";
+        return false;
+    }
+    if ((value = target.param("limit")) && (!parseInt(*value, query.limit) || query.limit <= 0)) {
+        error = "Invalid 'limit'";
+        return false;
+    }
+    if ((value = target.param("cursor"))) {
+        std::size_t sep = value->find('_');
+        if (sep == std::string::npos || !parseInt(value->substr(0, sep), query.cursor_ts) ||
+            !parseInt(value->substr(sep + 1), query.cursor_sensor)) {
+            error = "Invalid 'cursor'";
+            return false;
+        }
+        query.has_cursor = true;
+    }
+    if ((value = target.param("max_points")) && (!parseInt(*value, query.max_points) || query.max_points < 2 ||
+                                                  query.max_points > MAX_POINTS)) {
+        error = "Invalid 'max_points'";
+        return false;
+    }
+    if ((value = target.param("resolution"))) {
+        int64_t seconds;
+        if (!parseInt(*value, seconds) || seconds <= 0 || seconds > MAX_RESOLUTION_SECONDS) {
+            error = "Invalid 'resolution'";
+            return false;
+        }
+        query.resolution = seconds * 1000;
+    }
+    if ((value = target.param("method"))) {
+        if (*value == "lttb")
+            query.method = DOWNSAMPLE_LTTB;
+        else if (*value == "minmax")
+            query.method = DOWNSAMPLE_MINMAX;
+        else {
+            error = "Invalid 'method'";
+            return false;
+        }
+    }
+    if ((value = target.param("time"))) {
+        if (*value == "epoch")
+            query.epoch_time = true;
+        else if (*value != "local") {
+            error = "Invalid 'time'";
+            return false;
+        }
+    }
+    if ((query.max_points || query.resolution) && (query.limit || query.has_cursor)) {
+        error = "'limit'/'cursor' cannot be combined with 'max_points'/'resolution'";
+        return false;
+    }
+    return true;
+}
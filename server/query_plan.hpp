@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "downsample.hpp"
+#include "query.hpp"
+
+// Таблицы по возрастанию шага и номинальный шаг (мс); у сырых значений шаг зависит от датчика
+const char* const TABLE_ORDER[] = {"temperatures", "avg_temp_hour", "avg_temp_day"};
+const int64_t TABLE_STEP[] = {0, 60 * 60 * 1000LL, 24 * 60 * 60 * 1000LL};
+const int TABLE_COUNT = 3;
+
+// Во сколько раз строк в таблице должно быть больше, чем точек, чтобы взять более грубую таблицу
+const int64_t COARSEN_FACTOR = 20;
+
+// Строки таблицы в диапазоне
+struct TableRange {
+    int64_t count = 0;
+    int64_t min_ts = 0;
+    int64_t max_ts = 0;
+};
+
+// Источник строк для прореженной выборки: база или кэш горячих данных
+class RowSource {
+public:
+    virtual ~RowSource() = default;
+    virtual TableRange range(int table, const RangeQuery& query) = 0;
+    // Точки таблицы в диапазоне [from, to) по возрастанию времени
+    virtual bool points(int table, const RangeQuery& query, std::vector<Point>& points) = 0;
+};
+
+// План прореженной выборки: таблица-источник и итоговое число точек
+struct QueryPlan {
+    int table;
+    TableRange range;
+    int64_t points;
+};
+
+// Число точек: max_points либо длина диапазона строк, делённая на шаг resolution
+inline int64_t planPoints(const RangeQuery& query, const TableRange& range) {
+    if (!query.resolution)
+        return query.max_points;
+    return std::clamp<int64_t>((range.max_ts - range.min_ts) / query.resolution + 1, 2, MAX_POINTS);
+}
+
+// Выбор таблицы для прореженной выборки. Запрос к таблице может уйти только в более грубую:
+//  - если в запрошенной строк в COARSEN_FACTOR раз больше, чем нужно точек, а в грубой их хватает;
+//  - если начало диапазона задано явно, а в грубой таблице есть данные заметно раньше
+//    (сырые значения за этот период уже удалены по сроку хранения)
+//  Без явного начала диапазон начинается с первой строки запрошенной таблицы, чтобы
+//  грубая таблица с более долгим сроком хранения не расширяла его
+inline QueryPlan planQuery(RowSource& source, int table, RangeQuery& query, bool explicit_from) {
+    QueryPlan plan{table, source.range(table, query), 0};
+    if (!explicit_from && plan.range.count > 0)
+        query.from = plan.range.min_ts;
+    while (plan.table + 1 < TABLE_COUNT) {
+        TableRange coarse = source.range(plan.table + 1, query);
+        int64_t points = planPoints(query, plan.range);
+        bool too_dense = plan.range.count > points * COARSEN_FACTOR && coarse.count >= points;
+        bool not_covered = explicit_from && coarse.count > 0 &&
+                           (plan.range.count == 0 || coarse.min_ts < plan.range.min_ts - TABLE_STEP[plan.table + 1]);
+        if (!too_dense && !not_covered)
+            break;
+        plan.table++;
+        plan.range = coarse;
+    }
+    plan.points = planPoints(query, plan.range);
+    return plan;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "storage.hpp"
+#include "logger.hpp"
+
+// Ограниченная очередь без блокировок для нескольких производителей и потребителей
+// (bounded MPMC, Д. Вьюков). Каждая ячейка хранит номер ожидаемой операции: производитель
+// и потребитель захватывают позицию одним CAS и публикуют ячейку записью номера.
+// Память выделяется один раз, ёмкость - степень двойки
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : buffer_(capacity), mask_(capacity - 1) {
+        for (std::size_t i = 0; i < capacity; ++i)
+            buffer_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // false - очередь заполнена
+    bool try_push(const T& value) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &buffer_[pos & mask_];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false - очередь пуста
+    bool try_pop(T& value) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &buffer_[pos & mask_];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Примерное число элементов (точное, если нет одновременных операций)
+    std::size_t size() const {
+        std::size_t enq = enqueue_pos_.load(std::memory_order_relaxed);
+        std::size_t deq = dequeue_pos_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    std::size_t capacity() const { return buffer_.size(); }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::vector<Cell> buffer_;
+    const std::size_t mask_;
+    // Позиции на разных строках кэша: производители и потребитель не мешают друг другу
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+// Что делать с измерением, если очередь заполнена (запись в базу не успевает)
+enum OverflowPolicy {
+    OVERFLOW_BLOCK,         // Ждать места: чтение портов останавливается
+    OVERFLOW_DROP_OLDEST,   // Выбросить самое старое измерение в очереди
+    OVERFLOW_SPILL          // Дописать измерение в файл; писатель заберёт его, когда догонит
+};
+
+inline bool parseOverflowPolicy(const std::string& name, OverflowPolicy& policy) {
+    if (name == "block")
+        policy = OVERFLOW_BLOCK;
+    else if (name == "drop_oldest")
+        policy = OVERFLOW_DROP_OLDEST;
+    else if (name == "spill")
+        policy = OVERFLOW_SPILL;
+    else
+        return false;
+    return true;
+}
+
+// Очередь измерений от потоков чтения портов к потоку записи в базу.
+// push() не блокируется, пока в очереди есть место; при переполнении действует policy.
+// Счётчики глубины, потерь и сброшенных в файл измерений читаются из любого потока
+class ReadingQueue {
+public:
+    ReadingQueue(std::size_t capacity, OverflowPolicy policy, std::string spill_path)
+        : queue_(capacity), policy_(policy), spill_path_(std::move(spill_path)) {}
+
+    ~ReadingQueue() {
+        if (spill_)
+            std::fclose(spill_);
+    }
+
+    void push(const Reading& reading) {
+        while (!queue_.try_push(reading)) {
+            if (policy_ == OVERFLOW_SPILL) {
+                spill(reading);
+                return;
+            }
+            if (policy_ == OVERFLOW_DROP_OLDEST) {
+                Reading oldest;
+                if (queue_.try_pop(oldest))
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            blocked_.fetch_add(1, std::memory_order_relaxed);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::size_t depth = queue_.size();
+        std::size_t max = max_depth_.load(std::memory_order_relaxed);
+        while (depth > max && !max_depth_.compare_exchange_weak(max, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Забрать из очереди не больше limit измерений; возвращает их число
+    template <class Rows>
+    std::size_t drain(Rows& rows, std::size_t limit) {
+        std::size_t n = 0;
+        Reading reading;
+        while (n < limit && queue_.try_pop(reading)) {
+            rows.push_back(reading);
+            n++;
+        }
+        return n;
+    }
+
+    // Забрать измерения, сброшенные в файл при переполнении (и оставшиеся от прошлого запуска)
+    template <class Rows>
+    std::size_t drainSpill(Rows& rows) {
+        if (!spill_pending_.exchange(false, std::memory_order_acquire))
+            return 0;
+        std::lock_guard<std::mutex> lock(spill_mutex_);
+        if (spill_) {
+            std::fclose(spill_);
+            spill_ = nullptr;
+        }
+        FILE* file = std::fopen(spill_path_.c_str(), "rb");
+        if (!file)
+            return 0;
+        std::size_t n = 0;
+        Reading reading;
+        while (std::fread(&reading, sizeof(reading), 1, file) == 1) {
+            rows.push_back(reading);
+            n++;
+        }
+        std::fclose(file);
+        std::remove(spill_path_.c_str());
+        return n;
+    }
+
+    std::size_t depth() const { return queue_.size(); }
+    std::size_t capacity() const { return queue_.capacity(); }
+    std::size_t maxDepth() const { return max_depth_.load(std::memory_order_relaxed); }
+    std::size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    std::size_t spilled() const { return spilled_.load(std::memory_order_relaxed); }
+    std::size_t blocked() const { return blocked_.load(std::memory_order_relaxed); }
+
+private:
+    void spill(const Reading& reading) {
+        std::lock_guard<std::mutex> lock(spill_mutex_);
+        if (!spill_)
+            spill_ = std::fopen(spill_path_.c_str(), "ab");
+        if (!spill_ || std::fwrite(&reading, sizeof(reading), 1, spill_) != 1) {
+            LOG_LIMITED(LEVEL_ERROR, 1, "Failed to write spill file '" << spill_path_ << "', reading dropped");
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::fflush(spill_);
+        spilled_.fetch_add(1, std::memory_order_relaxed);
+        spill_pending_.store(true, std::memory_order_release);
+    }
+
+    BoundedQueue<Reading> queue_;
+    OverflowPolicy policy_;
+    std::string spill_path_;
+    std::mutex spill_mutex_;        // Только для медленного пути при переполнении
+    FILE* spill_ = nullptr;
+    std::atomic<bool> spill_pending_{true};  // Файл может быть непуст (при запуске - от прошлого запуска)
+
+    std::atomic<std::size_t> max_depth_{0};
+    std::atomic<std::size_t> dropped_{0};
+    std::atomic<std::size_t> spilled_{0};
+    std::atomic<std::size_t> blocked_{0};   // Ожиданий места при OVERFLOW_BLOCK
+};
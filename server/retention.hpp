@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db_writer.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "storage.hpp"
+
+// Обслуживание базы сборщика: срок хранения таблиц и возврат места файлу.
+// Проход запускается планировщиком (scheduler.hpp) раз в RETENTION_PERIOD.
+// Устаревшие строки удаляются порциями; каждая порция - отдельная короткая транзакция под мьютексом
+// соединения. Размер порции подстраивается под бюджет времени, а между порциями мьютекс свободен
+// не меньше, чем длилась порция, поэтому большой хвост после простоя не задерживает запись
+// новых измерений дольше одной порции.
+// Сырые значения не удаляются, а переносятся в архив по одним суткам: шаг архивации (его передаёт
+// вызывающий код) сжимает сутки без мьютекса и под ним только добавляет чанки в индекс, а строки
+// заархивированных суток удаляются отсюда такими же порциями по ключу.
+// Когда удалять нечего, свободные страницы возвращаются файлу порциями PRAGMA incremental_vacuum
+// (только у базы в режиме auto_vacuum = INCREMENTAL)
+const std::chrono::seconds RETENTION_PERIOD(60);                    // Период прохода по таблицам
+const std::chrono::milliseconds RETENTION_BATCH_BUDGET(20);         // Длительность порции по умолчанию
+const std::chrono::milliseconds RETENTION_MIN_PAUSE(5);             // Пауза между порциями не меньше
+const std::size_t RETENTION_MIN_BATCH = 64;                         // Строк в порции удаления
+const std::size_t RETENTION_MAX_BATCH = 65536;
+const std::size_t VACUUM_MIN_PAGES = 16;                            // Страниц в шаге incremental_vacuum
+const std::size_t VACUUM_MAX_PAGES = 4096;
+
+// Срок хранения строк таблицы, мс; 0 - хранить всё
+struct RetentionPolicy {
+    std::string table;
+    int64_t max_age_ms;
+};
+
+// Срок: число с единицей s, m, h или d ("90d", "12h"); "0" - без срока
+inline bool parseRetentionAge(std::string_view text, int64_t& millis) {
+    if (text == "0") {
+        millis = 0;
+        return true;
+    }
+    if (text.size() < 2)
+        return false;
+    int64_t unit;
+    switch (text.back()) {
+    case 's': unit = 1000; break;
+    case 'm': unit = 60 * 1000; break;
+    case 'h': unit = 60 * 60 * 1000; break;
+    case 'd': unit = ARCHIVE_DAY; break;
+    default: return false;
+    }
+    int64_t count = 0;
+    for (char ch : text.substr(0, text.size() - 1)) {
+        if (ch < '0' || ch > '9' || count > INT64_MAX / unit / 10)
+            return false;
+        count = count * 10 + (ch - '0');
+    }
+    millis = count * unit;
+    return count > 0;
+}
+
+// "table=age" - срок для таблицы из policies (в ней уже политики по умолчанию для всех таблиц).
+// Другие имена не принимаются: имя таблицы подставляется в текст запроса
+inline bool parseRetentionPolicy(std::string_view text, std::vector<RetentionPolicy>& policies) {
+    std::size_t eq = text.find('=');
+    if (eq == std::string_view::npos)
+        return false;
+    for (RetentionPolicy& policy : policies) {
+        if (policy.table == text.substr(0, eq))
+            return parseRetentionAge(text.substr(eq + 1), policy.max_age_ms);
+    }
+    return false;
+}
+
+class RetentionWorker {
+public:
+    // Соединение writer используется только под mutex. archive_day(cutoff, archived) переносит в архив
+    // одни сутки сырых значений, целиком лежащие до cutoff, и возвращает в archived заархивированные
+    // строки таблицы (удаляет их RetentionWorker); false - таких суток нет или перенос не удался.
+    // batch_seconds - время порции удаления
+    using ArchiveDay = std::function<bool(int64_t cutoff, std::vector<Reading>& archived)>;
+    RetentionWorker(DbWriter& writer, std::mutex& mutex, std::vector<RetentionPolicy> policies,
+                    std::chrono::milliseconds budget, ArchiveDay archive_day, Histogram& batch_seconds)
+        : writer_(writer), mutex_(mutex), policies_(std::move(policies)), budget_(budget),
+          archive_day_(std::move(archive_day)), batch_seconds_(batch_seconds),
+          backlog_(policies_.size()), removed_(policies_.size()) {
+        for (std::size_t i = 0; i < policies_.size(); ++i) {
+            std::string labels = "table=\"" + policies_[i].table + "\"";
+            metrics().gaugeFunction("retention_backlog_rows", "Rows past the retention period still in the table",
+                                    [this, i] { return double(backlog_[i].load(std::memory_order_relaxed)); }, labels);
+            metrics().counterFunction("retention_removed_rows_total", "Rows deleted or archived on expiry",
+                                      [this, i] { return double(removed_[i].load(std::memory_order_relaxed)); }, labels);
+        }
+        metrics().gaugeFunction("retention_batch_rows", "Current size of a retention delete batch",
+                                [this] { return double(batch_.load(std::memory_order_relaxed)); });
+        metrics().gaugeFunction("db_free_pages", "Database pages freed by deletes and not yet returned to the file",
+                                [this] { return double(free_pages_.load(std::memory_order_relaxed)); });
+        metrics().counterFunction("retention_vacuumed_pages_total", "Pages returned to the file by incremental vacuum",
+                                  [this] { return double(vacuumed_pages_.load(std::memory_order_relaxed)); });
+    }
+
+    // Проход по всем таблицам: удаление устаревших строк, затем возврат места файлу.
+    // Вызовы не должны пересекаться; проход с большим хвостом длится, пока хвост не удалён
+    void pass() {
+        if (!checked_) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                vacuum_enabled_ = writer_.autoVacuum() == AUTO_VACUUM_INCREMENTAL;
+            }
+            checked_ = true;
+            LOG_INFO("Retention: " << describe() << ", batch budget " << budget_.count() << " ms");
+            if (!vacuum_enabled_)
+                LOG_WARN("Database is not in auto_vacuum = INCREMENTAL mode, freed space stays in the file; "
+                         "convert it with migrate_db --auto-vacuum");
+        }
+        bool done = true;
+        for (std::size_t i = 0; i < policies_.size() && !stopping(); ++i)
+            done = expire(i) && done;
+        // Место возвращается файлу, когда устаревших строк не осталось
+        if (done && vacuum_enabled_)
+            vacuum();
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_pages_.store(writer_.freePages(), std::memory_order_relaxed);
+    }
+
+    // Прервать текущий проход между порциями; следующие проходы ничего не делают
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+    }
+
+private:
+    // Удаление (перенос в архив) строк таблицы старше срока; false - не всё удалено
+    bool expire(std::size_t index) {
+        const RetentionPolicy& policy = policies_[index];
+        if (policy.max_age_ms <= 0)
+            return true;
+        bool archive = !isAggregateTable(policy.table);
+        int64_t cutoff = nowMillis() - policy.max_age_ms;
+        // В архив уходят только сутки целиком
+        int64_t limit = archive ? archiveDay(cutoff) : cutoff;
+        int64_t backlog;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            backlog = writer_.countOlderThan(policy.table, limit);
+        }
+        backlog_[index].store(backlog, std::memory_order_relaxed);
+        if (backlog == 0)
+            return true;
+        LOG_INFO("Retention: " << backlog << " rows of " << policy.table << (archive ? " to archive" : " to delete"));
+
+        while (backlog > 0 && !stopping()) {
+            // Следующие сутки в архив; мьютекс занят только на время записи индекса.
+            // Строки прерванных суток (ошибка удаления) дочищаются раньше следующих
+            if (archive && archived_pos_ == archived_.size()) {
+                archived_.clear();
+                archived_pos_ = 0;
+                if (!archive_day_(cutoff, archived_) || archived_.empty())
+                    return false;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int64_t before = backlog;
+            std::size_t batch = batch_.load(std::memory_order_relaxed);
+            bool ok;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ScopedTimer timer(batch_seconds_);
+                if (archive) {
+                    std::size_t count = std::min(batch, archived_.size() - archived_pos_);
+                    ok = writer_.deleteRows(policy.table, archived_, archived_pos_, count);
+                    if (ok)
+                        archived_pos_ += count;
+                    // Сутки удалены - остаток пересчитывается (в таблице могли остаться строки, пришедшие позже)
+                    backlog = archived_pos_ == archived_.size() ? writer_.countOlderThan(policy.table, limit)
+                                                                : std::max<int64_t>(backlog - static_cast<int64_t>(ok ? count : 0), 0);
+                } else {
+                    std::size_t deleted = 0;
+                    ok = writer_.deleteOldest(policy.table, cutoff, batch, deleted);
+                    // Неполная порция - старше срока строк больше нет (новые за время прохода не считаются)
+                    backlog = ok && deleted < batch ? 0 : std::max<int64_t>(backlog - static_cast<int64_t>(deleted), 0);
+                }
+            }
+            std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - start;
+            removed_[index].fetch_add(static_cast<uint64_t>(std::max<int64_t>(before - backlog, 0)), std::memory_order_relaxed);
+            backlog_[index].store(backlog, std::memory_order_relaxed);
+            if (!ok)
+                return false;
+            batch_.store(adjust(batch, took, RETENTION_MIN_BATCH, RETENTION_MAX_BATCH), std::memory_order_relaxed);
+            pause(took);
+        }
+        return backlog == 0;
+    }
+
+    // Возврат свободных страниц файлу шагами, каждый под мьютексом отдельно
+    void vacuum() {
+        uint64_t total = 0;
+        while (!stopping()) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int64_t before, after;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                before = writer_.freePages();
+                after = before > 0 && writer_.incrementalVacuum(static_cast<int64_t>(vacuum_pages_)) ? writer_.freePages() : before;
+            }
+            free_pages_.store(after, std::memory_order_relaxed);
+            if (after >= before)
+                break;
+            total += static_cast<uint64_t>(before - after);
+            vacuumed_pages_.fetch_add(static_cast<uint64_t>(before - after), std::memory_order_relaxed);
+            std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - start;
+            vacuum_pages_ = adjust(vacuum_pages_, took, VACUUM_MIN_PAGES, VACUUM_MAX_PAGES);
+            pause(took);
+        }
+        if (total > 0)
+            LOG_INFO("Retention: " << total << " free pages returned to the file");
+    }
+
+    // Следующий размер порции: дольше бюджета - вдвое меньше, быстрее половины бюджета - вдвое больше
+    std::size_t adjust(std::size_t size, std::chrono::steady_clock::duration took, std::size_t min, std::size_t max) const {
+        if (took > budget_)
+            return std::max(min, size / 2);
+        if (took < budget_ / 2)
+            return std::min(max, size * 2);
+        return size;
+    }
+
+    // Между порциями соединение свободно не меньше, чем длилась порция
+    void pause(std::chrono::steady_clock::duration took) {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait_for(lock, std::max<std::chrono::steady_clock::duration>(took, RETENTION_MIN_PAUSE), [this] { return stop_; });
+    }
+
+    bool stopping() {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        return stop_;
+    }
+
+    std::string describe() const {
+        std::string text;
+        for (const RetentionPolicy& policy : policies_) {
+            if (!text.empty())
+                text += ", ";
+            text += policy.table + (isAggregateTable(policy.table) ? " " : " archived after ");
+            text += policy.max_age_ms > 0 ? std::to_string(policy.max_age_ms / 1000) + " s" : "kept";
+        }
+        return text;
+    }
+
+    DbWriter& writer_;
+    std::mutex& mutex_;                         // Соединение writer_
+    const std::vector<RetentionPolicy> policies_;
+    const std::chrono::milliseconds budget_;
+    ArchiveDay archive_day_;
+    Histogram& batch_seconds_;
+    std::vector<Reading> archived_;             // Строки заархивированных суток, ещё не удалённые из таблицы
+    std::size_t archived_pos_ = 0;              // Удалены archived_[0, archived_pos_)
+    std::size_t vacuum_pages_ = 256;
+    bool checked_ = false;                      // Режим auto_vacuum проверен при первом проходе
+    bool vacuum_enabled_ = false;
+
+    // Читаются при выгрузке метрик из другого потока
+    std::vector<std::atomic<int64_t>> backlog_;
+    std::vector<std::atomic<uint64_t>> removed_;
+    std::atomic<std::size_t> batch_{1024};
+    std::atomic<int64_t> free_pages_{0};
+    std::atomic<uint64_t> vacuumed_pages_{0};
+
+    // Паузы между порциями, прерываемые stop()
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+};
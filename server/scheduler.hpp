@@ -0,0 +1,128 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+#include "metrics.hpp"
+
+// Планировщик периодических задач: синхронизация с базой, закрытие интервалов агрегации,
+// сроки хранения, выгрузка метрик. Задачи выполняются на небольшом пуле потоков по таймерам
+// boost::asio::steady_timer и не зависят от того, как часто приходят измерения.
+// Срок следующего запуска задаёт функция от текущего времени по системным часам, поэтому задачу
+// можно привязать к границе минуты, часа или суток; срок пересчитывается перед каждым ожиданием,
+// и перевод часов не накапливает сдвиг.
+// Задача не выполняется одновременно сама с собой (strand). Если запуск затянулся дольше
+// следующего срока, пропущенные сроки не догоняются: следующий - ближайший после окончания.
+// Для каждой задачи в метриках - длительность, опоздание запуска относительно срока и число запусков
+class Scheduler {
+public:
+    // Срок следующего запуска, мс от эпохи, строго после now
+    using Next = std::function<int64_t(int64_t now)>;
+
+    explicit Scheduler(std::size_t threads) : threads_(std::max<std::size_t>(threads, 1)) {}
+    ~Scheduler() { stop(); }
+
+    // Сроки - кратные period от эпохи со сдвигом offset: every(60 с) - начало каждой минуты
+    static Next every(std::chrono::milliseconds period, std::chrono::milliseconds offset = std::chrono::milliseconds(0)) {
+        int64_t step = period.count();
+        int64_t shift = offset.count() % step;
+        return [step, shift](int64_t now) {
+            int64_t next = (now - shift) / step * step + shift;
+            return next > now ? next : next + step;
+        };
+    }
+
+    // Задача добавляется до start()
+    void add(const std::string& name, Next next, std::function<void()> body) {
+        std::string labels = "task=\"" + name + "\"";
+        tasks_.push_back(std::unique_ptr<Task>(new Task{
+            name, std::move(next), std::move(body), boost::asio::make_strand(io_context_),
+            boost::asio::steady_timer(io_context_), 0,
+            metrics().histogram("scheduler_task_duration_seconds", "Time a scheduled task ran", labels),
+            metrics().histogram("scheduler_task_delay_seconds", "How late a scheduled task started after its deadline", labels),
+            metrics().counter("scheduler_task_runs_total", "Scheduled task runs", labels)}));
+    }
+
+    void start() {
+        for (const std::unique_ptr<Task>& task : tasks_)
+            schedule(*task);
+        for (std::size_t i = 0; i < threads_; ++i)
+            pool_.emplace_back([this] { io_context_.run(); });
+    }
+
+    // Запуск задачи вне расписания (например, досрочная синхронизация); срок по расписанию не меняется.
+    // Если задача сейчас выполняется, запуск выполнится после неё
+    void trigger(const std::string& name) {
+        for (const std::unique_ptr<Task>& task : tasks_) {
+            if (task->name == name) {
+                Task* target = task.get();
+                boost::asio::post(target->strand, [this, target] { run(*target); });
+            }
+        }
+    }
+
+    // Остановка после текущих запусков
+    void stop() {
+        work_.reset();
+        io_context_.stop();
+        for (std::thread& thread : pool_)
+            thread.join();
+        pool_.clear();
+    }
+
+private:
+    struct Task {
+        std::string name;
+        Next next;
+        std::function<void()> body;
+        boost::asio::strand<boost::asio::io_context::executor_type> strand;
+        boost::asio::steady_timer timer;
+        int64_t deadline;           // Срок ожидаемого запуска, мс от эпохи
+        Histogram& duration;
+        Histogram& delay;
+        Counter& runs;
+    };
+
+    static int64_t wallMillis() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Ожидание срока по монотонным часам: ожидание не прерывается переводом системных часов
+    void schedule(Task& task) {
+        int64_t now = wallMillis();
+        task.deadline = task.next(now);
+        task.timer.expires_after(std::chrono::milliseconds(task.deadline - now));
+        task.timer.async_wait(boost::asio::bind_executor(task.strand, [this, &task](const boost::system::error_code& error) {
+            if (error)
+                return;
+            task.delay.observe(static_cast<uint64_t>(std::max<int64_t>(wallMillis() - task.deadline, 0)) * 1000000);
+            run(task);
+            schedule(task);
+        }));
+    }
+
+    void run(Task& task) {
+        ScopedTimer timer(task.duration);
+        task.runs.inc();
+        try {
+            task.body();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Scheduled task " << task.name << " failed: " << e.what());
+        }
+    }
+
+    const std::size_t threads_;
+    boost::asio::io_context io_context_;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_ = boost::asio::make_work_guard(io_context_);
+    std::vector<std::unique_ptr<Task>> tasks_;
+    std::vector<std::thread> pool_;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+#include "sensor_protocol.hpp"
+
+// Датчик, подключённый к последовательному порту
+struct SensorConfig {
+    int32_t sensor_id;
+    std::string device;
+    unsigned baud_rate;
+    SensorProtocol protocol;
+};
+
+const unsigned DEFAULT_BAUD_RATE = 115200;
+
+// Чтение списка датчиков. Формат - строка на датчик, '#' начинает комментарий:
+//   # sensor_id  порт          [скорость]  [text|binary]
+//   0            /dev/ttyUSB0  115200
+//   1            /dev/ttyUSB1  9600        binary
+//   2            /dev/ttyUSB2  binary
+// Без протокола - protocol. При ошибке печатает её с номером строки и возвращает false
+inline bool loadSensorConfig(const std::string& path, std::vector<SensorConfig>& sensors,
+                             SensorProtocol protocol = PROTOCOL_TEXT) {
+    std::ifstream file(path);
+    if (!file) {
+        LOG_ERROR("Failed to open config '" << path << "'");
+        return false;
+    }
+    std::set<int32_t> ids;
+    std::set<std::string> devices;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string id;
+        if (!(fields >> id))
+            continue;
+        SensorConfig sensor{0, "", DEFAULT_BAUD_RATE, protocol};
+        std::string extra;
+        bool ok = true;
+        try {
+            std::size_t used = 0;
+            long value = std::stol(id, &used);
+            ok = used == id.size() && value >= 0 && value <= INT32_MAX;
+            sensor.sensor_id = static_cast<int32_t>(value);
+        } catch (const std::exception&) {
+            ok = false;
+        }
+        ok = ok && (fields >> sensor.device);
+        bool has_baud = false;
+        bool has_protocol = false;
+        while (ok && (fields >> extra)) {
+            if (!has_protocol && parseSensorProtocol(extra, sensor.protocol)) {
+                has_protocol = true;
+                continue;
+            }
+            try {
+                ok = !has_baud && !has_protocol;
+                sensor.baud_rate = static_cast<unsigned>(std::stoul(extra));
+                has_baud = true;
+            } catch (const std::exception&) {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            LOG_ERROR(path << ":" << number << ": expected '<sensor_id> <port> [baud_rate] [text|binary]'");
+            return false;
+        }
+        if (!ids.insert(sensor.sensor_id).second || !devices.insert(sensor.device).second) {
+            LOG_ERROR(path << ":" << number << ": duplicate sensor id or port");
+            return false;
+        }
+        sensors.push_back(sensor);
+    }
+    if (sensors.empty()) {
+        LOG_ERROR("No sensors in config '" << path << "'");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "crc32.hpp"
+
+// Протоколы обмена с датчиком по последовательному порту:
+//  - текстовый: каждое измерение - строка с числом в °C, завершённая '\n';
+//  - двоичный: кадры с несколькими измерениями подряд, little-endian:
+//      0   2       синхрослово 0xAA 0x55
+//      2   2       длина тела L = 14 + 2 * N
+//      4   2       номер датчика на устройстве
+//      6   4       интервал между измерениями, мкс
+//      10  8       время первого измерения по часам устройства, мс
+//      18  2 * N   измерения int16 в сотых долях °C
+//      4 + L   4   CRC-32 байт с 2 по 4 + L (длина и тело)
+// Кадр из 32 измерений - 86 байт вместо ~160 в тексте, проверяется CRC и несёт время устройства.
+// Интервал в мкс: при округлении до мс кадры на частотах выше сотен Гц наползали бы друг на друга
+enum SensorProtocol {
+    PROTOCOL_TEXT,
+    PROTOCOL_BINARY
+};
+
+inline bool parseSensorProtocol(std::string_view name, SensorProtocol& protocol) {
+    if (name == "text")
+        protocol = PROTOCOL_TEXT;
+    else if (name == "binary")
+        protocol = PROTOCOL_BINARY;
+    else
+        return false;
+    return true;
+}
+
+const unsigned char FRAME_SYNC_0 = 0xAA;
+const unsigned char FRAME_SYNC_1 = 0x55;
+const std::size_t FRAME_PREFIX_SIZE = 4;            // Синхрослово и длина
+const std::size_t FRAME_FIXED_BODY = 14;            // Тело без измерений
+const std::size_t FRAME_CRC_SIZE = 4;
+const std::size_t FRAME_MAX_SAMPLES = 256;
+const std::size_t FRAME_MAX_SIZE = FRAME_PREFIX_SIZE + FRAME_FIXED_BODY + 2 * FRAME_MAX_SAMPLES + FRAME_CRC_SIZE;
+const double FRAME_VALUE_SCALE = 100.0;             // Измерения в сотых долях °C
+
+// Текстовое измерение: число с точкой без показателя степени, без пробелов и мусора вокруг
+inline bool parseTextReading(std::string_view line, double& value) {
+    const char* end = line.data() + line.size();
+    auto result = std::from_chars(line.data(), end, value, std::chars_format::fixed);
+    return result.ec == std::errc() && result.ptr == end && std::isfinite(value);
+}
+
+inline uint16_t loadLE16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t loadLE32(const unsigned char* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t loadLE64(const unsigned char* p) {
+    return uint64_t(loadLE32(p)) | (uint64_t(loadLE32(p + 4)) << 32);
+}
+
+template <class T>
+inline void appendLE(std::string& out, T value) {
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        out.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+}
+
+// Кадр, разобранный на месте: измерения читаются прямо из буфера декодера
+// и действительны только внутри обработчика
+struct SensorFrame {
+    uint16_t sensor_id;
+    uint32_t interval_us;
+    int64_t device_ts;                  // мс по часам устройства
+    std::size_t count;
+    const unsigned char* samples;
+
+    double value(std::size_t i) const {
+        return static_cast<int16_t>(loadLE16(samples + 2 * i)) / FRAME_VALUE_SCALE;
+    }
+
+    // Время измерения i по часам устройства, мс (с округлением вниз)
+    int64_t deviceTs(std::size_t i) const {
+        return device_ts + static_cast<int64_t>(i * interval_us / 1000);
+    }
+};
+
+// Кадр с измерениями values в out (дописывается). false - больше FRAME_MAX_SAMPLES
+// измерений или значение вне диапазона int16 в сотых долях
+inline bool encodeFrame(std::string& out, uint16_t sensor_id, uint32_t interval_us, int64_t device_ts,
+                        const std::vector<double>& values) {
+    if (values.empty() || values.size() > FRAME_MAX_SAMPLES)
+        return false;
+    std::size_t start = out.size();
+    out.push_back(static_cast<char>(FRAME_SYNC_0));
+    out.push_back(static_cast<char>(FRAME_SYNC_1));
+    appendLE(out, static_cast<uint16_t>(FRAME_FIXED_BODY + 2 * values.size()));
+    appendLE(out, sensor_id);
+    appendLE(out, interval_us);
+    appendLE(out, static_cast<uint64_t>(device_ts));
+    for (double value : values) {
+        double scaled = std::round(value * FRAME_VALUE_SCALE);
+        if (!(scaled >= INT16_MIN && scaled <= INT16_MAX)) {
+            out.resize(start);
+            return false;
+        }
+        appendLE(out, static_cast<uint16_t>(static_cast<int16_t>(scaled)));
+    }
+    appendLE(out, crc32(out.data() + start + 2, out.size() - start - 2));
+    return true;
+}
+
+// Поиск кадров в принятом потоке байт. Данные читаются в линейный буфер, кадры разбираются
+// на месте без копирования; остаток недочитанного кадра переносится в начало буфера,
+// только когда место в конце кончилось (он короче FRAME_MAX_SIZE).
+// После искажения (неверная длина или CRC) поиск продолжается со следующего байта после
+// синхрослова, поэтому испорченный кадр теряется один, а следующие находятся.
+// Счётчики читаются из других потоков (метрики)
+class FrameDecoder {
+public:
+    explicit FrameDecoder(std::size_t capacity = 64 * 1024) : buffer_(std::max(capacity, 2 * FRAME_MAX_SIZE)) {}
+
+    // Свободный участок для следующего чтения
+    std::pair<char*, std::size_t> prepare() {
+        if (buffer_.size() - end_ < FRAME_MAX_SIZE) {
+            std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        return {buffer_.data() + end_, buffer_.size() - end_};
+    }
+
+    // В участок из prepare() записано n байт; handler(const SensorFrame&) вызывается
+    // для каждого целого кадра
+    template <class Handler>
+    void commit(std::size_t n, Handler&& handler) {
+        end_ += n;
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer_.data());
+        while (end_ - begin_ >= FRAME_PREFIX_SIZE) {
+            const unsigned char* p = data + begin_;
+            std::size_t available = end_ - begin_;
+            if (p[0] != FRAME_SYNC_0 || p[1] != FRAME_SYNC_1) {
+                const void* sync = std::memchr(p + 1, FRAME_SYNC_0, available - 1);
+                std::size_t skip = sync ? static_cast<const unsigned char*>(sync) - p : available;
+                add(skipped_bytes_, skip);
+                begin_ += skip;
+                continue;
+            }
+            std::size_t length = loadLE16(p + 2);
+            if (length < FRAME_FIXED_BODY + 2 || length > FRAME_MAX_SIZE - FRAME_PREFIX_SIZE - FRAME_CRC_SIZE ||
+                (length - FRAME_FIXED_BODY) % 2 != 0) {
+                resync();
+                continue;
+            }
+            std::size_t size = FRAME_PREFIX_SIZE + length + FRAME_CRC_SIZE;
+            if (available < size)
+                break;
+            if (crc32(p + 2, length + 2) != loadLE32(p + FRAME_PREFIX_SIZE + length)) {
+                resync();
+                continue;
+            }
+            SensorFrame frame;
+            frame.sensor_id = loadLE16(p + 4);
+            frame.interval_us = loadLE32(p + 6);
+            frame.device_ts = static_cast<int64_t>(loadLE64(p + 10));
+            frame.count = (length - FRAME_FIXED_BODY) / 2;
+            frame.samples = p + 18;
+            begin_ += size;
+            add(frames_, 1);
+            handler(frame);
+        }
+        if (begin_ == end_)
+            begin_ = end_ = 0;
+    }
+
+    // Сброс недочитанного кадра (после переподключения)
+    void reset() { begin_ = end_ = 0; }
+
+    uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+    uint64_t errors() const { return errors_.load(std::memory_order_relaxed); }                  // Неверная длина или CRC
+    uint64_t skippedBytes() const { return skipped_bytes_.load(std::memory_order_relaxed); }     // Байт вне кадров
+
+private:
+    // Синхрослово оказалось ложным или кадр испорчен: поиск со следующего байта
+    void resync() {
+        add(errors_, 1);
+        add(skipped_bytes_, 1);
+        begin_ += 1;
+    }
+
+    // Пишет только поток чтения
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::vector<char> buffer_;
+    std::size_t begin_ = 0;      // Начало неразобранных данных
+    std::size_t end_ = 0;        // Конец принятых данных
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> errors_{0};
+    std::atomic<uint64_t> skipped_bytes_{0};
+};
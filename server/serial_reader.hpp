@@ -0,0 +1,291 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "storage.hpp"
+#include "sensor_protocol.hpp"
+#include "logger.hpp"
+
+// Разбиение принятого потока байт на строки по '\n' в кольцевом буфере.
+// Буфер выделяется один раз; строка, целиком лежащая в буфере, передаётся без копирования,
+// переходящая через конец буфера - склеивается в переиспользуемую строку.
+// Строка длиннее буфера отбрасывается целиком (до следующего '\n')
+class LineFramer {
+public:
+    // capacity - степень двойки
+    explicit LineFramer(std::size_t capacity = 64 * 1024) : buffer_(capacity) {}
+
+    // Свободный непрерывный участок для следующего чтения
+    boost::asio::mutable_buffer prepare() {
+        if (size_ == buffer_.size()) {
+            // Буфер заполнен без единого '\n': строка слишком длинная (считается один раз,
+            // сколько бы буферов она ни заняла)
+            if (!discarding_)
+                overflows_++;
+            discarding_ = true;
+            head_ = size_ = scanned_ = 0;
+        }
+        std::size_t tail = (head_ + size_) & mask();
+        std::size_t free = std::min(buffer_.size() - size_, buffer_.size() - tail);
+        return boost::asio::buffer(buffer_.data() + tail, free);
+    }
+
+    // В участок из prepare() записано n байт; handler(std::string_view) вызывается для каждой
+    // полной непустой строки (без '\n' и завершающего '\r')
+    template <class Handler>
+    void commit(std::size_t n, Handler&& handler) {
+        size_ += n;
+        while (scanned_ < size_) {
+            std::size_t start = (head_ + scanned_) & mask();
+            std::size_t len = std::min(size_ - scanned_, buffer_.size() - start);
+            const char* nl = static_cast<const char*>(std::memchr(buffer_.data() + start, '\n', len));
+            if (!nl) {
+                scanned_ += len;
+                continue;
+            }
+            std::size_t line_len = scanned_ + static_cast<std::size_t>(nl - (buffer_.data() + start));
+            if (!discarding_)
+                deliver(line_len, handler);
+            discarding_ = false;
+            head_ = (head_ + line_len + 1) & mask();
+            size_ -= line_len + 1;
+            scanned_ = 0;
+        }
+    }
+
+    // Сброс недочитанной строки (после переподключения)
+    void reset() {
+        head_ = size_ = scanned_ = 0;
+        discarding_ = false;
+    }
+
+    // Число отброшенных слишком длинных строк
+    std::size_t overflows() const { return overflows_; }
+
+private:
+    std::size_t mask() const { return buffer_.size() - 1; }
+
+    template <class Handler>
+    void deliver(std::size_t len, Handler& handler) {
+        std::string_view line;
+        if (head_ + len <= buffer_.size()) {
+            line = std::string_view(buffer_.data() + head_, len);
+        } else {
+            std::size_t first = buffer_.size() - head_;
+            joined_.assign(buffer_.data() + head_, first);
+            joined_.append(buffer_.data(), len - first);
+            line = joined_;
+        }
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (!line.empty())
+            handler(line);
+    }
+
+    std::vector<char> buffer_;
+    std::size_t head_ = 0;       // Начало недочитанных данных
+    std::size_t size_ = 0;       // Недочитанных байт
+    std::size_t scanned_ = 0;    // Из них уже просмотрено без '\n'
+    bool discarding_ = false;    // Пропуск остатка слишком длинной строки
+    std::size_t overflows_ = 0;
+    std::string joined_;
+};
+
+// Чтение последовательного порта на io_context без блокирующих вызовов.
+// В текстовом протоколе обработчику передаётся каждая полная строка, в двоичном - каждый целый кадр,
+// вместе с моментом приёма по монотонным часам.
+// Метка времени в мс от эпохи тоже считается от монотонных часов (перевод системного времени
+// её не сдвигает; расхождение больше секунды с системными часами исправляется) и строго возрастает.
+// У кадра метка есть у каждого измерения: время устройства переводится в системное по сдвигу,
+// замеренному на первом кадре; сдвиг замеряется заново, если последнее измерение кадра
+// расходится с моментом приёма больше чем на секунду (устройство перезапущено, часы уплыли).
+// Метки измерений тоже строго возрастают: база хранит мс, поэтому при частоте выше 1 кГц
+// или после сдвига назад метки уходят вперёд по 1 мс, но ни одно измерение не совпадает с другим.
+//
+// Если порт не открывается или пропал (устройство отключено, EOF, ошибка чтения),
+// порт закрывается и открывается заново с экспоненциальной задержкой от RECONNECT_MIN до RECONNECT_MAX;
+// после успешного чтения задержка сбрасывается
+class SerialReader {
+public:
+    struct Sample {
+        std::string_view line;                  // Текстовый протокол
+        const SensorFrame* frame = nullptr;     // Двоичный протокол
+        const int64_t* frame_ts = nullptr;      // Метки измерений кадра (frame->count), мс от эпохи
+        std::chrono::steady_clock::time_point received;
+        int64_t ts;     // мс от эпохи; у кадра - метка первого измерения
+    };
+    using Handler = std::function<void(const Sample& sample)>;
+
+    SerialReader(boost::asio::io_context& io_context, std::string device, unsigned baud_rate, SensorProtocol protocol,
+                 Handler handler)
+        : port_(io_context), timer_(io_context), device_(std::move(device)), baud_rate_(baud_rate),
+          protocol_(protocol), handler_(std::move(handler)) {}
+
+    // Первое открытие порта; false, если порт сейчас недоступен (попытки продолжатся в фоне)
+    bool start() {
+        return open();
+    }
+
+    void stop() {
+        stopped_ = true;
+        timer_.cancel();
+        boost::system::error_code ec;
+        port_.close(ec);
+    }
+
+    std::size_t reconnects() const { return reconnects_.load(std::memory_order_relaxed); }     // Читается из потока метрик
+    std::size_t overflows() const { return framer_.overflows(); }
+    const FrameDecoder& decoder() const { return decoder_; }
+
+private:
+    static constexpr std::chrono::milliseconds RECONNECT_MIN{100};
+    static constexpr std::chrono::milliseconds RECONNECT_MAX{10000};
+
+    bool open() {
+        namespace asio = boost::asio;
+        boost::system::error_code ec;
+        port_.open(device_, ec);
+        if (!ec) port_.set_option(asio::serial_port_base::baud_rate(baud_rate_), ec);
+        if (!ec) port_.set_option(asio::serial_port_base::character_size(8), ec);
+        if (!ec) port_.set_option(asio::serial_port_base::parity(asio::serial_port_base::parity::none), ec);
+        if (!ec) port_.set_option(asio::serial_port_base::stop_bits(asio::serial_port_base::stop_bits::one), ec);
+        if (!ec) port_.set_option(asio::serial_port_base::flow_control(asio::serial_port_base::flow_control::none), ec);
+        if (ec) {
+            LOG_WARN("Failed to open port '" << device_ << "': " << ec.message());
+            boost::system::error_code ignored;
+            port_.close(ignored);
+            schedule_reconnect();
+            return false;
+        }
+        LOG_INFO("Port '" << device_ << "' opened");
+        framer_.reset();
+        decoder_.reset();
+        device_offset_.reset();
+        do_read();
+        return true;
+    }
+
+    void do_read() {
+        boost::asio::mutable_buffer buffer;
+        if (protocol_ == PROTOCOL_BINARY) {
+            auto free = decoder_.prepare();
+            buffer = boost::asio::buffer(free.first, free.second);
+        } else {
+            buffer = framer_.prepare();
+        }
+        port_.async_read_some(buffer, [this](const boost::system::error_code& ec, std::size_t n) { on_read(ec, n); });
+    }
+
+    void on_read(const boost::system::error_code& ec, std::size_t n) {
+        if (stopped_)
+            return;
+        if (ec) {
+            LOG_WARN("Port '" << device_ << "' read error: " << ec.message() << ", reconnecting");
+            boost::system::error_code ignored;
+            port_.close(ignored);
+            reconnects_.store(reconnects_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            schedule_reconnect();
+            return;
+        }
+        backoff_ = RECONNECT_MIN;
+
+        Sample sample;
+        sample.received = std::chrono::steady_clock::now();
+        if (protocol_ == PROTOCOL_BINARY) {
+            uint64_t errors = decoder_.errors();
+            decoder_.commit(n, [this, &sample](const SensorFrame& frame) {
+                sample.frame = &frame;
+                sample.frame_ts = frameTimestamps(frame, sample.received);
+                sample.ts = sample.frame_ts[0];
+                handler_(sample);
+            });
+            if (decoder_.errors() != errors)
+                LOG_LIMITED(LEVEL_WARN, 1, "Port '" << device_ << "': corrupted frames, " << decoder_.errors() << " so far");
+        } else {
+            sample.ts = timestamp(sample.received);
+            bool first = true;
+            framer_.commit(n, [this, &sample, &first](std::string_view line) {
+                if (!first)
+                    sample.ts = ++last_ts_;     // Следующие строки того же чтения - на 1 мс позже
+                first = false;
+                sample.line = line;
+                handler_(sample);
+            });
+        }
+        do_read();
+    }
+
+    void schedule_reconnect() {
+        if (stopped_)
+            return;
+        timer_.expires_after(backoff_);
+        timer_.async_wait([this](const boost::system::error_code& ec) {
+            if (!ec && !stopped_)
+                open();
+        });
+        backoff_ = std::min(backoff_ * 2, RECONNECT_MAX);
+    }
+
+    // Системное время приёма по монотонным часам
+    int64_t wallTime(std::chrono::steady_clock::time_point received) {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        int64_t ts = anchor_wall_ + duration_cast<milliseconds>(received - anchor_mono_).count();
+        int64_t wall = nowMillis();
+        if (anchor_wall_ == 0 || ts - wall > 1000 || wall - ts > 1000) {
+            anchor_mono_ = received;
+            anchor_wall_ = wall;
+            ts = wall;
+        }
+        return ts;
+    }
+
+    // Метка времени строки
+    int64_t timestamp(std::chrono::steady_clock::time_point received) {
+        last_ts_ = std::max(wallTime(received), last_ts_ + 1);
+        return last_ts_;
+    }
+
+    // Метки измерений кадра: время устройства со сдвигом до системного, не раньше предыдущей метки + 1 мс
+    const int64_t* frameTimestamps(const SensorFrame& frame, std::chrono::steady_clock::time_point received) {
+        int64_t now = wallTime(received);
+        int64_t last = frame.deviceTs(frame.count - 1);
+        if (!device_offset_ || last + *device_offset_ - now > 1000 || now - (last + *device_offset_) > 1000)
+            device_offset_ = now - last;
+        frame_ts_.resize(frame.count);
+        for (std::size_t i = 0; i < frame.count; ++i) {
+            last_ts_ = std::max(frame.deviceTs(i) + *device_offset_, last_ts_ + 1);
+            frame_ts_[i] = last_ts_;
+        }
+        return frame_ts_.data();
+    }
+
+    boost::asio::serial_port port_;
+    boost::asio::steady_timer timer_;
+    std::string device_;
+    unsigned baud_rate_;
+    SensorProtocol protocol_;
+    Handler handler_;
+    LineFramer framer_;
+    FrameDecoder decoder_;
+    std::optional<int64_t> device_offset_;      // Системное время минус время устройства, мс
+    std::vector<int64_t> frame_ts_;             // Метки измерений последнего кадра
+    std::chrono::milliseconds backoff_ = RECONNECT_MIN;
+    bool stopped_ = false;
+    std::atomic<std::size_t> reconnects_{0};
+
+    std::chrono::steady_clock::time_point anchor_mono_;
+    int64_t anchor_wall_ = 0;
+    int64_t last_ts_ = 0;       // Последняя выданная метка (строки или измерения кадра)
+};
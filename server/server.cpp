@@ -1,85 +1,882 @@
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <iostream>
 #include <sqlite3.h>
-#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+
+#include "json_writer.hpp"
+#include "wire_format.hpp"
+#include "compression.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
+#include "storage.hpp"
+#include "query.hpp"
+#include "query_plan.hpp"
+#include "downsample.hpp"
+#include "hot_cache.hpp"
+#include "broadcaster.hpp"
+#include "archive.hpp"
+#include "stats.hpp"
+#include "chart.hpp"
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
-namespace pt = boost::property_tree;
 
 using tcp = asio::ip::tcp;
 
-// Глобальные переменные для работы с базой данных
-sqlite3* db;
-std::mutex db_mutex;
+// Таймауты соединения
+const std::chrono::seconds READ_TIMEOUT(30);   // Чтение первого запроса
+const std::chrono::seconds IDLE_TIMEOUT(60);   // Ожидание следующего запроса на keep-alive соединении
+const std::chrono::seconds WRITE_TIMEOUT(30);  // Отправка ответа
 
-// Инициализация базы данных
-void initializeDatabase() {
-    int rc = sqlite3_open("temperature.db", &db);
-    if (rc) {
-        std::cerr << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
-        exit(1);
+// Размер порции потокового ответа
+const std::size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+// Кэш горячих данных: сырые значения за последние сутки (срок их хранения) и все агрегаты
+const int64_t HOT_WINDOW = 24 * 60 * 60 * 1000LL;
+const std::chrono::seconds CACHE_REFRESH_INTERVAL(1);   // Проверка новых данных в базе
+
+// Поток событий /stream
+const std::size_t MAX_STREAM_QUEUE = 1024;                 // Неотправленных сообщений на клиента, затем отключение
+const std::chrono::seconds STREAM_PING_INTERVAL(15);     // Комментарий-пинг: держит соединение и выявляет отключившихся
+
+// Ошибки отдельных соединений (обрыв, таймаут) пишутся в журнал не чаще стольких в секунду с каждого места
+const uint32_t LOG_CLIENT_ERRORS_PER_SECOND = 10;
+
+// Пул соединений для чтения: запросы выполняются параллельно и не ждут записи temperature_monitor
+ReadPool* read_pool;
+HotCache* hot_cache;
+Broadcaster* broadcaster;
+
+// Метрики. /metrics отдаёт их вместе с метриками temperature_monitor, которые он выгружает в файл
+#define INGEST_METRICS_PATH "temperature_monitor.prom"
+
+// Маршруты в метках метрик HTTP
+enum Route {
+    ROUTE_TEMPERATURES,
+    ROUTE_AVG_TEMP_HOUR,
+    ROUTE_AVG_TEMP_DAY,
+    ROUTE_CHART,
+    ROUTE_STATS,
+    ROUTE_STREAM,
+    ROUTE_METRICS,
+    ROUTE_OTHER,
+    ROUTE_COUNT
+};
+const char* const ROUTE_LABEL[ROUTE_COUNT] = {"/temperatures", "/avg_temp_hour", "/avg_temp_day", "/chart", "/stats",
+                                              "/stream", "/metrics", "other"};
+
+Histogram* handler_seconds[ROUTE_COUNT];    // Обработка запроса до начала отправки
+Histogram* request_seconds[ROUTE_COUNT];    // От прочтения запроса до отправки ответа целиком
+Counter* responses_total[6];                // По классу кода ответа: [1] - 1xx ... [5] - 5xx
+Histogram* prepare_seconds;                 // Подготовка SQL-запроса строк
+Counter* streamed_rows_total;               // Строк отдано потоком из базы и архива
+std::atomic<int64_t> open_sessions{0};
+
+void registerMetrics() {
+    for (int r = 0; r < ROUTE_COUNT; ++r) {
+        std::string label = std::string("path=\"") + ROUTE_LABEL[r] + "\"";
+        handler_seconds[r] = &metrics().histogram("http_handler_duration_seconds", "Time to handle a request before sending the response", label);
+        request_seconds[r] = &metrics().histogram("http_request_duration_seconds", "Time from reading a request to sending the whole response", label);
     }
+    for (int c = 1; c <= 5; ++c)
+        responses_total[c] = &metrics().counter("http_responses_total", "Responses by status class", "code=\"" + std::to_string(c) + "xx\"");
+    prepare_seconds = &metrics().histogram("server_sql_duration_seconds", "SQLite statement time", "statement=\"prepare_rows\"");
+    streamed_rows_total = &metrics().counter("server_streamed_rows_total", "Rows streamed from the database and archive");
+    metrics().counterFunction("log_dropped_total", "Log records dropped because a thread's log buffer was full", [] { return double(logger().dropped()); });
+    metrics().gaugeFunction("http_open_connections", "Open HTTP connections", [] { return double(open_sessions.load()); });
+    metrics().gaugeFunction("stream_subscribers", "Connected /stream clients", [] { return double(broadcaster ? broadcaster->size() : 0); });
+    metrics().gaugeFunction("hot_cache_version", "Data version of the hot cache", [] {
+        auto lock = hot_cache->lock_shared();
+        return double(hot_cache->version());
+    });
+    metrics().gaugeFunction("hot_cache_raw_rows", "Raw readings held in the hot cache", [] {
+        auto lock = hot_cache->lock_shared();
+        return double(hot_cache->table(0).size());
+    });
+}
+
+// Инициализация базы данных.
+// Пишущее соединение открывается один раз, чтобы создать файл с таблицами и перевести его в режим WAL,
+// после чего сервер работает только через соединения для чтения
+void initializeDatabase(std::size_t connections) {
+    sqlite3* db = openDatabase(STORAGE_DB_PATH, false);
+    if (!db)
+        exit(1);
+    bool ok = initializeSchema(db);
+    sqlite3_close(db);
+    if (!ok)
+        exit(1);
+    read_pool = new ReadPool(STORAGE_DB_PATH, connections);
+    hot_cache = new HotCache(STORAGE_DB_PATH, HOT_WINDOW);
+    hot_cache->refresh();
 }
 
-// Выполнение SQL-запроса и возврат результата в формате JSON
-std::string executeQuery(const std::string& query) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    pt::ptree root;
-    pt::ptree data;
+// Значения, подставляемые в SQL-запрос
+using Bindings = std::vector<int64_t>;
 
+// Подготовка запроса с привязкой целочисленных параметров ?1, ?2, ...
+sqlite3_stmt* prepareQuery(sqlite3* db, const std::string& query, const Bindings& bindings) {
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        return "[]";
+        LOG_ERROR("Failed to prepare statement: " << sqlite3_errmsg(db));
+        return nullptr;
     }
+    for (std::size_t i = 0; i < bindings.size(); ++i)
+        sqlite3_bind_int64(stmt, static_cast<int>(i + 1), bindings[i]);
+    return stmt;
+}
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        pt::ptree row;
-        row.put("timestamp", reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-        row.put("value", sqlite3_column_double(stmt, 1));
-        
-        data.push_back(std::make_pair("", row));
+// Условие выборки по диапазону времени [from, to) и датчику; параметры дописываются в bindings
+std::string rangeCondition(const RangeQuery& query, Bindings& bindings) {
+    bindings.push_back(query.from);
+    bindings.push_back(query.to);
+    std::string sql = " WHERE ts >= ?" + std::to_string(bindings.size() - 1) + " AND ts < ?" + std::to_string(bindings.size());
+    if (query.sensor >= 0) {
+        bindings.push_back(query.sensor);
+        sql += " AND sensor_id = ?" + std::to_string(bindings.size());
     }
+    return sql;
+}
 
-    root.add_child("data", data);
-    sqlite3_finalize(stmt);
+// Архивная часть выборки сырых значений: чанки за [from, to) до конца архива.
+// Начало выборки из таблицы сдвигается на конец архива - строки раньше него читаются только из чанков.
+// Вызывается в транзакции чтения, общей с запросом к таблице: архивация между ними не даст
+// ни потерянных, ни повторённых строк
+std::unique_ptr<ArchiveCursor> openArchive(sqlite3* db, RangeQuery& query) {
+    int64_t until = archivedUntil(db);
+    int64_t to = std::min(query.to, until);
+    int64_t from = query.has_cursor ? std::max(query.from, query.cursor_ts) : query.from;
+    std::vector<ArchiveChunk> chunks;
+    if (from < to)
+        listChunks(db, from, to, query.sensor, chunks);
+    auto archive = std::make_unique<ArchiveCursor>(ARCHIVE_DIR, std::move(chunks), query.from, to);
+    if (query.has_cursor)
+        archive->after(query.cursor_ts, query.cursor_sensor);
+    query.from = std::max(query.from, until);
+    return archive;
+}
 
-    std::ostringstream oss;
-    pt::write_json(oss, root);
-    return oss.str();
+// Результат SQL-запроса (ts, value, sensor_id), который читается и сериализуется порциями.
+// Если задан архив, сначала отдаются его строки; запрос тогда выполняется в транзакции чтения,
+// которая завершается вместе с потоком.
+// Если задан limit и результат им обрезан, в конце документа пишется курсор следующей страницы
+class RowStream {
+public:
+    RowStream(ReadPool::Connection connection, sqlite3_stmt* stmt, RowWriter writer, int64_t limit,
+              std::unique_ptr<ArchiveCursor> archive = nullptr)
+        : connection_(std::move(connection)), stmt_(stmt), archive_(std::move(archive)), writer_(std::move(writer)), limit_(limit) {}
+    ~RowStream() {
+        streamed_rows_total->inc(writer_.rows());
+        sqlite3_finalize(stmt_);
+        if (archive_)
+            sqlite3_exec(connection_.get(), "COMMIT;", 0, 0, 0);
+    }
+
+    // Дописывает строки в out, пока его размер не достигнет limit.
+    // Возвращает true, если в результате ещё остались строки
+    bool fill(std::string& out, std::size_t limit) {
+        if (!started_) {
+            writer_.begin(out);
+            started_ = true;
+        }
+        Reading reading;
+        while (!finished_ && out.size() < limit) {
+            bool full = limit_ > 0 && writer_.rows() == static_cast<std::size_t>(limit_);
+            if (!full && archive_ && archive_->next(reading)) {
+                last_ts_ = reading.ts;
+                last_sensor_ = reading.sensor_id;
+                writer_.row(out, reading.ts, reading.sensor_id, reading.value);
+                continue;
+            }
+            int rc = full ? SQLITE_DONE : sqlite3_step(stmt_);
+            if (rc == SQLITE_ROW) {
+                last_ts_ = sqlite3_column_int64(stmt_, 0);
+                last_sensor_ = sqlite3_column_int64(stmt_, 2);
+                writer_.row(out, last_ts_, static_cast<int32_t>(last_sensor_), sqlite3_column_double(stmt_, 1));
+            } else {
+                if (rc != SQLITE_DONE)
+                    LOG_ERROR("Failed to read row: " << sqlite3_errmsg(connection_.get()));
+                bool truncated = limit_ > 0 && writer_.rows() == static_cast<std::size_t>(limit_);
+                writer_.end(out, truncated ? formatCursor(last_ts_, last_sensor_) : std::string());
+                finished_ = true;
+            }
+        }
+        return !finished_;
+    }
+
+private:
+    ReadPool::Connection connection_;   // Соединение удерживается, пока результат не прочитан
+    sqlite3_stmt* stmt_;
+    std::unique_ptr<ArchiveCursor> archive_;
+    RowWriter writer_;
+    int64_t limit_;
+    int64_t last_ts_ = 0;
+    int64_t last_sensor_ = 0;
+    bool started_ = false;
+    bool finished_ = false;
+
+    RowStream(const RowStream&) = delete;
+    RowStream& operator=(const RowStream&) = delete;
+};
+
+// Выполнение SQL-запроса; строки результата (после строк архива, если он задан) читаются через RowStream по мере отправки
+std::unique_ptr<RowStream> executeQuery(ReadPool::Connection connection, const std::string& query, const Bindings& bindings,
+                                        RowWriter writer, int64_t limit, std::unique_ptr<ArchiveCursor> archive = nullptr) {
+    sqlite3_stmt* stmt;
+    {
+        ScopedTimer timer(*prepare_seconds);
+        stmt = prepareQuery(connection.get(), query, bindings);
+    }
+    if (!stmt) {
+        if (archive)
+            sqlite3_exec(connection.get(), "ROLLBACK;", 0, 0, 0);
+        return nullptr;
+    }
+    return std::make_unique<RowStream>(std::move(connection), stmt, std::move(writer), limit, std::move(archive));
+}
+
+// Чтение из базы; сырые значения - из архива и таблицы. Вызывающий держит транзакцию чтения
+class DbSource : public RowSource {
+public:
+    explicit DbSource(sqlite3* db) : db_(db), archived_until_(archivedUntil(db)) {}
+
+    TableRange range(int table, const RangeQuery& query) override {
+        TableRange range = tableRange(table, table == 0 ? tableQuery(query) : query);
+        if (table != 0 || query.from >= archived_until_)
+            return range;
+        // Статистика чанков целиком в диапазоне - из индекса, крайние чанки распаковываются
+        TableRange archive;
+        std::vector<ArchiveChunk> chunks;
+        listChunks(db_, query.from, std::min(query.to, archived_until_), query.sensor, chunks);
+        std::vector<Reading> rows;
+        for (const ArchiveChunk& chunk : chunks) {
+            if (chunk.min_ts >= query.from && chunk.max_ts < query.to) {
+                addRange(archive, chunk.count, chunk.min_ts, chunk.max_ts);
+                continue;
+            }
+            rows.clear();
+            readChunk(ARCHIVE_DIR, chunk.sensor_id, chunk.day, rows);
+            for (const Reading& row : rows)
+                if (row.ts >= query.from && row.ts < query.to)
+                    addRange(archive, 1, row.ts, row.ts);
+        }
+        if (range.count > 0)
+            addRange(archive, range.count, range.min_ts, range.max_ts);
+        return archive;
+    }
+
+    bool points(int table, const RangeQuery& query, std::vector<Point>& points) override {
+        if (table == 0 && query.from < archived_until_) {
+            std::vector<ArchiveChunk> chunks;
+            int64_t to = std::min(query.to, archived_until_);
+            if (!listChunks(db_, query.from, to, query.sensor, chunks))
+                return false;
+            ArchiveCursor archive(ARCHIVE_DIR, std::move(chunks), query.from, to);
+            Reading reading;
+            while (archive.next(reading))
+                points.push_back(Point{reading.ts, reading.value, reading.sensor_id});
+        }
+        return tablePoints(table, table == 0 ? tableQuery(query) : query, points);
+    }
+
+private:
+    // Часть запроса к сырым значениям, читаемая из таблицы (после конца архива)
+    RangeQuery tableQuery(RangeQuery query) const {
+        query.from = std::max(query.from, archived_until_);
+        return query;
+    }
+
+    static void addRange(TableRange& range, int64_t count, int64_t min_ts, int64_t max_ts) {
+        range.min_ts = range.count > 0 ? std::min(range.min_ts, min_ts) : min_ts;
+        range.max_ts = range.count > 0 ? std::max(range.max_ts, max_ts) : max_ts;
+        range.count += count;
+    }
+
+    TableRange tableRange(int table, const RangeQuery& query) {
+        TableRange range;
+        Bindings bindings;
+        std::string where = rangeCondition(query, bindings);
+        sqlite3_stmt* stmt = prepareQuery(db_, std::string("SELECT COUNT(*), MIN(ts), MAX(ts) FROM ") + TABLE_ORDER[table] + where + ";",
+                                          bindings);
+        if (!stmt)
+            return range;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            range.count = sqlite3_column_int64(stmt, 0);
+            range.min_ts = sqlite3_column_int64(stmt, 1);
+            range.max_ts = sqlite3_column_int64(stmt, 2);
+        }
+        sqlite3_finalize(stmt);
+        return range;
+    }
+
+    bool tablePoints(int table, const RangeQuery& query, std::vector<Point>& points) {
+        Bindings bindings;
+        std::string where = rangeCondition(query, bindings);
+        sqlite3_stmt* stmt = prepareQuery(db_, std::string("SELECT ts, value, sensor_id FROM ") + TABLE_ORDER[table] + where + " ORDER BY ts;",
+                                          bindings);
+        if (!stmt)
+            return false;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            points.push_back(Point{sqlite3_column_int64(stmt, 0), sqlite3_column_double(stmt, 1), sqlite3_column_int(stmt, 2)});
+        sqlite3_finalize(stmt);
+        return true;
+    }
+
+    sqlite3* db_;
+    int64_t archived_until_;
+};
+
+// Чтение из кэша; вызывающий удерживает lock_shared() кэша
+class CacheSource : public RowSource {
+public:
+    explicit CacheSource(const HotCache& cache) : cache_(cache) {}
+
+    TableRange range(int table, const RangeQuery& query) override {
+        const ReadingRing& ring = cache_.table(table);
+        std::size_t lo = ring.lowerBound(query.from), hi = ring.lowerBound(query.to);
+        TableRange range;
+        if (query.sensor < 0) {
+            if (lo < hi) {
+                range.count = static_cast<int64_t>(hi - lo);
+                range.min_ts = ring.ts(lo);
+                range.max_ts = ring.ts(hi - 1);
+            }
+            return range;
+        }
+        for (std::size_t i = lo; i < hi; ++i) {
+            if (ring.sensor(i) != query.sensor)
+                continue;
+            if (range.count++ == 0)
+                range.min_ts = ring.ts(i);
+            range.max_ts = ring.ts(i);
+        }
+        return range;
+    }
+
+    bool points(int table, const RangeQuery& query, std::vector<Point>& points) override {
+        const ReadingRing& ring = cache_.table(table);
+        for (std::size_t i = ring.lowerBound(query.from), hi = ring.lowerBound(query.to); i < hi; ++i)
+            if (query.sensor < 0 || ring.sensor(i) == query.sensor)
+                points.push_back(Point{ring.ts(i), ring.value(i), ring.sensor(i)});
+        return true;
+    }
+
+private:
+    const HotCache& cache_;
+};
+
+// Прореженная выборка: строки читаются целиком (их не больше, чем в диапазоне таблицы)
+// и прореживаются до max_points на каждый датчик. Возвращает таблицу-источник либо -1 при ошибке
+int downsample(RowSource& source, int table, RangeQuery query, bool explicit_from, std::vector<Point>& points) {
+    QueryPlan plan = planQuery(source, table, query, explicit_from);
+    points.reserve(static_cast<std::size_t>(plan.range.count));
+    if (!source.points(plan.table, query, points))
+        return -1;
+
+    std::size_t target = static_cast<std::size_t>(plan.points);
+    if (query.method == DOWNSAMPLE_MINMAX)
+        points = downsampleBySensor(points, target, downsampleMinMax);
+    else
+        points = downsampleBySensor(points, target, downsampleLttb);
+    return plan.table;
+}
+
+// Прореженная выборка в body
+int write_downsampled(RowSource& source, int table, RangeQuery query, bool explicit_from, std::string& body) {
+    std::vector<Point> points;
+    int source_table = downsample(source, table, query, explicit_from, points);
+    if (source_table < 0)
+        return -1;
+
+    RowWriter writer(query.format, query.epoch_time);
+    writer.begin(body);
+    for (const Point& point : points)
+        writer.row(body, point.ts, point.sensor_id, point.value);
+    writer.end(body);
+    return source_table;
+}
+
+// Строки кэшированной таблицы в body с учётом диапазона, курсора и limit (как у RowStream)
+void write_cached_rows(const ReadingRing& ring, const RangeQuery& query, std::string& body) {
+    std::size_t end = ring.lowerBound(query.to);
+    std::size_t i = ring.lowerBound(query.from);
+    if (query.has_cursor)
+        i = std::max(i, ring.upperBound(query.cursor_ts, query.cursor_sensor));
+    std::size_t limit = query.limit ? static_cast<std::size_t>(query.limit) : SIZE_MAX;
+
+    RowWriter writer(query.format, query.epoch_time);
+    writer.begin(body);
+    std::size_t last = 0;
+    for (; i < end && writer.rows() < limit; ++i) {
+        if (query.sensor >= 0 && ring.sensor(i) != query.sensor)
+            continue;
+        writer.row(body, ring.ts(i), ring.sensor(i), ring.value(i));
+        last = i;
+    }
+    bool truncated = query.limit > 0 && writer.rows() == limit;
+    writer.end(body, truncated ? formatCursor(ring.ts(last), ring.sensor(last)) : std::string());
+}
+
+// Ответ на запрос: заголовки и готовое тело в res, общее готовое тело в shared_body
+// либо поток строк в rows. event_stream - соединение переходит в поток событий /stream.
+// encoding - сжатие, принятое клиентом: тело в res сжимается после обработчика, поток строк -
+// при отправке, shared_body обработчик кладёт уже сжатым
+struct Reply {
+    http::response<http::string_body> res;
+    std::shared_ptr<const std::string> shared_body;
+    std::unique_ptr<RowStream> rows;
+    bool event_stream = false;
+    int64_t stream_sensor = -1;
+    ContentEncoding encoding = ENCODING_IDENTITY;
+    Route route = ROUTE_OTHER;
+};
+
+void reply_error(Reply& reply, http::status status, const std::string& message) {
+    reply.res.result(status);
+    reply.res.set(http::field::content_type, "text/plain");
+    reply.res.body() = message;
+}
+
+// ETag варианта ответа из кэша: тела разных форматов и кодировок различаются
+std::string cached_etag(const Reply& reply, const std::string& format_tag) {
+    std::string etag = hot_cache->etag();
+    if (!format_tag.empty())
+        etag.insert(etag.size() - 1, "-" + format_tag);
+    if (reply.encoding != ENCODING_IDENTITY)
+        etag.insert(etag.size() - 1, std::string("-") + encodingName(reply.encoding));
+    return etag;
+}
+
+// Готовое тело из кэша в кодировке клиента. Сжатый вариант хранится в кэше ответов
+// рядом с исходным, поэтому сжимается один раз на версию данных
+void reply_with_cached(Reply& reply, const std::string& key, uint64_t version, CachedResponse cached) {
+    if (reply.encoding != ENCODING_IDENTITY && cached.body->size() >= MIN_COMPRESS_SIZE) {
+        std::string encoded_key = std::string(encodingName(reply.encoding)) + " " + key;
+        CachedResponse encoded;
+        if (!hot_cache->response(encoded_key, version, encoded)) {
+            auto body = std::make_shared<std::string>();
+            if (compressBody(*cached.body, reply.encoding, CACHED_COMPRESSION_LEVEL, *body)) {
+                encoded.body = std::move(body);
+                encoded.source_table = cached.source_table;
+                hot_cache->storeResponse(encoded_key, version, encoded);
+            }
+        }
+        if (encoded.body) {
+            reply.res.set(http::field::content_encoding, encodingName(reply.encoding));
+            cached = std::move(encoded);
+        }
+    }
+    reply.shared_body = std::move(cached.body);
+}
+
+// Диапазон запроса целиком в кэше (под блокировкой кэша). Таблицы агрегатов в кэше целиком;
+// сырые значения - только за окно, и диапазон должен начинаться в нём явно: без from он начинается
+// с первой строки таблицы, а в базе и архиве она может быть раньше окна. Конец диапазона
+// до начала окна (только ?to=) тоже уходит в базу
+bool cache_covers(int table, const RangeQuery& query, bool explicit_from) {
+    if (!hot_cache->initialized())
+        return false;
+    int64_t covered_from = hot_cache->coveredFrom(table);
+    if (covered_from == std::numeric_limits<int64_t>::min())
+        return true;
+    return explicit_from && query.from >= covered_from && query.to > covered_from;
+}
+
+// Ответ из кэша горячих данных, если запрошенный диапазон в нём целиком.
+// Готовые тела ответов хранятся до следующего изменения данных и отдаются без копирования;
+// клиенту с актуальным ETag (If-None-Match) отвечаем 304 без тела
+bool reply_from_cache(Reply& reply, int table, const Target& target, const RangeQuery& query,
+                      const std::string& key, beast::string_view if_none_match) {
+    bool explicit_from = target.param("from") != nullptr;
+    auto lock = hot_cache->lock_shared();
+    if (!cache_covers(table, query, explicit_from))
+        return false;
+
+    std::string etag = cached_etag(reply, formatTag(query.format));
+    reply.res.set(http::field::etag, etag);
+    if (!if_none_match.empty() && if_none_match.find(etag) != beast::string_view::npos) {
+        reply.res.result(http::status::not_modified);
+        return true;
+    }
+
+    uint64_t version = hot_cache->version();
+    CachedResponse cached;
+    if (!hot_cache->response(key, version, cached)) {
+        auto body = std::make_shared<std::string>();
+        if (query.max_points || query.resolution) {
+            CacheSource source(*hot_cache);
+            cached.source_table = TABLE_ORDER[write_downsampled(source, table, query, explicit_from, *body)];
+        } else {
+            write_cached_rows(hot_cache->table(table), query, *body);
+        }
+        cached.body = std::move(body);
+        hot_cache->storeResponse(key, version, cached);
+    }
+
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, contentType(query.format));
+    if (!cached.source_table.empty())
+        reply.res.set("X-Source-Table", cached.source_table);
+    reply_with_cached(reply, key, version, std::move(cached));
+    return true;
+}
+
+// Прореженная выборка из базы одним телом размером не больше max_points строк
+void reply_with_downsampled(Reply& reply, int table, const RangeQuery& query, bool explicit_from) {
+    ReadPool::Connection connection = read_pool->acquire();
+    if (!connection)
+        return reply_error(reply, http::status::internal_server_error, "Database error");
+
+    // Индекс архива и таблица читаются из одного снимка базы
+    sqlite3_exec(connection.get(), "BEGIN;", 0, 0, 0);
+    DbSource source(connection.get());
+    int source_table = write_downsampled(source, table, query, explicit_from, reply.res.body());
+    sqlite3_exec(connection.get(), "COMMIT;", 0, 0, 0);
+    if (source_table < 0)
+        return reply_error(reply, http::status::internal_server_error, "Database error");
+
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, contentType(query.format));
+    reply.res.set("X-Source-Table", TABLE_ORDER[source_table]);
+}
+
+// Ответ с данными таблицы с учётом параметров выборки
+void reply_with_table(Reply& reply, int table, const Target& target, const http::request<http::string_body>& req) {
+    RangeQuery query;
+    std::string error;
+    if (!parseRangeQuery(target, query, error))
+        return reply_error(reply, http::status::bad_request, error);
+    beast::string_view accept = req[http::field::accept];
+    query.format = negotiateFormat(std::string_view(accept.data(), accept.size()));
+    reply.res.set(http::field::vary, "Accept");
+
+    if (reply_from_cache(reply, table, target, query, formatTag(query.format) + std::string(req.target()),
+                         req[http::field::if_none_match]))
+        return;
+
+    if (query.max_points || query.resolution)
+        return reply_with_downsampled(reply, table, query, target.param("from") != nullptr);
+
+    ReadPool::Connection connection = read_pool->acquire();
+    if (!connection)
+        return reply_error(reply, http::status::internal_server_error, "Database error");
+    std::unique_ptr<ArchiveCursor> archive;
+    if (table == 0) {
+        sqlite3_exec(connection.get(), "BEGIN;", 0, 0, 0);
+        archive = openArchive(connection.get(), query);
+    }
+
+    Bindings bindings;
+    std::string sql = std::string("SELECT ts, value, sensor_id FROM ") + TABLE_ORDER[table] + rangeCondition(query, bindings);
+    if (query.has_cursor) {
+        sql += " AND (ts, sensor_id) > (?" + std::to_string(bindings.size() + 1) + ", ?" + std::to_string(bindings.size() + 2) + ")";
+        bindings.push_back(query.cursor_ts);
+        bindings.push_back(query.cursor_sensor);
+    }
+    sql += " ORDER BY ts, sensor_id";
+    if (query.limit) {
+        sql += " LIMIT ?" + std::to_string(bindings.size() + 1);
+        bindings.push_back(query.limit);
+    }
+
+    reply.rows = executeQuery(std::move(connection), sql + ";", bindings, RowWriter(query.format, query.epoch_time), query.limit,
+                              std::move(archive));
+    if (!reply.rows)
+        return reply_error(reply, http::status::internal_server_error, "Database error");
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, contentType(query.format));
+}
+
+// Число корзин гистограммы /stats не больше
+const int64_t MAX_HISTOGRAM_BINS = 10000;
+
+// Сырые значения в диапазоне запроса: из кэша, если он покрывает диапазон, иначе из архива и базы
+bool collect_values(const RangeQuery& query, bool explicit_from, std::vector<int64_t>& ts, std::vector<double>& values) {
+    std::vector<Point> points;
+    {
+        auto lock = hot_cache->lock_shared();
+        if (cache_covers(0, query, explicit_from)) {
+            CacheSource source(*hot_cache);
+            source.points(0, query, points);
+        } else {
+            lock.unlock();
+            ReadPool::Connection connection = read_pool->acquire();
+            if (!connection)
+                return false;
+            sqlite3_exec(connection.get(), "BEGIN;", 0, 0, 0);
+            DbSource source(connection.get());
+            bool ok = source.points(0, query, points);
+            sqlite3_exec(connection.get(), "COMMIT;", 0, 0, 0);
+            if (!ok)
+                return false;
+        }
+    }
+    ts.resize(points.size());
+    values.resize(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        ts[i] = points[i].ts;
+        values[i] = points[i].value;
+    }
+    return true;
+}
+
+// Статистика набора значений в JSON: "count","avg","min","max","stddev"
+void write_bucket_stats(std::string& out, const Bucket& bucket) {
+    out.append("\"count\":").append(std::to_string(bucket.count));
+    out.append(",\"avg\":");
+    JsonWriter::appendDouble(out, bucket.count ? bucket.average() : NAN);
+    out.append(",\"min\":");
+    JsonWriter::appendDouble(out, bucket.count ? bucket.min : NAN);
+    out.append(",\"max\":");
+    JsonWriter::appendDouble(out, bucket.count ? bucket.max : NAN);
+    out.append(",\"stddev\":");
+    JsonWriter::appendDouble(out, bucket.stddev());
+}
+
+// Статистика сырых значений за диапазон:
+//   {"count":..,"avg":..,"min":..,"max":..,"stddev":..,"p50":..,"p95":..,"p99":..,
+//    "buckets":[{"timestamp":..,"count":..,...}],      - при bucket=<секунды>, пустые интервалы пропускаются
+//    "histogram":{"min":..,"max":..,"counts":[...]}}   - при bins=<число корзин> на [min, max]
+void reply_with_stats(Reply& reply, const Target& target) {
+    RangeQuery query;
+    std::string error;
+    if (!parseRangeQuery(target, query, error))
+        return reply_error(reply, http::status::bad_request, error);
+    int64_t bucket = 0, bins = 0;
+    const std::string* value;
+    if ((value = target.param("bucket")) && (!parseInt(*value, bucket) || bucket <= 0 || bucket > INT64_MAX / 1000))
+        return reply_error(reply, http::status::bad_request, "Invalid 'bucket'");
+    if ((value = target.param("bins")) && (!parseInt(*value, bins) || bins <= 0 || bins > MAX_HISTOGRAM_BINS))
+        return reply_error(reply, http::status::bad_request, "Invalid 'bins'");
+
+    std::vector<int64_t> ts;
+    std::vector<double> values;
+    if (!collect_values(query, target.param("from") != nullptr, ts, values))
+        return reply_error(reply, http::status::internal_server_error, "Database error");
+
+    Bucket total = summarize(values.data(), values.size());
+    std::string& body = reply.res.body();
+    body.push_back('{');
+    write_bucket_stats(body, total);
+
+    if (bucket) {
+        std::vector<Bucket> buckets = summarizeBuckets(ts.data(), values.data(), values.size(), 0, bucket * 1000);
+        LocalTimeFormatter time;
+        body.append(",\"buckets\":[");
+        for (std::size_t i = 0; i < buckets.size(); ++i) {
+            body.append(i ? ",{\"timestamp\":" : "{\"timestamp\":");
+            if (query.epoch_time) {
+                body.append(std::to_string(buckets[i].start));
+            } else {
+                body.push_back('"');
+                time.append(body, buckets[i].start);
+                body.push_back('"');
+            }
+            body.push_back(',');
+            write_bucket_stats(body, buckets[i]);
+            body.push_back('}');
+        }
+        body.push_back(']');
+    }
+    if (bins) {
+        std::vector<int64_t> counts = histogram(values.data(), values.size(), total.min, total.max, static_cast<int32_t>(bins));
+        body.append(",\"histogram\":{\"min\":");
+        JsonWriter::appendDouble(body, total.count ? total.min : NAN);
+        body.append(",\"max\":");
+        JsonWriter::appendDouble(body, total.count ? total.max : NAN);
+        body.append(",\"counts\":[");
+        for (std::size_t i = 0; i < counts.size(); ++i)
+            body.append(i ? "," : "").append(std::to_string(counts[i]));
+        body.append("]}");
+    }
+
+    // Процентили последними: частичная сортировка меняет порядок значений
+    const double PERCENTILES[] = {0.5, 0.95, 0.99};
+    const char* const PERCENTILE_NAMES[] = {"p50", "p95", "p99"};
+    for (int i = 0; i < 3; ++i) {
+        body.append(",\"").append(PERCENTILE_NAMES[i]).append("\":");
+        JsonWriter::appendDouble(body, values.empty() ? NAN : percentile(values, PERCENTILES[i]));
+    }
+    body.push_back('}');
+
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, "application/json");
+}
+
+// Графики /chart.svg и /chart.png
+const char* const TABLE_TITLE[] = {"Raw Temperatures", "Average Temperature per Hour", "Average Temperature per Day"};
+const int64_t CHART_DEFAULT_WIDTH = 1000;
+const int64_t CHART_DEFAULT_HEIGHT = 600;
+const int64_t CHART_MIN_SIZE = 200;
+const int64_t CHART_MAX_SIZE = 4000;
+
+// График таблицы: /chart.svg|png?table=&from=&to=&sensor=&width=&height=[&method=].
+// Данные прореживаются до ширины картинки. Готовые картинки хранятся в кэше ответов до изменения данных
+// (ключ - формат, таблица, диапазон, датчик и размер), клиенту с актуальным ETag отвечаем 304
+void reply_with_chart(Reply& reply, bool png, const Target& target, beast::string_view if_none_match) {
+    RangeQuery query;
+    std::string error;
+    if (!parseRangeQuery(target, query, error))
+        return reply_error(reply, http::status::bad_request, error);
+    int table = 0;
+    const std::string* value;
+    if ((value = target.param("table"))) {
+        table = -1;
+        for (int t = 0; t < TABLE_COUNT; ++t)
+            if (*value == TABLE_ORDER[t])
+                table = t;
+        if (table < 0)
+            return reply_error(reply, http::status::bad_request, "Invalid 'table'");
+    }
+    int64_t width = CHART_DEFAULT_WIDTH, height = CHART_DEFAULT_HEIGHT;
+    if ((value = target.param("width")) && (!parseInt(*value, width) || width < CHART_MIN_SIZE || width > CHART_MAX_SIZE))
+        return reply_error(reply, http::status::bad_request, "Invalid 'width'");
+    if ((value = target.param("height")) && (!parseInt(*value, height) || height < CHART_MIN_SIZE || height > CHART_MAX_SIZE))
+        return reply_error(reply, http::status::bad_request, "Invalid 'height'");
+    bool explicit_from = target.param("from") != nullptr;
+    query.max_points = width - 84;     // Ширина области построения ChartLayout
+    query.resolution = 0;
+
+    std::string key = std::string("chart ") + (png ? "png " : "svg ") + TABLE_ORDER[table] + " " +
+                      (explicit_from ? std::to_string(query.from) : "-") + " " + std::to_string(query.to) + " " +
+                      std::to_string(query.sensor) + " " + std::to_string(width) + "x" + std::to_string(height) + " " +
+                      std::to_string(query.method);
+
+    const char* content_type = png ? "image/png" : "image/svg+xml";
+    if (png)
+        reply.encoding = ENCODING_IDENTITY;     // PNG уже сжат
+    std::vector<Point> points;
+    uint64_t version;
+    bool from_cache = false;
+    {
+        auto lock = hot_cache->lock_shared();
+        version = hot_cache->version();
+        std::string etag = cached_etag(reply, std::string());
+        reply.res.set(http::field::etag, etag);
+        if (!if_none_match.empty() && if_none_match.find(etag) != beast::string_view::npos) {
+            reply.res.result(http::status::not_modified);
+            return;
+        }
+        CachedResponse cached;
+        if (hot_cache->response(key, version, cached)) {
+            reply.res.result(http::status::ok);
+            reply.res.set(http::field::content_type, content_type);
+            reply_with_cached(reply, key, version, std::move(cached));
+            return;
+        }
+        if (cache_covers(table, query, explicit_from)) {
+            CacheSource source(*hot_cache);
+            downsample(source, table, query, explicit_from, points);
+            from_cache = true;
+        }
+    }
+    if (!from_cache) {
+        ReadPool::Connection connection = read_pool->acquire();
+        if (!connection)
+            return reply_error(reply, http::status::internal_server_error, "Database error");
+        sqlite3_exec(connection.get(), "BEGIN;", 0, 0, 0);
+        DbSource source(connection.get());
+        int source_table = downsample(source, table, query, explicit_from, points);
+        sqlite3_exec(connection.get(), "COMMIT;", 0, 0, 0);
+        if (source_table < 0)
+            return reply_error(reply, http::status::internal_server_error, "Database error");
+    }
+
+    CachedResponse cached;
+    cached.body = std::make_shared<std::string>(png ? renderPng(points, static_cast<int>(width), static_cast<int>(height))
+                                                    : renderSvg(points, TABLE_TITLE[table], static_cast<int>(width), static_cast<int>(height)));
+    if (cached.body->empty())
+        return reply_error(reply, http::status::internal_server_error, "Render error");
+    hot_cache->storeResponse(key, version, cached);
+
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, content_type);
+    reply_with_cached(reply, key, version, std::move(cached));
+}
+
+// Метрики сервера и temperature_monitor в текстовом формате Prometheus
+void reply_with_metrics(Reply& reply) {
+    std::string body = metrics().render();
+    std::ifstream file(INGEST_METRICS_PATH, std::ios::binary);
+    if (file)
+        body.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    reply.res.result(http::status::ok);
+    reply.res.set(http::field::content_type, "text/plain; version=0.0.4");
+    reply.res.body() = std::move(body);
 }
 
 // Обработчик HTTP-запросов
-void handle_request(http::request<http::string_body>& req, http::response<http::string_body>& res) {
+void handle_request(const http::request<http::string_body>& req, Reply& reply) {
+    http::response<http::string_body>& res = reply.res;
     res.version(req.version());
-    res.keep_alive(false);
+    res.keep_alive(req.keep_alive());
+
+    // Время обработки учитывается по маршруту, который выбран ниже
+    struct HandlerTimer {
+        const Reply& reply;
+        std::chrono::steady_clock::time_point started;
+        ~HandlerTimer() { handler_seconds[reply.route]->observe(std::chrono::steady_clock::now() - started); }
+    } timer{reply, std::chrono::steady_clock::now()};
+
+    Target target = parseTarget(std::string_view(req.target().data(), req.target().size()));
+    beast::string_view accept_encoding = req[http::field::accept_encoding];
+    reply.encoding = negotiateEncoding(std::string_view(accept_encoding.data(), accept_encoding.size()));
 
     if (req.method() == http::verb::get) {
-        if (req.target() == "/temperatures") {
+        if (target.path == "/temperatures") {
             // Получение данных из таблицы temperatures
-            std::string json_data = executeQuery("SELECT timestamp, value FROM temperatures;");
-            res.result(http::status::ok);
-            res.set(http::field::content_type, "application/json");
-            res.body() = json_data;
-        } else if (req.target() == "/avg_temp_hour") {
+            reply.route = ROUTE_TEMPERATURES;
+            reply_with_table(reply, 0, target, req);
+        } else if (target.path == "/avg_temp_hour") {
             // Получение данных из таблицы avg_temp_hour
-            std::string json_data = executeQuery("SELECT timestamp, value FROM avg_temp_hour;");
-            res.result(http::status::ok);
-            res.set(http::field::content_type, "application/json");
-            res.body() = json_data;
-        } else if (req.target() == "/avg_temp_day") {
+            reply.route = ROUTE_AVG_TEMP_HOUR;
+            reply_with_table(reply, 1, target, req);
+        } else if (target.path == "/avg_temp_day") {
             // Получение данных из таблицы avg_temp_day
-            std::string json_data = executeQuery("SELECT timestamp, value FROM avg_temp_day;");
+            reply.route = ROUTE_AVG_TEMP_DAY;
+            reply_with_table(reply, 2, target, req);
+        } else if (target.path == "/chart.svg" || target.path == "/chart.png") {
+            // График таблицы, построенный на сервере
+            reply.route = ROUTE_CHART;
+            reply_with_chart(reply, target.path == "/chart.png", target, req[http::field::if_none_match]);
+        } else if (target.path == "/stats") {
+            // Статистика сырых значений за диапазон, по интервалам и гистограмма
+            reply.route = ROUTE_STATS;
+            reply_with_stats(reply, target);
+        } else if (target.path == "/metrics") {
+            // Метрики для Prometheus
+            reply.route = ROUTE_METRICS;
+            reply_with_metrics(reply);
+        } else if (target.path == "/stream") {
+            // Подписка на новые измерения и агрегаты (Server-Sent Events); тело - до закрытия соединения
+            reply.route = ROUTE_STREAM;
+            const std::string* sensor = target.param("sensor");
+            if (sensor && (!parseInt(*sensor, reply.stream_sensor) || reply.stream_sensor < 0)) {
+                reply_error(reply, http::status::bad_request, "Invalid 'sensor'");
+                res.prepare_payload();
+                return;
+            }
+            reply.event_stream = true;
             res.result(http::status::ok);
-            res.set(http::field::content_type, "application/json");
-            res.body() = json_data;
+            res.set(http::field::content_type, "text/event-stream");
+            res.set(http::field::cache_control, "no-cache");
+            res.set(http::field::access_control_allow_origin, "*");
+            res.keep_alive(false);
         } else {
             res.result(http::status::not_found);
             res.body() = "Resource not found";
@@ -89,42 +886,389 @@ void handle_request(http::request<http::string_body>& req, http::response<http::
         res.body() = "Method not allowed";
     }
 
-    res.prepare_payload();
+    if (reply.event_stream)
+        return;
+    // Тело зависит от Accept-Encoding (кроме PNG)
+    if (res[http::field::content_type] != "image/png") {
+        beast::string_view vary = res[http::field::vary];
+        res.set(http::field::vary, vary.empty() ? std::string("Accept-Encoding") : std::string(vary) + ", Accept-Encoding");
+    }
+    if (!reply.rows && !reply.shared_body) {
+        std::string compressed;
+        if (reply.encoding != ENCODING_IDENTITY && res.body().size() >= MIN_COMPRESS_SIZE &&
+            compressBody(res.body(), reply.encoding, STREAM_COMPRESSION_LEVEL, compressed)) {
+            res.body() = std::move(compressed);
+            res.set(http::field::content_encoding, encodingName(reply.encoding));
+        }
+        res.prepare_payload();
+    }
+}
+
+// Событие потока /stream: новая строка таблицы. Сообщение сериализуется один раз для всех подписчиков:
+//   event: <таблица>
+//   data: {"sensor_id":0,"ts":<мс от эпохи>,"timestamp":"<локальное время>","value":...}
+// Вызывается только из обновления кэша, поэтому форматтер времени может быть общим.
+// Строка попадает сюда не раньше, чем temperature_monitor запишет её в базу (раз в его --sync-period,
+// по умолчанию минута), плюс до CACHE_REFRESH_INTERVAL на обновление кэша
+void publish_row(int table, int64_t ts, int32_t sensor_id, double value) {
+    static LocalTimeFormatter time;
+    if (broadcaster->size() == 0)
+        return;
+    auto message = std::make_shared<std::string>();
+    message->append("event: ").append(TABLE_ORDER[table]);
+    message->append("\ndata: {\"sensor_id\":").append(std::to_string(sensor_id));
+    message->append(",\"ts\":").append(std::to_string(ts));
+    message->append(",\"timestamp\":\"");
+    time.append(*message, ts);
+    message->append("\",\"value\":");
+    JsonWriter::appendDouble(*message, value);
+    message->append("}\n\n");
+    broadcaster->publish(message, sensor_id);
 }
 
-// Запуск сервера
-void run_server(asio::io_context& io_context, unsigned short port) {
-    tcp::acceptor acceptor(io_context, {tcp::v4(), port});
-    std::cout << "Server is running on port " << port << std::endl;
+// Соединение потока событий /stream. Получает сокет от Session после разбора запроса.
+// Сообщения общие для всех подписчиков и ставятся в очередь без копирования; накопившиеся
+// отправляются одной записью. Клиент, у которого в очереди больше MAX_STREAM_QUEUE
+// сообщений, не успевает их принимать и отключается: остальные не ждут медленного
+class EventStream : public Subscriber, public std::enable_shared_from_this<EventStream> {
+public:
+    // sensor - только события датчика sensor; -1 - все
+    EventStream(beast::tcp_stream&& stream, int64_t sensor)
+        : stream_(std::move(stream)), ping_timer_(stream_.get_executor()), sensor_(sensor) {}
+
+    // Отправка заголовков ответа и запуск пингов; вызывается на strand соединения
+    void run(const http::response_header<>& header) {
+        std::ostringstream os;
+        os << header;
+        pending_++;
+        enqueue(std::make_shared<std::string>(os.str()));
+        schedule_ping();
+    }
+
+    void deliver(const std::shared_ptr<const std::string>& message, int32_t sensor_id) override {
+        if (sensor_ >= 0 && sensor_id != sensor_)
+            return;
+        if (pending_.fetch_add(1) >= MAX_STREAM_QUEUE) {
+            pending_.fetch_sub(1);
+            if (!dropped_.exchange(true))
+                asio::post(stream_.get_executor(), [self = shared_from_this()] {
+                    LOG_LIMITED(LEVEL_WARN, LOG_CLIENT_ERRORS_PER_SECOND, "Stream client too slow, disconnecting");
+                    self->do_close();
+                });
+            return;
+        }
+        asio::post(stream_.get_executor(), [self = shared_from_this(), message] { self->enqueue(message); });
+    }
+
+private:
+    void enqueue(std::shared_ptr<const std::string> message) {
+        if (closed_)
+            return;
+        queue_.push_back(std::move(message));
+        if (!writing_)
+            do_write();
+    }
+
+    void do_write() {
+        writing_ = true;
+        buffers_.clear();
+        for (const auto& message : queue_)
+            buffers_.push_back(asio::buffer(*message));
+        in_flight_ = queue_.size();
+        stream_.expires_after(WRITE_TIMEOUT);
+        asio::async_write(stream_, buffers_, beast::bind_front_handler(&EventStream::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t) {
+        writing_ = false;
+        if (ec)
+            return do_close();
+        stream_.expires_never();
+        queue_.erase(queue_.begin(), queue_.begin() + static_cast<std::ptrdiff_t>(in_flight_));
+        pending_ -= in_flight_;
+        if (!queue_.empty() && !closed_)
+            do_write();
+    }
+
+    void schedule_ping() {
+        ping_timer_.expires_after(STREAM_PING_INTERVAL);
+        ping_timer_.async_wait([self = shared_from_this()](beast::error_code ec) {
+            if (ec || self->closed_)
+                return;
+            static const auto ping = std::make_shared<const std::string>(": ping\n\n");
+            self->pending_++;
+            self->enqueue(ping);
+            self->schedule_ping();
+        });
+    }
+
+    void do_close() {
+        if (closed_)
+            return;
+        closed_ = true;
+        ping_timer_.cancel();
+        beast::error_code ec;
+        stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream_.close();
+    }
+
+    beast::tcp_stream stream_;
+    asio::steady_timer ping_timer_;
+    int64_t sensor_;
+    std::deque<std::shared_ptr<const std::string>> queue_;
+    std::vector<asio::const_buffer> buffers_;
+    std::size_t in_flight_ = 0;
+    bool writing_ = false;
+    bool closed_ = false;
+    std::atomic<std::size_t> pending_{0};   // Принято к отправке, но ещё не отправлено
+    std::atomic<bool> dropped_{false};
+};
+
+// Сессия одного TCP-соединения: HTTP/1.1 keep-alive, запросы обрабатываются по очереди.
+// Конвейерные (pipelined) запросы, пришедшие одним пакетом, остаются в buffer_
+// и читаются следующим async_read, поэтому ответы уходят в порядке запросов.
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    explicit Session(tcp::socket&& socket) : stream_(std::move(socket)) { open_sessions++; }
+    ~Session() { open_sessions--; }
+
+    void run() {
+        // Все операции сессии выполняются на её strand
+        asio::dispatch(stream_.get_executor(),
+                       beast::bind_front_handler(&Session::do_read, shared_from_this()));
+    }
+
+private:
+    void do_read() {
+        req_ = {};
+        // Первый запрос ждём READ_TIMEOUT, последующие на keep-alive соединении - IDLE_TIMEOUT
+        stream_.expires_after(requests_served_ == 0 ? READ_TIMEOUT : IDLE_TIMEOUT);
+        http::async_read(stream_, buffer_, req_,
+                         beast::bind_front_handler(&Session::on_read, shared_from_this()));
+    }
+
+    void on_read(beast::error_code ec, std::size_t) {
+        if (ec == http::error::end_of_stream || ec == beast::error::timeout)
+            return do_close();
+        if (ec) {
+            LOG_LIMITED(LEVEL_WARN, LOG_CLIENT_ERRORS_PER_SECOND, "Read error: " << ec.message());
+            return do_close();
+        }
+
+        reply_ = {};
+        request_started_ = std::chrono::steady_clock::now();
+        handle_request(req_, reply_);
+        requests_served_++;
+        unsigned status_class = reply_.res.result_int() / 100;
+        if (status_class >= 1 && status_class <= 5)
+            responses_total[status_class]->inc();
+        keep_alive_ = reply_.res.keep_alive();
+
+        if (reply_.event_stream) {
+            auto events = std::make_shared<EventStream>(std::move(stream_), reply_.stream_sensor);
+            events->run(reply_.res.base());
+            broadcaster->subscribe(events);
+            return;
+        }
+        if (reply_.rows || reply_.shared_body)
+            return start_stream();
+
+        stream_.expires_after(WRITE_TIMEOUT);
+        http::async_write(stream_, reply_.res,
+                          beast::bind_front_handler(&Session::on_write, shared_from_this()));
+    }
 
-    for (;;) {
-        tcp::socket socket(io_context);
-        acceptor.accept(socket);
+    void on_write(beast::error_code ec, std::size_t) {
+        request_seconds[reply_.route]->observe(std::chrono::steady_clock::now() - request_started_);
+        if (ec) {
+            LOG_LIMITED(LEVEL_WARN, LOG_CLIENT_ERRORS_PER_SECOND, "Write error: " << ec.message());
+            return do_close();
+        }
+        reply_ = {};
+        if (!keep_alive_)
+            return do_close();
+        do_read();
+    }
+
+    // Отправка результата запроса. Если он уместился в первую порцию, уходит
+    // обычным ответом с Content-Length, иначе - порциями через chunked transfer.
+    // HTTP/1.0 не поддерживает chunked, поэтому такому клиенту тело собирается целиком.
+    // Общее готовое тело из кэша отправляется прямо из его буфера, без копирования
+    void start_stream() {
+        const std::string* body = reply_.shared_body.get();
+        bool more = false;
+        if (reply_.rows) {
+            bool chunked = req_.version() >= 11;
+            compressor_.reset();
+            if (reply_.encoding != ENCODING_IDENTITY) {
+                compressor_.emplace(reply_.encoding, STREAM_COMPRESSION_LEVEL);
+                reply_.res.set(http::field::content_encoding, encodingName(reply_.encoding));
+            }
+            more = fill_chunk(chunked ? STREAM_CHUNK_SIZE : SIZE_MAX);
+            body = &chunk_;
+        }
 
-        beast::flat_buffer buffer;
-        http::request<http::string_body> req;
-        http::read(socket, buffer, req);
+        stream_res_.emplace(std::move(reply_.res.base()));
+        if (more)
+            stream_res_->chunked(true);
+        else
+            stream_res_->content_length(body->size());
+        set_chunk(*body, more);
 
-        http::response<http::string_body> res;
-        handle_request(req, res);
+        serializer_.emplace(*stream_res_);
+        stream_.expires_after(WRITE_TIMEOUT);
+        http::async_write(stream_, *serializer_,
+                          beast::bind_front_handler(&Session::on_stream_write, shared_from_this()));
+    }
+
+    void on_stream_write(beast::error_code ec, std::size_t) {
+        // need_buffer означает, что текущая порция отправлена и нужна следующая
+        if (ec == http::error::need_buffer)
+            ec = {};
+        if (ec) {
+            LOG_LIMITED(LEVEL_WARN, LOG_CLIENT_ERRORS_PER_SECOND, "Write error: " << ec.message());
+            return do_close();
+        }
+        if (serializer_->is_done()) {
+            serializer_.reset();
+            stream_res_.reset();
+            return on_write(ec, 0);
+        }
+
+        set_chunk(chunk_, fill_chunk(STREAM_CHUNK_SIZE));
+        stream_.expires_after(WRITE_TIMEOUT);
+        http::async_write(stream_, *serializer_,
+                          beast::bind_front_handler(&Session::on_stream_write, shared_from_this()));
+    }
 
-        http::write(socket, res);
+    // Следующая порция потока строк в chunk_ (сжатая, если клиент принимает сжатие).
+    // Возвращает true, если в результате ещё остались строки
+    bool fill_chunk(std::size_t limit) {
+        chunk_.clear();
+        if (!compressor_)
+            return reply_.rows->fill(chunk_, limit);
+        raw_chunk_.clear();
+        bool more = reply_.rows->fill(raw_chunk_, limit);
+        if (!compressor_->compress(raw_chunk_, chunk_, !more))
+            LOG_ERROR("Compression error");
+        return more;
     }
+
+    void set_chunk(const std::string& chunk, bool more) {
+        auto& body = stream_res_->body();
+        body.data = chunk.empty() ? nullptr : const_cast<char*>(chunk.data());
+        body.size = chunk.size();
+        body.more = more;
+    }
+
+    void do_close() {
+        beast::error_code ec;
+        stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+    }
+
+    beast::tcp_stream stream_;
+    beast::flat_buffer buffer_;
+    http::request<http::string_body> req_;
+    Reply reply_;
+    bool keep_alive_ = false;
+    std::size_t requests_served_ = 0;
+    std::chrono::steady_clock::time_point request_started_;
+
+    // Потоковый ответ; буферы порции переиспользуются между запросами
+    std::string chunk_;
+    std::string raw_chunk_;                     // Порция до сжатия
+    std::optional<StreamCompressor> compressor_;
+    std::optional<http::response<http::buffer_body>> stream_res_;
+    std::optional<http::response_serializer<http::buffer_body>> serializer_;
+};
+
+// Приём входящих соединений; каждое соединение получает свой strand
+class Listener : public std::enable_shared_from_this<Listener> {
+public:
+    Listener(asio::io_context& io_context, tcp::endpoint endpoint)
+        : io_context_(io_context), acceptor_(asio::make_strand(io_context)) {
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(asio::socket_base::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen(asio::socket_base::max_listen_connections);
+    }
+
+    void run() { do_accept(); }
+
+private:
+    void do_accept() {
+        acceptor_.async_accept(asio::make_strand(io_context_),
+                               beast::bind_front_handler(&Listener::on_accept, shared_from_this()));
+    }
+
+    void on_accept(beast::error_code ec, tcp::socket socket) {
+        if (ec) {
+            LOG_LIMITED(LEVEL_ERROR, LOG_CLIENT_ERRORS_PER_SECOND, "Accept error: " << ec.message());
+        } else {
+            socket.set_option(tcp::no_delay(true), ec);
+            std::make_shared<Session>(std::move(socket))->run();
+        }
+        do_accept();
+    }
+
+    asio::io_context& io_context_;
+    tcp::acceptor acceptor_;
+};
+
+// Периодическое обновление кэша горячих данных; без изменений в базе обходится одним PRAGMA
+void schedule_cache_refresh(asio::steady_timer& timer) {
+    timer.expires_after(CACHE_REFRESH_INTERVAL);
+    timer.async_wait([&timer](beast::error_code ec) {
+        if (ec)
+            return;
+        hot_cache->refresh();
+        schedule_cache_refresh(timer);
+    });
+}
+
+// Запуск сервера на threads рабочих потоках
+void run_server(asio::io_context& io_context, unsigned short port, unsigned threads) {
+    std::make_shared<Listener>(io_context, tcp::endpoint{tcp::v4(), port})->run();
+    LOG_INFO("Server is running on port " << port << " (" << threads << " threads)");
+
+    // Корректное завершение по Ctrl+C / SIGTERM
+    asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    signals.async_wait([&io_context](beast::error_code, int) { io_context.stop(); });
+
+    broadcaster = new Broadcaster();
+    hot_cache->onNewRow(publish_row);
+    asio::steady_timer refresh_timer(io_context);
+    schedule_cache_refresh(refresh_timer);
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back([&io_context] { io_context.run(); });
+    io_context.run();
+
+    for (auto& t : workers)
+        t.join();
 }
 
-int main() {
+int main(int argc, char** argv) {
     try {
-        asio::io_context io_context;
+        // Порт и число рабочих потоков можно передать аргументами: server [port] [threads]
+        unsigned short port = argc > 1 ? static_cast<unsigned short>(std::stoi(argv[1])) : 8080;
+        unsigned threads = argc > 2 ? static_cast<unsigned>(std::stoi(argv[2])) : std::thread::hardware_concurrency();
+        if (threads == 0)
+            threads = 1;
+
+        asio::io_context io_context(static_cast<int>(threads));
 
         // Инициализация базы данных
-        initializeDatabase();
+        initializeDatabase(threads);
+        registerMetrics();
 
-        // Запуск сервера на порту 8080
-        run_server(io_context, 8080);
+        run_server(io_context, port, threads);
     } catch (std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        LOG_ERROR("Error: " << e.what());
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
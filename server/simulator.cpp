@@ -1,72 +1,698 @@
 #include "my_serial.hpp"
-#include <sstream>              
-#include <iostream>             
+#include <sstream>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
-#include <ctime>
+#include <thread>
+#include <vector>
 
-const double TIME_DELAY = 10.0;
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
 
-template<class T> std::string to_string(const T& v)
-{
-    std::ostringstream ss;
-    ss << v;
-    return ss.str();
+#include "sensor_protocol.hpp"
+#include "storage.hpp"
+#include "waveform.hpp"
+
+// Симулятор датчиков и генератор нагрузки для temperature_monitor.
+// M датчиков пишут в свои порты: существующие последовательные порты или пары pty, которые
+// симулятор создаёт сам (ссылки DIR/sensor<i>, их же он записывает в файл датчиков для --config).
+// Измерения идут с заданной частотой по расписанию, датчики сдвинуты по фазе, чтобы нагрузка
+// была равномерной. Значения - модель Waveform с зерном (повторяемы) либо записанная трасса.
+// Раз в --report секунд печатается достигнутая частота, отставание от расписания и потери:
+// если порт не принимает данные (читатель не успевает), неотправленное копится до PENDING_LIMIT,
+// дальше измерения отбрасываются.
+// С --hangup порты pty отключаются по расписанию: когда читатель забрал всё отправленное (в порт
+// уходят только целые строки и кадры), пара pty закрывается и создаётся новая под той же ссылкой,
+// как при переподключении устройства; измерения за это время ждут в очереди порта.
+// Метки задержки (--markers) - измерения со значением ниже MARKER_BASE, номер метки
+// закодирован в значении. С --lag-db симулятор ищет их в базе и считает задержку записи
+// (метка времени строки минус момент отправки) и задержку появления в базе
+
+const double DEFAULT_RATE = 0.1;                // Измерений в секунду на датчик (раз в 10 с)
+const double MIN_RATE = 0.1;
+const double MAX_RATE = 10000;
+const int MAX_SENSORS = 1024;
+const std::size_t PENDING_LIMIT = 64 * 1024;    // Неотправленных байт на порт
+const double MARKER_BASE = -300.0;              // Метки: MARKER_BASE - seq / 100
+const int MARKER_SEQS = 2600;                   // Номера меток по кругу (значения до -325,99)
+const std::chrono::milliseconds LAG_POLL(100);
+const std::chrono::seconds HANGUP_DRAIN_TIMEOUT(1);     // Ожидание читателя перед отключением pty
+const std::chrono::milliseconds HANGUP_POLL(5);
+
+// Порт одного датчика
+struct SimPort {
+    std::string name;                                   // Путь для temperature_monitor
+    std::unique_ptr<cplib::SerialPort> serial;          // Настоящий порт
+    int master = -1;                                    // Ведущая сторона pty
+    int slave = -1;     // Ведомая сторона держится открытой: иначе pty закрывается, пока читатель переподключается
+    std::string pending;                                // Ещё не принятое портом
+};
+
+struct SimSensor {
+    SimPort port;
+    std::unique_ptr<Waveform> waveform;
+    double offset = 0;                  // Сдвиг расписания, с
+    uint64_t index = 0;                 // Номер следующего измерения
+    std::vector<double> frame;          // Измерения следующего кадра
+    int64_t frame_ts = 0;
+    double next_marker = 0;
+    int marker_seq = 0;
+};
+
+// Отправленная метка, ждущая появления в базе
+struct SentMarker {
+    int64_t sent;       // мс от эпохи
+};
+
+struct TraceSample {
+    double t;
+    int sensor;
+    double value;
+};
+
+// Параметры запуска
+struct Options {
+    std::vector<std::string> ports;
+    std::string pty_dir;
+    int sensors = 1;
+    double hangup = 0;                  // Период отключения pty, с; 0 - без отключений
+    std::string write_config;
+    double rate = DEFAULT_RATE;
+    std::size_t frame_samples = 0;      // 0 - текстовый протокол
+    uint64_t seed = 0;
+    bool has_seed = false;
+    WaveformParams waveform;
+    double corrupt = 0;
+    std::string record;
+    std::string replay;
+    double speed = 1;
+    double markers = 0;
+    std::string lag_db;
+    double duration = 0;
+    double report = 1;
+    std::string summary;
+};
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+// Метки и задержки, общие с потоком опроса базы
+std::mutex lag_mutex;
+std::map<std::pair<int32_t, int>, SentMarker> sent_markers;    // (датчик, номер) -> отправка
+std::vector<double> ingest_lags, visible_lags;                  // мс, с прошлого отчёта
+std::vector<double> all_ingest_lags, all_visible_lags;
+
+int64_t wallMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-void csleep(double timeout) {
-#if defined (WIN32)
-    if (timeout <= 0.0)
-        ::Sleep(INFINITE);
-    else
-        ::Sleep((DWORD)(timeout * 1e3));
-#else
-    if (timeout <= 0.0)
-        pause();
-    else {
-        struct timespec t;
-        t.tv_sec = (int)timeout;
-        t.tv_nsec = (int)((timeout - t.tv_sec)*1e9);
-        nanosleep(&t, NULL);
+void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [options] <port>... | " << name << " [options] --ptys <dir>" << std::endl;
+    std::cout << "       " << name << " <port> [interval_seconds]" << std::endl;
+    std::cout << "Ports:" << std::endl;
+    std::cout << "  --ptys DIR               create pty pairs, linked as DIR/sensor<i>" << std::endl;
+    std::cout << "  --sensors M              number of sensors with --ptys (default 1, up to " << MAX_SENSORS << ")" << std::endl;
+    std::cout << "  --write-config FILE      write a sensor config for temperature_monitor --config" << std::endl;
+    std::cout << "  --hangup S               with --ptys: every S seconds replace each pty with a new one (the reader reconnects)" << std::endl;
+    std::cout << "Load:" << std::endl;
+    std::cout << "  --rate HZ                readings per second per sensor, " << MIN_RATE << ".." << MAX_RATE
+              << " (default " << DEFAULT_RATE << ")" << std::endl;
+    std::cout << "  --binary N               binary frames of N readings instead of text lines" << std::endl;
+    std::cout << "  --duration S             stop after S seconds (default: until interrupted)" << std::endl;
+    std::cout << "  --report S               print the achieved rate every S seconds (default 1, 0 - only at exit)" << std::endl;
+    std::cout << "  --summary FILE           write the totals as JSON at exit (for bench_ingest)" << std::endl;
+    std::cout << "Waveform:" << std::endl;
+    std::cout << "  --seed N                 random seed (default: random, printed at start)" << std::endl;
+    std::cout << "  --base C --swing C --period S    daily cycle (default 25, 3, 86400)" << std::endl;
+    std::cout << "  --drift C                random walk, degrees per hour (default 0.5)" << std::endl;
+    std::cout << "  --noise C                noise standard deviation (default 0.1)" << std::endl;
+    std::cout << "  --spike-probability P --spike C  outliers (default 0, 10)" << std::endl;
+    std::cout << "  --dropouts-per-hour N --dropout-seconds S  silent periods (default 0, 5)" << std::endl;
+    std::cout << "  --corrupt P              flip a bit in a fraction P of sent bytes" << std::endl;
+    std::cout << "Traces and latency:" << std::endl;
+    std::cout << "  --record FILE            save sent readings as '<seconds> <sensor> <value>' lines" << std::endl;
+    std::cout << "  --replay FILE            send a recorded trace instead of the waveform" << std::endl;
+    std::cout << "  --speed X                replay speed (default 1)" << std::endl;
+    std::cout << "  --markers S              send a latency marker from every sensor every S seconds" << std::endl;
+    std::cout << "  --lag-db PATH            find markers in the database and report the lag" << std::endl;
+}
+
+bool parseNumber(const char* text, double& value) {
+    const char* end = text + std::strlen(text);
+    auto result = std::from_chars(text, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    std::map<std::string, double*> numbers = {
+        {"--rate", &options.rate},
+        {"--base", &options.waveform.base},
+        {"--swing", &options.waveform.swing},
+        {"--period", &options.waveform.period},
+        {"--drift", &options.waveform.drift},
+        {"--noise", &options.waveform.noise},
+        {"--spike-probability", &options.waveform.spike_probability},
+        {"--spike", &options.waveform.spike},
+        {"--dropouts-per-hour", &options.waveform.dropouts_per_hour},
+        {"--dropout-seconds", &options.waveform.dropout_seconds},
+        {"--corrupt", &options.corrupt},
+        {"--speed", &options.speed},
+        {"--markers", &options.markers},
+        {"--duration", &options.duration},
+        {"--report", &options.report},
+        {"--hangup", &options.hangup},
+    };
+    std::map<std::string, std::string*> strings = {
+        {"--ptys", &options.pty_dir},
+        {"--write-config", &options.write_config},
+        {"--record", &options.record},
+        {"--replay", &options.replay},
+        {"--lag-db", &options.lag_db},
+        {"--summary", &options.summary},
+    };
+    bool has_rate = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            options.ports.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        double number;
+        if (numbers.count(arg)) {
+            if (!parseNumber(value, number))
+                return false;
+            *numbers[arg] = number;
+            has_rate = has_rate || arg == "--rate";
+        } else if (strings.count(arg)) {
+            *strings[arg] = value;
+        } else if (arg == "--sensors" || arg == "--binary" || arg == "--seed") {
+            if (!parseNumber(value, number) || number < 0 || number != std::floor(number))
+                return false;
+            if (arg == "--sensors")
+                options.sensors = static_cast<int>(number);
+            else if (arg == "--binary")
+                options.frame_samples = static_cast<std::size_t>(number);
+            else
+                options.seed = static_cast<uint64_t>(number), options.has_seed = true;
+        } else {
+            return false;
+        }
     }
-#endif
+    // Прежний вызов: simulator <port> <interval_seconds>
+    double interval;
+    if (!has_rate && options.ports.size() == 2 && parseNumber(options.ports[1].c_str(), interval) && interval > 0) {
+        options.rate = 1 / interval;
+        options.ports.pop_back();
+    }
+    if (options.ports.empty() == options.pty_dir.empty())
+        return false;
+    if (!options.ports.empty())
+        options.sensors = static_cast<int>(options.ports.size());
+    return options.sensors >= 1 && options.sensors <= MAX_SENSORS && options.rate >= MIN_RATE && options.rate <= MAX_RATE &&
+           options.frame_samples <= FRAME_MAX_SAMPLES && options.corrupt >= 0 && options.corrupt < 1 && options.speed > 0 &&
+           options.markers >= 0 && options.duration >= 0 && options.report >= 0 && options.waveform.period > 0 &&
+           options.hangup >= 0 && (options.hangup == 0 || !options.pty_dir.empty());
 }
 
-double random_number() {
-    static std::random_device rd;  // Источник случайных чисел (seed)
-    static std::mt19937 gen(rd()); // Генератор Mersenne Twister
+// Трасса: строки "<секунды> <датчик> <значение>", '#' - комментарий; сортируется по времени
+bool loadTrace(const std::string& path, std::vector<TraceSample>& trace) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Failed to open trace '" << path << "'" << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        TraceSample sample;
+        if (!(fields >> sample.t))
+            continue;
+        if (!(fields >> sample.sensor >> sample.value) || sample.sensor < 0 || sample.sensor >= MAX_SENSORS) {
+            std::cout << path << ":" << number << ": expected '<seconds> <sensor> <value>'" << std::endl;
+            return false;
+        }
+        trace.push_back(sample);
+    }
+    std::stable_sort(trace.begin(), trace.end(), [](const TraceSample& a, const TraceSample& b) { return a.t < b.t; });
+    return true;
+}
 
+#ifndef _WIN32
+// Пара pty: ведомая сторона в сыром режиме, ссылка link на неё (заменяется атомарно: читатель,
+// переоткрывающий порт, видит старую или новую ссылку)
+bool openPty(SimPort& port, const std::string& link) {
+    port.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (port.master < 0 || grantpt(port.master) != 0 || unlockpt(port.master) != 0)
+        return false;
+    const char* name = ptsname(port.master);
+    port.slave = name ? ::open(name, O_RDWR | O_NOCTTY) : -1;
+    if (port.slave < 0)
+        return false;
+    termios tio;
+    tcgetattr(port.slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(port.slave, TCSANOW, &tio);
+    fcntl(port.master, F_SETFL, fcntl(port.master, F_GETFL) | O_NONBLOCK);
+    std::string temp = link + ".new";
+    ::unlink(temp.c_str());
+    if (::symlink(name, temp.c_str()) != 0 || ::rename(temp.c_str(), link.c_str()) != 0)
+        return false;
+    port.name = link;
+    return true;
+}
+#endif
 
-    std::uniform_real_distribution<> distrib(20.0, 30.0);
+// Отправка накопленного; pty не блокирует, непринятое остаётся в pending
+std::size_t flushPort(SimPort& port) {
+    if (port.pending.empty())
+        return 0;
+    std::size_t written = 0;
+    if (port.serial) {
+        port.serial->Write(port.pending.data(), port.pending.size(), &written);
+    }
+#ifndef _WIN32
+    else {
+        ssize_t n = ::write(port.master, port.pending.data(), port.pending.size());
+        written = n > 0 ? static_cast<std::size_t>(n) : 0;
+    }
+#endif
+    port.pending.erase(0, written);
+    return written;
+}
 
-    double random_value = distrib(gen);
+#ifndef _WIN32
+// Отключение pty: досылка очереди и ожидание, пока читатель заберёт всё отправленное, затем новая
+// пара под той же ссылкой; досланное прибавляется к bytes. drained = false - читатель не забрал
+// данные за HANGUP_DRAIN_TIMEOUT, пара оставлена; false - пара не заменена. Записанное доходит
+// до ведомой стороны не сразу, а при закрытии пары непрочитанное там теряется, поэтому её очередь
+// проверяется через HANGUP_POLL после записи
+bool hangupPty(SimPort& port, uint64_t& bytes, bool& drained) {
+    for (auto deadline = std::chrono::steady_clock::now() + HANGUP_DRAIN_TIMEOUT;;) {
+        bytes += flushPort(port);
+        std::this_thread::sleep_for(HANGUP_POLL);
+        int queued = 0;
+        if (port.pending.empty() && ioctl(port.slave, FIONREAD, &queued) == 0 && queued == 0)
+            break;
+        if (std::chrono::steady_clock::now() >= deadline) {
+            drained = false;
+            return false;
+        }
+    }
+    ::close(port.slave);
+    ::close(port.master);
+    port.slave = port.master = -1;
+    drained = true;
+    return openPty(port, port.name);
+}
+#endif
 
-    random_value = std::round(random_value * 10) / 10;
+double percentile(std::vector<double>& values, double p) {
+    if (values.empty())
+        return 0;
+    std::size_t i = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + i, values.end());
+    return values[i];
+}
 
-    return random_value;
+std::string lagSummary(std::vector<double>& ingest, std::vector<double>& visible) {
+    std::ostringstream out;
+    out << "lag ms: ingest p50 " << percentile(ingest, 0.5) << " p99 " << percentile(ingest, 0.99)
+        << " max " << percentile(ingest, 1) << ", visible p50 " << percentile(visible, 0.5) << " p99 "
+        << percentile(visible, 0.99) << " max " << percentile(visible, 1) << " (" << visible.size() << " markers)";
+    return out.str();
 }
 
+// Поток опроса базы: метки, отправленные симулятором, ищутся среди новых строк temperatures.
+// Номер датчика в базе должен совпадать с номером датчика симулятора (как в --write-config)
+void pollMarkers(const std::string& path, const std::atomic<bool>& done) {
+    sqlite3* db = nullptr;
+    sqlite3_stmt* stmt = nullptr;
+    while (!done) {
+        std::this_thread::sleep_for(LAG_POLL);
+        if (!db) {
+            // База появляется, когда temperature_monitor запущен
+            std::error_code ec;
+            if (!std::filesystem::exists(path, ec))
+                continue;
+            db = openDatabase(path.c_str(), true);
+            if (db && sqlite3_prepare_v2(db, "SELECT sensor_id, ts, value FROM temperatures WHERE ts >= ? AND value <= ? AND value > ?;",
+                                         -1, &stmt, nullptr) != SQLITE_OK) {
+                sqlite3_close(db);
+                db = nullptr;
+            }
+            if (!db)
+                continue;
+        }
+        int64_t from;
+        {
+            std::lock_guard<std::mutex> lock(lag_mutex);
+            if (sent_markers.empty())
+                continue;
+            from = INT64_MAX;
+            for (const auto& marker : sent_markers)
+                from = std::min(from, marker.second.sent);
+        }
+        sqlite3_bind_int64(stmt, 1, from - 10000);
+        sqlite3_bind_double(stmt, 2, MARKER_BASE + 0.005);
+        sqlite3_bind_double(stmt, 3, MARKER_BASE - MARKER_SEQS / 100.0);
+        int64_t now = wallMillis();
+        std::lock_guard<std::mutex> lock(lag_mutex);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            int32_t sensor = sqlite3_column_int(stmt, 0);
+            int64_t ts = sqlite3_column_int64(stmt, 1);
+            int seq = static_cast<int>(std::lround((MARKER_BASE - sqlite3_column_double(stmt, 2)) * 100));
+            auto it = sent_markers.find({sensor, seq});
+            // Метка с тем же номером из предыдущего круга
+            if (it == sent_markers.end() || std::abs(ts - it->second.sent) > 600000)
+                continue;
+            ingest_lags.push_back(double(ts - it->second.sent));
+            visible_lags.push_back(double(now - it->second.sent));
+            sent_markers.erase(it);
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
 
 int main(int argc, char** argv)
 {
-    if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <port>" << std::endl;
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
         return -1;
     }
+    std::vector<TraceSample> trace;
+    if (!options.replay.empty()) {
+        if (!loadTrace(options.replay, trace))
+            return -1;
+        for (const TraceSample& sample : trace) {
+            if (sample.sensor >= options.sensors && !options.pty_dir.empty())
+                options.sensors = sample.sensor + 1;
+            if (sample.sensor >= options.sensors) {
+                std::cout << "Trace has sensor " << sample.sensor << ", but only " << options.sensors << " ports" << std::endl;
+                return -1;
+            }
+        }
+    }
+    if (!options.has_seed)
+        options.seed = (uint64_t(std::random_device()()) << 32) | std::random_device()();
+
+    std::vector<SimSensor> sensors(options.sensors);
+    for (int i = 0; i < options.sensors; ++i) {
+        SimSensor& sensor = sensors[i];
+        if (!options.pty_dir.empty()) {
+#ifndef _WIN32
+            if (!openPty(sensor.port, options.pty_dir + "/sensor" + std::to_string(i))) {
+                std::cout << "Failed to create pty '" << options.pty_dir << "/sensor" << i << "'! Terminating..." << std::endl;
+                return -2;
+            }
+#else
+            std::cout << "--ptys is not supported on Windows" << std::endl;
+            return -2;
+#endif
+        } else {
+            sensor.port.name = options.ports[i];
+            sensor.port.serial = std::make_unique<cplib::SerialPort>(sensor.port.name, cplib::SerialPort::BAUDRATE_115200);
+            if (!sensor.port.serial->IsOpen()) {
+                std::cout << "Failed to open port '" << sensor.port.name << "'! Terminating..." << std::endl;
+                return -2;
+            }
+        }
+        sensor.waveform = std::make_unique<Waveform>(options.waveform, options.seed, static_cast<uint32_t>(i));
+        sensor.offset = double(i) / options.sensors / options.rate;
+        sensor.next_marker = sensor.offset;
+    }
 
-    cplib::SerialPort smport(std::string(argv[1]), cplib::SerialPort::BAUDRATE_115200);
-    if (!smport.IsOpen()) {
-        std::cout << "Failed to open port '" << argv[1] << "'! Terminating..." << std::endl;
-        return -2;
+    if (!options.write_config.empty()) {
+        std::ofstream config(options.write_config, std::ios::trunc);
+        for (int i = 0; i < options.sensors; ++i)
+            config << i << " " << sensors[i].port.name << " 115200" << (options.frame_samples ? " binary" : "") << "\n";
+        if (!config) {
+            std::cout << "Failed to write config '" << options.write_config << "'" << std::endl;
+            return -1;
+        }
     }
 
-    std::string mystr;
+    std::unique_ptr<std::ofstream> record;
+    if (!options.record.empty()) {
+        record = std::make_unique<std::ofstream>(options.record, std::ios::trunc);
+        *record << "# seconds sensor value\n";
+    }
+
+    std::cout << "Simulating " << options.sensors << " sensors at " << options.rate << " Hz"
+              << (options.frame_samples ? ", binary frames of " + std::to_string(options.frame_samples) : std::string(", text"))
+              << (options.replay.empty() ? ", seed " + std::to_string(options.seed) : ", replaying " + options.replay) << std::endl;
+    for (const SimSensor& sensor : sensors)
+        if (!options.pty_dir.empty())
+            std::cout << "  " << sensor.port.name << std::endl;
+
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
+    std::atomic<bool> done{false};
+    std::thread lag_thread;
+    if (!options.lag_db.empty())
+        lag_thread = std::thread(pollMarkers, options.lag_db, std::cref(done));
+
+    std::mt19937_64 corrupt_rng(options.seed ^ 0x5bd1e995);
+    std::geometric_distribution<uint64_t> corrupt_gap(options.corrupt > 0 ? options.corrupt : 0.5);
+    uint64_t next_corrupt = corrupt_gap(corrupt_rng);
+    const uint32_t interval_us = static_cast<uint32_t>(std::clamp(std::llround(1e6 / options.rate), 1LL, 4294967295LL));
+
+    // Счётчики: с прошлого отчёта и всего
+    uint64_t sent = 0, sent_bytes = 0, dropped = 0, total_sent = 0, total_bytes = 0, total_dropped = 0;
+    uint64_t hangups = 0, hangups_postponed = 0;
+    double next_hangup = options.hangup;
+    double max_late = 0, total_max_late = 0;
+
+    // Измерение датчика в момент t расписания: значение (или метка) в pending порта
+    auto emit = [&](SimSensor& sensor, int index, double t, double value) {
+        std::string& out = sensor.port.pending;
+        if (options.markers > 0 && t >= sensor.next_marker) {
+            value = MARKER_BASE - sensor.marker_seq / 100.0;
+            std::lock_guard<std::mutex> lock(lag_mutex);
+            sent_markers[{index, sensor.marker_seq}] = SentMarker{wallMillis()};
+            sensor.marker_seq = (sensor.marker_seq + 1) % MARKER_SEQS;
+            sensor.next_marker += options.markers;
+        } else if (record) {
+            char buf[64];
+            char* end = std::to_chars(buf, buf + sizeof(buf), t, std::chars_format::fixed, 6).ptr;
+            *end++ = ' ';
+            end = std::to_chars(end, buf + sizeof(buf), index).ptr;
+            *end++ = ' ';
+            end = std::to_chars(end, buf + sizeof(buf), value, std::chars_format::fixed, 2).ptr;
+            *end++ = '\n';
+            record->write(buf, end - buf);
+        }
+        std::size_t start = out.size();
+        if (options.frame_samples) {
+            if (sensor.frame.empty())
+                sensor.frame_ts = static_cast<int64_t>(t * 1000);
+            sensor.frame.push_back(value);
+            if (sensor.frame.size() < options.frame_samples)
+                return;
+            if (out.size() < PENDING_LIMIT && encodeFrame(out, 0, interval_us, sensor.frame_ts, sensor.frame))
+                sent += sensor.frame.size();
+            else
+                dropped += sensor.frame.size();
+            sensor.frame.clear();
+        } else {
+            if (out.size() >= PENDING_LIMIT) {
+                dropped++;
+                return;
+            }
+            char buf[32];
+            auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, 2);
+            out.append(buf, result.ptr);
+            out.push_back('\n');
+            sent++;
+        }
+        // Искажение: next_corrupt - сколько байт пропустить до следующего испорченного
+        for (std::size_t i = start; options.corrupt > 0 && i < out.size(); ++i) {
+            if (next_corrupt >= out.size() - i) {
+                next_corrupt -= out.size() - i;
+                break;
+            }
+            i += next_corrupt;
+            out[i] ^= static_cast<char>(1 << (corrupt_rng() % 8));
+            next_corrupt = corrupt_gap(corrupt_rng);
+        }
+    };
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    clock::time_point last_report = start;
+    std::size_t next_trace = 0;
     for (;;) {
-        mystr = to_string(random_number());
-        smport << mystr;
-        csleep(TIME_DELAY);
+        clock::time_point now = clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        bool finished = stop_requested || (options.duration > 0 && elapsed >= options.duration);
+
+        double next_due;
+        if (!options.replay.empty()) {
+            for (; next_trace < trace.size() && trace[next_trace].t / options.speed <= elapsed; ++next_trace) {
+                const TraceSample& sample = trace[next_trace];
+                max_late = std::max(max_late, elapsed - sample.t / options.speed);
+                emit(sensors[sample.sensor], sample.sensor, sample.t, sample.value);
+            }
+            finished = finished || next_trace == trace.size();
+            next_due = next_trace < trace.size() ? trace[next_trace].t / options.speed : elapsed;
+        } else {
+            next_due = elapsed + 1;
+            for (int i = 0; i < options.sensors; ++i) {
+                SimSensor& sensor = sensors[i];
+                double t;
+                while ((t = sensor.offset + sensor.index / options.rate) <= elapsed) {
+                    max_late = std::max(max_late, elapsed - t);
+                    double value;
+                    if (sensor.waveform->sample(t, value))
+                        emit(sensor, i, t, value);
+                    sensor.index++;
+                }
+                next_due = std::min(next_due, t);
+            }
+        }
+
+        bool backlog = false;
+        for (SimSensor& sensor : sensors) {
+            sent_bytes += flushPort(sensor.port);
+            backlog = backlog || !sensor.port.pending.empty();
+        }
+
+#ifndef _WIN32
+        if (options.hangup > 0 && elapsed >= next_hangup && !finished) {
+            next_hangup += options.hangup;
+            for (SimSensor& sensor : sensors) {
+                bool drained;
+                if (hangupPty(sensor.port, sent_bytes, drained)) {
+                    hangups++;
+                } else if (drained) {
+                    std::cout << "Failed to replace pty '" << sensor.port.name << "'! Terminating..." << std::endl;
+                    return -2;
+                } else {
+                    hangups_postponed++;
+                }
+            }
+        }
+#endif
+
+        double since_report = std::chrono::duration<double>(now - last_report).count();
+        if (finished || (options.report > 0 && since_report >= options.report)) {
+            std::size_t pending = 0;
+            for (const SimSensor& sensor : sensors)
+                pending += sensor.port.pending.size();
+            std::cout << "t=" << std::lround(elapsed) << "s sent " << sent / since_report << "/s of "
+                      << options.rate * options.sensors << "/s, " << sent_bytes / since_report / 1024 << " KB/s, max late "
+                      << max_late * 1000 << " ms, pending " << pending << " B, dropped " << dropped;
+            if (!options.lag_db.empty()) {
+                std::lock_guard<std::mutex> lock(lag_mutex);
+                std::cout << ", " << lagSummary(ingest_lags, visible_lags) << ", waiting " << sent_markers.size();
+                all_ingest_lags.insert(all_ingest_lags.end(), ingest_lags.begin(), ingest_lags.end());
+                all_visible_lags.insert(all_visible_lags.end(), visible_lags.begin(), visible_lags.end());
+                ingest_lags.clear();
+                visible_lags.clear();
+            }
+            std::cout << std::endl;
+            total_sent += sent;
+            total_bytes += sent_bytes;
+            total_dropped += dropped;
+            total_max_late = std::max(total_max_late, max_late);
+            sent = sent_bytes = dropped = 0;
+            max_late = 0;
+            last_report = now;
+        }
+        if (finished)
+            break;
+
+        // Сон до следующего измерения; непринятые портом данные - повтор через миллисекунду
+        double sleep = std::min(next_due - elapsed, backlog ? 0.001 : 0.1);
+        if (sleep > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
     }
 
-    return 0;
-}
+    // Неполный последний кадр уходит коротким кадром: измерения в нём уже записаны в --record
+    for (SimSensor& sensor : sensors) {
+        if (sensor.frame.empty())
+            continue;
+        if (encodeFrame(sensor.port.pending, 0, interval_us, sensor.frame_ts, sensor.frame))
+            total_sent += sensor.frame.size();
+        else
+            total_dropped += sensor.frame.size();
+        sensor.frame.clear();
+    }
 
+    // Досылка и ожидание, пока читатель заберёт отправленное: при закрытии pty непрочитанное теряется
+    // (записанное доходит до ведомой стороны не сразу, поэтому очередь проверяется после паузы)
+    for (clock::time_point deadline = clock::now() + std::chrono::seconds(1); clock::now() < deadline;) {
+        for (SimSensor& sensor : sensors)
+            total_bytes += flushPort(sensor.port);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        bool busy = false;
+        for (SimSensor& sensor : sensors) {
+            busy = busy || !sensor.port.pending.empty();
+#ifndef _WIN32
+            int queued = 0;
+            busy = busy || (sensor.port.slave >= 0 && ioctl(sensor.port.slave, FIONREAD, &queued) == 0 && queued > 0);
+#endif
+        }
+        if (!busy)
+            break;
+    }
 
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "Total: " << total_sent << " readings in " << elapsed << " s (" << total_sent / elapsed << "/s), "
+              << total_bytes << " bytes, dropped " << total_dropped;
+    if (options.hangup > 0)
+        std::cout << ", " << hangups << " pty hangups (" << hangups_postponed << " postponed: the reader did not keep up)";
+    std::cout << std::endl;
+    done = true;
+    if (lag_thread.joinable()) {
+        lag_thread.join();
+        std::lock_guard<std::mutex> lock(lag_mutex);
+        std::cout << "Total " << lagSummary(all_ingest_lags, all_visible_lags) << ", not seen " << sent_markers.size() << std::endl;
+    }
+    if (!options.summary.empty()) {
+        std::ofstream summary(options.summary, std::ios::trunc);
+        summary << "{\"sensors\":" << options.sensors << ",\"rate\":" << options.rate << ",\"seconds\":" << elapsed
+                << ",\"sent\":" << total_sent << ",\"bytes\":" << total_bytes << ",\"dropped\":" << total_dropped
+                << ",\"max_late_ms\":" << total_max_late * 1000 << ",\"hangups\":" << hangups;
+        if (!options.lag_db.empty()) {
+            summary << ",\"ingest_lag_p50_ms\":" << percentile(all_ingest_lags, 0.5) << ",\"ingest_lag_p99_ms\":"
+                    << percentile(all_ingest_lags, 0.99) << ",\"visible_lag_p50_ms\":" << percentile(all_visible_lags, 0.5)
+                    << ",\"visible_lag_p99_ms\":" << percentile(all_visible_lags, 0.99) << ",\"markers_seen\":"
+                    << all_visible_lags.size() << ",\"markers_missing\":" << sent_markers.size();
+        }
+        summary << "}" << std::endl;
+        if (!summary)
+            std::cout << "Failed to write summary '" << options.summary << "'" << std::endl;
+    }
+#ifndef _WIN32
+    for (SimSensor& sensor : sensors) {
+        if (sensor.port.master >= 0) {
+            ::unlink(sensor.port.name.c_str());
+            ::close(sensor.port.slave);
+            ::close(sensor.port.master);
+        }
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "aggregator.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STATS_X86 1
+#endif
+
+// Статистика по массивам значений: сумма, минимум/максимум, дисперсия, гистограмма,
+// статистика по интервалам времени и процентили.
+// Внутренние циклы есть в трёх вариантах - скалярном, SSE2 и AVX2; вариант выбирается
+// при первом вызове по возможностям процессора (AVX2 и SSE2 - только x86 с GCC/Clang,
+// код для них компилируется атрибутом target, без ключей сборки для всего файла).
+//
+// Дисперсия считается блоками: внутри блока (в кэше) - двумя проходами от среднего блока,
+// блоки объединяются формулой Чана (Bucket::merge). Так векторизуется и вычисление
+// по Уэлфорду, и точность не теряется на больших суммах
+
+// Внутренние циклы одного набора инструкций
+struct StatsKernels {
+    const char* name;
+    // Сумма, минимум и максимум n > 0 значений
+    void (*reduce)(const double* values, std::size_t n, double& sum, double& min, double& max);
+    // Сумма квадратов отклонений от mean
+    double (*deviations)(const double* values, std::size_t n, double mean);
+    // Номера корзин гистограммы: (value - lo) * scale, ограниченные [0, bins - 1]
+    void (*bins)(const double* values, std::size_t n, double lo, double scale, int32_t bins, int32_t* out);
+};
+
+namespace stats_detail {
+
+inline void reduceScalar(const double* values, std::size_t n, double& sum, double& min, double& max) {
+    double s = 0.0, lo = values[0], hi = values[0];
+    for (std::size_t i = 0; i < n; ++i) {
+        s += values[i];
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+    }
+    sum = s;
+    min = lo;
+    max = hi;
+}
+
+inline double deviationsScalar(const double* values, std::size_t n, double mean) {
+    double m2 = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        double d = values[i] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+inline int32_t binIndex(double value, double lo, double scale, int32_t bins) {
+    double index = (value - lo) * scale;
+    if (!(index >= 0.0))
+        return 0;
+    return index >= static_cast<double>(bins - 1) ? bins - 1 : static_cast<int32_t>(index);
+}
+
+inline void binsScalar(const double* values, std::size_t n, double lo, double scale, int32_t bins, int32_t* out) {
+    for (std::size_t i = 0; i < n; ++i)
+        out[i] = binIndex(values[i], lo, scale, bins);
+}
+
+#ifdef STATS_X86
+
+__attribute__((target("sse2"))) inline void reduceSse2(const double* values, std::size_t n, double& sum, double& min, double& max) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    __m128d lo = _mm_set1_pd(values[0]), hi = lo;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d a = _mm_loadu_pd(values + i), b = _mm_loadu_pd(values + i + 2);
+        s0 = _mm_add_pd(s0, a);
+        s1 = _mm_add_pd(s1, b);
+        lo = _mm_min_pd(lo, _mm_min_pd(a, b));
+        hi = _mm_max_pd(hi, _mm_max_pd(a, b));
+    }
+    double s[2], l[2], h[2];
+    _mm_storeu_pd(s, _mm_add_pd(s0, s1));
+    _mm_storeu_pd(l, lo);
+    _mm_storeu_pd(h, hi);
+    sum = s[0] + s[1];
+    min = std::min(l[0], l[1]);
+    max = std::max(h[0], h[1]);
+    for (; i < n; ++i) {
+        sum += values[i];
+        min = std::min(min, values[i]);
+        max = std::max(max, values[i]);
+    }
+}
+
+__attribute__((target("sse2"))) inline double deviationsSse2(const double* values, std::size_t n, double mean) {
+    __m128d m = _mm_set1_pd(mean);
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d a = _mm_sub_pd(_mm_loadu_pd(values + i), m), b = _mm_sub_pd(_mm_loadu_pd(values + i + 2), m);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(a, a));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(b, b));
+    }
+    double s[2];
+    _mm_storeu_pd(s, _mm_add_pd(s0, s1));
+    double m2 = s[0] + s[1];
+    for (; i < n; ++i) {
+        double d = values[i] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+__attribute__((target("sse2"))) inline void binsSse2(const double* values, std::size_t n, double lo, double scale, int32_t bins, int32_t* out) {
+    __m128d l = _mm_set1_pd(lo), k = _mm_set1_pd(scale);
+    __m128d zero = _mm_setzero_pd(), top = _mm_set1_pd(static_cast<double>(bins - 1));
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d index = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(values + i), l), k);
+        index = _mm_min_pd(_mm_max_pd(index, zero), top);    // max(NaN, 0) = 0
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_cvttpd_epi32(index));
+    }
+    for (; i < n; ++i)
+        out[i] = binIndex(values[i], lo, scale, bins);
+}
+
+__attribute__((target("avx2"))) inline void reduceAvx2(const double* values, std::size_t n, double& sum, double& min, double& max) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d lo = _mm256_set1_pd(values[0]), hi = lo;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a = _mm256_loadu_pd(values + i), b = _mm256_loadu_pd(values + i + 4);
+        s0 = _mm256_add_pd(s0, a);
+        s1 = _mm256_add_pd(s1, b);
+        lo = _mm256_min_pd(lo, _mm256_min_pd(a, b));
+        hi = _mm256_max_pd(hi, _mm256_max_pd(a, b));
+    }
+    double s[4], l[4], h[4];
+    _mm256_storeu_pd(s, _mm256_add_pd(s0, s1));
+    _mm256_storeu_pd(l, lo);
+    _mm256_storeu_pd(h, hi);
+    sum = (s[0] + s[1]) + (s[2] + s[3]);
+    min = std::min(std::min(l[0], l[1]), std::min(l[2], l[3]));
+    max = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+    for (; i < n; ++i) {
+        sum += values[i];
+        min = std::min(min, values[i]);
+        max = std::max(max, values[i]);
+    }
+}
+
+__attribute__((target("avx2,fma"))) inline double deviationsAvx2(const double* values, std::size_t n, double mean) {
+    __m256d m = _mm256_set1_pd(mean);
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a = _mm256_sub_pd(_mm256_loadu_pd(values + i), m), b = _mm256_sub_pd(_mm256_loadu_pd(values + i + 4), m);
+        s0 = _mm256_fmadd_pd(a, a, s0);
+        s1 = _mm256_fmadd_pd(b, b, s1);
+    }
+    double s[4];
+    _mm256_storeu_pd(s, _mm256_add_pd(s0, s1));
+    double m2 = (s[0] + s[1]) + (s[2] + s[3]);
+    for (; i < n; ++i) {
+        double d = values[i] - mean;
+        m2 += d * d;
+    }
+    return m2;
+}
+
+__attribute__((target("avx2"))) inline void binsAvx2(const double* values, std::size_t n, double lo, double scale, int32_t bins, int32_t* out) {
+    __m256d l = _mm256_set1_pd(lo), k = _mm256_set1_pd(scale);
+    __m256d zero = _mm256_setzero_pd(), top = _mm256_set1_pd(static_cast<double>(bins - 1));
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d index = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(values + i), l), k);
+        index = _mm256_min_pd(_mm256_max_pd(index, zero), top);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvttpd_epi32(index));
+    }
+    for (; i < n; ++i)
+        out[i] = binIndex(values[i], lo, scale, bins);
+}
+
+#endif
+
+} // namespace stats_detail
+
+// Все варианты, от лучшего к худшему; последний - скалярный, доступен всегда
+inline const std::vector<StatsKernels>& availableStatsKernels() {
+    static const std::vector<StatsKernels> kernels = [] {
+        using namespace stats_detail;
+        std::vector<StatsKernels> list;
+#ifdef STATS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            list.push_back(StatsKernels{"avx2", reduceAvx2, deviationsAvx2, binsAvx2});
+        if (__builtin_cpu_supports("sse2"))
+            list.push_back(StatsKernels{"sse2", reduceSse2, deviationsSse2, binsSse2});
+#endif
+        list.push_back(StatsKernels{"scalar", reduceScalar, deviationsScalar, binsScalar});
+        return list;
+    }();
+    return kernels;
+}
+
+// Лучший вариант для этого процессора
+inline const StatsKernels& statsKernels() {
+    return availableStatsKernels().front();
+}
+
+// Размер блока дисперсии: два прохода по блоку идут из кэша L1
+const std::size_t STATS_BLOCK = 2048;
+
+// Число, сумма, минимум, максимум, среднее и сумма квадратов отклонений n значений
+inline Bucket summarize(const double* values, std::size_t n, const StatsKernels& kernels = statsKernels()) {
+    Bucket total;
+    for (std::size_t i = 0; i < n; i += STATS_BLOCK) {
+        std::size_t len = std::min(STATS_BLOCK, n - i);
+        Bucket block;
+        kernels.reduce(values + i, len, block.sum, block.min, block.max);
+        block.count = static_cast<int64_t>(len);
+        block.mean = block.sum / static_cast<double>(len);
+        block.m2 = kernels.deviations(values + i, len, block.mean);
+        total.merge(block);
+    }
+    return total;
+}
+
+// Статистика по интервалам [start + k * width, start + (k + 1) * width); метки ts - по возрастанию.
+// Пустые интервалы пропускаются
+inline std::vector<Bucket> summarizeBuckets(const int64_t* ts, const double* values, std::size_t n, int64_t start, int64_t width,
+                                            const StatsKernels& kernels = statsKernels()) {
+    std::vector<Bucket> buckets;
+    std::size_t i = 0;
+    while (i < n) {
+        int64_t k = (ts[i] - start) / width - (ts[i] < start && (ts[i] - start) % width != 0 ? 1 : 0);
+        int64_t bucket_start = start + k * width;
+        std::size_t end = static_cast<std::size_t>(std::lower_bound(ts + i, ts + n, bucket_start + width) - ts);
+        Bucket bucket = summarize(values + i, end - i, kernels);
+        bucket.start = bucket_start;
+        bucket.end = bucket_start + width;
+        buckets.push_back(bucket);
+        i = end;
+    }
+    return buckets;
+}
+
+// Гистограмма значений в bins корзинах равной ширины на [lo, hi]; значения вне диапазона - в крайние корзины
+inline std::vector<int64_t> histogram(const double* values, std::size_t n, double lo, double hi, int32_t bins,
+                                      const StatsKernels& kernels = statsKernels()) {
+    std::vector<int64_t> counts(static_cast<std::size_t>(bins), 0);
+    double scale = hi > lo ? bins / (hi - lo) : 0.0;
+    int32_t index[STATS_BLOCK];
+    for (std::size_t i = 0; i < n; i += STATS_BLOCK) {
+        std::size_t len = std::min(STATS_BLOCK, n - i);
+        kernels.bins(values + i, len, lo, scale, bins, index);
+        for (std::size_t j = 0; j < len; ++j)
+            counts[static_cast<std::size_t>(index[j])]++;
+    }
+    return counts;
+}
+
+// Процентиль p (0..1) с линейной интерполяцией между соседними по рангу значениями.
+// Порядок values меняется (частичная сортировка)
+inline double percentile(std::vector<double>& values, double p) {
+    if (values.empty())
+        return 0.0;
+    double rank = p * static_cast<double>(values.size() - 1);
+    std::size_t lo = static_cast<std::size_t>(rank);
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(lo), values.end());
+    double value = values[lo];
+    if (lo + 1 < values.size() && rank > static_cast<double>(lo)) {
+        double next = *std::min_element(values.begin() + static_cast<std::ptrdiff_t>(lo) + 1, values.end());
+        value += (next - value) * (rank - static_cast<double>(lo));
+    }
+    return value;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+
+// Файл базы, общий для temperature_monitor и server
+#define STORAGE_DB_PATH "temperature.db"
+
+// Версия схемы (PRAGMA user_version).
+// 0 - исходная схема с ключом "timestamp TEXT" в локальном времени;
+// 2 - целочисленные ключи в миллисекундах от эпохи (UTC), таблицы WITHOUT ROWID;
+// 3 - в таблицах агрегатов добавлены count, min, max и stddev;
+// 4 - индекс сырых значений по (sensor_id, ts) для выборок одного датчика;
+// 5 - индекс архива сырых значений archive_chunks (см. archive.hpp)
+#define STORAGE_SCHEMA_VERSION 5
+
+// Таблицы с измерениями: сырые значения и средние за час и за день
+static const char* const STORAGE_TABLES[] = {"temperatures", "avg_temp_hour", "avg_temp_day"};
+
+// Дополнительные столбцы таблиц агрегатов; value в них - среднее за интервал
+static const char* const AGGREGATE_COLUMNS[] = {"count INTEGER", "min REAL", "max REAL", "stddev REAL"};
+
+// Таблица агрегатов (не сырых значений)
+inline bool isAggregateTable(const std::string& table) {
+    return table != "temperatures";
+}
+
+// Одно измерение
+struct Reading {
+    int64_t ts;         // Время, мс от эпохи (UTC)
+    double value;       // Температура
+    int32_t sensor_id;  // Датчик; 0 - единственный датчик по умолчанию
+};
+
+// Текущее время в мс от эпохи
+inline int64_t nowMillis() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+// Таблица в схеме версии 2.
+// Ключ (ts, sensor_id): выборки по диапазону времени читают таблицу подряд,
+// без отдельного индекса, а измерения разных датчиков в одну миллисекунду не конфликтуют.
+// Столбцы агрегатов добавляет initializeSchema
+inline std::string tableSchema(const std::string& table) {
+    return "CREATE TABLE IF NOT EXISTS " + table + " ("
+           "ts INTEGER NOT NULL, "
+           "sensor_id INTEGER NOT NULL DEFAULT 0, "
+           "value REAL NOT NULL, "
+           "PRIMARY KEY (ts, sensor_id)"
+           ") WITHOUT ROWID;";
+}
+
+// Значение целочисленного запроса из одной ячейки
+inline int64_t queryInt(sqlite3* db, const std::string& sql) {
+    sqlite3_stmt* stmt;
+    int64_t result = 0;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        result = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+// PRAGMA auto_vacuum: 2 - INCREMENTAL
+const int64_t AUTO_VACUUM_INCREMENTAL = 2;
+
+inline bool incrementalVacuumEnabled(sqlite3* db) {
+    return queryInt(db, "PRAGMA auto_vacuum;") == AUTO_VACUUM_INCREMENTAL;
+}
+
+// Таблица в исходной схеме с текстовым ключом timestamp
+inline bool isLegacyTable(sqlite3* db, const std::string& table) {
+    return queryInt(db, "SELECT COUNT(*) FROM pragma_table_info('" + table + "') WHERE name = 'timestamp';") > 0;
+}
+
+// Создание таблиц текущей схемы.
+// Базу в исходной схеме нужно сначала перенести утилитой migrate_db
+inline bool initializeSchema(sqlite3* db) {
+    for (const char* table : STORAGE_TABLES) {
+        if (isLegacyTable(db, table)) {
+            LOG_ERROR("Table " << table << " uses the legacy TEXT timestamp schema, run migrate_db first");
+            return false;
+        }
+    }
+    std::string sql;
+    for (const char* table : STORAGE_TABLES)
+        sql += tableSchema(table);
+    // Выборка одного датчика из многих не должна читать строки всех датчиков за период
+    sql += "CREATE INDEX IF NOT EXISTS temperatures_sensor ON temperatures (sensor_id, ts);";
+    // Чанк архива - сутки значений датчика; count, диапазон времени и значений позволяют
+    // планировать выборку, не читая файлы
+    sql += "CREATE TABLE IF NOT EXISTS archive_chunks ("
+           "day INTEGER NOT NULL, "
+           "sensor_id INTEGER NOT NULL, "
+           "count INTEGER NOT NULL, "
+           "min_ts INTEGER NOT NULL, "
+           "max_ts INTEGER NOT NULL, "
+           "min REAL NOT NULL, "
+           "max REAL NOT NULL, "
+           "bytes INTEGER NOT NULL, "
+           "PRIMARY KEY (day, sensor_id)"
+           ") WITHOUT ROWID;";
+
+    char* errMsg = 0;
+    if (sqlite3_exec(db, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error: " << errMsg);
+        sqlite3_free(errMsg);
+        return false;
+    }
+
+    // Недостающие столбцы агрегатов (переход со схемы версии 2)
+    sql.clear();
+    for (const char* table : STORAGE_TABLES) {
+        if (!isAggregateTable(table))
+            continue;
+        for (const char* column : AGGREGATE_COLUMNS) {
+            std::string name(column, strchr(column, ' '));
+            if (queryInt(db, "SELECT COUNT(*) FROM pragma_table_info('" + std::string(table) + "') WHERE name = '" + name + "';") == 0)
+                sql += "ALTER TABLE " + std::string(table) + " ADD COLUMN " + column + ";";
+        }
+    }
+    sql += "PRAGMA user_version = " + std::to_string(STORAGE_SCHEMA_VERSION) + ";";
+
+    if (sqlite3_exec(db, sql.c_str(), 0, 0, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error: " << errMsg);
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+// Настройки соединения:
+//  WAL - читатели не блокируют писателя и друг друга;
+//  synchronous=NORMAL - в режиме WAL фиксация без fsync на каждую транзакцию, fsync при checkpoint;
+//  mmap_size - чтение страниц через отображение файла без копирования;
+//  cache_size - кэш страниц 16 МБ (отрицательное значение - в КБ);
+//  busy_timeout - ожидание блокировки вместо мгновенной ошибки SQLITE_BUSY
+inline void applyPragmas(sqlite3* db, bool readonly) {
+    const char* common = R"(
+        PRAGMA synchronous = NORMAL;
+        PRAGMA mmap_size = 268435456;
+        PRAGMA cache_size = -16000;
+        PRAGMA temp_store = MEMORY;
+    )";
+    sqlite3_busy_timeout(db, 5000);
+    char* errMsg = 0;
+    // Режим журнала хранится в самом файле, поэтому его включает только пишущее соединение.
+    // Страницы, освобождённые удалением, возвращаются файлу порциями (PRAGMA incremental_vacuum,
+    // см. retention.hpp). Режим auto_vacuum меняется только у пустой базы и до включения WAL;
+    // у существующей он не меняется, её переводит migrate_db --auto-vacuum
+    if (!readonly && sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL; PRAGMA journal_mode = WAL;", 0, 0, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error: " << errMsg);
+        sqlite3_free(errMsg);
+    }
+    if (sqlite3_exec(db, common, 0, 0, &errMsg) != SQLITE_OK) {
+        LOG_ERROR("SQL error: " << errMsg);
+        sqlite3_free(errMsg);
+    }
+}
+
+// Открытие базы. Пишущее соединение создаёт файл при необходимости.
+// Соединение используется одним потоком за раз, поэтому внутренний мьютекс SQLite не нужен
+inline sqlite3* openDatabase(const char* path, bool readonly) {
+    sqlite3* db = nullptr;
+    int flags = (readonly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) | SQLITE_OPEN_NOMUTEX;
+    if (sqlite3_open_v2(path, &db, flags, nullptr) != SQLITE_OK) {
+        LOG_ERROR("Can't open database: " << sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return nullptr;
+    }
+    applyPragmas(db, readonly);
+    return db;
+}
+
+// Пул соединений только для чтения.
+// Держит до capacity свободных соединений (по одному на рабочий поток).
+// Если свободных нет, открывается новое: потоковый ответ может удерживать соединение,
+// пока клиент медленно читает, и ожидание в пуле заблокировало бы рабочие потоки
+class ReadPool {
+public:
+    // Соединение, взятое из пула; при уничтожении возвращается обратно
+    class Connection {
+    public:
+        Connection() = default;
+        Connection(ReadPool* pool, sqlite3* db) : pool_(pool), db_(db) {}
+        Connection(Connection&& other) noexcept : pool_(other.pool_), db_(other.db_) { other.db_ = nullptr; }
+        Connection& operator=(Connection&& other) noexcept {
+            if (this != &other) {
+                reset();
+                pool_ = other.pool_;
+                db_ = other.db_;
+                other.db_ = nullptr;
+            }
+            return *this;
+        }
+        ~Connection() { reset(); }
+
+        sqlite3* get() const { return db_; }
+        explicit operator bool() const { return db_ != nullptr; }
+
+        void reset() {
+            if (db_)
+                pool_->release(db_);
+            db_ = nullptr;
+        }
+
+    private:
+        ReadPool* pool_ = nullptr;
+        sqlite3* db_ = nullptr;
+    };
+
+    ReadPool(std::string path, std::size_t capacity) : path_(std::move(path)), capacity_(capacity) {
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            sqlite3* db = openDatabase(path_.c_str(), true);
+            if (!db)
+                break;
+            idle_.push_back(db);
+        }
+    }
+    ~ReadPool() {
+        for (sqlite3* db : idle_)
+            sqlite3_close(db);
+    }
+
+    // Взять соединение; пустое, если базу открыть не удалось
+    Connection acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                sqlite3* db = idle_.back();
+                idle_.pop_back();
+                return Connection(this, db);
+            }
+        }
+        sqlite3* db = openDatabase(path_.c_str(), true);
+        return db ? Connection(this, db) : Connection();
+    }
+
+private:
+    void release(sqlite3* db) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (idle_.size() < capacity_) {
+                idle_.push_back(db);
+                return;
+            }
+        }
+        sqlite3_close(db);
+    }
+
+    std::string path_;
+    std::size_t capacity_;
+    std::mutex mutex_;
+    std::vector<sqlite3*> idle_;
+
+    ReadPool(const ReadPool&) = delete;
+    ReadPool& operator=(const ReadPool&) = delete;
+};
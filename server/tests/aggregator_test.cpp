@@ -0,0 +1,105 @@
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "aggregator.hpp"
+
+// Границы часа и суток по локальному времени (periodStart/periodEnd, aggregator.hpp) в часовых поясах
+// с переходом на летнее время: сутки перехода длятся 23 или 25 часов и начинаются в полночь,
+// в том числе для интервалов, открытых после перехода. Метки - мс от эпохи UTC
+const int64_t HOUR = 3600 * 1000LL;
+
+void setTimeZone(const char* zone) {
+#ifdef _WIN32
+    _putenv_s("TZ", zone);
+    _tzset();
+#else
+    setenv("TZ", zone, 1);
+    tzset();
+#endif
+}
+
+// Момент внутри суток и ожидаемые начало и конец этих суток
+struct DayCase {
+    const char* zone;
+    const char* name;
+    int64_t ts;
+    int64_t start;
+    int64_t end;
+};
+
+const DayCase DAY_CASES[] = {
+    // 2024-03-31: 02:00 CET -> 03:00 CEST, сутки 23 ч с 2024-03-30T23:00Z
+    {"Europe/Berlin", "spring forward, before", 1711843200000 - HOUR, 1711839600000, 1711922400000},
+    {"Europe/Berlin", "spring forward, after", 1711886400000, 1711839600000, 1711922400000},
+    {"Europe/Berlin", "spring forward, last second", 1711922400000 - 1000, 1711839600000, 1711922400000},
+    // 2024-10-27: 03:00 CEST -> 02:00 CET, сутки 25 ч с 2024-10-26T22:00Z
+    {"Europe/Berlin", "fall back, before", 1729987200000 - 2 * HOUR, 1729980000000, 1730070000000},
+    {"Europe/Berlin", "fall back, after", 1730026800000, 1729980000000, 1730070000000},
+    {"Europe/Berlin", "fall back, repeated hour", 1729990800000 + 1000, 1729980000000, 1730070000000},
+    {"Europe/Berlin", "ordinary day", 1718445600000, 1718402400000, 1718488800000},
+    // 2024-09-08: 00:00 -04 -> 01:00 -03, полуночи нет: сутки с 01:00 (2024-09-08T04:00Z), 23 ч
+    {"America/Santiago", "no midnight", 1725800400000, 1725768000000, 1725850800000},
+    {"UTC", "utc", 1718445600123, 1718409600000, 1718496000000},
+};
+
+void testDayBounds() {
+    for (const DayCase& c : DAY_CASES) {
+        setTimeZone(c.zone);
+        int64_t start = periodStart(PERIOD_DAY, c.ts);
+        int64_t end = periodEnd(PERIOD_DAY, start);
+        if (start != c.start || end != c.end)
+            std::cerr << c.zone << ", " << c.name << ": start " << start << " end " << end << std::endl;
+        CHECK(start == c.start && end == c.end);
+        CHECK_EQ(periodStart(PERIOD_HOUR, c.ts), c.ts - c.ts % HOUR);
+    }
+}
+
+// Измерения раз в 10 минут через двое суток перехода: каждый закрытый суточный интервал начинается
+// в полночь и кончается в следующую, часовые - ровно по часу
+void testRollingAcrossTransition() {
+    setTimeZone("Europe/Berlin");
+    std::vector<Bucket> days;
+    int hours = 0;
+    RollingAggregator aggregator([&](AggregatePeriod period, int32_t, const Bucket& bucket) {
+        if (period == PERIOD_DAY)
+            days.push_back(bucket);
+        else if (bucket.end - bucket.start == HOUR && bucket.start % HOUR == 0)
+            hours++;
+    });
+    const int64_t from = 1729980000000;         // 2024-10-27 00:00 CEST
+    const int64_t to = from + 25 * HOUR + 24 * HOUR + 10 * 60000;
+    for (int64_t ts = from + 5 * 60000; ts < to; ts += 10 * 60000)
+        aggregator.add(Reading{ts, 20.0, 1});
+    CHECK_EQ(days.size(), std::size_t(2));
+    if (days.size() == 2) {
+        CHECK_EQ(days[0].start, from);
+        CHECK_EQ(days[0].end, from + 25 * HOUR);
+        CHECK_EQ(days[0].count, int64_t(25 * 6));
+        CHECK_EQ(days[1].start, from + 25 * HOUR);
+        CHECK_EQ(days[1].end, from + 49 * HOUR);
+    }
+    CHECK_EQ(hours, 49);
+
+    // Интервал, открытый после перехода (перезапуск посреди суток)
+    days.clear();
+    RollingAggregator restored([&](AggregatePeriod period, int32_t, const Bucket& bucket) {
+        if (period == PERIOD_DAY)
+            days.push_back(bucket);
+    });
+    Bucket saved;
+    saved.add(19.0);
+    restored.restore(PERIOD_DAY, 1, from + 12 * HOUR, saved);
+    const Bucket* day = restored.current(PERIOD_DAY, 1);
+    CHECK(day && day->start == from && day->end == from + 25 * HOUR);
+}
+
+int main() {
+    testDayBounds();
+    testRollingAcrossTransition();
+    return checkResult();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <iostream>
+
+// Проверки тестов (ctest): CHECK печатает непрошедшее условие с местом и продолжает,
+// код возврата теста - checkResult()
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                          \
+    do {                                                                                     \
+        if (!(cond)) {                                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            checkFailures()++;                                                               \
+        }                                                                                    \
+    } while (false)
+
+// Равенство с выводом обоих значений
+#define CHECK_EQ(a, b)                                                                       \
+    do {                                                                                     \
+        auto check_a_ = (a);                                                                 \
+        auto check_b_ = (b);                                                                 \
+        if (!(check_a_ == check_b_)) {                                                       \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " \
+                      << check_a_ << " != " << check_b_ << std::endl;                        \
+            checkFailures()++;                                                               \
+        }                                                                                    \
+    } while (false)
+
+inline int checkResult() {
+    if (checkFailures() > 0)
+        std::cerr << checkFailures() << " checks failed" << std::endl;
+    return checkFailures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "sensor_protocol.hpp"
+
+// Восстановление FrameDecoder (sensor_protocol.hpp) после искажений потока: перевёрнутые биты,
+// оборванный кадр и неверная длина, ложное синхрослово, чтения по частям. Для каждого потока
+// известно, сколько в нём целых кадров, ошибок (errors) и байт вне кадров (skippedBytes),
+// и декодер должен получить ровно это при любом делении потока на чтения.
+// Кадры без байта 0xAA после синхрослова ("чистые"), чтобы испорченный кадр давал ровно одну ошибку
+const int64_t FIRST_TS = 1700000000000;
+const uint32_t INTERVAL_US = 100000;
+const std::size_t TRAILING_FRAMES = 8;      // Целых кадров после искажения: 8 * 86 байт длиннее любого кадра
+
+// Результат разбора потока
+struct Decoded {
+    std::vector<int64_t> ts;                // Время устройства принятых кадров по порядку
+    std::vector<double> values;
+    uint64_t frames = 0;
+    uint64_t errors = 0;
+    uint64_t skipped = 0;
+};
+
+// Поток и что из него должно получиться
+struct Stream {
+    std::string bytes;
+    Decoded expected;
+
+    void good(const std::string& frame, const std::vector<double>& values) {
+        bytes += frame;
+        expected.ts.push_back(static_cast<int64_t>(loadLE64(reinterpret_cast<const unsigned char*>(frame.data()) + 10)));
+        expected.values.insert(expected.values.end(), values.begin(), values.end());
+        expected.frames++;
+    }
+
+    void bad(const std::string& data, uint64_t errors) {
+        bytes += data;
+        expected.errors += errors;
+        expected.skipped += data.size();
+    }
+};
+
+// Чистые кадры с возрастающим временем и случайными измерениями
+class Frames {
+public:
+    explicit Frames(uint64_t seed) : rng_(seed) {}
+
+    // count - такое, что в байтах длины нет 0xAA
+    std::string clean(std::size_t count, std::vector<double>& values) {
+        for (;;) {
+            values.clear();
+            for (std::size_t i = 0; i < count; ++i)
+                values.push_back(static_cast<double>(static_cast<int>(rng_() % 12500) - 4000) / FRAME_VALUE_SCALE);
+            std::string frame;
+            encodeFrame(frame, static_cast<uint16_t>(rng_() % 4), INTERVAL_US, ts_, values);
+            ts_ += static_cast<int64_t>(count * INTERVAL_US / 1000);
+            if (frame.find(static_cast<char>(FRAME_SYNC_0), 1) == std::string::npos)
+                return frame;
+        }
+    }
+
+    std::string clean(std::size_t count = 32) {
+        std::vector<double> values;
+        return clean(count, values);
+    }
+
+    void good(Stream& stream, std::size_t count = 32) {
+        std::vector<double> values;
+        std::string frame = clean(count, values);
+        stream.good(frame, values);
+    }
+
+    std::mt19937_64& rng() { return rng_; }
+
+private:
+    std::mt19937_64 rng_;
+    int64_t ts_ = FIRST_TS;
+};
+
+// Разбор потока чтениями по next() байт (не больше свободного места) в декодер ёмкости capacity
+template <class NextChunk>
+Decoded decode(const std::string& stream, std::size_t capacity, NextChunk&& next) {
+    FrameDecoder decoder(capacity);
+    Decoded decoded;
+    auto handler = [&](const SensorFrame& frame) {
+        decoded.ts.push_back(frame.device_ts);
+        for (std::size_t i = 0; i < frame.count; ++i)
+            decoded.values.push_back(frame.value(i));
+    };
+    for (std::size_t pos = 0; pos < stream.size();) {
+        auto space = decoder.prepare();
+        std::size_t n = std::min({next(), space.second, stream.size() - pos});
+        std::memcpy(space.first, stream.data() + pos, n);
+        decoder.commit(n, handler);
+        pos += n;
+    }
+    decoded.frames = decoder.frames();
+    decoded.errors = decoder.errors();
+    decoded.skipped = decoder.skippedBytes();
+    return decoded;
+}
+
+Decoded decode(const std::string& stream) {
+    return decode(stream, 64 * 1024, [] { return SIZE_MAX; });
+}
+
+// Совпадение с ожидаемым; false - чтобы перебор не печатал одну и ту же ошибку много раз
+bool expect(const Decoded& decoded, const Decoded& expected, const char* what) {
+    bool same = decoded.frames == expected.frames && decoded.errors == expected.errors &&
+                decoded.skipped == expected.skipped && decoded.ts == expected.ts && decoded.values == expected.values;
+    if (!same)
+        std::cerr << what << ": frames " << decoded.frames << " errors " << decoded.errors << " skipped " << decoded.skipped
+                  << ", expected " << expected.frames << " " << expected.errors << " " << expected.skipped << std::endl;
+    CHECK(same);
+    return same;
+}
+
+// Целые кадры подряд, в том числе из одного и из наибольшего числа измерений
+void testClean(Frames& frames) {
+    Stream stream;
+    for (std::size_t count : {std::size_t(1), std::size_t(2), std::size_t(32), FRAME_MAX_SAMPLES, std::size_t(7)})
+        frames.good(stream, count);
+    for (int i = 0; i < 100; ++i)
+        frames.good(stream);
+    CHECK_EQ(stream.expected.errors, uint64_t(0));
+    expect(decode(stream.bytes), stream.expected, "clean");
+}
+
+// Каждый бит испорченного кадра по очереди: теряется только он. Бит в синхрослове - кадр
+// не найден (байты пропущены без ошибки), иначе - одна ошибка длины или CRC
+void testFlippedBits(Frames& frames) {
+    std::string victim = frames.clean();
+    std::vector<double> before_values, after_values;
+    std::string before = frames.clean(32, before_values);
+    std::vector<std::string> after;
+    std::vector<std::vector<double>> after_values_list;
+    for (std::size_t i = 0; i < TRAILING_FRAMES; ++i) {
+        after.push_back(frames.clean(32, after_values));
+        after_values_list.push_back(after_values);
+    }
+    int checked = 0;
+    for (std::size_t byte = 0; byte < victim.size(); ++byte) {
+        for (int bit = 0; bit < 8; ++bit) {
+            std::string corrupted = victim;
+            corrupted[byte] = static_cast<char>(corrupted[byte] ^ (1 << bit));
+            // Новый байт 0xAA - возможное ложное синхрослово, его проверяет testFalseSync
+            if (static_cast<unsigned char>(corrupted[byte]) == FRAME_SYNC_0)
+                continue;
+            Stream stream;
+            stream.good(before, before_values);
+            stream.bad(corrupted, byte < 2 ? 0 : 1);
+            for (std::size_t i = 0; i < after.size(); ++i)
+                stream.good(after[i], after_values_list[i]);
+            checked++;
+            if (!expect(decode(stream.bytes), stream.expected, ("bit " + std::to_string(byte * 8 + bit)).c_str()))
+                return;
+        }
+    }
+    CHECK(checked > static_cast<int>(victim.size()) * 7);
+}
+
+// Оборванный кадр (передатчик прервался, следующий кадр пришёл целым) и неверная длина в заголовке
+void testTruncated(Frames& frames) {
+    std::string victim = frames.clean();
+    for (std::size_t cut = 1; cut < victim.size(); ++cut) {
+        Stream stream;
+        frames.good(stream);
+        // Из одного байта 0xAA синхрослова не начать: пропуск без ошибки. Иначе кадр ждёт
+        // байт до своей длины, CRC не сходится на байтах следующего кадра
+        stream.bad(victim.substr(0, cut), cut == 1 ? 0 : 1);
+        for (std::size_t i = 0; i < TRAILING_FRAMES; ++i)
+            frames.good(stream);
+        if (!expect(decode(stream.bytes), stream.expected, ("cut " + std::to_string(cut)).c_str()))
+            return;
+    }
+    // Длина короче тела без измерений, нечётная, больше наибольшего кадра, короче настоящей
+    for (uint16_t length : {uint16_t(0), uint16_t(FRAME_FIXED_BODY), uint16_t(FRAME_FIXED_BODY + 3),
+                            uint16_t(FRAME_MAX_SIZE), uint16_t(0xFFFF), uint16_t(FRAME_FIXED_BODY + 2 * 10)}) {
+        std::string corrupted = victim;
+        corrupted[2] = static_cast<char>(length & 0xFF);
+        corrupted[3] = static_cast<char>(length >> 8);
+        if (corrupted.find(static_cast<char>(FRAME_SYNC_0), 1) != std::string::npos)
+            continue;
+        Stream stream;
+        frames.good(stream);
+        stream.bad(corrupted, 1);
+        for (std::size_t i = 0; i < TRAILING_FRAMES; ++i)
+            frames.good(stream);
+        expect(decode(stream.bytes), stream.expected, ("length " + std::to_string(length)).c_str());
+    }
+}
+
+// Синхрослово 0xAA 0x55 в мусоре между кадрами и в измерениях кадра
+void testFalseSync(Frames& frames) {
+    const unsigned char sync[] = {FRAME_SYNC_0, FRAME_SYNC_1};
+    std::string sync_word(reinterpret_cast<const char*>(sync), sizeof(sync));
+    {
+        // Допустимая длина 16: ложный кадр ждёт 24 байта, CRC не сходится
+        Stream stream;
+        frames.good(stream);
+        stream.bad(std::string("\x01", 1) + sync_word + std::string("\x10\x00\x07\x08", 4), 1);
+        for (std::size_t i = 0; i < TRAILING_FRAMES; ++i)
+            frames.good(stream);
+        expect(decode(stream.bytes), stream.expected, "false sync, valid length");
+    }
+    {
+        // Синхрослово за синхрословом: длины 0x55AA неверны, две ошибки
+        Stream stream;
+        frames.good(stream);
+        stream.bad(sync_word + sync_word, 2);
+        for (std::size_t i = 0; i < TRAILING_FRAMES; ++i)
+            frames.good(stream);
+        expect(decode(stream.bytes), stream.expected, "false sync twice");
+    }
+    // Измерение 219.30 (0x55AA) - синхрослово в теле кадра, за ним длина 2 (измерение 0.02).
+    // Целый кадр разбирается от своего синхрослова; испорченный даёт ещё одну ошибку на ложном
+    std::vector<double> values;
+    std::string inner;
+    for (;;) {
+        std::string frame = frames.clean(32, values);
+        values[5] = 219.30;
+        values[6] = 0.02;
+        std::string rebuilt;
+        encodeFrame(rebuilt, loadLE16(reinterpret_cast<const unsigned char*>(frame.data()) + 4), INTERVAL_US,
+                    static_cast<int64_t>(loadLE64(reinterpret_cast<const unsigned char*>(frame.data()) + 10)), values);
+        if (std::count(rebuilt.begin() + 1, rebuilt.end(), static_cast<char>(FRAME_SYNC_0)) == 1) {
+            inner = rebuilt;
+            break;
+        }
+    }
+    CHECK_EQ(inner.find(sync_word, 1), FRAME_PREFIX_SIZE + FRAME_FIXED_BODY + 2 * 5);
+    {
+        Stream stream;
+        frames.good(stream);
+        stream.good(inner, values);
+        frames.good(stream);
+        expect(decode(stream.bytes), stream.expected, "sync word in samples");
+    }
+    {
+        std::string corrupted = inner;
+        corrupted.back() = static_cast<char>(corrupted.back() ^ 0x01);
+        if (static_cast<unsigned char>(corrupted.back()) != FRAME_SYNC_0) {
+            Stream stream;
+            frames.good(stream);
+            stream.bad(corrupted, 2);
+            for (std::size_t i = 0; i < TRAILING_FRAMES; ++i)
+                frames.good(stream);
+            expect(decode(stream.bytes), stream.expected, "sync word in a corrupted frame");
+        }
+    }
+}
+
+// Поток со всеми видами искажений вперемешку, прочитанный целиком, по 1, 2, 3... байта и случайными
+// частями, в том числе в буфер наименьшей ёмкости (остаток кадра переносится в начало)
+void testSplitReads(Frames& frames) {
+    Stream stream;
+    std::mt19937_64& rng = frames.rng();
+    for (int i = 0; i < 400; ++i) {
+        std::size_t count = rng() % 8 == 0 ? rng() % FRAME_MAX_SAMPLES + 1 : 32;
+        // При 78 и 206 измерениях младший байт длины 0xAA: такой кадр не бывает чистым
+        if ((FRAME_FIXED_BODY + 2 * count) % 256 == FRAME_SYNC_0)
+            count++;
+        frames.good(stream, count);
+        if (i >= 400 - static_cast<int>(TRAILING_FRAMES))
+            continue;
+        switch (rng() % 8) {
+        case 0: {
+            // Перевёрнутый бит после синхрослова
+            std::string corrupted = frames.clean();
+            std::size_t byte = 2 + rng() % (corrupted.size() - 2);
+            corrupted[byte] = static_cast<char>(corrupted[byte] ^ (1 << (rng() % 8)));
+            if (static_cast<unsigned char>(corrupted[byte]) != FRAME_SYNC_0)
+                stream.bad(corrupted, 1);
+            break;
+        }
+        case 1: {
+            std::string truncated = frames.clean().substr(0, 4 + rng() % 80);
+            stream.bad(truncated, 1);
+            break;
+        }
+        case 2:
+            stream.bad(std::string("\x13\xAA\x55\x10\x00\x01", 6), 1);
+            break;
+        case 3:
+            stream.bad(std::string("\x01\x02\x03", 3), 0);
+            break;
+        default:
+            break;
+        }
+    }
+    CHECK(stream.expected.errors > 50);
+    const std::size_t min_capacity = 2 * FRAME_MAX_SIZE;
+    expect(decode(stream.bytes), stream.expected, "whole");
+    for (std::size_t chunk : {1, 2, 3, 5, 17, 85, 86, 87, 533, 534, 535, 4096}) {
+        for (std::size_t capacity : {min_capacity, std::size_t(64 * 1024)}) {
+            std::string what = "chunk " + std::to_string(chunk) + " capacity " + std::to_string(capacity);
+            expect(decode(stream.bytes, capacity, [&] { return chunk; }), stream.expected, what.c_str());
+        }
+    }
+    for (int i = 0; i < 20; ++i) {
+        std::size_t max_chunk = std::size_t(1) << (rng() % 12);
+        expect(decode(stream.bytes, min_capacity, [&] { return rng() % max_chunk + 1; }), stream.expected, "random chunks");
+    }
+}
+
+int main(int argc, char** argv) {
+    Frames frames(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1);
+    testClean(frames);
+    testFlippedBits(frames);
+    testTruncated(frames);
+    testFalseSync(frames);
+    testSplitReads(frames);
+    return checkResult();
+}
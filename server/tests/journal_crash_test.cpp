@@ -0,0 +1,290 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Точки сбоя внутри журнала: процесс-писатель убивает себя на N-м проходе точки
+void crashPoint(const char* name);
+#define JOURNAL_CRASH_POINT(name) crashPoint(name)
+
+#include "check.hpp"
+#include "crc32.hpp"
+#include "db_writer.hpp"
+#include "journal.hpp"
+#include "storage.hpp"
+
+// Сбои процесса с журналом (journal.hpp) и базой, как у temperature_monitor.
+// Писатель - отдельный процесс (этот же файл с аргументом writer): дописывает в журнал измерения
+// с возрастающими номерами (ts), синхронизирует их с базой и освобождает, принимая новые
+// между записью в базу и освобождением. Его убивают SIGKILL:
+//  - random  - в случайный момент;
+//  - synced  - между фиксацией транзакции SQLite и release;
+//  - release - в release до переключения заголовка;
+//  - compact - в переносе хвоста после копирования записей, до switchTo.
+// После части сбоев в файле журнала портится одна неосвобождённая запись: последняя (обрыв
+// посреди сброса) или случайная (повреждённая запись в середине).
+// Затем журнал повторяется в базу так же, как при запуске сборщика, и проверяется, что в базе
+// каждое дописанное измерение ровно один раз; не хватать может только испорченных записей
+const std::size_t CAPACITY = 512;               // Записей в журнале: перенос хвоста и смена поколения часто
+const std::size_t COMMIT_RECORDS = 16;
+const int WRITER_STEPS = 4000;                  // Писатель без сбоя завершается сам
+const int ROUNDS_RANDOM = 150;
+const int ROUNDS_PER_POINT = 40;
+
+const char* crash_point_name = "";
+int crash_countdown = 0;
+
+void crashPoint(const char* name) {
+    if (std::strcmp(name, crash_point_name) == 0 && --crash_countdown == 0)
+        raise(SIGKILL);
+}
+
+struct Paths {
+    std::string db;
+    std::string journal;
+    std::string progress;
+};
+
+Paths paths(const std::string& dir) {
+    return Paths{dir + "/test.db", dir + "/test.journal", dir + "/progress"};
+}
+
+// Счётчик дописанных в журнал измерений, общий с писателем (файл в памяти переживает SIGKILL)
+std::atomic<uint64_t>* mapProgress(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(uint64_t)) != 0)
+        return nullptr;
+    void* map = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? nullptr : static_cast<std::atomic<uint64_t>*>(map);
+}
+
+Journal openJournal(const Paths& p) {
+    return Journal(p.journal, CAPACITY, COMMIT_RECORDS, std::chrono::milliseconds(1));
+}
+
+// Повтор журнала при запуске (как replayJournal в main.cpp); replayed - повторённые измерения,
+// damaged - пропущенные повреждённые записи
+bool recover(Journal& journal, DbWriter& writer, std::vector<Reading>& replayed, std::size_t& damaged) {
+    std::size_t rows = journal.replay(replayed);
+    damaged = journal.damaged();
+    if (rows == 0)
+        return true;
+    if (!writer.insertBatch("temperatures", replayed, true))
+        return false;
+    journal.release(rows);
+    return true;
+}
+
+// Измерения базы по возрастанию ts
+std::vector<int64_t> stored(sqlite3* db) {
+    std::vector<int64_t> ts;
+    sqlite3_stmt* stmt = nullptr;
+    sqlite3_prepare_v2(db, "SELECT ts FROM temperatures ORDER BY ts;", -1, &stmt, nullptr);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        ts.push_back(sqlite3_column_int64(stmt, 0));
+    sqlite3_finalize(stmt);
+    return ts;
+}
+
+// Процесс-писатель
+int runWriter(const std::string& dir, const char* point, int countdown, uint64_t seed) {
+    crash_point_name = point;
+    crash_countdown = countdown;
+    Paths p = paths(dir);
+    std::atomic<uint64_t>* appended = mapProgress(p.progress);
+    sqlite3* db = openDatabase(p.db.c_str(), false);
+    if (!appended || !db || !initializeSchema(db))
+        return 2;
+    DbWriter writer(db);
+    Journal journal = openJournal(p);
+    std::vector<Reading> replayed;
+    std::size_t damaged = 0;
+    if (!journal.open() || !recover(journal, writer, replayed, damaged))
+        return 2;
+
+    std::vector<int64_t> ts = stored(db);
+    int64_t next = ts.empty() ? 0 : ts.back() + 1;
+    std::mt19937_64 rng(seed);
+    std::deque<Reading> pending;
+    auto append = [&] {
+        Reading reading{next, 20.0 + static_cast<double>(next % 100) / 10, 0};
+        if (!journal.append(reading))
+            return false;
+        pending.push_back(reading);
+        appended->store(static_cast<uint64_t>(++next), std::memory_order_release);
+        return true;
+    };
+    for (int step = 0; step < WRITER_STEPS; ++step) {
+        for (std::size_t n = rng() % 48 + 1; n > 0 && journal.size() < CAPACITY - 64; --n)
+            if (!append())
+                return 3;
+        journal.maybeCommit();
+        if (rng() % 3 != 0 && journal.size() < CAPACITY - 64)
+            continue;
+        // Синхронизация: запись в базу, затем освобождение; измерения, принятые между ними, остаются
+        std::deque<Reading> rows;
+        rows.swap(pending);
+        std::size_t journaled = journal.size();
+        if (!writer.insertBatch("temperatures", rows))
+            return 4;
+        crashPoint("synced");
+        for (std::size_t n = rng() % 8; n > 0; --n)
+            append();
+        journal.maybeCommit();
+        journal.release(journaled);
+    }
+    return 0;
+}
+
+// Запись журнала текущего поколения с меткой ts среди неосвобождённых; -1 - нет такой
+long findRecord(const std::vector<char>& file, int64_t ts) {
+    uint64_t state;
+    std::memcpy(&state, file.data() + 8, sizeof(state));
+    uint64_t generation = state >> 32;
+    std::size_t start = static_cast<std::size_t>(state & 0xFFFFFFFF);
+    for (std::size_t i = start; i < CAPACITY; ++i) {
+        const char* record = file.data() + 4096 + i * 24;
+        int64_t record_ts;
+        uint32_t checksum;
+        std::memcpy(&record_ts, record, sizeof(record_ts));
+        std::memcpy(&checksum, record + 20, sizeof(checksum));
+        uint32_t crc = crc32(&generation, sizeof(generation));
+        if (record_ts == ts && crc32(record, 20, crc) == checksum)
+            return static_cast<long>(i);
+    }
+    return -1;
+}
+
+// Порча записи с меткой ts, если она ещё в журнале: половина байт значения (недописанный сброс)
+bool tearRecord(const std::string& path, int64_t ts) {
+    FILE* file = std::fopen(path.c_str(), "r+b");
+    if (!file)
+        return false;
+    std::vector<char> data(4096 + CAPACITY * 24);
+    bool torn = false;
+    if (std::fread(data.data(), 1, data.size(), file) == data.size()) {
+        long index = findRecord(data, ts);
+        if (index >= 0) {
+            const char garbage[4] = {0x5a, 0x5a, 0x5a, 0x5a};
+            std::fseek(file, 4096 + index * 24 + 8, SEEK_SET);
+            torn = std::fwrite(garbage, 1, sizeof(garbage), file) == sizeof(garbage);
+        }
+    }
+    std::fclose(file);
+    return torn;
+}
+
+// Один сбой писателя, повтор журнала и проверка базы. Возвращает true, если писатель убит
+bool round(const std::string& self, const std::string& dir, const char* point, std::mt19937_64& rng,
+           std::set<int64_t>& torn) {
+    Paths p = paths(dir);
+    std::atomic<uint64_t>* appended = mapProgress(p.progress);
+    int countdown = static_cast<int>(rng() % 12 + 1);
+    std::string countdown_arg = std::to_string(countdown);
+    std::string seed_arg = std::to_string(rng());
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(self.c_str(), self.c_str(), "writer", dir.c_str(), point, countdown_arg.c_str(), seed_arg.c_str(), nullptr);
+        _exit(127);
+    }
+    if (std::strcmp(point, "random") == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(2000 + rng() % 30000));
+        kill(pid, SIGKILL);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bool killed = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+    CHECK(killed || (WIFEXITED(status) && WEXITSTATUS(status) == 0));
+
+    int64_t last = static_cast<int64_t>(appended->load()) - 1;
+    bool tear = false;
+    if (killed && last >= 0 && rng() % 3 == 0) {
+        // Последняя дописанная или случайная из последних
+        int64_t ts = rng() % 2 ? last : last - static_cast<int64_t>(rng() % 64);
+        tear = ts >= 0 && tearRecord(p.journal, ts);
+        if (tear)
+            torn.insert(ts);
+    }
+
+    sqlite3* db = openDatabase(p.db.c_str(), false);
+    CHECK(db && initializeSchema(db));
+    {
+        DbWriter writer(db);
+        Journal journal = openJournal(p);
+        std::vector<Reading> replayed;
+        std::size_t damaged = 0;
+        CHECK(journal.open());
+        CHECK(recover(journal, writer, replayed, damaged));
+        // Повреждённой может быть только испорченная тестом запись, не след прерванного переноса
+        CHECK(damaged <= (tear ? 1u : 0u));
+        std::set<int64_t> unique;
+        for (const Reading& reading : replayed)
+            CHECK(unique.insert(reading.ts).second);
+        CHECK_EQ(journal.size(), std::size_t(0));
+    }
+
+    // Каждое дописанное измерение (и, возможно, одно дописанное перед самым сбоем) ровно один раз
+    std::vector<int64_t> ts = stored(db);
+    sqlite3_close(db);
+    int64_t expected = 0;
+    for (int64_t value : ts) {
+        while (expected < value && torn.count(expected))
+            expected++;
+        CHECK_EQ(value, expected);
+        if (value != expected)
+            break;
+        expected++;
+    }
+    while (expected <= last && torn.count(expected))
+        expected++;
+    CHECK(expected > last && expected <= last + 2);
+    munmap(appended, sizeof(uint64_t));
+    return killed;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 6 && std::string(argv[1]) == "writer")
+        return runWriter(argv[2], argv[3], std::atoi(argv[4]), std::strtoull(argv[5], nullptr, 10));
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/journal_crash_XXXXXX";
+    if (!mkdtemp(&dir[0])) {
+        std::cerr << "Failed to create a temporary directory" << std::endl;
+        return 1;
+    }
+    std::mt19937_64 rng(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1);
+    std::set<int64_t> torn;
+    const std::pair<const char*, int> points[] = {
+        {"random", ROUNDS_RANDOM}, {"synced", ROUNDS_PER_POINT}, {"release", ROUNDS_PER_POINT}, {"compact", ROUNDS_PER_POINT}};
+    for (const auto& point : points) {
+        int killed = 0;
+        for (int i = 0; i < point.second && checkFailures() == 0; ++i)
+            killed += round(argv[0], dir, point.first, rng, torn);
+        std::cout << point.first << ": " << killed << " of " << point.second << " writers killed" << std::endl;
+        CHECK(killed > point.second / 2);
+    }
+    std::cout << torn.size() << " records torn" << std::endl;
+    CHECK(!torn.empty());
+
+    Paths p = paths(dir);
+    for (const std::string& path : {p.db, p.db + "-wal", p.db + "-shm", p.journal, p.progress})
+        std::remove(path.c_str());
+    rmdir(dir.c_str());
+    return checkResult();
+}
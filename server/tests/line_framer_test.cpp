@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "serial_reader.hpp"
+
+// Разбиение потока на строки (LineFramer, serial_reader.hpp) в маленьком кольцевом буфере:
+// строки через конец буфера, '\r\n' и пустые строки, строка длиннее буфера, сброс после
+// переподключения - при любом делении потока на чтения
+const std::size_t CAPACITY = 16;
+
+struct Framed {
+    std::vector<std::string> lines;
+    std::size_t overflows = 0;
+};
+
+// Разбор stream чтениями по next() байт (не больше свободного участка)
+template <class NextChunk>
+Framed frame(LineFramer& framer, const std::string& stream, NextChunk&& next) {
+    Framed framed;
+    for (std::size_t pos = 0; pos < stream.size();) {
+        boost::asio::mutable_buffer space = framer.prepare();
+        std::size_t n = std::min({next(), space.size(), stream.size() - pos});
+        std::memcpy(space.data(), stream.data() + pos, n);
+        framer.commit(n, [&](std::string_view line) { framed.lines.emplace_back(line); });
+        pos += n;
+    }
+    framed.overflows = framer.overflows();
+    return framed;
+}
+
+Framed frame(const std::string& stream, std::size_t chunk, std::size_t capacity = CAPACITY) {
+    LineFramer framer(capacity);
+    return frame(framer, stream, [chunk] { return chunk; });
+}
+
+// Строки, которые должны получиться из lines: без пустых, без '\r' в конце, без длиннее буфера
+Framed expected(const std::vector<std::string>& lines, std::size_t capacity) {
+    Framed framed;
+    for (std::string line : lines) {
+        if (line.size() >= capacity) {
+            framed.overflows++;
+            continue;
+        }
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            framed.lines.push_back(line);
+    }
+    return framed;
+}
+
+std::string join(const std::vector<std::string>& lines) {
+    std::string stream;
+    for (const std::string& line : lines)
+        stream += line + "\n";
+    return stream;
+}
+
+bool same(const Framed& a, const Framed& b, const std::string& what) {
+    bool equal = a.lines == b.lines && a.overflows == b.overflows;
+    if (!equal)
+        std::cerr << what << ": " << a.lines.size() << " lines, " << a.overflows << " overflows, expected "
+                  << b.lines.size() << " and " << b.overflows << std::endl;
+    CHECK(equal);
+    return equal;
+}
+
+// Строки до CAPACITY - 1 байт в буфере на CAPACITY: каждая сдвигает начало, и строки переходят
+// через конец буфера при любом размере чтения
+void testWrap() {
+    std::vector<std::string> lines;
+    for (std::size_t length = 0; length < CAPACITY; ++length) {
+        std::string line;
+        for (std::size_t i = 0; i < length; ++i)
+            line.push_back(static_cast<char>('a' + (length + i) % 26));
+        lines.push_back(line);
+        if (length > 0)
+            lines.push_back(line.substr(0, length - 1) + "\r");
+    }
+    lines.push_back("\r");
+    std::string stream = join(lines);
+    for (std::size_t chunk = 1; chunk <= CAPACITY + 1; ++chunk)
+        if (!same(frame(stream, chunk), expected(lines, CAPACITY), "wrap, chunk " + std::to_string(chunk)))
+            return;
+}
+
+// Строка из CAPACITY - 1 байт помещается, из CAPACITY и длиннее отбрасывается целиком и считается
+// один раз, следующие строки целы; в том числе когда длинная строка начинается посреди буфера
+void testOverflow() {
+    const std::string fits(CAPACITY - 1, 'x');
+    const std::vector<std::size_t> too_long = {CAPACITY, CAPACITY + 1, 2 * CAPACITY, 3 * CAPACITY + 5};
+    for (std::size_t length : too_long) {
+        for (std::size_t prefix = 0; prefix < CAPACITY; prefix += 5) {
+            std::vector<std::string> lines = {std::string(prefix, 'p'), std::string(length, 'y'), fits, "after"};
+            std::string stream = join(lines);
+            Framed want = expected(lines, CAPACITY);
+            CHECK_EQ(want.overflows, std::size_t(1));
+            for (std::size_t chunk : {std::size_t(1), std::size_t(3), CAPACITY})
+                if (!same(frame(stream, chunk), want, "overflow " + std::to_string(length) + " after " +
+                                                      std::to_string(prefix) + ", chunk " + std::to_string(chunk)))
+                    return;
+        }
+    }
+}
+
+// Сброс после переподключения: недочитанная строка и пропуск длинной строки забываются
+void testReset() {
+    LineFramer framer(CAPACITY);
+    auto all = [] { return SIZE_MAX; };
+    Framed framed = frame(framer, "first\npart", all);
+    framer.reset();
+    framed = frame(framer, "ial\nsecond\n", all);
+    std::vector<std::string> want = {"ial", "second"};
+    CHECK(framed.lines == want);
+
+    // Строка длиннее буфера оборвалась переподключением: следующая строка не пропускается
+    framed = frame(framer, std::string(CAPACITY + 3, 'z'), all);
+    framer.reset();
+    framed = frame(framer, "third\n", all);
+    want = {"third"};
+    CHECK(framed.lines == want);
+    CHECK_EQ(framed.overflows, std::size_t(1));
+}
+
+// Случайные строки от пустых до вдвое длиннее буфера, случайные чтения
+void testRandom() {
+    std::mt19937_64 rng(1);
+    for (std::size_t capacity : {std::size_t(16), std::size_t(64), std::size_t(1024)}) {
+        std::vector<std::string> lines;
+        for (int i = 0; i < 2000; ++i) {
+            std::string line(rng() % (2 * capacity), ' ');
+            for (char& ch : line)
+                ch = static_cast<char>('0' + rng() % 10);
+            if (!line.empty() && rng() % 4 == 0)
+                line.back() = '\r';
+            lines.push_back(line);
+        }
+        std::string stream = join(lines);
+        Framed want = expected(lines, capacity);
+        for (int run = 0; run < 10; ++run) {
+            std::size_t max_chunk = std::size_t(1) << (rng() % 12);
+            LineFramer framer(capacity);
+            Framed framed = frame(framer, stream, [&] { return rng() % max_chunk + 1; });
+            if (!same(framed, want, "random, capacity " + std::to_string(capacity)))
+                return;
+        }
+    }
+}
+
+int main() {
+    testWrap();
+    testOverflow();
+    testReset();
+    testRandom();
+    return checkResult();
+}
@@ -0,0 +1,224 @@
+#include <sqlite3.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "storage.hpp"
+
+// Сквозная проверка переподключения порта: simulator пишет датчики в свои pty и раз в HANGUP
+// секунд заменяет каждую пару pty новой (--hangup, как отключение и подключение устройства),
+// temperature_monitor читает их и пишет в базу раз в секунду. Затем база сравнивается с тем,
+// что симулятор отправил (--record): у каждого датчика те же значения в том же порядке,
+// ни одно не потеряно и не записано дважды, а сборщик действительно переподключался.
+// Текстовый протокол и двоичные кадры - отдельные сеансы
+#ifndef TEST_BIN_DIR
+#define TEST_BIN_DIR "."
+#endif
+
+const int SENSORS = 2;
+const char* const DURATION = "5";
+const char* const HANGUP = "1";
+const int MIN_HANGUPS = SENSORS * 3;                // Из четырёх на датчик часть может быть отложена
+const std::chrono::seconds START_TIMEOUT(10);
+const std::chrono::seconds SIMULATOR_TIMEOUT(20);
+const std::chrono::seconds DB_TIMEOUT(15);          // Запись в базу раз в секунду и запас
+const std::chrono::seconds METRICS_TIMEOUT(12);     // Метрики сборщика выгружаются раз в 5 с
+// Значения отправляются с точностью 0,01 (в кадре - int16 в сотых долях, округление может
+// отличаться от текстового на единицу младшего разряда)
+const double VALUE_TOLERANCE = 0.011;
+
+// Дочерний процесс в каталоге dir, вывод в log
+pid_t spawn(const std::string& dir, const std::string& log, const std::vector<std::string>& args) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    if (chdir(dir.c_str()) != 0)
+        _exit(127);
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    std::vector<char*> argv;
+    for (const std::string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+}
+
+// Ожидание условия не дольше timeout
+template <class Condition>
+bool waitFor(std::chrono::milliseconds timeout, Condition&& condition) {
+    for (auto deadline = std::chrono::steady_clock::now() + timeout;; ) {
+        if (condition())
+            return true;
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+bool exited(pid_t pid, int& status) {
+    return waitpid(pid, &status, WNOHANG) == pid;
+}
+
+void stopProcess(pid_t pid) {
+    int status;
+    kill(pid, SIGTERM);
+    if (!waitFor(std::chrono::seconds(3), [&] { return exited(pid, status); })) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::ostringstream out;
+    out << file.rdbuf();
+    return out.str();
+}
+
+// Число из итогов симулятора ("name":value) или метрики сборщика (строка "name value")
+bool findNumber(const std::string& text, const std::string& key, double& value) {
+    std::size_t pos = text.find(key);
+    if (pos == std::string::npos)
+        return false;
+    value = std::strtod(text.c_str() + pos + key.size(), nullptr);
+    return true;
+}
+
+// Отправленные значения по датчикам, в порядке отправки
+std::map<int, std::vector<double>> readRecord(const std::string& path) {
+    std::map<int, std::vector<double>> sent;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        double t, value;
+        int sensor;
+        if (fields >> t >> sensor >> value)
+            sent[sensor].push_back(value);
+    }
+    return sent;
+}
+
+// Записанные значения по датчикам, по возрастанию метки времени
+std::map<int, std::vector<double>> readDatabase(const std::string& path) {
+    std::map<int, std::vector<double>> stored;
+    sqlite3* db = openDatabase(path.c_str(), true);
+    sqlite3_stmt* stmt = nullptr;
+    if (db && sqlite3_prepare_v2(db, "SELECT sensor_id, value FROM temperatures ORDER BY sensor_id, ts;", -1, &stmt,
+                                 nullptr) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            stored[sqlite3_column_int(stmt, 0)].push_back(sqlite3_column_double(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return stored;
+}
+
+std::size_t total(const std::map<int, std::vector<double>>& values) {
+    std::size_t n = 0;
+    for (const auto& sensor : values)
+        n += sensor.second.size();
+    return n;
+}
+
+// Сеанс: rate измерений в секунду на датчик, кадры по binary измерений (0 - текст)
+void session(const std::string& name, const char* rate, int binary) {
+    std::string dir = std::filesystem::temp_directory_path().string() + "/pty_reconnect_XXXXXX";
+    if (!mkdtemp(&dir[0])) {
+        CHECK(false);
+        return;
+    }
+    std::filesystem::create_directories(dir + "/ptys");
+    std::vector<std::string> sim_args = {TEST_BIN_DIR "/simulator", "--ptys", dir + "/ptys",
+                                         "--sensors", std::to_string(SENSORS), "--rate", rate,
+                                         "--write-config", dir + "/sensors.conf",
+                                         "--duration", DURATION, "--hangup", HANGUP,
+                                         "--report", "0", "--seed", "1",
+                                         "--record", dir + "/sent.txt", "--summary", dir + "/simulator.json"};
+    if (binary > 0) {
+        sim_args.push_back("--binary");
+        sim_args.push_back(std::to_string(binary));
+    }
+    pid_t simulator = spawn(dir, dir + "/simulator.log", sim_args);
+    int status = 0;
+    bool started = waitFor(START_TIMEOUT, [&] { return std::filesystem::exists(dir + "/sensors.conf"); });
+    CHECK(started);
+    pid_t monitor = spawn(dir, dir + "/temperature_monitor.log",
+                          {TEST_BIN_DIR "/temperature_monitor", "--config", dir + "/sensors.conf", "--sync-period", "1"});
+
+    bool finished = waitFor(SIMULATOR_TIMEOUT, [&] { return exited(simulator, status); });
+    CHECK(finished && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (!finished)
+        stopProcess(simulator);
+    std::string summary = readFile(dir + "/simulator.json");
+    double sent = 0, dropped = -1, hangups = 0;
+    CHECK(findNumber(summary, "\"sent\":", sent) && findNumber(summary, "\"dropped\":", dropped) &&
+          findNumber(summary, "\"hangups\":", hangups));
+    CHECK_EQ(dropped, 0.0);
+    CHECK(hangups >= MIN_HANGUPS);
+
+    std::map<int, std::vector<double>> expected = readRecord(dir + "/sent.txt");
+    CHECK_EQ(total(expected), static_cast<std::size_t>(sent));
+    std::map<int, std::vector<double>> stored;
+    waitFor(DB_TIMEOUT, [&] {
+        stored = readDatabase(dir + "/" STORAGE_DB_PATH);
+        return total(stored) >= total(expected);
+    });
+    double reconnects = 0;
+    waitFor(METRICS_TIMEOUT, [&] {
+        return findNumber(readFile(dir + "/temperature_monitor.prom"), "\ningest_port_reconnects_total ", reconnects) &&
+               reconnects >= hangups;
+    });
+    stopProcess(monitor);
+    stored = readDatabase(dir + "/" STORAGE_DB_PATH);
+
+    std::cout << name << ": " << sent << " readings sent, " << total(stored) << " stored, " << hangups << " pty hangups, "
+              << reconnects << " reconnects" << std::endl;
+    CHECK(reconnects >= hangups);
+    CHECK_EQ(stored.size(), expected.size());
+    for (const auto& sensor : expected) {
+        const std::vector<double>& want = sensor.second;
+        const std::vector<double>& got = stored[sensor.first];
+        CHECK_EQ(got.size(), want.size());
+        for (std::size_t i = 0; i < std::min(got.size(), want.size()); ++i) {
+            if (std::fabs(got[i] - want[i]) > VALUE_TOLERANCE) {
+                std::cerr << name << ": sensor " << sensor.first << " reading " << i << " is " << got[i] << ", sent "
+                          << want[i] << std::endl;
+                CHECK(false);
+                break;
+            }
+        }
+    }
+    if (checkFailures() == 0)
+        std::filesystem::remove_all(dir);
+    else
+        std::cerr << "Logs are kept in " << dir << std::endl;
+}
+
+int main() {
+    session("text", "500", 0);
+    session("binary", "1000", 16);
+    return checkResult();
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "query.hpp"
+#include "query_plan.hpp"
+
+// Разбор параметров выборки (parseRangeQuery, query.hpp), выбор таблицы прореженной
+// выборки (planQuery, query_plan.hpp), по таблицам случаев, и число точек после прореживания
+// (downsample.hpp)
+const int64_t SECOND = 1000;
+const int64_t HOUR = 3600 * SECOND;
+const int64_t DAY = 24 * HOUR;
+const int64_t NOW = 1700000000000;
+const int64_t TS_MAX = std::numeric_limits<int64_t>::max();
+const int64_t TS_MIN = std::numeric_limits<int64_t>::min();
+
+bool parse(const std::string& query_string, RangeQuery& query, std::string& error) {
+    return parseRangeQuery(parseTarget("/temperatures?" + query_string), query, error);
+}
+
+// Неверные параметры: ответ 400 с этим описанием
+struct BadCase {
+    const char* query;
+    const char* error;
+};
+
+const BadCase BAD_CASES[] = {
+    {"from=abc", "Invalid 'from'"},
+    {"from=", "Invalid 'from'"},
+    {"from=2024-01-01X", "Invalid 'from'"},
+    {"from=2024-01-01 12", "Invalid 'from'"},
+    {"from=9223372036854775808", "Invalid 'from'"},
+    {"from=-9223372036854775809", "Invalid 'from'"},
+    {"from=99999999999999999999999", "Invalid 'from'"},
+    {"to=abc", "Invalid 'to'"},
+    {"to=9223372036854775808", "Invalid 'to'"},
+    {"to=1e3", "Invalid 'to'"},
+    {"from=1000&to=1000", "'from' must be earlier than 'to'"},
+    {"from=1001&to=1000", "'from' must be earlier than 'to'"},
+    {"to=-9223372036854775808", "'from' must be earlier than 'to'"},
+    {"sensor=-1", "Invalid 'sensor'"},
+    {"sensor=2147483648", "Invalid 'sensor'"},
+    {"sensor=1.5", "Invalid 'sensor'"},
+    {"limit=0", "Invalid 'limit'"},
+    {"limit=-1", "Invalid 'limit'"},
+    {"limit=abc", "Invalid 'limit'"},
+    {"limit=10x", "Invalid 'limit'"},
+    {"limit=9223372036854775808", "Invalid 'limit'"},
+    {"cursor=", "Invalid 'cursor'"},
+    {"cursor=123", "Invalid 'cursor'"},
+    {"cursor=_1", "Invalid 'cursor'"},
+    {"cursor=1_", "Invalid 'cursor'"},
+    {"cursor=1_2_3", "Invalid 'cursor'"},
+    {"cursor=a_1", "Invalid 'cursor'"},
+    {"cursor=9223372036854775808_0", "Invalid 'cursor'"},
+    {"cursor=0_9223372036854775808", "Invalid 'cursor'"},
+    {"max_points=0", "Invalid 'max_points'"},
+    {"max_points=1", "Invalid 'max_points'"},
+    {"max_points=100001", "Invalid 'max_points'"},
+    {"max_points=9223372036854775807", "Invalid 'max_points'"},
+    {"max_points=9223372036854775808", "Invalid 'max_points'"},
+    {"resolution=0", "Invalid 'resolution'"},
+    {"resolution=-60", "Invalid 'resolution'"},
+    {"resolution=1.5", "Invalid 'resolution'"},
+    {"resolution=31622401", "Invalid 'resolution'"},
+    {"resolution=2305843009213693952", "Invalid 'resolution'"},      // * 1000 == 0 по модулю 2^64
+    {"resolution=9223372036854775807", "Invalid 'resolution'"},
+    {"resolution=9223372036854775808", "Invalid 'resolution'"},
+    {"method=avg", "Invalid 'method'"},
+    {"time=utc", "Invalid 'time'"},
+    {"max_points=100&limit=10", "'limit'/'cursor' cannot be combined with 'max_points'/'resolution'"},
+    {"resolution=60&cursor=1_0", "'limit'/'cursor' cannot be combined with 'max_points'/'resolution'"},
+};
+
+void testBadParameters() {
+    for (const BadCase& c : BAD_CASES) {
+        RangeQuery query;
+        std::string error;
+        bool ok = parse(c.query, query, error);
+        if (ok || error != c.error)
+            std::cerr << c.query << ": " << (ok ? "accepted" : error) << std::endl;
+        CHECK(!ok && error == c.error);
+    }
+}
+
+// Верные параметры и крайние значения
+void testGoodParameters() {
+    RangeQuery query;
+    std::string error;
+    CHECK(parse("", query, error));
+    CHECK_EQ(query.from, TS_MIN);
+    CHECK_EQ(query.to, TS_MAX);
+    CHECK_EQ(query.sensor, int64_t(-1));
+
+    query = RangeQuery();
+    CHECK(parse("from=-9223372036854775808&to=9223372036854775807&sensor=2147483647&limit=9223372036854775807", query, error));
+    CHECK_EQ(query.from, TS_MIN);
+    CHECK_EQ(query.to, TS_MAX);
+    CHECK_EQ(query.sensor, int64_t(2147483647));
+    CHECK_EQ(query.limit, TS_MAX);
+
+    query = RangeQuery();
+    CHECK(parse("max_points=2&method=minmax&time=epoch", query, error));
+    CHECK_EQ(query.max_points, int64_t(2));
+    CHECK(query.method == DOWNSAMPLE_MINMAX && query.epoch_time);
+
+    query = RangeQuery();
+    CHECK(parse("max_points=100000&resolution=31622400", query, error));
+    CHECK_EQ(query.max_points, MAX_POINTS);
+    CHECK_EQ(query.resolution, MAX_RESOLUTION_SECONDS * 1000);
+
+    // Локальное время: с секундами и без, через пробел (+ в строке запроса) и 'T'
+    query = RangeQuery();
+    CHECK(parse("from=2024-03-01+10:00&to=2024-03-01T10:00:01", query, error));
+    CHECK_EQ(query.to - query.from, SECOND);
+    query = RangeQuery();
+    CHECK(parse("from=2024-03-01&to=2024-03-01%2000:00:01", query, error));
+    CHECK_EQ(query.to - query.from, SECOND);
+}
+
+// Курсор из ответа (formatCursor) принимается и даёт тот же ключ, в том числе на краях int64
+void testCursorRoundTrip() {
+    const int64_t timestamps[] = {TS_MIN, -1, 0, 1, NOW, TS_MAX};
+    const int64_t sensors[] = {0, 1, 2147483647};
+    for (int64_t ts : timestamps) {
+        for (int64_t sensor : sensors) {
+            RangeQuery query;
+            std::string error;
+            std::string cursor = formatCursor(ts, sensor);
+            CHECK(parse("limit=100&cursor=" + cursor, query, error));
+            CHECK(query.has_cursor);
+            CHECK_EQ(query.cursor_ts, ts);
+            CHECK_EQ(query.cursor_sensor, sensor);
+            CHECK_EQ(formatCursor(query.cursor_ts, query.cursor_sensor), cursor);
+        }
+    }
+}
+
+// Таблицы с шагом строк, как после сроков хранения: сырые значения раз в 10 с за сутки,
+// часовые средние за 30 суток, суточные за год (все заканчиваются перед NOW)
+class FakeSource : public RowSource {
+public:
+    FakeSource() {
+        for (int64_t ts = NOW - DAY; ts < NOW; ts += 10 * SECOND)
+            tables_[0].push_back(ts);
+        for (int64_t ts = NOW - 30 * DAY; ts < NOW; ts += HOUR)
+            tables_[1].push_back(ts);
+        for (int64_t ts = NOW - 365 * DAY; ts < NOW; ts += DAY)
+            tables_[2].push_back(ts);
+    }
+
+    TableRange range(int table, const RangeQuery& query) override {
+        const std::vector<int64_t>& ts = tables_[table];
+        auto lo = std::lower_bound(ts.begin(), ts.end(), query.from);
+        auto hi = std::lower_bound(ts.begin(), ts.end(), query.to);
+        TableRange range;
+        if (lo < hi)
+            range = TableRange{hi - lo, *lo, *(hi - 1)};
+        return range;
+    }
+
+    bool points(int, const RangeQuery&, std::vector<Point>&) override { return false; }
+
+private:
+    std::vector<int64_t> tables_[TABLE_COUNT];
+};
+
+// Запрос к таблице table и ожидаемый план
+struct PlanCase {
+    const char* name;
+    int table;
+    int64_t from;                   // 0 - без явного начала
+    int64_t to;                     // 0 - без конца
+    int64_t max_points;
+    int64_t resolution;             // с
+    int expected_table;
+    int64_t expected_points;
+};
+
+const PlanCase PLAN_CASES[] = {
+    // Огрубление: в запрошенной таблице строк больше, чем точек * COARSEN_FACTOR
+    {"raw, enough points", 0, 0, 0, 1000, 0, 0, 1000},
+    {"raw, hourly rows fewer than points", 0, 0, 0, 100, 0, 0, 100},
+    {"raw to hourly", 0, 0, 0, 10, 0, 1, 10},
+    {"hourly, enough points", 1, 0, 0, 50, 0, 1, 50},
+    {"hourly to daily", 1, 0, 0, 10, 0, 2, 10},
+    {"raw to daily over a month", 0, NOW - 30 * DAY, 0, 2, 0, 2, 2},
+    // Шаг resolution: точек - длина диапазона, делённая на шаг
+    {"raw at 1 min", 0, 0, 0, 0, 60, 0, 1440},
+    {"raw at 10 s", 0, 0, 0, 0, 10, 0, 8640},
+    {"raw at 1 h", 0, 0, 0, 0, 3600, 1, 24},
+    {"daily at 1 s, capped", 2, 0, 0, 0, 1, 2, MAX_POINTS},
+    {"hourly at a year to daily, at least 2", 1, 0, 0, 0, 366 * 24 * 3600, 2, 2},
+    // Диапазон не покрыт запрошенной таблицей (сырые значения удалены по сроку хранения)
+    {"raw covered from 12 h", 0, NOW - 12 * HOUR, 0, 1000, 0, 0, 1000},
+    {"raw, hourly earlier by one step", 0, NOW - DAY - HOUR, 0, 1000, 0, 0, 1000},
+    {"raw not covered from 26 h", 0, NOW - DAY - 2 * HOUR, 0, 1000, 0, 1, 1000},
+    {"raw not covered from 10 days", 0, NOW - 10 * DAY, 0, 1000, 0, 1, 1000},
+    {"raw not covered from 100 days", 0, NOW - 100 * DAY, 0, 1000, 0, 2, 1000},
+    {"raw empty in an old range", 0, NOW - 20 * DAY, NOW - 19 * DAY, 1000, 0, 1, 1000},
+    {"all empty in the future", 0, NOW + DAY, NOW + 2 * DAY, 1000, 0, 0, 1000},
+    {"raw not covered, resolution", 0, NOW - 10 * DAY, 0, 0, 3600, 1, 10 * 24},
+};
+
+void testPlan() {
+    FakeSource source;
+    for (const PlanCase& c : PLAN_CASES) {
+        RangeQuery query;
+        if (c.from)
+            query.from = c.from;
+        if (c.to)
+            query.to = c.to;
+        query.max_points = c.max_points;
+        query.resolution = c.resolution * 1000;
+        QueryPlan plan = planQuery(source, c.table, query, c.from != 0);
+        if (plan.table != c.expected_table || plan.points != c.expected_points)
+            std::cerr << c.name << ": table " << plan.table << " points " << plan.points << std::endl;
+        CHECK(plan.table == c.expected_table && plan.points == c.expected_points);
+    }
+}
+
+// Ряд каждого датчика прореживается не больше чем до target точек при любом допустимом
+// max_points, в том числе наименьшем (2) и при большом resolution; LTTB сохраняет крайние точки
+void testDownsampleSize() {
+    const int SENSORS = 2;
+    const std::size_t ROWS = 1000;
+    std::vector<Point> data;
+    for (std::size_t i = 0; i < ROWS; ++i)
+        for (int sensor = 0; sensor < SENSORS; ++sensor)
+            data.push_back(Point{NOW + static_cast<int64_t>(i) * SECOND, static_cast<double>((i * 7919) % 101), sensor});
+
+    RangeQuery query;
+    query.resolution = MAX_RESOLUTION_SECONDS * 1000;
+    const std::size_t planned = static_cast<std::size_t>(planPoints(query, TableRange{int64_t(ROWS), NOW, NOW + DAY}));
+    CHECK_EQ(planned, std::size_t(2));
+    for (std::size_t target : {std::size_t(2), std::size_t(3), std::size_t(10), ROWS - 1, ROWS}) {
+        for (bool lttb : {true, false}) {
+            std::vector<Point> sampled = lttb ? downsampleBySensor(data, target, downsampleLttb)
+                                              : downsampleBySensor(data, target, downsampleMinMax);
+            for (int sensor = 0; sensor < SENSORS; ++sensor) {
+                std::vector<Point> series;
+                for (const Point& point : sampled)
+                    if (point.sensor_id == sensor)
+                        series.push_back(point);
+                if (series.size() > target || series.size() < std::min<std::size_t>(target, 2))
+                    std::cerr << (lttb ? "lttb" : "minmax") << " to " << target << ": " << series.size() << " points" << std::endl;
+                CHECK(series.size() <= target && series.size() >= std::min<std::size_t>(target, 2));
+                if (lttb && !series.empty()) {
+                    CHECK_EQ(series.front().ts, NOW);
+                    CHECK_EQ(series.back().ts, NOW + static_cast<int64_t>(ROWS - 1) * SECOND);
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    testBadParameters();
+    testGoodParameters();
+    testCursorRoundTrip();
+    testPlan();
+    testDownsampleSize();
+    return checkResult();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// Модель показаний датчика для симулятора и нагрузочных замеров:
+// суточный ход (синусоида) вокруг base, медленный дрейф (случайное блуждание),
+// шум, одиночные выбросы и провалы, когда датчик молчит.
+// Значения - функция номера измерения и зерна: при том же зерне и частоте последовательность
+// повторяется независимо от того, успевает ли отправитель
+const double WAVEFORM_PI = 3.14159265358979323846;
+
+struct WaveformParams {
+    double base = 25.0;                 // °C
+    double swing = 3.0;                 // Амплитуда суточного хода, °C
+    double period = 24 * 60 * 60;       // Период хода, с
+    double drift = 0.5;                 // Дрейф, °C за час (стандартное отклонение блуждания)
+    double noise = 0.1;                 // Шум, °C (стандартное отклонение)
+    double spike_probability = 0;       // Доля измерений-выбросов
+    double spike = 10.0;                // Величина выброса, °C (знак случайный)
+    double dropouts_per_hour = 0;       // Частота провалов
+    double dropout_seconds = 5;         // Длительность провала
+};
+
+class Waveform {
+public:
+    // seed и sensor задают свою последовательность для каждого датчика; фаза хода у датчиков разная
+    Waveform(const WaveformParams& params, uint64_t seed, uint32_t sensor)
+        : params_(params) {
+        std::seed_seq seq{uint32_t(seed), uint32_t(seed >> 32), sensor};
+        rng_.seed(seq);
+        phase_ = std::uniform_real_distribution<double>(0, 2 * WAVEFORM_PI)(rng_);
+    }
+
+    // Измерение в момент t секунд от начала (t не убывает). false - датчик в провале и молчит
+    bool sample(double t, double& value) {
+        double dt = t - last_t_;
+        last_t_ = t;
+        if (params_.drift > 0 && dt > 0)
+            drift_ += normal_(rng_) * params_.drift * std::sqrt(dt / 3600);
+        if (t < dropout_until_)
+            return false;
+        if (params_.dropouts_per_hour > 0 && uniform_(rng_) < params_.dropouts_per_hour * dt / 3600) {
+            dropout_until_ = t + params_.dropout_seconds;
+            return false;
+        }
+        value = params_.base + params_.swing * std::sin(2 * WAVEFORM_PI * t / params_.period + phase_) + drift_ +
+                normal_(rng_) * params_.noise;
+        if (params_.spike_probability > 0 && uniform_(rng_) < params_.spike_probability)
+            value += uniform_(rng_) < 0.5 ? -params_.spike : params_.spike;
+        value = std::round(value * 100) / 100;      // Разрешение датчика - 0,01 °C
+        return true;
+    }
+
+private:
+    WaveformParams params_;
+    std::mt19937_64 rng_;
+    std::normal_distribution<double> normal_;
+    std::uniform_real_distribution<double> uniform_;
+    double phase_ = 0;
+    double drift_ = 0;
+    double last_t_ = 0;
+    double dropout_until_ = -1;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json_writer.hpp"
+
+// Форматы ответа с данными таблиц, выбираются по заголовку Accept:
+//  - application/json (по умолчанию) - см. JsonWriter;
+//  - application/vnd.temperature.columns - столбцы little-endian:
+//      заголовок "TCOL", версия 2 (1 байт), разрядность значений 32|64 (1 байт), 2 байта нулей;
+//      блоки: число строк n (uint32), 4 байта нулей, n меток int64 (мс от эпохи), n значений
+//      float64 или float32, n номеров датчиков int32 (значения и датчики дополнены нулями до кратной 8 длины);
+//      последний блок - n = 0, вместо нулей длина курсора следующей страницы, затем сам курсор;
+//  - application/msgpack - последовательность объектов MessagePack, по одному на блок:
+//      {"ts": [int...], "value": [float...], "sensor_id": [int...]}; в последнем (возможно пустом) блоке при обрезке
+//      по limit есть ключ "next_cursor".
+// Параметр value=float32 в Accept (для двоичных форматов) отдаёт значения в float32.
+// Метки в двоичных форматах всегда мс от эпохи. Строки пишутся блоками до ROW_BLOCK,
+// поэтому ответ по-прежнему формируется потоково
+enum WireFormat {
+    FORMAT_JSON,
+    FORMAT_COLUMNS,
+    FORMAT_MSGPACK
+};
+
+struct ResponseFormat {
+    WireFormat format = FORMAT_JSON;
+    bool float32 = false;
+};
+
+const std::size_t ROW_BLOCK = 4096;
+
+inline const char* contentType(const ResponseFormat& format) {
+    switch (format.format) {
+    case FORMAT_COLUMNS:
+        return "application/vnd.temperature.columns";
+    case FORMAT_MSGPACK:
+        return "application/msgpack";
+    default:
+        return "application/json";
+    }
+}
+
+// Метка формата для ключа кэша ответов и ETag: тела разных форматов различаются. У JSON пустая
+inline std::string formatTag(const ResponseFormat& format) {
+    if (format.format == FORMAT_JSON)
+        return std::string();
+    return std::string(format.format == FORMAT_COLUMNS ? "columns" : "msgpack") + (format.float32 ? "32" : "");
+}
+
+inline std::string_view trimSpaces(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Выбор формата по заголовку Accept: поддерживаемый тип с наибольшим q, при равных - первый.
+// Без заголовка или без поддерживаемых типов - JSON
+inline ResponseFormat negotiateFormat(std::string_view accept) {
+    ResponseFormat best;
+    double best_q = -1;
+    while (!accept.empty()) {
+        std::size_t comma = accept.find(',');
+        std::string_view item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        std::size_t semicolon = item.find(';');
+        std::string_view type = trimSpaces(item.substr(0, semicolon));
+        ResponseFormat format;
+        if (type == "application/json" || type == "application/*" || type == "*/*")
+            format.format = FORMAT_JSON;
+        else if (type == "application/vnd.temperature.columns")
+            format.format = FORMAT_COLUMNS;
+        else if (type == "application/msgpack" || type == "application/x-msgpack")
+            format.format = FORMAT_MSGPACK;
+        else
+            continue;
+
+        double q = 1;
+        while (semicolon != std::string_view::npos) {
+            item = item.substr(semicolon + 1);
+            semicolon = item.find(';');
+            std::string_view param = trimSpaces(item.substr(0, semicolon));
+            if (param == "value=float32")
+                format.float32 = format.format != FORMAT_JSON;
+            else if (param.substr(0, 2) == "q=")
+                q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+        }
+        if (q > best_q) {
+            best = format;
+            best_q = q;
+        }
+    }
+    if (best_q <= 0)
+        return ResponseFormat();
+    return best;
+}
+
+// Запись строк результата в выбранном формате; интерфейс как у JsonWriter
+class RowWriter {
+public:
+    RowWriter(ResponseFormat format, bool epoch_time) : format_(format), json_(epoch_time) {
+        if (format_.format != FORMAT_JSON) {
+            ts_.reserve(ROW_BLOCK);
+            values_.reserve(ROW_BLOCK);
+            sensors_.reserve(ROW_BLOCK);
+        }
+    }
+
+    void begin(std::string& out) {
+        rows_ = 0;
+        if (format_.format == FORMAT_JSON)
+            return json_.begin(out);
+        if (format_.format == FORMAT_COLUMNS) {
+            const char header[8] = {'T', 'C', 'O', 'L', 2, static_cast<char>(format_.float32 ? 32 : 64), 0, 0};
+            out.append(header, sizeof(header));
+        }
+    }
+
+    void end(std::string& out, std::string_view next_cursor = {}) {
+        if (format_.format == FORMAT_JSON)
+            return json_.end(out, next_cursor);
+        if (format_.format == FORMAT_COLUMNS) {
+            if (!ts_.empty())
+                flush(out);
+            appendLE(out, uint32_t(0));
+            appendLE(out, static_cast<uint32_t>(next_cursor.size()));
+            out.append(next_cursor.data(), next_cursor.size());
+        } else {
+            flush(out, next_cursor);
+        }
+    }
+
+    void row(std::string& out, int64_t timestamp, int32_t sensor_id, double value) {
+        ++rows_;
+        if (format_.format == FORMAT_JSON)
+            return json_.row(out, timestamp, sensor_id, value);
+        ts_.push_back(timestamp);
+        values_.push_back(value);
+        sensors_.push_back(sensor_id);
+        if (ts_.size() == ROW_BLOCK)
+            flush(out);
+    }
+
+    std::size_t rows() const { return rows_; }
+
+private:
+    // Накопленный блок строк в out
+    void flush(std::string& out, std::string_view next_cursor = {}) {
+        if (format_.format == FORMAT_COLUMNS)
+            flushColumns(out);
+        else
+            flushMsgpack(out, next_cursor);
+        ts_.clear();
+        values_.clear();
+        sensors_.clear();
+    }
+
+    void flushColumns(std::string& out) {
+        std::size_t n = ts_.size();
+        appendLE(out, static_cast<uint32_t>(n));
+        appendLE(out, uint32_t(0));
+        std::size_t pos = out.size();
+        std::size_t value_bytes = format_.float32 ? (n * 4 + 7) / 8 * 8 : n * 8;
+        std::size_t sensor_bytes = (n * 4 + 7) / 8 * 8;
+        out.resize(pos + n * 8 + value_bytes + sensor_bytes);
+        char* p = &out[pos];
+        for (std::size_t i = 0; i < n; ++i)
+            storeLE(p + i * 8, static_cast<uint64_t>(ts_[i]));
+        p += n * 8;
+        if (format_.float32) {
+            for (std::size_t i = 0; i < n; ++i) {
+                float v = static_cast<float>(values_[i]);
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                storeLE(p + i * 4, bits);
+            }
+            std::memset(p + n * 4, 0, value_bytes - n * 4);
+        } else {
+            for (std::size_t i = 0; i < n; ++i) {
+                uint64_t bits;
+                std::memcpy(&bits, &values_[i], sizeof(bits));
+                storeLE(p + i * 8, bits);
+            }
+        }
+        p += value_bytes;
+        for (std::size_t i = 0; i < n; ++i)
+            storeLE(p + i * 4, static_cast<uint32_t>(sensors_[i]));
+        std::memset(p + n * 4, 0, sensor_bytes - n * 4);
+    }
+
+    void flushMsgpack(std::string& out, std::string_view next_cursor) {
+        std::size_t n = ts_.size();
+        out.push_back(static_cast<char>(next_cursor.empty() ? 0x83 : 0x84));     // fixmap
+        out.append("\xa2ts", 3);
+        msgpackArray(out, n);
+        for (int64_t ts : ts_) {
+            out.push_back(static_cast<char>(0xd3));                                // int 64
+            storeBE(out, static_cast<uint64_t>(ts));
+        }
+        out.append("\xa5value", 6);
+        msgpackArray(out, n);
+        for (double value : values_) {
+            if (format_.float32) {
+                float v = static_cast<float>(value);
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                out.push_back(static_cast<char>(0xca));                            // float 32
+                storeBE(out, bits);
+            } else {
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                out.push_back(static_cast<char>(0xcb));                            // float 64
+                storeBE(out, bits);
+            }
+        }
+        out.append("\xa9sensor_id", 10);
+        msgpackArray(out, n);
+        for (int32_t sensor_id : sensors_) {
+            out.push_back(static_cast<char>(0xd2));                                // int 32
+            storeBE(out, static_cast<uint32_t>(sensor_id));
+        }
+        if (!next_cursor.empty()) {
+            out.append("\xabnext_cursor", 12);
+            out.push_back(static_cast<char>(0xd9));                                // str 8
+            out.push_back(static_cast<char>(next_cursor.size()));
+            out.append(next_cursor.data(), next_cursor.size());
+        }
+    }
+
+    static void msgpackArray(std::string& out, std::size_t n) {
+        if (n < 16) {
+            out.push_back(static_cast<char>(0x90 | n));                            // fixarray
+        } else {
+            out.push_back(static_cast<char>(0xdc));                                // array 16
+            out.push_back(static_cast<char>(n >> 8));
+            out.push_back(static_cast<char>(n));
+        }
+    }
+
+    template <class T>
+    static void storeLE(char* p, T value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            p[i] = static_cast<char>(value >> (8 * i));
+#else
+        std::memcpy(p, &value, sizeof(T));
+#endif
+    }
+
+    template <class T>
+    static void appendLE(std::string& out, T value) {
+        char buf[sizeof(T)];
+        storeLE(buf, value);
+        out.append(buf, sizeof(T));
+    }
+
+    template <class T>
+    static void storeBE(std::string& out, T value) {
+        char buf[sizeof(T)];
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            buf[i] = static_cast<char>(value >> (8 * (sizeof(T) - 1 - i)));
+        out.append(buf, sizeof(T));
+    }
+
+    ResponseFormat format_;
+    JsonWriter json_;
+    std::vector<int64_t> ts_;
+    std::vector<double> values_;
+    std::vector<int32_t> sensors_;
+    std::size_t rows_ = 0;
+};